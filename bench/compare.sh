@@ -0,0 +1,65 @@
+#!/bin/bash
+#
+# Compares two result files written by run.sh. Every workload in both is listed with its change in
+# throughput and p99 latency, and the script fails if any workload's throughput dropped by more than the
+# threshold, so it can gate a change.
+#
+# Usage: compare.sh <old results> <new results> [threshold percent]
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <old results> <new results> [threshold percent]"
+    exit 1
+fi
+
+awk -v threshold="${3:-10}" '
+    function field(line, key,    match_) {
+        if (match(line, "\"" key "\":\"?[^,\"}]*")) {
+            match_ = substr(line, RSTART, RLENGTH)
+            sub("\"" key "\":\"?", "", match_)
+            return match_
+        }
+        return ""
+    }
+
+    {
+        name = field($0, "name")
+        if (name == "" || substr(name, 1, 1) == "_") {
+            next
+        }
+    }
+
+    FNR == NR {
+        old_ops[name] = field($0, "ops_per_sec")
+        old_p99[name] = field($0, "p99_us")
+        next
+    }
+
+    {
+        ops = field($0, "ops_per_sec")
+        p99 = field($0, "p99_us")
+
+        if (!(name in old_ops) || old_ops[name] == 0) {
+            printf "%-24s %12s %12.1f %8s %10s %10.1f\n", name, "-", ops, "new", "-", p99
+            next
+        }
+
+        change = (ops - old_ops[name]) * 100 / old_ops[name]
+        flag = change < -threshold ? "  REGRESSED" : ""
+        if (flag != "") {
+            regressed++
+        }
+
+        printf "%-24s %12.1f %12.1f %+7.1f%% %10.1f %10.1f%s\n", name, old_ops[name], ops, change, old_p99[name], p99, flag
+    }
+
+    BEGIN {
+        printf "%-24s %12s %12s %8s %10s %10s\n", "workload", "old ops/s", "new ops/s", "change", "old p99us", "new p99us"
+    }
+
+    END {
+        if (regressed > 0) {
+            printf "%d workload(s) regressed by more than %s%%\n", regressed, threshold
+            exit 1
+        }
+    }
+' "$1" "$2"
@@ -0,0 +1,883 @@
+/**
+ * @file myfs_bench.c
+ *
+ * Runs file system workloads in a directory on a mounted MyFS and writes one JSON object per result to
+ * stdout, so runs can be compared by `compare.sh`. Every workload starts from an empty directory and
+ * uses fixed sizes, counts and random seeds, so two runs do the same work.
+ *
+ * Usage: myfs_bench [-f files] [-m MB] [-t threads] [-d depth] [-w workload,...] <directory>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/** The size of the blocks used by the random read and write workloads. */
+#define BENCH_RANDOM_SIZE 4096
+
+/** The longest path the workloads make. */
+#define BENCH_PATH_MAX_LEN 4096
+
+/** The longest path of a workload's directory. It's kept shorter than a path so files in it always fit. */
+#define BENCH_DIR_MAX_LEN 2048
+
+/**
+ * The settings for a run.
+ */
+typedef struct {
+    const char *dir;                //!< The directory to run in.
+    unsigned int files;             //!< The number of files made by the metadata workloads.
+    unsigned int mb;                //!< The size of the file used by the read and write workloads, in MB.
+    unsigned int threads;           //!< The number of clients run by the parallel workload.
+    unsigned int depth;             //!< The number of directories in the deep path.
+    const char *workloads;          //!< A comma separated list of the workloads to run, or `NULL` for all of them.
+} bench_t;
+
+/**
+ * The timings of one workload.
+ */
+typedef struct {
+    uint64_t *latencies;            //!< The duration of each operation in nanoseconds.
+    size_t ops;                     //!< The number of operations timed.
+    size_t ops_max;                 //!< The size of `latencies`.
+    uint64_t bytes;                 //!< The number of bytes read or written.
+    struct timespec start;          //!< When the workload started.
+    struct timespec end;            //!< When the workload ended.
+} bench_result_t;
+
+/**
+ * The work for one client of the parallel workload.
+ */
+typedef struct {
+    bench_t *bench;
+    unsigned int id;                //!< The client's number.
+    bench_result_t result;
+    bool success;
+} bench_client_t;
+
+typedef bool (*bench_workload_t)(bench_t *bench);
+
+static uint64_t
+bench_now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static bool
+bench_result_init(bench_result_t *result, size_t ops_max) {
+    memset(result, 0, sizeof(*result));
+
+    result->latencies = malloc(ops_max * sizeof(*result->latencies));
+    if (result->latencies == NULL) {
+        fprintf(stderr, "Error allocating %zu latencies: Out of memory\n", ops_max);
+        return false;
+    }
+
+    result->ops_max = ops_max;
+    clock_gettime(CLOCK_MONOTONIC, &result->start);
+
+    return true;
+}
+
+static void
+bench_result_free(bench_result_t *result) {
+    free(result->latencies);
+    result->latencies = NULL;
+}
+
+static void
+bench_result_add(bench_result_t *result, uint64_t start_ns, uint64_t bytes) {
+    if (result->ops < result->ops_max) {
+        result->latencies[result->ops++] = bench_now_ns() - start_ns;
+    }
+
+    result->bytes += bytes;
+}
+
+static int
+bench_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+bench_percentile(bench_result_t *result, double percentile) {
+    size_t i;
+
+    if (result->ops == 0) {
+        return 0;
+    }
+
+    i = (size_t)(result->ops * percentile / 100.0);
+    if (i >= result->ops) {
+        i = result->ops - 1;
+    }
+
+    return result->latencies[i] / 1000.0;
+}
+
+/**
+ * Writes a result as one line of JSON and frees it.
+ */
+static void
+bench_result_print(const char *name, bench_result_t *result) {
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &result->end);
+    secs = (result->end.tv_sec - result->start.tv_sec) + (result->end.tv_nsec - result->start.tv_nsec) / 1e9;
+
+    qsort(result->latencies, result->ops, sizeof(*result->latencies), bench_compare);
+
+    printf("{\"name\":\"%s\",\"ops\":%zu,\"bytes\":%llu,\"secs\":%.3f,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.2f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+           name,
+           result->ops,
+           (unsigned long long)result->bytes,
+           secs,
+           secs > 0 ? result->ops / secs : 0,
+           secs > 0 ? result->bytes / secs / 1048576 : 0,
+           bench_percentile(result, 50),
+           bench_percentile(result, 99),
+           result->ops > 0 ? result->latencies[result->ops - 1] / 1000.0 : 0);
+    fflush(stdout);
+
+    bench_result_free(result);
+}
+
+/**
+ * A small random number generator, so every run uses the same offsets.
+ */
+static uint64_t
+bench_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+/**
+ * Removes a directory and everything in it.
+ */
+static bool
+bench_remove(const char *path) {
+    char child[BENCH_PATH_MAX_LEN];
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir;
+
+    if (lstat(path, &st) != 0) {
+        return errno == ENOENT;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        return unlink(path) == 0;
+    }
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        return false;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (!bench_remove(child)) {
+            closedir(dir);
+            return false;
+        }
+    }
+
+    closedir(dir);
+
+    return rmdir(path) == 0;
+}
+
+/**
+ * Makes an empty directory for a workload.
+ */
+static bool
+bench_mkdir(bench_t *bench, const char *name, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", bench->dir, name);
+
+    if (!bench_remove(path) || mkdir(path, 0755) != 0) {
+        fprintf(stderr, "Error making %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Drops a file's pages from the kernel's cache, so the next read goes to MyFS.
+ */
+static void
+bench_drop_cache(int fd) {
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+/**
+ * Writes and then reads a file sequentially with requests of `size` bytes.
+ */
+static bool
+bench_sequential(bench_t *bench, size_t size) {
+    char dir[BENCH_DIR_MAX_LEN], path[BENCH_PATH_MAX_LEN], name[64], *buf;
+    bench_result_t result;
+    uint64_t start;
+    size_t total, count, i;
+    ssize_t ret;
+    int fd = -1;
+    bool success = false;
+
+    total = (size_t)bench->mb * 1048576;
+    count = total / size;
+
+    buf = malloc(size);
+    if (buf == NULL || !bench_mkdir(bench, "sequential", dir, sizeof(dir))) {
+        free(buf);
+        return false;
+    }
+
+    memset(buf, 'm', size);
+    snprintf(path, sizeof(path), "%s/data", dir);
+
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0 || !bench_result_init(&result, count)) {
+        goto done;
+    }
+
+    for (i = 0; i < count; i++) {
+        start = bench_now_ns();
+        ret = write(fd, buf, size);
+        if (ret != (ssize_t)size) {
+            fprintf(stderr, "Error writing %s: %s\n", path, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+        bench_result_add(&result, start, size);
+    }
+
+    bench_drop_cache(fd);
+    snprintf(name, sizeof(name), "seq_write_%zu", size);
+    bench_result_print(name, &result);
+
+    if (!bench_result_init(&result, count)) {
+        goto done;
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    for (i = 0; i < count; i++) {
+        start = bench_now_ns();
+        ret = read(fd, buf, size);
+        if (ret != (ssize_t)size) {
+            fprintf(stderr, "Error reading %s: %s\n", path, ret < 0 ? strerror(errno) : "Short read");
+            bench_result_free(&result);
+            goto done;
+        }
+        bench_result_add(&result, start, size);
+    }
+
+    snprintf(name, sizeof(name), "seq_read_%zu", size);
+    bench_result_print(name, &result);
+
+    success = true;
+
+done:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buf);
+    bench_remove(dir);
+
+    return success;
+}
+
+static bool
+bench_sequential_4k(bench_t *bench) {
+    return bench_sequential(bench, 4096);
+}
+
+static bool
+bench_sequential_64k(bench_t *bench) {
+    return bench_sequential(bench, 65536);
+}
+
+static bool
+bench_sequential_1m(bench_t *bench) {
+    return bench_sequential(bench, 1048576);
+}
+
+/**
+ * Writes and then reads 4K blocks at random offsets of a file.
+ */
+static bool
+bench_random_io(bench_t *bench) {
+    char dir[BENCH_DIR_MAX_LEN], path[BENCH_PATH_MAX_LEN], buf[BENCH_RANDOM_SIZE];
+    bench_result_t result;
+    uint64_t start, state;
+    size_t blocks, count, i;
+    off_t offset;
+    int fd = -1;
+    bool success = false;
+
+    blocks = (size_t)bench->mb * 1048576 / BENCH_RANDOM_SIZE;
+    count = blocks;
+
+    if (!bench_mkdir(bench, "random", dir, sizeof(dir))) {
+        return false;
+    }
+
+    memset(buf, 'r', sizeof(buf));
+    snprintf(path, sizeof(path), "%s/data", dir);
+
+    //Lay the file out first so the reads and writes land inside of it.
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)blocks * BENCH_RANDOM_SIZE) != 0 || !bench_result_init(&result, count)) {
+        goto done;
+    }
+
+    state = 0x6d796673;
+    for (i = 0; i < count; i++) {
+        offset = (off_t)(bench_random(&state) % blocks) * BENCH_RANDOM_SIZE;
+
+        start = bench_now_ns();
+        if (pwrite(fd, buf, sizeof(buf), offset) != sizeof(buf)) {
+            fprintf(stderr, "Error writing %s: %s\n", path, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+        bench_result_add(&result, start, sizeof(buf));
+    }
+
+    bench_drop_cache(fd);
+    bench_result_print("rand_write_4096", &result);
+
+    if (!bench_result_init(&result, count)) {
+        goto done;
+    }
+
+    state = 0x6d796673;
+    for (i = 0; i < count; i++) {
+        offset = (off_t)(bench_random(&state) % blocks) * BENCH_RANDOM_SIZE;
+
+        start = bench_now_ns();
+        if (pread(fd, buf, sizeof(buf), offset) != sizeof(buf)) {
+            fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+        bench_result_add(&result, start, sizeof(buf));
+    }
+
+    bench_result_print("rand_read_4096", &result);
+
+    success = true;
+
+done:
+    if (fd >= 0) {
+        close(fd);
+    }
+    bench_remove(dir);
+
+    return success;
+}
+
+/**
+ * Creates, stats and then unlinks `bench->files` empty files in one directory.
+ */
+static bool
+bench_metadata(bench_t *bench) {
+    char dir[BENCH_DIR_MAX_LEN], path[BENCH_PATH_MAX_LEN];
+    bench_result_t result;
+    struct stat st;
+    uint64_t start;
+    unsigned int i;
+    int fd;
+    bool success = false;
+
+    if (!bench_mkdir(bench, "metadata", dir, sizeof(dir)) || !bench_result_init(&result, bench->files)) {
+        return false;
+    }
+
+    for (i = 0; i < bench->files; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", dir, i);
+
+        start = bench_now_ns();
+        fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Error creating %s: %s\n", path, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+        close(fd);
+        bench_result_add(&result, start, 0);
+    }
+
+    bench_result_print("create", &result);
+
+    if (!bench_result_init(&result, bench->files)) {
+        goto done;
+    }
+
+    for (i = 0; i < bench->files; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", dir, i);
+
+        start = bench_now_ns();
+        if (stat(path, &st) != 0) {
+            fprintf(stderr, "Error getting attributes of %s: %s\n", path, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+        bench_result_add(&result, start, 0);
+    }
+
+    bench_result_print("stat", &result);
+
+    if (!bench_result_init(&result, bench->files)) {
+        goto done;
+    }
+
+    for (i = 0; i < bench->files; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", dir, i);
+
+        start = bench_now_ns();
+        if (unlink(path) != 0) {
+            fprintf(stderr, "Error unlinking %s: %s\n", path, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+        bench_result_add(&result, start, 0);
+    }
+
+    bench_result_print("unlink", &result);
+
+    success = true;
+
+done:
+    bench_remove(dir);
+
+    return success;
+}
+
+/**
+ * Stats a file at the bottom of `bench->depth` nested directories, which makes MyFS resolve every parent.
+ */
+static bool
+bench_deep_stat(bench_t *bench) {
+    char dir[BENCH_DIR_MAX_LEN], path[BENCH_PATH_MAX_LEN];
+    bench_result_t result;
+    struct stat st;
+    uint64_t start;
+    size_t len;
+    unsigned int i;
+    int fd;
+    bool success = false;
+
+    if (!bench_mkdir(bench, "deep", dir, sizeof(dir))) {
+        return false;
+    }
+
+    len = snprintf(path, sizeof(path), "%s", dir);
+    for (i = 0; i < bench->depth && len < sizeof(path) - 16; i++) {
+        len += snprintf(path + len, sizeof(path) - len, "/d%u", i);
+        if (mkdir(path, 0755) != 0) {
+            fprintf(stderr, "Error making %s: %s\n", path, strerror(errno));
+            goto done;
+        }
+    }
+
+    snprintf(path + len, sizeof(path) - len, "/leaf");
+    fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error creating %s: %s\n", path, strerror(errno));
+        goto done;
+    }
+    close(fd);
+
+    if (!bench_result_init(&result, bench->files)) {
+        goto done;
+    }
+
+    for (i = 0; i < bench->files; i++) {
+        start = bench_now_ns();
+        if (stat(path, &st) != 0) {
+            fprintf(stderr, "Error getting attributes of %s: %s\n", path, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+        bench_result_add(&result, start, 0);
+    }
+
+    bench_result_print("deep_stat", &result);
+
+    success = true;
+
+done:
+    bench_remove(dir);
+
+    return success;
+}
+
+/**
+ * Lists a directory of `bench->files` files, ten times over.
+ */
+static bool
+bench_readdir(bench_t *bench) {
+    char dir[BENCH_DIR_MAX_LEN], path[BENCH_PATH_MAX_LEN];
+    bench_result_t result;
+    struct dirent *entry;
+    uint64_t start;
+    unsigned int i, entries;
+    DIR *d;
+    int fd;
+    bool success = false;
+
+    if (!bench_mkdir(bench, "readdir", dir, sizeof(dir))) {
+        return false;
+    }
+
+    for (i = 0; i < bench->files; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", dir, i);
+
+        fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Error creating %s: %s\n", path, strerror(errno));
+            goto done;
+        }
+        close(fd);
+    }
+
+    if (!bench_result_init(&result, 10)) {
+        goto done;
+    }
+
+    for (i = 0; i < 10; i++) {
+        start = bench_now_ns();
+
+        d = opendir(dir);
+        if (d == NULL) {
+            fprintf(stderr, "Error opening %s: %s\n", dir, strerror(errno));
+            bench_result_free(&result);
+            goto done;
+        }
+
+        entries = 0;
+        while ((entry = readdir(d)) != NULL) {
+            entries++;
+        }
+        closedir(d);
+
+        bench_result_add(&result, start, 0);
+
+        //Count the files too, so a readdir that drops entries doesn't look fast.
+        if (entries != bench->files + 2) {
+            fprintf(stderr, "Error listing %s: Found %u entries, expected %u\n", dir, entries, bench->files + 2);
+            bench_result_free(&result);
+            goto done;
+        }
+    }
+
+    bench_result_print("readdir", &result);
+
+    success = true;
+
+done:
+    bench_remove(dir);
+
+    return success;
+}
+
+/**
+ * One client of the parallel workload. It creates, writes, reads back and unlinks small files in its
+ * own directory.
+ */
+static void *
+bench_client(void *user_data) {
+    bench_client_t *client = user_data;
+    char dir[BENCH_DIR_MAX_LEN], path[BENCH_PATH_MAX_LEN], buf[BENCH_RANDOM_SIZE];
+    unsigned int i, files;
+    uint64_t start;
+    int fd;
+
+    files = client->bench->files / client->bench->threads;
+
+    snprintf(dir, sizeof(dir), "%s/parallel/c%u", client->bench->dir, client->id);
+    if (mkdir(dir, 0755) != 0) {
+        fprintf(stderr, "Error making %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+
+    memset(buf, 'p', sizeof(buf));
+
+    for (i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", dir, i);
+
+        start = bench_now_ns();
+
+        fd = open(path, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Error creating %s: %s\n", path, strerror(errno));
+            return NULL;
+        }
+
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf) || pread(fd, buf, sizeof(buf), 0) != sizeof(buf)) {
+            fprintf(stderr, "Error writing and reading %s: %s\n", path, strerror(errno));
+            close(fd);
+            return NULL;
+        }
+
+        close(fd);
+
+        if (unlink(path) != 0) {
+            fprintf(stderr, "Error unlinking %s: %s\n", path, strerror(errno));
+            return NULL;
+        }
+
+        bench_result_add(&client->result, start, sizeof(buf) * 2);
+    }
+
+    client->success = true;
+
+    return NULL;
+}
+
+/**
+ * One client of the hot_create workload. It creates empty files in the directory every client shares, so
+ * every create contends for the same parent.
+ */
+static void *
+bench_hot_client(void *user_data) {
+    bench_client_t *client = user_data;
+    char path[BENCH_PATH_MAX_LEN];
+    unsigned int i, files;
+    uint64_t start;
+    int fd;
+
+    files = client->bench->files / client->bench->threads;
+
+    for (i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/hot_create/c%u_f%u", client->bench->dir, client->id, i);
+
+        start = bench_now_ns();
+
+        fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Error creating %s: %s\n", path, strerror(errno));
+            return NULL;
+        }
+
+        close(fd);
+
+        bench_result_add(&client->result, start, 0);
+    }
+
+    client->success = true;
+
+    return NULL;
+}
+
+/**
+ * Runs `bench->threads` clients at once in the workload's directory and reports them together.
+ *
+ * @param[in] bench The settings.
+ * @param[in] workload The workload's name, which is also its directory's.
+ * @param[in] client The function each client runs.
+ */
+static bool
+bench_clients(bench_t *bench, const char *workload, void *(*client)(void *)) {
+    char dir[BENCH_DIR_MAX_LEN], name[64];
+    bench_client_t *clients;
+    bench_result_t result;
+    pthread_t *threads;
+    unsigned int i, started = 0;
+    bool success = false;
+
+    clients = calloc(bench->threads, sizeof(*clients));
+    threads = calloc(bench->threads, sizeof(*threads));
+    if (clients == NULL || threads == NULL || !bench_mkdir(bench, workload, dir, sizeof(dir))) {
+        goto done;
+    }
+
+    if (!bench_result_init(&result, bench->files)) {
+        goto done;
+    }
+
+    for (i = 0; i < bench->threads; i++) {
+        clients[i].bench = bench;
+        clients[i].id = i;
+        if (!bench_result_init(&clients[i].result, bench->files / bench->threads)) {
+            break;
+        }
+    }
+
+    if (i == bench->threads) {
+        for (started = 0; started < bench->threads; started++) {
+            if (pthread_create(&threads[started], NULL, client, &clients[started]) != 0) {
+                fprintf(stderr, "Error starting client %u\n", started);
+                break;
+            }
+        }
+    }
+
+    success = started == bench->threads;
+
+    //Merge every client's latencies into one result.
+    for (i = 0; i < bench->threads; i++) {
+        if (i < started) {
+            pthread_join(threads[i], NULL);
+            success = success && clients[i].success;
+
+            memcpy(result.latencies + result.ops, clients[i].result.latencies, clients[i].result.ops * sizeof(*result.latencies));
+            result.ops += clients[i].result.ops;
+            result.bytes += clients[i].result.bytes;
+        }
+
+        bench_result_free(&clients[i].result);
+    }
+
+    if (success) {
+        snprintf(name, sizeof(name), "%s_%u", workload, bench->threads);
+        bench_result_print(name, &result);
+    }
+    else {
+        bench_result_free(&result);
+    }
+
+done:
+    free(clients);
+    free(threads);
+    bench_remove(dir);
+
+    return success;
+}
+
+/**
+ * Runs `bench->threads` clients that each create, write, read back and unlink files in their own directory.
+ */
+static bool
+bench_parallel(bench_t *bench) {
+    return bench_clients(bench, "parallel", bench_client);
+}
+
+/**
+ * Runs `bench->threads` clients that create `bench->files` files between them in one directory.
+ */
+static bool
+bench_hot_create(bench_t *bench) {
+    return bench_clients(bench, "hot_create", bench_hot_client);
+}
+
+/**
+ * Every workload, in the order they're run.
+ */
+static const struct {
+    const char *name;
+    bench_workload_t run;
+} bench_workloads[] = {
+    {"seq_4k",     bench_sequential_4k},
+    {"seq_64k",    bench_sequential_64k},
+    {"seq_1m",     bench_sequential_1m},
+    {"random",     bench_random_io},
+    {"metadata",   bench_metadata},
+    {"deep_stat",  bench_deep_stat},
+    {"readdir",    bench_readdir},
+    {"parallel",   bench_parallel},
+    {"hot_create", bench_hot_create}
+};
+
+#define BENCH_WORKLOADS_COUNT (sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+/**
+ * Determines if the workload `name` was asked for.
+ */
+static bool
+bench_selected(bench_t *bench, const char *name) {
+    const char *match;
+    size_t len = strlen(name);
+
+    if (bench->workloads == NULL) {
+        return true;
+    }
+
+    for (match = strstr(bench->workloads, name); match != NULL; match = strstr(match + 1, name)) {
+        if ((match == bench->workloads || match[-1] == ',') && (match[len] == '\0' || match[len] == ',')) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+bench_usage(const char *program) {
+    unsigned int i;
+
+    fprintf(stderr, "Usage: %s [-f files] [-m MB] [-t threads] [-d depth] [-w workload,...] <directory>\n", program);
+    fprintf(stderr, "  -f  Files made by the metadata, deep_stat, readdir, parallel and hot_create workloads. Default 100000.\n");
+    fprintf(stderr, "  -m  Size of the file used by the read and write workloads in MB. Default 64.\n");
+    fprintf(stderr, "  -t  Clients run by the parallel and hot_create workloads. Default 8.\n");
+    fprintf(stderr, "  -d  Directories in the deep_stat path. Default 32.\n");
+    fprintf(stderr, "  -w  The workloads to run. Default all of them:");
+    for (i = 0; i < BENCH_WORKLOADS_COUNT; i++) {
+        fprintf(stderr, " %s", bench_workloads[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int
+main(int argc, char **argv) {
+    bench_t bench = {NULL, 100000, 64, 8, 32, NULL};
+    unsigned int i;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "f:m:t:d:w:")) != -1) {
+        switch (opt) {
+            case 'f': bench.files = strtoul(optarg, NULL, 10); break;
+            case 'm': bench.mb = strtoul(optarg, NULL, 10); break;
+            case 't': bench.threads = strtoul(optarg, NULL, 10); break;
+            case 'd': bench.depth = strtoul(optarg, NULL, 10); break;
+            case 'w': bench.workloads = optarg; break;
+            default:
+                bench_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || bench.files == 0 || bench.mb == 0 || bench.threads == 0) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+
+    bench.dir = argv[optind];
+
+    for (i = 0; i < BENCH_WORKLOADS_COUNT; i++) {
+        if (!bench_selected(&bench, bench_workloads[i].name)) {
+            continue;
+        }
+
+        fprintf(stderr, "Running %s\n", bench_workloads[i].name);
+
+        if (!bench_workloads[i].run(&bench)) {
+            fprintf(stderr, "Error running %s\n", bench_workloads[i].name);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,121 @@
+#!/bin/bash
+#
+# Runs the MyFS benchmark suite against a MariaDB server of its own.
+#
+# A throwaway mariadbd is started on a temporary datadir, a MyFS database is created in it from
+# `myfs --print-create-sql`, and MyFS is mounted on a temporary directory. myfs_bench then runs every
+# workload in the mount and its results are written as JSON lines to the results file, one object per
+# workload, so two runs can be compared with compare.sh.
+#
+# Usage: run.sh [results file] [myfs_bench options]
+#
+# The results file defaults to bench/results/<date>-<commit>.json. Options after it are passed to
+# myfs_bench, eg. `run.sh out.json -f 10000 -w metadata`. The myfs and myfs_bench binaries are taken from
+# src/myfs and bench unless MYFS and MYFS_BENCH are set. MARIADB_PORT sets the port the server listens
+# on (default 33306) and MARIADBD_OPTS adds options to the server, eg. a larger buffer pool.
+
+set -e
+
+bench=$(cd "$(dirname "$0")" && pwd)
+myfs=${MYFS:-$bench/../src/myfs/myfs}
+myfs_bench=${MYFS_BENCH:-$bench/myfs_bench}
+port=${MARIADB_PORT:-33306}
+commit=$(git -C "$bench" rev-parse --short HEAD 2> /dev/null || echo unknown)
+results=${1:-$bench/results/$(date +%Y%m%d-%H%M%S)-$commit.json}
+shift || true
+
+for tool in mariadb-install-db mariadbd mariadb mariadb-admin fusermount3 mountpoint; do
+    if ! command -v $tool > /dev/null; then
+        echo "$tool is needed to run the benchmarks"
+        exit 1
+    fi
+done
+
+tmp=$(mktemp -d /tmp/myfs-bench.XXXXXX)
+socket=$tmp/mariadb.sock
+mount=$tmp/mnt
+server_pid=
+myfs_pid=
+
+cleanup() {
+    if [ -n "$myfs_pid" ]; then
+        fusermount3 -u "$mount" 2> /dev/null || true
+        wait $myfs_pid 2> /dev/null || true
+    fi
+
+    if [ -n "$server_pid" ]; then
+        mariadb-admin --no-defaults --socket="$socket" -uroot shutdown 2> /dev/null || kill $server_pid 2> /dev/null || true
+        wait $server_pid 2> /dev/null || true
+    fi
+
+    rm -rf "$tmp"
+}
+
+trap cleanup EXIT
+
+mkdir -p "$mount" "$(dirname "$results")"
+
+echo "Starting MariaDB in $tmp"
+mariadb-install-db --no-defaults --user="$(id -un)" --datadir="$tmp/data" --auth-root-authentication-method=normal --skip-test-db > "$tmp/install.log" 2>&1
+mariadbd --no-defaults --user="$(id -un)" --datadir="$tmp/data" --socket="$socket" --port="$port" --bind-address=127.0.0.1 \
+         --log-error="$tmp/mariadbd.log" $MARIADBD_OPTS &
+server_pid=$!
+
+for i in $(seq 1 100); do
+    mariadb-admin --no-defaults --socket="$socket" -uroot ping > /dev/null 2>&1 && break
+    sleep 0.1
+done
+
+if ! mariadb-admin --no-defaults --socket="$socket" -uroot ping > /dev/null 2>&1; then
+    echo "MariaDB did not start, see $tmp/mariadbd.log"
+    cat "$tmp/mariadbd.log"
+    exit 1
+fi
+
+echo "Creating the MyFS database"
+"$myfs" --print-create-sql | sed -e "s/<myfs_database>/myfs_bench/g" \
+                                 -e "s/<linux user>/$(id -un)/g" \
+                                 -e "s/<linux group>/$(id -gn)/g" \
+                                 -e "s/<myfs_user>/myfs_bench/g" \
+                                 -e "s/<myfs_user_host>/127.0.0.1/g" \
+                                 -e "s/<myfs_user_password>/myfs_bench/g" \
+                           | mariadb --no-defaults --socket="$socket" -uroot
+
+cat > "$tmp/myfs.conf" << EOF
+mariadb_database = myfs_bench
+mariadb_host = 127.0.0.1
+mariadb_password = myfs_bench
+mariadb_port = $port
+mariadb_user = myfs_bench
+metrics_file = $tmp/metrics
+mount = $mount
+reclaimer_level = 0
+trace_file =
+EOF
+
+echo "Mounting MyFS on $mount"
+printf 'y\n' | "$myfs" --config-file "$tmp/myfs.conf" > "$tmp/myfs.log" 2>&1 &
+myfs_pid=$!
+
+for i in $(seq 1 100); do
+    mountpoint -q "$mount" && break
+    sleep 0.1
+done
+
+if ! mountpoint -q "$mount"; then
+    echo "MyFS did not mount on $mount"
+    cat "$tmp/myfs.log"
+    exit 1
+fi
+
+echo "Writing results to $results"
+printf '{"name":"_run","commit":"%s","date":"%s","host":"%s","mariadb":"%s"}\n' \
+       "$commit" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -n)" "$(mariadbd --version | awk '{print $3}')" > "$results"
+
+status=0
+"$myfs_bench" "$@" "$mount" >> "$results" || status=$?
+
+# Keep MyFS's own view of the run next to the results.
+cat "$mount/.myfs/queries" > "${results%.json}.queries" 2> /dev/null || true
+
+exit $status
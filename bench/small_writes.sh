@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+# Measures small write throughput on MyFS, first without and then with the kernel's writeback cache.
+#
+# MyFS is mounted once for each run using the given config file, so the mount point must not already be in use.
+# Each run is written as JSON lines like run.sh's, to <results>-off.json and <results>-on.json, and the two
+# are compared with compare.sh at the end.
+#
+# Usage: small_writes.sh <config file> <mount point> [total MB] [write size in bytes]
+#
+# The myfs binary is taken from src/myfs unless MYFS is set. The results default to
+# bench/results/<date>-<commit>-small_writes unless RESULTS is set.
+
+set -e
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <config file> <mount point> [total MB] [write size in bytes]"
+    exit 1
+fi
+
+config=$1
+mount=$2
+total_mb=${3:-16}
+write_size=${4:-512}
+bench=$(cd "$(dirname "$0")" && pwd)
+myfs=${MYFS:-$bench/../src/myfs/myfs}
+commit=$(git -C "$bench" rev-parse --short HEAD 2> /dev/null || echo unknown)
+results=${RESULTS:-$bench/results/$(date +%Y%m%d-%H%M%S)-$commit-small_writes}
+count=$((total_mb * 1024 * 1024 / write_size))
+
+mkdir -p "$(dirname "$results")"
+
+run() {
+    local writeback=$1 file=$2 pid start end i
+
+    # MyFS asks to confirm its settings before mounting.
+    printf 'y\n' | "$myfs" --config-file "$config" --mount "$mount" --writeback-cache "$writeback" > /dev/null &
+    pid=$!
+
+    for i in $(seq 1 100); do
+        mountpoint -q "$mount" && break
+        sleep 0.1
+    done
+
+    if ! mountpoint -q "$mount"; then
+        echo "MyFS did not mount on $mount"
+        kill $pid 2> /dev/null || true
+        exit 1
+    fi
+
+    start=$(date +%s.%N)
+    dd if=/dev/zero of="$mount/small_writes.bench" bs="$write_size" count="$count" conv=fsync status=none
+    end=$(date +%s.%N)
+
+    rm -f "$mount/small_writes.bench"
+    fusermount3 -u "$mount"
+    wait $pid || true
+
+    awk -v writeback="$writeback" -v count="$count" -v size="$write_size" -v start="$start" -v end="$end" 'BEGIN {
+        secs = end - start
+        printf "writeback_cache=%-5s %d writes of %d bytes in %.2fs: %.0f writes/s, %.2f MB/s\n", writeback, count, size, secs, count / secs, count * size / secs / 1048576
+    }'
+
+    printf '{"name":"_run","commit":"%s","date":"%s","host":"%s","writeback_cache":%s}\n' \
+           "$commit" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -n)" "$writeback" > "$file"
+    awk -v count="$count" -v size="$write_size" -v start="$start" -v end="$end" 'BEGIN {
+        secs = end - start
+        printf "{\"name\":\"small_write_%d\",\"ops\":%d,\"bytes\":%d,\"secs\":%.3f,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.2f}\n", size, count, count * size, secs, count / secs, count * size / secs / 1048576
+    }' >> "$file"
+}
+
+run false "$results-off.json"
+run true "$results-on.json"
+
+echo "Results written to $results-off.json and $results-on.json"
+"$bench/compare.sh" "$results-off.json" "$results-on.json" || true
@@ -10,6 +10,9 @@
 #include "string.h"
 #include "config.h"
 
+/** The number of hash buckets used to find config parameters by name. Must be a power of two. */
+#define CONFIG_BUCKETS 64
+
 typedef struct config_t config_t;
 
 /**
@@ -25,11 +28,15 @@ struct config_t {
     char *help;                 //!< Text to display for the help.
     bool priority;              //!< Parse this config's command line before the config file.
     config_t *next;             //!< A pointer to the next config struct in the linke;
+    config_t *bucket_next;      //!< A pointer to the next config struct in the same hash bucket.
 };
 
 /** Linked list of all the config parameters. */
 static config_t *configs = NULL;
 
+/** The config parameters indexed by a hash of their name. */
+static config_t *config_buckets[CONFIG_BUCKETS];
+
 /** A description of the program to print out when --help is used. */
 static char *config_description = NULL;
 
@@ -65,6 +72,24 @@ config_free() {
     if (config_description != NULL) {
         free(config_description);
     }
+
+    configs = NULL;
+    memset(config_buckets, 0, sizeof(config_buckets));
+}
+
+/**
+ * FNV-1a hash of a config parameter's name, masked to a bucket index.
+ */
+static unsigned int
+config_hash(const char *name) {
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash & (CONFIG_BUCKETS - 1);
 }
 
 void
@@ -106,6 +131,7 @@ config_set_description(const char *fmt, ...) {
 
 void
 config_set_default(const char *name, const char *name_command_line, const char *name_config_file, const char *value_default, config_func_t func, const char *help) {
+    unsigned int bucket;
     config_t *config;
 
     //Build the config structure.
@@ -134,6 +160,11 @@ config_set_default(const char *name, const char *name_command_line, const char *
         config->next = configs;
         configs = config;
     }
+
+    //Add to the hash index.
+    bucket = config_hash(name);
+    config->bucket_next = config_buckets[bucket];
+    config_buckets[bucket] = config;
 }
 
 void
@@ -158,13 +189,13 @@ static config_t *
 config_find(const char *name) {
     config_t *config;
 
-    config = configs;
+    config = config_buckets[config_hash(name)];
     while (config != NULL) {
         if (strcmp(config->name, name) == 0) {
             return config;
         }
 
-        config = config->next;
+        config = config->bucket_next;
     }
 
     return NULL;
@@ -8,8 +8,27 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <stdatomic.h>
+#include <mariadb/errmsg.h>
+#include <mariadb/mysqld_error.h>
+#include "log.h"
+#include "metrics.h"
 #include "db.h"
 
+#define MODULE "DB"
+
+/** The longest part of a query that's used to tell templates apart. Anything past this is ignored. */
+#define DB_PROFILE_QUERY_MAX_LEN 1024
+
+/**
+ * What to do with the result of a query.
+ */
+typedef enum {
+    DB_RESULT_NONE,                 //!< The query has no result.
+    DB_RESULT_STORE,                //!< The result is read into memory with `mysql_store_result()`.
+    DB_RESULT_USE                   //!< The result is streamed with `mysql_use_result()`.
+} db_result_t;
+
 void
 db_init(db_t *db) {
     memset(db, 0, sizeof(*db));
@@ -17,6 +36,344 @@ db_init(db_t *db) {
 
 void
 db_free(db_t *db) {
+    unsigned int i;
+
+    for (i = 0; i <= DB_PROFILE_MAX; i++) {
+        free(db->profile[i].query);
+    }
+
+    memset(db->profile, 0, sizeof(db->profile));
+}
+
+/**
+ * Copies a query into `buf` with its values replaced by `?`, so queries built from the same format differ
+ * only where the format did. Quoted strings and numbers become `?`, and lists of them become one `?`.
+ * Identifiers in backticks are kept as they are.
+ *
+ * @return The length of `buf`.
+ */
+static size_t
+db_profile_normalize(const char *query, int len, char *buf, size_t size) {
+    const char *end = query + len;
+    char quote, prev = ' ';
+    size_t out = 0;
+
+    while (query < end && out < size - 1) {
+        if (*query == '`') {
+            //Copy identifiers as they are, they may contain anything.
+            do {
+                buf[out++] = *query++;
+            } while (query < end && *query != '`' && out < size - 1);
+
+            if (query < end && out < size - 1) {
+                buf[out++] = *query++;
+            }
+
+            prev = '`';
+            continue;
+        }
+
+        if (*query == '\'' || *query == '"') {
+            quote = *query++;
+            while (query < end && *query != quote) {
+                if (*query == '\\' && query + 1 < end) {
+                    query++;
+                }
+                query++;
+            }
+            query++;
+        }
+        else if (*query >= '0' && *query <= '9' && !(prev == '_' || prev == '$' || (prev >= '0' && prev <= '9') || (prev >= 'a' && prev <= 'z') || (prev >= 'A' && prev <= 'Z'))) {
+            //Take hex and decimal numbers whole.
+            while (query < end && ((*query >= '0' && *query <= '9') || (*query >= 'a' && *query <= 'f') || (*query >= 'A' && *query <= 'F') || *query == 'x' || *query == '.')) {
+                query++;
+            }
+        }
+        else {
+            prev = *query;
+            buf[out++] = *query++;
+            continue;
+        }
+
+        //`?,?` becomes `?`, so IN lists and multi row inserts match however long they are.
+        if (out >= 2 && buf[out - 1] == ',' && buf[out - 2] == '?') {
+            out--;
+        }
+        else {
+            buf[out++] = '?';
+        }
+
+        prev = '?';
+    }
+
+    buf[out] = '\0';
+
+    return out;
+}
+
+/**
+ * Finds the profile for a template, claiming a free slot the first time it's seen. If there are no free
+ * slots, the shared last slot is used.
+ */
+static db_profile_t *
+db_profile_get(db_t *db, const char *template, size_t len) {
+    db_profile_t *profile;
+    uint64_t hash = 14695981039346656037ULL, seen;
+    unsigned int i;
+    char *query;
+
+    //FNV-1a.
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)template[i]) * 1099511628211ULL;
+    }
+
+    //0 marks a free slot.
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    for (i = 0; i < DB_PROFILE_MAX; i++) {
+        profile = &db->profile[(hash + i) % DB_PROFILE_MAX];
+
+        seen = atomic_load_explicit(&profile->hash, memory_order_acquire);
+        if (seen == 0 && atomic_compare_exchange_strong(&profile->hash, &seen, hash)) {
+            query = strndup(template, len);
+            atomic_store_explicit(&profile->query, query, memory_order_release);
+            return profile;
+        }
+
+        if (seen == hash) {
+            return profile;
+        }
+    }
+
+    return &db->profile[DB_PROFILE_MAX];
+}
+
+/**
+ * Records one query into its template's profile.
+ */
+static void
+db_profile_add(db_profile_t *profile, bool success, uint64_t ns, uint64_t rows, uint64_t bytes) {
+    uint64_t max, us;
+    unsigned int bucket;
+
+    us = ns / 1000;
+    bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= DB_PROFILE_BUCKETS) {
+        bucket = DB_PROFILE_BUCKETS - 1;
+    }
+
+    //Queries take far longer than these adds, so the profiles are shared by every thread.
+    atomic_fetch_add_explicit(&profile->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profile->errors, success ? 0 : 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profile->rows, rows, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profile->bytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profile->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profile->buckets[bucket], 1, memory_order_relaxed);
+
+    max = atomic_load_explicit(&profile->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&profile->max_ns, &max, ns, memory_order_relaxed, memory_order_relaxed));
+}
+
+/**
+ * Logs the statements that took the most time, if it's time to.
+ */
+static void
+db_profile_summary(db_t *db) {
+    time_t now, next;
+    char *data = NULL, *line, *save;
+    size_t len = 0;
+    FILE *f;
+
+    if (db->summary_interval == 0) {
+        return;
+    }
+
+    now = time(NULL);
+    next = atomic_load_explicit(&db->summary_next, memory_order_relaxed);
+
+    //Only the thread that moves `summary_next` along logs the summary.
+    if (now < next || !atomic_compare_exchange_strong(&db->summary_next, &next, now + db->summary_interval)) {
+        return;
+    }
+
+    //The first interval starts with the first query.
+    if (next == 0) {
+        return;
+    }
+
+    f = open_memstream(&data, &len);
+    if (f == NULL) {
+        return;
+    }
+
+    db_profile_write(db, f, db->summary_top);
+    fclose(f);
+
+    line = strtok_r(data, "\n", &save);
+    while (line != NULL) {
+        log_info(MODULE, "%s", line);
+        line = strtok_r(NULL, "\n", &save);
+    }
+
+    free(data);
+}
+
+/**
+ * A copy of one profile, for writing.
+ */
+typedef struct {
+    const char *query;
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t rows;
+    uint64_t bytes;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[DB_PROFILE_BUCKETS];
+} db_profile_totals_t;
+
+static int
+db_profile_compare(const void *a, const void *b) {
+    const db_profile_totals_t *x = a, *y = b;
+
+    if (x->total_ns == y->total_ns) {
+        return 0;
+    }
+
+    return x->total_ns < y->total_ns ? 1 : -1;
+}
+
+/**
+ * Gets the duration at `percentile` in microseconds. This is the top of the bucket the percentile falls in.
+ */
+static double
+db_profile_percentile(db_profile_totals_t *totals, double percentile) {
+    uint64_t rank, seen = 0, us;
+    unsigned int i;
+
+    rank = (uint64_t)(totals->calls * percentile / 100.0 + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < DB_PROFILE_BUCKETS - 1; i++) {
+        seen += totals->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    us = 1ULL << i;
+    if (us * 1000 > totals->max_ns) {
+        return totals->max_ns / 1000.0;
+    }
+
+    return us;
+}
+
+void
+db_profile_write(db_t *db, FILE *f, unsigned int top) {
+    db_profile_totals_t *totals;
+    db_profile_t *profile;
+    unsigned int i, j, count = 0;
+    uint64_t total_ns = 0;
+    const char *c;
+
+    totals = calloc(DB_PROFILE_MAX + 1, sizeof(*totals));
+    if (totals == NULL) {
+        log_err(MODULE, "Error writing statement profiles: Out of memory");
+        return;
+    }
+
+    for (i = 0; i <= DB_PROFILE_MAX; i++) {
+        profile = &db->profile[i];
+
+        totals[count].calls = atomic_load_explicit(&profile->calls, memory_order_relaxed);
+        if (totals[count].calls == 0) {
+            continue;
+        }
+
+        totals[count].query = atomic_load_explicit(&profile->query, memory_order_acquire);
+        totals[count].errors = atomic_load_explicit(&profile->errors, memory_order_relaxed);
+        totals[count].rows = atomic_load_explicit(&profile->rows, memory_order_relaxed);
+        totals[count].bytes = atomic_load_explicit(&profile->bytes, memory_order_relaxed);
+        totals[count].total_ns = atomic_load_explicit(&profile->total_ns, memory_order_relaxed);
+        totals[count].max_ns = atomic_load_explicit(&profile->max_ns, memory_order_relaxed);
+        for (j = 0; j < DB_PROFILE_BUCKETS; j++) {
+            totals[count].buckets[j] = atomic_load_explicit(&profile->buckets[j], memory_order_relaxed);
+        }
+
+        //The last slot holds every statement that didn't get its own.
+        if (i == DB_PROFILE_MAX) {
+            totals[count].query = "(other statements)";
+        }
+
+        total_ns += totals[count].total_ns;
+        count++;
+    }
+
+    qsort(totals, count, sizeof(*totals), db_profile_compare);
+
+    if (top == 0 || top > count) {
+        top = count;
+    }
+
+    fprintf(f, "# Top %u of %u statements by total time, in microseconds\n", top, count);
+    fprintf(f, "%6s %10s %8s %12s %10s %10s %10s %10s %10s %12s  %s\n", "time%", "calls", "errors", "total", "avg", "p50", "p99", "max", "rows", "bytes", "statement");
+
+    for (i = 0; i < top; i++) {
+        fprintf(f, "%6.1f %10llu %8llu %12.0f %10.1f %10.1f %10.1f %10.1f %10llu %12llu  ",
+                total_ns > 0 ? totals[i].total_ns * 100.0 / total_ns : 0.0,
+                (unsigned long long)totals[i].calls,
+                (unsigned long long)totals[i].errors,
+                totals[i].total_ns / 1000.0,
+                totals[i].total_ns / 1000.0 / totals[i].calls,
+                db_profile_percentile(&totals[i], 50),
+                db_profile_percentile(&totals[i], 99),
+                totals[i].max_ns / 1000.0,
+                (unsigned long long)totals[i].rows,
+                (unsigned long long)totals[i].bytes);
+
+        //Templates are written over several lines in the code. Keep each one on one line here.
+        for (c = totals[i].query != NULL ? totals[i].query : "?"; *c != '\0'; c++) {
+            fputc(*c == '\n' ? ' ' : *c, f);
+        }
+        fputc('\n', f);
+    }
+
+    free(totals);
+}
+
+/**
+ * Gets the number of nanoseconds between `start` and now.
+ */
+static uint64_t
+db_elapsed_ns(struct timespec *start) {
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) * 1000000000ULL + end.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * Closes every prepared statement kept for the connection.
+ */
+static void
+db_stmt_free_all(db_t *db) {
+    unsigned int i;
+
+    for (i = 0; i < DB_STMT_CACHE_MAX; i++) {
+        if (db->stmts[i].stmt != NULL) {
+            mysql_stmt_close(db->stmts[i].stmt);
+            free(db->stmts[i].query);
+        }
+    }
+
+    memset(db->stmts, 0, sizeof(db->stmts));
+    db->stmts_next = 0;
 }
 
 bool
@@ -33,6 +390,7 @@ db_connect(db_t *db, const char *host, const char *user, const char *password, c
 
     if (mysql_real_connect(&db->mysql, host, user, password, database, port, NULL, 10) == NULL) {
         snprintf(db->error, sizeof(db->error), "%s", mysql_error(&db->mysql));
+        db->error_no = mysql_errno(&db->mysql);
         return false;
     }
 
@@ -41,6 +399,7 @@ db_connect(db_t *db, const char *host, const char *user, const char *password, c
 
 void
 db_disconnect(db_t *db) {
+    db_stmt_free_all(db);
     mysql_close(&db->mysql);
 }
 
@@ -50,17 +409,29 @@ db_set_failed_query_options(db_t *db, int retry_wait, int retry_count) {
     db->failed_query_retry_count = retry_count;
 }
 
+void
+db_set_profile_options(db_t *db, unsigned int slow_query_ms, unsigned int summary_interval, unsigned int summary_top) {
+    db->slow_query_ms = slow_query_ms;
+    db->summary_interval = summary_interval;
+    db->summary_top = summary_top;
+}
+
 const char *
 db_error(db_t *db) {
     return db->error;
 }
 
+unsigned int
+db_errno(db_t *db) {
+    return db->error_no;
+}
+
 /**
  * Run a query and optionally retry if the query fails if `failed_query_retry_wait`
  * and `failed_query_retry_count` are set.
  */
 static bool
-db_query_timed(db_t *db, const char *query, int len) {
+db_query_retry(db_t *db, const char *query, int len) {
     time_t next_try = 0;
     int count = 0, ret;
 
@@ -78,6 +449,7 @@ db_query_timed(db_t *db, const char *query, int len) {
         //If `ret` is 0, then the query succeeded. If so, reset the error in case a previous query failed.
         if (ret == 0) {
             db->error[0] = '\0';
+            db->error_no = 0;
             break;
         }
 
@@ -86,6 +458,7 @@ db_query_timed(db_t *db, const char *query, int len) {
         //If `failed_query_retry_wait` is -1, do not retry again.
         if (db->failed_query_retry_wait == -1) {
             snprintf(db->error, sizeof(db->error), "%s", mysql_error(&db->mysql));
+            db->error_no = mysql_errno(&db->mysql);
             break;
         }
 
@@ -94,20 +467,89 @@ db_query_timed(db_t *db, const char *query, int len) {
         if (db->failed_query_retry_count != -1) {
             if (++count >= db->failed_query_retry_count) {
                 snprintf(db->error, sizeof(db->error), "%s", mysql_error(&db->mysql));
+                db->error_no = mysql_errno(&db->mysql);
                 break;
             }
         }
 
         //Set the timer for when to retry next.
         next_try = time(NULL) + db->failed_query_retry_wait;
+        METRICS_COUNT("db_query_retries", 1);
     }
 
     return ret == 0;
 }
 
+/**
+ * Runs a query, reads its result if it has one, and records how long it took into the profile for
+ * `template`. If `template` is `NULL`, the query itself with its values taken out is the template.
+ */
+static bool
+db_query_timed(db_t *db, const char *template, const char *query, int len, db_result_t result, MYSQL_RES **res) {
+    struct timespec start;
+    char normalized[DB_PROFILE_QUERY_MAX_LEN + 1];
+    uint64_t ns, rows = 0;
+    size_t template_len;
+    bool success;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    success = db_query_retry(db, query, len);
+
+    if (success && result != DB_RESULT_NONE) {
+        //Rows streamed with DB_RESULT_USE are read by the caller after this, so they can't be counted here.
+        *res = result == DB_RESULT_STORE ? mysql_store_result(&db->mysql) : mysql_use_result(&db->mysql);
+        if (*res == NULL) {
+            snprintf(db->error, sizeof(db->error), "%s", mysql_error(&db->mysql));
+            db->error_no = mysql_errno(&db->mysql);
+            success = false;
+        }
+        else if (result == DB_RESULT_STORE) {
+            rows = mysql_num_rows(*res);
+        }
+    }
+    else if (success) {
+        rows = mysql_affected_rows(&db->mysql);
+    }
+
+    ns = db_elapsed_ns(&start);
+
+    if (success) {
+        metrics_stat_add(METRICS_STAT_QUERIES, 1);
+        metrics_stat_add(METRICS_STAT_ROWS, rows);
+    }
+
+    if (template != NULL) {
+        template_len = strnlen(template, DB_PROFILE_QUERY_MAX_LEN);
+    }
+    else {
+        template_len = db_profile_normalize(query, len, normalized, sizeof(normalized));
+        template = normalized;
+    }
+
+    db_profile_add(db_profile_get(db, template, template_len), success, ns, rows, len);
+
+    if (db->slow_query_ms > 0 && ns >= db->slow_query_ms * 1000000ULL) {
+        log_warn(MODULE, "Slow query took %.3fms: %.*s", ns / 1000000.0, len, query);
+    }
+
+    db_profile_summary(db);
+
+    return success;
+}
+
 bool
 db_query(db_t *db, const char *query, int len) {
-    return db_query_timed(db, query, len);
+    return db_query_timed(db, NULL, query, len, DB_RESULT_NONE, NULL);
+}
+
+/**
+ * Gets the template to profile a query built from `fmt` under. A format that's only a string is no
+ * template at all, so the query itself is used.
+ */
+static const char *
+db_format_template(const char *fmt) {
+    return strcmp(fmt, "%s") == 0 ? NULL : fmt;
 }
 
 bool
@@ -121,7 +563,7 @@ db_queryf(db_t *db, const char *fmt, ...) {
     len = vasprintf(&query, fmt, ap);
     va_end(ap);
 
-    success = db_query(db, query, len);
+    success = db_query_timed(db, db_format_template(fmt), query, len, DB_RESULT_NONE, NULL);
     free(query);
 
     return success;
@@ -130,16 +572,38 @@ db_queryf(db_t *db, const char *fmt, ...) {
 MYSQL_RES *
 db_select(db_t *db, const char *query, int len) {
     MYSQL_RES *res;
-    bool success;
 
-    success = db_query_timed(db, query, len);
-    if (!success) {
+    if (!db_query_timed(db, NULL, query, len, DB_RESULT_STORE, &res)) {
         return NULL;
     }
 
-    res = mysql_store_result(&db->mysql);
-    if (res == NULL) {
-        snprintf(db->error, sizeof(db->error), "%s", mysql_error(&db->mysql));
+    return res;
+}
+
+MYSQL_RES *
+db_selectf(db_t *db, const char *fmt, ...) {
+    va_list ap;
+    char *query;
+    int len;
+    MYSQL_RES *res;
+    bool success;
+
+    va_start(ap, fmt);
+    len = vasprintf(&query, fmt, ap);
+    va_end(ap);
+
+    success = db_query_timed(db, db_format_template(fmt), query, len, DB_RESULT_STORE, &res);
+    free(query);
+
+    return success ? res : NULL;
+}
+
+MYSQL_RES *
+db_select_stream(db_t *db, const char *query, int len) {
+    MYSQL_RES *res;
+
+    //Only the result's metadata is read here. Rows are read from the connection by mysql_fetch_row().
+    if (!db_query_timed(db, NULL, query, len, DB_RESULT_USE, &res)) {
         return NULL;
     }
 
@@ -147,20 +611,220 @@ db_select(db_t *db, const char *query, int len) {
 }
 
 MYSQL_RES *
-db_selectf(db_t *db, const char *fmt, ...) {
+db_select_streamf(db_t *db, const char *fmt, ...) {
     va_list ap;
     char *query;
     int len;
     MYSQL_RES *res;
+    bool success;
 
     va_start(ap, fmt);
     len = vasprintf(&query, fmt, ap);
     va_end(ap);
 
-    res = db_select(db, query, len);
+    success = db_query_timed(db, db_format_template(fmt), query, len, DB_RESULT_USE, &res);
     free(query);
 
-    return res;
+    return success ? res : NULL;
+}
+
+bool
+db_stream_error(db_t *db) {
+    if (mysql_errno(&db->mysql) == 0) {
+        return false;
+    }
+
+    snprintf(db->error, sizeof(db->error), "%s", mysql_error(&db->mysql));
+    db->error_no = mysql_errno(&db->mysql);
+    return true;
+}
+
+/**
+ * Finds the prepared statement for `query`, preparing it if this connection hasn't seen it yet.
+ * If the cache is full, the slots are reused in a round robin fashion.
+ */
+static MYSQL_STMT *
+db_stmt_get(db_t *db, const char *query) {
+    MYSQL_STMT *stmt;
+    db_stmt_t *entry = NULL;
+    unsigned int i;
+
+    for (i = 0; i < DB_STMT_CACHE_MAX; i++) {
+        if (db->stmts[i].stmt == NULL) {
+            if (entry == NULL) {
+                entry = &db->stmts[i];
+            }
+        }
+        else if (strcmp(db->stmts[i].query, query) == 0) {
+            METRICS_COUNT("db_stmt_cache_hits", 1);
+            return db->stmts[i].stmt;
+        }
+    }
+
+    METRICS_COUNT("db_stmt_cache_misses", 1);
+
+    //No empty slots, replace one.
+    if (entry == NULL) {
+        entry = &db->stmts[db->stmts_next];
+        db->stmts_next = (db->stmts_next + 1) % DB_STMT_CACHE_MAX;
+
+        mysql_stmt_close(entry->stmt);
+        free(entry->query);
+        entry->stmt = NULL;
+        entry->query = NULL;
+    }
+
+    stmt = mysql_stmt_init(&db->mysql);
+    if (stmt == NULL) {
+        snprintf(db->error, sizeof(db->error), "%s", mysql_error(&db->mysql));
+        db->error_no = mysql_errno(&db->mysql);
+        return NULL;
+    }
+
+    if (mysql_stmt_prepare(stmt, query, strlen(query)) != 0) {
+        snprintf(db->error, sizeof(db->error), "%s", mysql_stmt_error(stmt));
+        db->error_no = mysql_stmt_errno(stmt);
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+
+    entry->query = strdup(query);
+    entry->stmt = stmt;
+
+    return stmt;
+}
+
+/**
+ * Determines if a statement failed because its connection went away. MariaDB forgets prepared
+ * statements when it reconnects, so they have to be prepared again.
+ */
+static bool
+db_stmt_lost(MYSQL_STMT *stmt) {
+    switch (mysql_stmt_errno(stmt)) {
+        case CR_SERVER_GONE_ERROR:
+        case CR_SERVER_LOST:
+        case CR_STMT_CLOSED:
+        case ER_UNKNOWN_STMT_HANDLER:
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Writes the values bound to a statement's parameters, for logging. Binary data is written as its length.
+ */
+static void
+db_stmt_params_write(char *buf, size_t size, MYSQL_BIND *params, unsigned int count) {
+    size_t len = 0;
+    unsigned int i;
+
+    buf[0] = '\0';
+
+    for (i = 0; i < count && len < size; i++) {
+        if (params[i].buffer_type == MYSQL_TYPE_LONG) {
+            len += snprintf(buf + len, size - len, "%s%u", i > 0 ? ", " : "", *(unsigned int *)params[i].buffer);
+        }
+        else {
+            len += snprintf(buf + len, size - len, "%s<%lu bytes>", i > 0 ? ", " : "", *params[i].length);
+        }
+    }
+}
+
+bool
+db_stmt_execute(db_t *db, const char *query, MYSQL_BIND *params) {
+    MYSQL_STMT *stmt;
+    struct timespec start;
+    char values[256];
+    uint64_t ns, rows = 0, bytes = 0;
+    unsigned int i, count = 0;
+    time_t next_try = 0;
+    bool success = false;
+    int failures = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (true) {
+        //Wait out `failed_query_retry_wait` between attempts, like `db_query_retry()`.
+        if (next_try > time(NULL)) {
+            usleep(1000 * 50);
+            continue;
+        }
+
+        stmt = db_stmt_get(db, query);
+        if (stmt == NULL) {
+            break;
+        }
+
+        //Parameters are re-bound on every execute since callers move the buffers around between executes.
+        if (mysql_stmt_bind_param(stmt, params) == 0 && mysql_stmt_execute(stmt) == 0) {
+            db->error[0] = '\0';
+            db->error_no = 0;
+            count = mysql_stmt_param_count(stmt);
+            rows = mysql_stmt_affected_rows(stmt);
+            metrics_stat_add(METRICS_STAT_QUERIES, 1);
+            metrics_stat_add(METRICS_STAT_ROWS, rows);
+            success = true;
+            break;
+        }
+
+        snprintf(db->error, sizeof(db->error), "%s", mysql_stmt_error(stmt));
+        db->error_no = mysql_stmt_errno(stmt);
+
+        if (!db_stmt_lost(stmt)) {
+            break;
+        }
+
+        //The server rolled back the open transaction along with the connection. Running the statement
+        //again would commit it on its own, so the caller has to see the failure and roll back instead.
+        if (db->transaction || db->failed_query_retry_wait == -1) {
+            break;
+        }
+
+        //-1 means retry forever.
+        if (db->failed_query_retry_count != -1 && ++failures >= db->failed_query_retry_count) {
+            break;
+        }
+
+        //Prepare everything again on the next attempt.
+        METRICS_COUNT("db_stmt_retries", 1);
+        db_stmt_free_all(db);
+        next_try = time(NULL) + db->failed_query_retry_wait;
+    }
+
+    ns = db_elapsed_ns(&start);
+
+    for (i = 0; i < count; i++) {
+        bytes += params[i].buffer_type == MYSQL_TYPE_LONG ? sizeof(unsigned int) : *params[i].length;
+    }
+
+    db_profile_add(db_profile_get(db, query, strnlen(query, DB_PROFILE_QUERY_MAX_LEN)), success, ns, rows, bytes);
+
+    if (db->slow_query_ms > 0 && ns >= db->slow_query_ms * 1000000ULL) {
+        db_stmt_params_write(values, sizeof(values), params, count);
+        log_warn(MODULE, "Slow query took %.3fms: %s -- [%s]", ns / 1000000.0, query, values);
+    }
+
+    db_profile_summary(db);
+
+    return success;
+}
+
+void
+db_bind_uint(MYSQL_BIND *bind, unsigned int *value) {
+    memset(bind, 0, sizeof(*bind));
+    bind->buffer_type = MYSQL_TYPE_LONG;
+    bind->buffer = value;
+    bind->is_unsigned = 1;
+}
+
+void
+db_bind_blob(MYSQL_BIND *bind, const char *data, unsigned long *length) {
+    memset(bind, 0, sizeof(*bind));
+    bind->buffer_type = MYSQL_TYPE_BLOB;
+    bind->buffer = (void *)data;
+    bind->buffer_length = *length;
+    bind->length = length;
 }
 
 unsigned long
@@ -210,7 +874,9 @@ db_user_exists(db_t *db, const char *user, const char *host, bool *exists) {
 
 bool
 db_transaction_start(db_t *db) {
-    return db_query(db, "START TRANSACTION", 17);
+    db->transaction = db_query(db, "START TRANSACTION", 17);
+
+    return db->transaction;
 }
 
 bool
@@ -224,6 +890,9 @@ db_transaction_stop(db_t *db, bool commit) {
         success = db_query(db, "ROLLBACK", 8);
     }
 
+    //Even a failed COMMIT or ROLLBACK ends the transaction.
+    db->transaction = false;
+
     return success;
 }
 
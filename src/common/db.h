@@ -7,16 +7,61 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 #include <mariadb/mysql.h>
 
+/** The maximum number of prepared statements kept open per connection. */
+#define DB_STMT_CACHE_MAX 16
+
+/** The maximum number of distinct statements profiled per connection. Statements past this are counted together. */
+#define DB_PROFILE_MAX 128
+
+/** The number of latency buckets per profiled statement. Bucket `i` counts queries that took up to 2^i microseconds. */
+#define DB_PROFILE_BUCKETS 32
+
+/**
+ * A prepared statement kept open for reuse.
+ */
+typedef struct {
+    char *query;                    //!< The statement's text, used to find it again.
+    MYSQL_STMT *stmt;               //!< The prepared statement.
+} db_stmt_t;
+
+/**
+ * The profile of one statement template: a printf format string, a prepared statement, or a query with its
+ * values taken out. Every query run from the same template is counted together.
+ */
+typedef struct {
+    _Atomic uint64_t hash;                      //!< The hash of the template, or 0 if the slot is free.
+    char * _Atomic query;                       //!< The template's text, once it's been copied.
+    _Atomic uint64_t calls;                     //!< The number of queries run.
+    _Atomic uint64_t errors;                    //!< The number of those that failed.
+    _Atomic uint64_t rows;                      //!< Rows returned or changed.
+    _Atomic uint64_t bytes;                     //!< Bytes of SQL and bound parameters sent.
+    _Atomic uint64_t total_ns;                  //!< The sum of all of the durations.
+    _Atomic uint64_t max_ns;                    //!< The longest duration.
+    _Atomic uint64_t buckets[DB_PROFILE_BUCKETS];
+} db_profile_t;
+
 /**
  * The database context.
  */
 typedef struct {
-    MYSQL mysql;                    //!< The handle to MariaDB and libmysqlclient.
-    int failed_query_retry_wait;    //!< Number of seconds to wait before re-trying a failed query.
-    int failed_query_retry_count;   //!< The total number of failed queries to retry.
-    char error[256];                //!< Any error text.
+    MYSQL mysql;                            //!< The handle to MariaDB and libmysqlclient.
+    int failed_query_retry_wait;            //!< Number of seconds to wait before re-trying a failed query.
+    int failed_query_retry_count;           //!< The total number of failed queries to retry.
+    char error[256];                        //!< Any error text.
+    unsigned int error_no;                  //!< The MariaDB error number that goes with `error`, or 0.
+    bool transaction;                       //!< Whether a transaction is open. Lost statements aren't retried inside of one.
+    db_stmt_t stmts[DB_STMT_CACHE_MAX];     //!< Prepared statements for this connection.
+    unsigned int stmts_next;                //!< The next slot in `stmts` to replace when it's full.
+    db_profile_t profile[DB_PROFILE_MAX + 1];   //!< Statement profiles. The last one counts the statements that didn't fit.
+    unsigned int slow_query_ms;             //!< Queries that take at least this many milliseconds are logged. 0 is off.
+    unsigned int summary_interval;          //!< The number of seconds between logging the top statements. 0 is off.
+    unsigned int summary_top;               //!< The number of statements to log in each summary.
+    _Atomic time_t summary_next;            //!< When to log the next summary.
 } db_t;
 
 /**
@@ -62,6 +107,26 @@ void db_disconnect(db_t *db);
  */
 void db_set_failed_query_options(db_t *db, int retry_wait, int retry_count);
 
+/**
+ * Sets options for profiling statements. Every query is always profiled by its template, this only sets
+ * what gets logged.
+ *
+ * @param[in] db The database context.
+ * @param[in] slow_query_ms Queries that take at least this many milliseconds are logged in full. 0 means do not log them.
+ * @param[in] summary_interval Number of seconds between logging the statements that took the most time. 0 means do not log them.
+ * @param[in] summary_top The number of statements to log in each summary.
+ */
+void db_set_profile_options(db_t *db, unsigned int slow_query_ms, unsigned int summary_interval, unsigned int summary_top);
+
+/**
+ * Writes the statement profiles as text, the statements that took the most total time first.
+ *
+ * @param[in] db The database context.
+ * @param[in] f The file to write to.
+ * @param[in] top The number of statements to write. 0 writes all of them.
+ */
+void db_profile_write(db_t *db, FILE *f, unsigned int top);
+
 /**
  * Returns the last error message. If no error has occurred, a blank string will be returned. The
  * error messages are not cleared out if an error occurs and then a successful operation occurs.
@@ -71,6 +136,15 @@ void db_set_failed_query_options(db_t *db, int retry_wait, int retry_count);
  */
 const char * db_error(db_t *db);
 
+/**
+ * Returns the MariaDB error number of the last error, such as `ER_DUP_ENTRY`, so callers can tell errors
+ * apart without matching their text. Like `db_error()`, it's only reset by a successful query.
+ *
+ * @param[in] db The database context.
+ * @return The error number, or 0 if no error has occurred.
+ */
+unsigned int db_errno(db_t *db);
+
 /**
  * Runs a query. This query should not be a SELECT type query.
  *
@@ -109,6 +183,74 @@ MYSQL_RES * db_select(db_t *db, const char *query, int len);
  */
 MYSQL_RES * db_selectf(db_t *db, const char *fmt, ...);
 
+/**
+ * Runs a query. This query should be a SELECT type query. Unlike `db_select()`, the result set is not
+ * buffered on the client. Rows are streamed from MariaDB as `mysql_fetch_row()` is called, so the first
+ * row is available as soon as it arrives and memory use does not grow with the size of the result.
+ *
+ * No other query may be run on `db` until the result has been free'd. `mysql_num_rows()` is not valid
+ * until every row has been fetched. When `mysql_fetch_row()` returns `NULL`, call `db_stream_error()`
+ * to tell the end of the result apart from a failure.
+ *
+ * @param[in] db The database context.
+ * @param[in] query The database query.
+ * @param[in] len The length of the database query.
+ * @return The MariaDB result or `NULL` of an error occurred.
+ */
+MYSQL_RES * db_select_stream(db_t *db, const char *query, int len);
+
+/**
+ * Runs a query. This query should be a SELECT type query. See `db_select_stream()`.
+ *
+ * @param[in] db The database context.
+ * @param[in] fmt A printf formatted string for the query.
+ * @return The MariaDB result or `NULL` of an error occurred.
+ */
+MYSQL_RES * db_select_streamf(db_t *db, const char *fmt, ...);
+
+/**
+ * Determines if fetching rows from a result returned by `db_select_stream()` failed. This should be
+ * called after `mysql_fetch_row()` returns `NULL`. On failure, the error is available from `db_error()`.
+ *
+ * @param[in] db The database context.
+ * @return `true` if an error occurred while fetching rows, otherwise `false`.
+ */
+bool db_stream_error(db_t *db);
+
+/**
+ * Executes a prepared statement. Parameters are marked with `?` in `query` and bound from `params`, which
+ * lets binary data be sent as-is instead of being escaped into the query text. The bound buffers are read
+ * when the statement is executed, so they only need to stay valid for the duration of this call.
+ *
+ * The statement is prepared the first time `query` is executed on this connection and is kept for reuse
+ * until the connection is closed. If the statement was lost because MariaDB reconnected, it is prepared
+ * again and retried as set by `db_set_failed_query_options()`, unless a transaction is open. The server
+ * rolled that transaction back, so the caller has to roll back too.
+ *
+ * @param[in] db The database context.
+ * @param[in] query The statement to execute.
+ * @param[in] params An array of parameters, one for each `?` in `query`.
+ * @return `true` if the statement was successful, otherwise `false`.
+ */
+bool db_stmt_execute(db_t *db, const char *query, MYSQL_BIND *params);
+
+/**
+ * Sets up a parameter to bind an unsigned int.
+ *
+ * @param[out] bind The parameter to set up.
+ * @param[in] value The value to bind. It is read when the statement is executed.
+ */
+void db_bind_uint(MYSQL_BIND *bind, unsigned int *value);
+
+/**
+ * Sets up a parameter to bind binary data. The data is sent as-is so it does not need to be escaped.
+ *
+ * @param[out] bind The parameter to set up.
+ * @param[in] data The data to bind. It is read when the statement is executed.
+ * @param[in] length The length of `data`. It is read when the statement is executed.
+ */
+void db_bind_blob(MYSQL_BIND *bind, const char *data, unsigned long *length);
+
 /**
  * Gets the last inserted auto increment ID.
  *
@@ -4,31 +4,86 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 #include <syslog.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include "log.h"
 
+/** The longest module name kept with a queued message. */
+#define LOG_MODULE_MAX_LEN 31
+
+/** The longest message. */
+#define LOG_MESSAGE_MAX_LEN 511
+
+/**
+ * A message waiting in the queue.
+ */
+typedef struct {
+    _Atomic size_t sequence;                    //!< Tells producers and the writer whose turn it is to use this slot.
+    log_severity_t severity;
+    time_t time;
+    char module[LOG_MODULE_MAX_LEN + 1];
+    char message[LOG_MESSAGE_MAX_LEN + 1];
+} log_entry_t;
+
+/**
+ * The last message written, to catch repeats.
+ */
+typedef struct {
+    log_severity_t severity;
+    char module[LOG_MODULE_MAX_LEN + 1];
+    char message[LOG_MESSAGE_MAX_LEN + 1];
+    unsigned int repeats;                       //!< The number of times it repeated since it was written.
+} log_last_t;
+
 typedef struct {
-    log_severity_t severity;        //<! The minimum severity to log
-    bool to_stdout;                 //<! Logging to stdout?
-    bool to_syslog;                 //<! Logging to syslog?
+    log_severity_t severity;        //!< The minimum severity to log
+    bool to_stdout;                 //!< Logging to stdout?
+    bool to_syslog;                 //!< Logging to syslog?
+    _Atomic bool async;             //!< Whether messages go through the queue.
+    log_entry_t queue[LOG_QUEUE_SIZE];
+    _Atomic size_t enqueue_pos;     //!< The next slot a producer claims.
+    size_t dequeue_pos;             //!< The next slot the writer reads. Only used by the writer.
+    _Atomic uint64_t dropped;       //!< Messages dropped because the queue was full.
+    sem_t ready;                    //!< Posted for every queued message.
+    pthread_t thread;               //!< The writer thread.
+    log_last_t last;                //!< Only used by the writer.
+    time_t window;                  //!< The second the writer is rate limiting in.
+    unsigned int window_count;      //!< The messages written in `window`.
+    uint64_t suppressed;            //!< The messages not written because of the rate limit.
 } log_t;
 
 static log_t log;
 
 void
 log_init() {
+    size_t i;
+
     log.severity = LOG_SEVERITY_DEBUG;
     log.to_stdout = true;
     log.to_syslog = false;
+    log.async = false;
+
+    for (i = 0; i < LOG_QUEUE_SIZE; i++) {
+        log.queue[i].sequence = i;
+    }
+
+    sem_init(&log.ready, 0, 0);
 }
 
 void
 log_free() {
+    log_stop();
+
     if (log.to_syslog) {
         closelog();
     }
+
+    sem_destroy(&log.ready);
 }
 
 void
@@ -85,12 +140,205 @@ log_syslog_severity(log_severity_t severity) {
     return 0;   //not sure what this will do
 }
 
+/**
+ * Writes a message to stdout and/or syslog.
+ */
+static void
+log_output(const char *module, log_severity_t severity, time_t when, const char *message) {
+    struct tm tm;
+
+    if (log.to_stdout) {
+        memset(&tm, 0, sizeof(tm));
+        localtime_r(&when, &tm);
+
+        printf("[%02d:%02d:%02d] %c [%s] %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec, log_severity_char(severity), module, message);
+    }
+
+    if (log.to_syslog) {
+        syslog(log_syslog_severity(severity), "%s", message);
+    }
+}
+
+/**
+ * Writes how many times the last message repeated, if it did.
+ */
+static void
+log_flush_repeats(time_t now) {
+    char message[64];
+
+    if (log.last.repeats > 0) {
+        snprintf(message, sizeof(message), "Last message repeated %u times", log.last.repeats);
+        log_output(log.last.module, log.last.severity, now, message);
+        log.last.repeats = 0;
+    }
+}
+
+/**
+ * Writes a message from the queue, folding repeats of the last message into a count and holding back
+ * messages past `LOG_RATE_MAX` a second.
+ */
+static void
+log_process_entry(log_entry_t *entry) {
+    if (entry->severity == log.last.severity && strcmp(entry->module, log.last.module) == 0 && strcmp(entry->message, log.last.message) == 0) {
+        log.last.repeats++;
+        return;
+    }
+
+    log_flush_repeats(entry->time);
+
+    if (entry->time != log.window) {
+        log.window = entry->time;
+        log.window_count = 0;
+    }
+
+    if (log.window_count >= LOG_RATE_MAX) {
+        log.suppressed++;
+        return;
+    }
+
+    log.window_count++;
+
+    log.last.severity = entry->severity;
+    strcpy(log.last.module, entry->module);
+    strcpy(log.last.message, entry->message);
+
+    log_output(entry->module, entry->severity, entry->time, entry->message);
+}
+
+/**
+ * Writes everything in the queue, then the counts of anything that wasn't written.
+ */
+static void
+log_drain() {
+    log_entry_t *entry;
+    uint64_t dropped;
+    char message[96];
+    time_t now;
+
+    while (true) {
+        entry = &log.queue[log.dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+        if (atomic_load_explicit(&entry->sequence, memory_order_acquire) != log.dequeue_pos + 1) {
+            break;
+        }
+
+        log_process_entry(entry);
+
+        //Hand the slot back to the producers for the next trip around the queue.
+        atomic_store_explicit(&entry->sequence, log.dequeue_pos + LOG_QUEUE_SIZE, memory_order_release);
+        log.dequeue_pos++;
+    }
+
+    now = time(NULL);
+
+    //Counts are reported once their second is over, otherwise a flood would still be a line per wake up.
+    if (now != log.window || !log.async) {
+        log_flush_repeats(now);
+
+        if (log.suppressed > 0) {
+            snprintf(message, sizeof(message), "Suppressed %llu messages, more than %d a second were logged", (unsigned long long)log.suppressed, LOG_RATE_MAX);
+            log_output("Log", LOG_SEVERITY_WARN, now, message);
+            log.suppressed = 0;
+        }
+    }
+
+    dropped = atomic_exchange_explicit(&log.dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        snprintf(message, sizeof(message), "Dropped %llu messages, the queue was full", (unsigned long long)dropped);
+        log_output("Log", LOG_SEVERITY_WARN, now, message);
+    }
+
+    if (log.to_stdout) {
+        fflush(stdout);
+    }
+}
+
+static void *
+log_process(void *user_data) {
+    struct timespec wake;
+
+    while (log.async) {
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += 1;
+
+        //Wake up at least once a second to report repeats and suppressed messages.
+        sem_timedwait(&log.ready, &wake);
+        log_drain();
+    }
+
+    //Write anything logged while stopping, along with all of the counts.
+    log_drain();
+
+    return NULL;
+}
+
+/**
+ * Puts a message on the queue without ever waiting. If the queue is full the message is dropped and
+ * counted instead. Any number of threads can do this at once.
+ */
+static void
+log_enqueue(const char *module, log_severity_t severity, const char *fmt, va_list ap) {
+    log_entry_t *entry;
+    size_t pos, sequence;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&log.enqueue_pos, memory_order_relaxed);
+
+    while (true) {
+        entry = &log.queue[pos & (LOG_QUEUE_SIZE - 1)];
+        sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+        diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&log.enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            atomic_fetch_add_explicit(&log.dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else {
+            pos = atomic_load_explicit(&log.enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    entry->severity = severity;
+    entry->time = time(NULL);
+    snprintf(entry->module, sizeof(entry->module), "%s", module);
+    vsnprintf(entry->message, sizeof(entry->message), fmt, ap);
+
+    atomic_store_explicit(&entry->sequence, pos + 1, memory_order_release);
+    sem_post(&log.ready);
+}
+
+bool
+log_start() {
+    int ret;
+
+    log.async = true;
+
+    ret = pthread_create(&log.thread, NULL, log_process, NULL);
+    if (ret != 0) {
+        log.async = false;
+        log_err("Log", "Error starting thread: %s", strerror(ret));
+    }
+
+    return log.async;
+}
+
+void
+log_stop() {
+    if (log.async) {
+        log.async = false;
+        sem_post(&log.ready);
+        pthread_join(log.thread, NULL);
+    }
+}
+
 void
 log_write(const char *module, log_severity_t severity, const char *fmt, ...) {
-    char message[512];
+    char message[LOG_MESSAGE_MAX_LEN + 1];
     va_list ap;
-    time_t now;
-    struct tm tm;
 
     //make sure the logging system is logging to someplace
     if (!log.to_stdout && !log.to_syslog) {
@@ -103,18 +351,14 @@ log_write(const char *module, log_severity_t severity, const char *fmt, ...) {
     }
 
     va_start(ap, fmt);
-    vsnprintf(message, sizeof(message), fmt, ap);
-    va_end(ap);
 
-    if (log.to_stdout) {
-        now = time(NULL);
-        memset(&tm, 0, sizeof(tm));
-        localtime_r(&now, &tm);
-
-        printf("[%02d:%02d:%02d] %c [%s] %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec, log_severity_char(severity), module, message);
+    if (log.async) {
+        log_enqueue(module, severity, fmt, ap);
     }
-
-    if (log.to_syslog) {
-        syslog(log_syslog_severity(severity), "%s", message);
+    else {
+        vsnprintf(message, sizeof(message), fmt, ap);
+        log_output(module, severity, time(NULL), message);
     }
+
+    va_end(ap);
 }
@@ -8,6 +8,12 @@
 
 #include <stdbool.h>
 
+/** The number of messages that can wait to be written. Messages logged while it's full are dropped. Must be a power of two. */
+#define LOG_QUEUE_SIZE 1024
+
+/** The most messages written a second. The rest are counted and reported instead. */
+#define LOG_RATE_MAX 100
+
 /**
  * Convenience macros so the severity is chosen by the macro name.
  */
@@ -36,6 +42,21 @@ void log_init();
  */
 void log_free();
 
+/**
+ * Starts a thread that writes messages, so `log_write()` only formats the message and queues it. It never
+ * waits: when the queue is full, messages are dropped and counted. Repeats of the same message are written
+ * as a count, and no more than `LOG_RATE_MAX` messages are written a second. Until this is called, and
+ * after `log_stop()`, messages are written right away by the calling thread.
+ *
+ * @return `true` on success, otherwise `false`.
+ */
+bool log_start();
+
+/**
+ * Stops the thread started by `log_start()` after it writes every queued message.
+ */
+void log_stop();
+
 /**
  * Sets the minimum logging level.
  *
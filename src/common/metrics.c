@@ -0,0 +1,531 @@
+/**
+ * @file metrics.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "log.h"
+#include "metrics.h"
+
+#define MODULE "Metrics"
+
+/** Cached in place of an ID when there was no room to register it, so it isn't searched for again. */
+#define METRICS_ID_NONE -2
+
+/** The number of linear sub-buckets per power of two, as a number of bits. */
+#define METRICS_SUB_BITS 3
+
+/**
+ * One histogram's data for one thread.
+ */
+typedef struct {
+    _Atomic uint64_t calls;                             //!< The number of times it was timed.
+    _Atomic uint64_t total_ns;                          //!< The sum of all of the durations.
+    _Atomic uint64_t max_ns;                            //!< The longest duration.
+    _Atomic uint64_t stats[METRICS_STAT_MAX];           //!< The stats added while it was running.
+    _Atomic uint64_t buckets[METRICS_BUCKETS];          //!< The number of durations in each bucket.
+} metrics_histogram_t;
+
+/**
+ * Everything one thread records into.
+ */
+typedef struct {
+    metrics_histogram_t histograms[METRICS_HISTOGRAMS_MAX];
+    _Atomic uint64_t counters[METRICS_COUNTERS_MAX];
+    bool in_use;                                        //!< Whether a running thread owns this slot. Protected by `lock`.
+} metrics_slot_t;
+
+/**
+ * The state of the calling thread.
+ */
+typedef struct {
+    metrics_slot_t *slot;                               //!< The slot this thread records into.
+    int stack[METRICS_DEPTH_MAX];                       //!< The histograms of the timers running on this thread.
+    unsigned int depth;                                 //!< The number of timers running on this thread.
+} metrics_thread_t;
+
+typedef struct {
+    const char *histogram_names[METRICS_HISTOGRAMS_MAX];
+    _Atomic int histograms_count;
+    const char *counter_names[METRICS_COUNTERS_MAX];
+    _Atomic int counters_count;
+    metrics_slot_t *slots[METRICS_THREADS_MAX];         //!< Slots owned by threads, kept after the thread exits so nothing is lost.
+    unsigned int slots_count;
+    metrics_slot_t shared;                              //!< The slot used by threads once `slots` is full.
+    pthread_key_t key;                                  //!< Gives a slot back when its thread exits.
+    pthread_mutex_t lock;                               //!< Protects registering names and handing out slots.
+    struct timespec started;                            //!< When the metrics were initialized.
+    char *path;                                         //!< The file the thread writes to.
+    unsigned int interval;                              //!< The seconds between writes.
+    pthread_t thread;                                   //!< The thread.
+    bool running;                                       //!< If the thread is running or not. Protected by `run_lock`.
+    pthread_mutex_t run_lock;
+    pthread_cond_t run_cond;                            //!< Signaled to stop the thread early.
+} metrics_t;
+
+/**
+ * The totals of one histogram across all threads.
+ */
+typedef struct {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t stats[METRICS_STAT_MAX];
+    uint64_t buckets[METRICS_BUCKETS];
+} metrics_totals_t;
+
+static metrics_t metrics;
+static _Thread_local metrics_thread_t metrics_thread;
+
+static void
+metrics_slot_release(void *data) {
+    metrics_slot_t *slot = data;
+
+    pthread_mutex_lock(&metrics.lock);
+    slot->in_use = false;
+    pthread_mutex_unlock(&metrics.lock);
+}
+
+/**
+ * Gets the calling thread's slot, handing it one the first time. A slot left by a thread that exited is
+ * reused before a new one is allocated.
+ */
+static metrics_slot_t *
+metrics_slot() {
+    metrics_slot_t *slot = NULL;
+    unsigned int i;
+
+    if (metrics_thread.slot != NULL) {
+        return metrics_thread.slot;
+    }
+
+    pthread_mutex_lock(&metrics.lock);
+
+    for (i = 0; i < metrics.slots_count; i++) {
+        if (!metrics.slots[i]->in_use) {
+            slot = metrics.slots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL && metrics.slots_count < METRICS_THREADS_MAX) {
+        slot = calloc(1, sizeof(*slot));
+        if (slot != NULL) {
+            metrics.slots[metrics.slots_count++] = slot;
+        }
+    }
+
+    if (slot != NULL) {
+        slot->in_use = true;
+        pthread_setspecific(metrics.key, slot);
+    }
+    else {
+        slot = &metrics.shared;
+    }
+
+    pthread_mutex_unlock(&metrics.lock);
+
+    metrics_thread.slot = slot;
+
+    return slot;
+}
+
+static void
+metrics_add(_Atomic uint64_t *value, uint64_t n) {
+    atomic_fetch_add_explicit(value, n, memory_order_relaxed);
+}
+
+static uint64_t
+metrics_load(_Atomic uint64_t *value) {
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static unsigned int
+metrics_bucket(uint64_t ns) {
+    unsigned int bit, bucket;
+
+    if (ns < (1 << METRICS_SUB_BITS)) {
+        return ns;
+    }
+
+    bit = 63 - __builtin_clzll(ns);
+    bucket = ((bit - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) + ((ns >> (bit - METRICS_SUB_BITS)) & ((1 << METRICS_SUB_BITS) - 1));
+
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+/**
+ * Gets the largest duration that goes into `bucket`.
+ */
+static uint64_t
+metrics_bucket_max(unsigned int bucket) {
+    unsigned int bit, sub;
+
+    if (bucket < (1 << METRICS_SUB_BITS)) {
+        return bucket;
+    }
+
+    bit = (bucket >> METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+    sub = bucket & ((1 << METRICS_SUB_BITS) - 1);
+
+    return ((uint64_t)((1 << METRICS_SUB_BITS) + sub + 1) << (bit - METRICS_SUB_BITS)) - 1;
+}
+
+static int
+metrics_register(_Atomic int *id, const char **names, _Atomic int *count, int max, const char *name) {
+    int cached, i, n;
+
+    cached = atomic_load_explicit(id, memory_order_acquire);
+    if (cached != METRICS_ID_UNSET) {
+        return cached;
+    }
+
+    pthread_mutex_lock(&metrics.lock);
+
+    n = atomic_load_explicit(count, memory_order_relaxed);
+    for (i = 0; i < n; i++) {
+        if (strcmp(names[i], name) == 0) {
+            break;
+        }
+    }
+
+    if (i == n) {
+        if (n < max) {
+            names[n] = name;
+            atomic_store_explicit(count, n + 1, memory_order_release);
+        }
+        else {
+            log_warn(MODULE, "Not recording '%s': Only %d can be registered", name, max);
+            i = METRICS_ID_NONE;
+        }
+    }
+
+    atomic_store_explicit(id, i, memory_order_release);
+
+    pthread_mutex_unlock(&metrics.lock);
+
+    return i;
+}
+
+void
+metrics_init() {
+    memset(&metrics, 0, sizeof(metrics));
+
+    pthread_mutex_init(&metrics.lock, NULL);
+    pthread_mutex_init(&metrics.run_lock, NULL);
+    pthread_cond_init(&metrics.run_cond, NULL);
+    pthread_key_create(&metrics.key, metrics_slot_release);
+    clock_gettime(CLOCK_MONOTONIC, &metrics.started);
+}
+
+void
+metrics_free() {
+    unsigned int i;
+
+    pthread_key_delete(metrics.key);
+
+    for (i = 0; i < metrics.slots_count; i++) {
+        free(metrics.slots[i]);
+    }
+
+    free(metrics.path);
+    pthread_cond_destroy(&metrics.run_cond);
+    pthread_mutex_destroy(&metrics.run_lock);
+    pthread_mutex_destroy(&metrics.lock);
+}
+
+int
+metrics_histogram_id(_Atomic int *id, const char *name) {
+    return metrics_register(id, metrics.histogram_names, &metrics.histograms_count, METRICS_HISTOGRAMS_MAX, name);
+}
+
+int
+metrics_counter_id(_Atomic int *id, const char *name) {
+    return metrics_register(id, metrics.counter_names, &metrics.counters_count, METRICS_COUNTERS_MAX, name);
+}
+
+metrics_timer_t
+metrics_timer_start(_Atomic int *id, const char *name) {
+    metrics_timer_t timer;
+
+    timer.id = metrics_histogram_id(id, name);
+
+    //Timers nested too deep are still timed, they just don't see stats added inside of them.
+    if (metrics_thread.depth < METRICS_DEPTH_MAX) {
+        metrics_thread.stack[metrics_thread.depth] = timer.id;
+    }
+    metrics_thread.depth++;
+
+    clock_gettime(CLOCK_MONOTONIC, &timer.start);
+
+    return timer;
+}
+
+void
+metrics_timer_stop(metrics_timer_t *timer) {
+    metrics_histogram_t *histogram;
+    struct timespec now;
+    uint64_t ns, max;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    metrics_thread.depth--;
+
+    if (timer->id < 0) {
+        return;
+    }
+
+    ns = (now.tv_sec - timer->start.tv_sec) * 1000000000ULL + now.tv_nsec - timer->start.tv_nsec;
+    histogram = &metrics_slot()->histograms[timer->id];
+
+    metrics_add(&histogram->calls, 1);
+    metrics_add(&histogram->total_ns, ns);
+    metrics_add(&histogram->buckets[metrics_bucket(ns)], 1);
+
+    max = metrics_load(&histogram->max_ns);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&histogram->max_ns, &max, ns, memory_order_relaxed, memory_order_relaxed));
+}
+
+void
+metrics_counter_add(int id, uint64_t n) {
+    if (id < 0) {
+        return;
+    }
+
+    metrics_add(&metrics_slot()->counters[id], n);
+}
+
+void
+metrics_stat_add(metrics_stat_t stat, uint64_t n) {
+    metrics_slot_t *slot;
+    unsigned int i, depth;
+
+    depth = metrics_thread.depth < METRICS_DEPTH_MAX ? metrics_thread.depth : METRICS_DEPTH_MAX;
+    if (depth == 0) {
+        return;
+    }
+
+    slot = metrics_slot();
+
+    for (i = 0; i < depth; i++) {
+        if (metrics_thread.stack[i] >= 0) {
+            metrics_add(&slot->histograms[metrics_thread.stack[i]].stats[stat], n);
+        }
+    }
+}
+
+static void
+metrics_totals_add(metrics_totals_t *totals, metrics_histogram_t *histogram) {
+    uint64_t max;
+    unsigned int i;
+
+    totals->calls += metrics_load(&histogram->calls);
+    totals->total_ns += metrics_load(&histogram->total_ns);
+
+    max = metrics_load(&histogram->max_ns);
+    if (max > totals->max_ns) {
+        totals->max_ns = max;
+    }
+
+    for (i = 0; i < METRICS_STAT_MAX; i++) {
+        totals->stats[i] += metrics_load(&histogram->stats[i]);
+    }
+
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        totals->buckets[i] += metrics_load(&histogram->buckets[i]);
+    }
+}
+
+/**
+ * Gets the duration at `percentile` in microseconds. Like HDR histograms, this is the largest duration in
+ * the bucket the percentile falls in, so it over reports by at most one bucket's width.
+ */
+static double
+metrics_percentile(metrics_totals_t *totals, double percentile) {
+    uint64_t rank, seen = 0, ns;
+    unsigned int i;
+
+    rank = (uint64_t)(totals->calls * percentile / 100.0 + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        seen += totals->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    ns = i < METRICS_BUCKETS ? metrics_bucket_max(i) : totals->max_ns;
+    if (ns > totals->max_ns) {
+        ns = totals->max_ns;
+    }
+
+    return ns / 1000.0;
+}
+
+void
+metrics_write(FILE *f, const char *match) {
+    metrics_totals_t *totals;
+    uint64_t counter;
+    struct timespec now;
+    int i, histograms_count, counters_count;
+    unsigned int j;
+
+    totals = calloc(METRICS_HISTOGRAMS_MAX, sizeof(*totals));
+    if (totals == NULL) {
+        log_err(MODULE, "Error writing metrics: Out of memory");
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(f, "# Uptime: %llds\n", (long long)(now.tv_sec - metrics.started.tv_sec));
+
+    pthread_mutex_lock(&metrics.lock);
+
+    histograms_count = metrics.histograms_count;
+    counters_count = metrics.counters_count;
+
+    fprintf(f, "# Counters\n");
+
+    for (i = 0; i < counters_count; i++) {
+        if (match != NULL && strstr(metrics.counter_names[i], match) == NULL) {
+            continue;
+        }
+
+        counter = metrics_load(&metrics.shared.counters[i]);
+        for (j = 0; j < metrics.slots_count; j++) {
+            counter += metrics_load(&metrics.slots[j]->counters[i]);
+        }
+
+        fprintf(f, "%-32s %llu\n", metrics.counter_names[i], (unsigned long long)counter);
+    }
+
+    for (i = 0; i < histograms_count; i++) {
+        metrics_totals_add(&totals[i], &metrics.shared.histograms[i]);
+        for (j = 0; j < metrics.slots_count; j++) {
+            metrics_totals_add(&totals[i], &metrics.slots[j]->histograms[i]);
+        }
+    }
+
+    fprintf(f, "# Timings in microseconds\n");
+    fprintf(f, "%-32s %10s %10s %10s %10s %10s %10s %10s %10s %12s\n", "name", "calls", "avg", "p50", "p90", "p99", "max", "queries", "rows", "bytes");
+
+    for (i = 0; i < histograms_count; i++) {
+        if (totals[i].calls == 0 || (match != NULL && strstr(metrics.histogram_names[i], match) == NULL)) {
+            continue;
+        }
+
+        fprintf(f, "%-32s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10llu %10llu %12llu\n",
+                metrics.histogram_names[i],
+                (unsigned long long)totals[i].calls,
+                totals[i].total_ns / 1000.0 / totals[i].calls,
+                metrics_percentile(&totals[i], 50),
+                metrics_percentile(&totals[i], 90),
+                metrics_percentile(&totals[i], 99),
+                totals[i].max_ns / 1000.0,
+                (unsigned long long)totals[i].stats[METRICS_STAT_QUERIES],
+                (unsigned long long)totals[i].stats[METRICS_STAT_ROWS],
+                (unsigned long long)totals[i].stats[METRICS_STAT_BYTES]);
+    }
+
+    pthread_mutex_unlock(&metrics.lock);
+
+    free(totals);
+}
+
+/**
+ * Writes the metrics to a temporary file and renames it over the metrics file.
+ */
+static void
+metrics_write_file() {
+    char path[4096];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s.tmp", metrics.path);
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        log_err(MODULE, "Error opening '%s': %s", path, strerror(errno));
+        return;
+    }
+
+    metrics_write(f, NULL);
+
+    if (fclose(f) != 0) {
+        log_err(MODULE, "Error writing '%s': %s", path, strerror(errno));
+        return;
+    }
+
+    if (rename(path, metrics.path) != 0) {
+        log_err(MODULE, "Error renaming '%s' to '%s': %s", path, metrics.path, strerror(errno));
+    }
+}
+
+static void *
+metrics_process(void *user_data) {
+    struct timespec wake;
+
+    pthread_mutex_lock(&metrics.run_lock);
+
+    while (metrics.running) {
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += metrics.interval;
+
+        while (metrics.running && pthread_cond_timedwait(&metrics.run_cond, &metrics.run_lock, &wake) != ETIMEDOUT);
+
+        metrics_write_file();
+    }
+
+    pthread_mutex_unlock(&metrics.run_lock);
+
+    return NULL;
+}
+
+bool
+metrics_start(const char *path, unsigned int interval) {
+    int ret;
+
+    if (path == NULL || path[0] == '\0') {
+        return true;
+    }
+
+    metrics.path = strdup(path);
+    if (metrics.path == NULL) {
+        log_err(MODULE, "Error starting: Out of memory");
+        return false;
+    }
+
+    metrics.interval = interval > 0 ? interval : 1;
+
+    log_info(MODULE, "Writing metrics to '%s' every %u seconds", metrics.path, metrics.interval);
+
+    metrics.running = true;
+    ret = pthread_create(&metrics.thread, NULL, metrics_process, NULL);
+    if (ret != 0) {
+        metrics.running = false;
+        log_err(MODULE, "Error starting thread: %s", strerror(ret));
+    }
+
+    return metrics.running;
+}
+
+void
+metrics_stop() {
+    bool running;
+
+    pthread_mutex_lock(&metrics.run_lock);
+    running = metrics.running;
+    metrics.running = false;
+    pthread_cond_signal(&metrics.run_cond);
+    pthread_mutex_unlock(&metrics.run_lock);
+
+    if (running) {
+        pthread_join(metrics.thread, NULL);
+    }
+}
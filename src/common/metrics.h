@@ -0,0 +1,159 @@
+#pragma once
+
+/**
+ * @file metrics.h
+ *
+ * A metrics module. It keeps named counters and latency histograms in memory and can periodically write
+ * them to a text file.
+ *
+ * Every thread records into its own slot, so recording never takes a lock or shares a cache line with
+ * another thread. Slots are summed together when the metrics are written.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/** The maximum number of distinct histograms. Timers past this are ignored. */
+#define METRICS_HISTOGRAMS_MAX 64
+
+/** The maximum number of distinct counters. Counters past this are ignored. */
+#define METRICS_COUNTERS_MAX 32
+
+/** The maximum number of threads with their own slot. Threads past this share one slot. */
+#define METRICS_THREADS_MAX 32
+
+/** The maximum number of timers that can be nested on one thread and still see the stats added inside of them. */
+#define METRICS_DEPTH_MAX 8
+
+/**
+ * The number of histogram buckets. Durations are bucketed in nanoseconds by their highest set bit, and
+ * then linearly into 8 sub-buckets, so a bucket's range is within 12.5% of its value. This covers up to
+ * 2^36 nanoseconds (about 68 seconds); anything longer goes in the last bucket.
+ */
+#define METRICS_BUCKETS 272
+
+/** The ID of a histogram or counter that hasn't been registered yet. */
+#define METRICS_ID_UNSET -1
+
+/**
+ * Times the rest of the enclosing function, from where this is placed until it returns, into a histogram
+ * named after the function.
+ */
+#define METRICS_SCOPE()                                                                                  \
+    static _Atomic int metrics_scope_id_ = METRICS_ID_UNSET;                                            \
+    metrics_timer_t metrics_scope_ __attribute__((cleanup(metrics_timer_stop))) = metrics_timer_start(&metrics_scope_id_, __func__)
+
+/**
+ * Adds `n` to the counter `name`.
+ */
+#define METRICS_COUNT(name, n)                                                                           \
+    do {                                                                                                 \
+        static _Atomic int metrics_count_id_ = METRICS_ID_UNSET;                                        \
+        metrics_counter_add(metrics_counter_id(&metrics_count_id_, name), n);                           \
+    } while (0)
+
+/**
+ * Stats that are added to every timer running on the calling thread. This is how a database query made
+ * by `myfs_db_file_read()` is counted towards both it and the `myfs_read()` that called it.
+ */
+typedef enum {
+    METRICS_STAT_QUERIES,           //!< Queries sent to the database.
+    METRICS_STAT_ROWS,              //!< Rows returned or changed by those queries.
+    METRICS_STAT_BYTES,             //!< File data bytes read or written.
+    METRICS_STAT_MAX                //!< The number of stats.
+} metrics_stat_t;
+
+/**
+ * A running timer, from `metrics_timer_start()`.
+ */
+typedef struct {
+    int id;                         //!< The histogram to record into, or `METRICS_ID_UNSET`.
+    struct timespec start;          //!< When the timer started.
+} metrics_timer_t;
+
+/**
+ * Initializes the metrics system. This must be called before any other metrics functions are called.
+ */
+void metrics_init();
+
+/**
+ * Frees the metrics system. No more metrics functions can be called after this.
+ */
+void metrics_free();
+
+/**
+ * Starts a thread that writes the metrics to `path` every `interval` seconds. The file is written to a
+ * temporary file first and renamed over `path`, so readers never see a partial file.
+ *
+ * @param[in] path The file to write to. If `NULL` or empty, nothing is started.
+ * @param[in] interval The number of seconds between writes.
+ * @return `true` on success, otherwise `false`.
+ */
+bool metrics_start(const char *path, unsigned int interval);
+
+/**
+ * Stops the thread started by `metrics_start()`, writing the metrics one last time.
+ */
+void metrics_stop();
+
+/**
+ * Gets the ID of the histogram `name`, registering it the first time. The ID is cached in `id` so later
+ * calls don't search by name.
+ *
+ * @param[in,out] id Where the ID is cached. This should start as `METRICS_ID_UNSET`.
+ * @param[in] name The histogram's name. This must stay valid for as long as the program runs.
+ * @return The ID, or `METRICS_ID_UNSET` if there's no room left.
+ */
+int metrics_histogram_id(_Atomic int *id, const char *name);
+
+/**
+ * Gets the ID of the counter `name`, registering it the first time. See `metrics_histogram_id()`.
+ *
+ * @param[in,out] id Where the ID is cached. This should start as `METRICS_ID_UNSET`.
+ * @param[in] name The counter's name. This must stay valid for as long as the program runs.
+ * @return The ID, or `METRICS_ID_UNSET` if there's no room left.
+ */
+int metrics_counter_id(_Atomic int *id, const char *name);
+
+/**
+ * Starts timing into the histogram `name`. Use `METRICS_SCOPE()` rather than calling this directly.
+ *
+ * @param[in,out] id Where the histogram's ID is cached.
+ * @param[in] name The histogram's name.
+ * @return The running timer.
+ */
+metrics_timer_t metrics_timer_start(_Atomic int *id, const char *name);
+
+/**
+ * Stops a timer and records how long it ran. Timers must be stopped in the reverse order they were
+ * started on a thread.
+ *
+ * @param[in] timer The timer from `metrics_timer_start()`.
+ */
+void metrics_timer_stop(metrics_timer_t *timer);
+
+/**
+ * Adds `n` to a counter.
+ *
+ * @param[in] id The counter's ID from `metrics_counter_id()`.
+ * @param[in] n The amount to add.
+ */
+void metrics_counter_add(int id, uint64_t n);
+
+/**
+ * Adds `n` to a stat for every timer currently running on the calling thread.
+ *
+ * @param[in] stat The stat to add to.
+ * @param[in] n The amount to add.
+ */
+void metrics_stat_add(metrics_stat_t stat, uint64_t n);
+
+/**
+ * Writes the current metrics as text.
+ *
+ * @param[in] f The file to write to.
+ * @param[in] match Only metrics whose names contain this are written. If `NULL`, all of them are written.
+ */
+void metrics_write(FILE *f, const char *match);
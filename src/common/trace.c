@@ -0,0 +1,493 @@
+/**
+ * @file trace.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "log.h"
+#include "trace.h"
+
+#define MODULE "Trace"
+
+/** Identifies a trace dump and its format. */
+#define TRACE_MAGIC "MYFSTRC1"
+
+/** Cached in place of an ID when there was no room to register it, so it isn't searched for again. */
+#define TRACE_ID_NONE (TRACE_OPS_MAX)
+
+/**
+ * The header of a trace dump. It's followed by `ops_count` names of `TRACE_OP_NAME_MAX_LEN + 1` bytes and
+ * then `records_count` records.
+ */
+typedef struct {
+    char magic[8];                      //!< `TRACE_MAGIC`.
+    uint32_t ops_count;                 //!< The number of operation names.
+    uint32_t records_count;             //!< The number of records.
+    int64_t realtime_offset_ns;         //!< Added to a record's CLOCK_MONOTONIC start to get the wall clock time.
+} trace_header_t;
+
+typedef char trace_name_t[TRACE_OP_NAME_MAX_LEN + 1];
+
+/**
+ * One thread's records.
+ */
+typedef struct {
+    _Atomic uint64_t head;                              //!< The number of records ever made. The next one goes at `head % TRACE_RECORDS`.
+    uint16_t thread;                                    //!< This ring's number.
+    bool in_use;                                        //!< Whether a running thread owns this ring. Protected by `lock`.
+    trace_record_t records[TRACE_RECORDS];
+} trace_ring_t;
+
+typedef struct {
+    const char *names[TRACE_OPS_MAX];
+    _Atomic int ops_count;
+    trace_ring_t *rings[TRACE_THREADS_MAX];             //!< Rings owned by threads, kept after the thread exits.
+    unsigned int rings_count;
+    trace_ring_t shared;                                //!< The ring used by threads once `rings` is full.
+    pthread_key_t key;                                  //!< Gives a ring back when its thread exits.
+    pthread_mutex_t lock;                               //!< Protects registering names and handing out rings.
+    char *path;                                         //!< The file SIGUSR2 dumps to.
+    pthread_t thread;                                   //!< The thread waiting for SIGUSR2.
+    _Atomic bool running;                               //!< If the thread is running or not.
+} trace_t;
+
+static trace_t trace;
+static _Thread_local trace_ring_t *trace_thread_ring;
+
+static void
+trace_ring_release(void *data) {
+    trace_ring_t *ring = data;
+
+    pthread_mutex_lock(&trace.lock);
+    ring->in_use = false;
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/**
+ * Gets the calling thread's ring, handing it one the first time.
+ */
+static trace_ring_t *
+trace_ring() {
+    trace_ring_t *ring = NULL;
+    unsigned int i;
+
+    if (trace_thread_ring != NULL) {
+        return trace_thread_ring;
+    }
+
+    pthread_mutex_lock(&trace.lock);
+
+    for (i = 0; i < trace.rings_count; i++) {
+        if (!trace.rings[i]->in_use) {
+            ring = trace.rings[i];
+            break;
+        }
+    }
+
+    if (ring == NULL && trace.rings_count < TRACE_THREADS_MAX) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring != NULL) {
+            ring->thread = trace.rings_count + 1;
+            trace.rings[trace.rings_count++] = ring;
+        }
+    }
+
+    if (ring != NULL) {
+        ring->in_use = true;
+        pthread_setspecific(trace.key, ring);
+    }
+    else {
+        ring = &trace.shared;
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+
+    trace_thread_ring = ring;
+
+    return ring;
+}
+
+static int
+trace_register(_Atomic int *id, const char *name) {
+    int cached, i, n;
+
+    cached = atomic_load_explicit(id, memory_order_acquire);
+    if (cached != TRACE_ID_UNSET) {
+        return cached;
+    }
+
+    pthread_mutex_lock(&trace.lock);
+
+    n = atomic_load_explicit(&trace.ops_count, memory_order_relaxed);
+    for (i = 0; i < n; i++) {
+        if (strcmp(trace.names[i], name) == 0) {
+            break;
+        }
+    }
+
+    if (i == n) {
+        if (n < TRACE_OPS_MAX) {
+            trace.names[n] = name;
+            atomic_store_explicit(&trace.ops_count, n + 1, memory_order_release);
+        }
+        else {
+            log_warn(MODULE, "Recording '%s' without a name: Only %d operations can be registered", name, TRACE_OPS_MAX);
+            i = TRACE_ID_NONE;
+        }
+    }
+
+    atomic_store_explicit(id, i, memory_order_release);
+
+    pthread_mutex_unlock(&trace.lock);
+
+    return i;
+}
+
+static uint64_t
+trace_ns(struct timespec *ts) {
+    return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+/**
+ * Gets how far CLOCK_REALTIME is ahead of CLOCK_MONOTONIC so records can be shown with wall clock times.
+ */
+static int64_t
+trace_realtime_offset() {
+    struct timespec realtime, monotonic;
+
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+    return (int64_t)trace_ns(&realtime) - (int64_t)trace_ns(&monotonic);
+}
+
+static int
+trace_record_compare(const void *a, const void *b) {
+    const trace_record_t *record1 = a, *record2 = b;
+
+    if (record1->start_ns < record2->start_ns) {
+        return -1;
+    }
+
+    return record1->start_ns > record2->start_ns;
+}
+
+/**
+ * Copies a ring's records, oldest first. Records being written while they're copied can come out
+ * half written; that's the price of never locking while recording.
+ */
+static unsigned int
+trace_ring_copy(trace_ring_t *ring, trace_record_t *dst) {
+    uint64_t head, count, i;
+
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+
+    for (i = 0; i < count; i++) {
+        dst[i] = ring->records[(head - count + i) & (TRACE_RECORDS - 1)];
+    }
+
+    return count;
+}
+
+/**
+ * Copies every ring's records and the operation names, sorted oldest first.
+ */
+static trace_record_t *
+trace_collect(trace_name_t *names, uint32_t *ops_count, uint32_t *records_count) {
+    trace_record_t *records;
+    unsigned int i, count;
+
+    pthread_mutex_lock(&trace.lock);
+
+    records = malloc((trace.rings_count + 1) * TRACE_RECORDS * sizeof(*records));
+    if (records == NULL) {
+        pthread_mutex_unlock(&trace.lock);
+        return NULL;
+    }
+
+    count = trace_ring_copy(&trace.shared, records);
+    for (i = 0; i < trace.rings_count; i++) {
+        count += trace_ring_copy(trace.rings[i], records + count);
+    }
+
+    *ops_count = trace.ops_count;
+    for (i = 0; i < *ops_count; i++) {
+        snprintf(names[i], sizeof(names[i]), "%s", trace.names[i]);
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+
+    qsort(records, count, sizeof(*records), trace_record_compare);
+    *records_count = count;
+
+    return records;
+}
+
+static void
+trace_print(FILE *f, trace_name_t *names, uint32_t ops_count, trace_record_t *records, uint32_t records_count, int64_t realtime_offset_ns) {
+    char timestamp[32];
+    uint64_t ns;
+    time_t seconds;
+    struct tm tm;
+    uint32_t i;
+
+    fprintf(f, "%-26s %-4s %-32s %10s %14s %10s %12s\n", "time", "thr", "op", "file_id", "offset", "size", "duration_us");
+
+    for (i = 0; i < records_count; i++) {
+        ns = records[i].start_ns + realtime_offset_ns;
+        seconds = ns / 1000000000ULL;
+        localtime_r(&seconds, &tm);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+        fprintf(f, "%s.%06llu %-4u %-32s %10u %14lld %10llu %12.1f\n",
+                timestamp,
+                (unsigned long long)(ns % 1000000000ULL / 1000),
+                records[i].thread,
+                records[i].op < ops_count ? names[records[i].op] : "?",
+                records[i].file_id,
+                (long long)records[i].offset,
+                (unsigned long long)records[i].size,
+                records[i].duration_ns / 1000.0);
+    }
+}
+
+static void *
+trace_process(void *user_data) {
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+
+    while (true) {
+        if (sigwait(&set, &sig) != 0) {
+            continue;
+        }
+
+        //trace_stop() sends SIGUSR2 too, to wake this up.
+        if (!trace.running) {
+            break;
+        }
+
+        log_info(MODULE, "Dumping to '%s'", trace.path);
+        trace_dump(trace.path);
+    }
+
+    return NULL;
+}
+
+void
+trace_init() {
+    memset(&trace, 0, sizeof(trace));
+
+    pthread_mutex_init(&trace.lock, NULL);
+    pthread_key_create(&trace.key, trace_ring_release);
+}
+
+void
+trace_free() {
+    unsigned int i;
+
+    pthread_key_delete(trace.key);
+
+    for (i = 0; i < trace.rings_count; i++) {
+        free(trace.rings[i]);
+    }
+
+    free(trace.path);
+    pthread_mutex_destroy(&trace.lock);
+}
+
+bool
+trace_start(const char *path) {
+    sigset_t set;
+    int ret;
+
+    if (path == NULL || path[0] == '\0') {
+        return true;
+    }
+
+    trace.path = strdup(path);
+    if (trace.path == NULL) {
+        log_err(MODULE, "Error starting: Out of memory");
+        return false;
+    }
+
+    //Threads started after this inherit the blocked signal, so only the dump thread receives it.
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    log_info(MODULE, "Send SIGUSR2 to dump the trace to '%s'", trace.path);
+
+    trace.running = true;
+    ret = pthread_create(&trace.thread, NULL, trace_process, NULL);
+    if (ret != 0) {
+        trace.running = false;
+        log_err(MODULE, "Error starting thread: %s", strerror(ret));
+    }
+
+    return trace.running;
+}
+
+void
+trace_stop() {
+    if (trace.running) {
+        trace.running = false;
+        pthread_kill(trace.thread, SIGUSR2);
+        pthread_join(trace.thread, NULL);
+    }
+}
+
+trace_span_t
+trace_span_begin(_Atomic int *id, const char *name, unsigned int file_id, int64_t offset, uint64_t size) {
+    trace_span_t span;
+
+    span.op = trace_register(id, name);
+    span.file_id = file_id;
+    span.offset = offset;
+    span.size = size;
+    clock_gettime(CLOCK_MONOTONIC, &span.start);
+
+    return span;
+}
+
+void
+trace_span_end(trace_span_t *span) {
+    trace_record_t *record;
+    trace_ring_t *ring;
+    struct timespec now;
+    uint64_t head;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    ring = trace_ring();
+
+    //Only the shared ring has more than one writer, but the add is uncontended on every other ring.
+    head = atomic_fetch_add_explicit(&ring->head, 1, memory_order_acq_rel);
+    record = &ring->records[head & (TRACE_RECORDS - 1)];
+
+    record->start_ns = trace_ns(&span->start);
+    record->duration_ns = trace_ns(&now) - record->start_ns;
+    record->offset = span->offset;
+    record->size = span->size;
+    record->file_id = span->file_id;
+    record->op = span->op;
+    record->thread = ring->thread;
+}
+
+bool
+trace_dump(const char *path) {
+    trace_name_t names[TRACE_OPS_MAX];
+    trace_record_t *records;
+    trace_header_t header;
+    bool success = false;
+    FILE *f = NULL;
+    int fd;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.realtime_offset_ns = trace_realtime_offset();
+
+    records = trace_collect(names, &header.ops_count, &header.records_count);
+    if (records == NULL) {
+        log_err(MODULE, "Error dumping to '%s': Out of memory", path);
+        return false;
+    }
+
+    //Don't follow a link someone else left at the path, or let anyone else read the dump.
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd != -1) {
+        f = fdopen(fd, "w");
+        if (f == NULL) {
+            close(fd);
+        }
+    }
+    if (f == NULL) {
+        log_err(MODULE, "Error dumping to '%s': %s", path, strerror(errno));
+        goto done;
+    }
+
+    success = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(names, sizeof(names[0]), header.ops_count, f) == header.ops_count &&
+              fwrite(records, sizeof(*records), header.records_count, f) == header.records_count;
+
+    if (fclose(f) != 0) {
+        success = false;
+    }
+
+    if (!success) {
+        log_err(MODULE, "Error dumping to '%s': %s", path, strerror(errno));
+    }
+
+done:
+    free(records);
+
+    return success;
+}
+
+void
+trace_write(FILE *f) {
+    trace_name_t names[TRACE_OPS_MAX];
+    trace_record_t *records;
+    uint32_t ops_count, records_count;
+
+    records = trace_collect(names, &ops_count, &records_count);
+    if (records == NULL) {
+        log_err(MODULE, "Error writing trace: Out of memory");
+        return;
+    }
+
+    trace_print(f, names, ops_count, records, records_count, trace_realtime_offset());
+    free(records);
+}
+
+bool
+trace_decode(const char *path, FILE *f) {
+    trace_name_t names[TRACE_OPS_MAX];
+    trace_record_t *records = NULL;
+    trace_header_t header;
+    bool success = false;
+    FILE *in;
+
+    in = fopen(path, "r");
+    if (in == NULL) {
+        log_err(MODULE, "Error decoding '%s': %s", path, strerror(errno));
+        return false;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.ops_count > TRACE_OPS_MAX) {
+        log_err(MODULE, "Error decoding '%s': Not a trace dump", path);
+        goto done;
+    }
+
+    records = malloc(header.records_count * sizeof(*records));
+    if (records == NULL && header.records_count > 0) {
+        log_err(MODULE, "Error decoding '%s': Out of memory", path);
+        goto done;
+    }
+
+    if (fread(names, sizeof(names[0]), header.ops_count, in) != header.ops_count ||
+        fread(records, sizeof(*records), header.records_count, in) != header.records_count) {
+        log_err(MODULE, "Error decoding '%s': The file is truncated", path);
+        goto done;
+    }
+
+    trace_print(f, names, header.ops_count, records, header.records_count, header.realtime_offset_ns);
+    success = true;
+
+done:
+    free(records);
+    fclose(in);
+
+    return success;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+/**
+ * @file trace.h
+ *
+ * A trace module. Each thread records fixed size binary records into its own ring buffer, so tracing can
+ * be left on: recording one is two clock reads and a copy, with no locks, formatting or I/O. The newest
+ * `TRACE_RECORDS` records of every thread are kept.
+ *
+ * The rings are dumped to a file on SIGUSR2 or by `trace_dump()`, and decoded into text by `trace_decode()`.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/** The number of records kept per thread. Must be a power of two. */
+#define TRACE_RECORDS 4096
+
+/** The maximum number of threads with their own ring. Threads past this share one ring. */
+#define TRACE_THREADS_MAX 32
+
+/** The maximum number of distinct operations. Operations past this are recorded without a name. */
+#define TRACE_OPS_MAX 64
+
+/** The longest operation name kept in a dump. */
+#define TRACE_OP_NAME_MAX_LEN 47
+
+/** The ID of an operation that hasn't been registered yet. */
+#define TRACE_ID_UNSET -1
+
+/**
+ * Records the rest of the enclosing function, from where this is placed until it returns, as one trace
+ * record named after the function.
+ */
+#define TRACE_SCOPE(file_id, offset, size)                                                               \
+    static _Atomic int trace_scope_id_ = TRACE_ID_UNSET;                                                \
+    trace_span_t trace_scope_ __attribute__((cleanup(trace_span_end))) = trace_span_begin(&trace_scope_id_, __func__, file_id, offset, size)
+
+/**
+ * A trace record.
+ */
+typedef struct {
+    uint64_t start_ns;              //!< When the operation started, in CLOCK_MONOTONIC nanoseconds.
+    uint64_t duration_ns;           //!< How long the operation took.
+    int64_t offset;                 //!< The file offset, if the operation has one.
+    uint64_t size;                  //!< The size of the data, if the operation has any.
+    uint32_t file_id;               //!< The File ID, or 0 if it's not known.
+    uint16_t op;                    //!< The operation's ID.
+    uint16_t thread;                //!< The ring the record was made on.
+} trace_record_t;
+
+/**
+ * A running operation, from `trace_span_begin()`.
+ */
+typedef struct {
+    int op;                         //!< The operation's ID.
+    unsigned int file_id;           //!< The File ID.
+    int64_t offset;                 //!< The file offset.
+    uint64_t size;                  //!< The size of the data.
+    struct timespec start;          //!< When the operation started.
+} trace_span_t;
+
+/**
+ * Initializes the trace system. This must be called before any other trace functions are called.
+ */
+void trace_init();
+
+/**
+ * Frees the trace system. No more trace functions can be called after this.
+ */
+void trace_free();
+
+/**
+ * Starts a thread that dumps the trace to `path` whenever the process gets SIGUSR2. This blocks SIGUSR2 in
+ * the calling thread, so it must be called before any other threads are started for them to inherit it.
+ *
+ * @param[in] path The file to dump to. If `NULL` or empty, nothing is started.
+ * @return `true` on success, otherwise `false`.
+ */
+bool trace_start(const char *path);
+
+/**
+ * Stops the thread started by `trace_start()`.
+ */
+void trace_stop();
+
+/**
+ * Starts recording an operation. Use `TRACE_SCOPE()` rather than calling this directly.
+ *
+ * @param[in,out] id Where the operation's ID is cached. This should start as `TRACE_ID_UNSET`.
+ * @param[in] name The operation's name. This must stay valid for as long as the program runs.
+ * @param[in] file_id The File ID, or 0 if it's not known.
+ * @param[in] offset The file offset.
+ * @param[in] size The size of the data.
+ * @return The running operation.
+ */
+trace_span_t trace_span_begin(_Atomic int *id, const char *name, unsigned int file_id, int64_t offset, uint64_t size);
+
+/**
+ * Stops recording an operation and writes its record.
+ *
+ * @param[in] span The operation from `trace_span_begin()`.
+ */
+void trace_span_end(trace_span_t *span);
+
+/**
+ * Dumps every thread's records to a binary file. The file is only readable by its owner, and a symbolic
+ * link at `path` is refused rather than followed.
+ *
+ * @param[in] path The file to write.
+ * @return `true` on success, otherwise `false`.
+ */
+bool trace_dump(const char *path);
+
+/**
+ * Writes every thread's records as text, oldest first.
+ *
+ * @param[in] f The file to write to.
+ */
+void trace_write(FILE *f);
+
+/**
+ * Decodes a file written by `trace_dump()` into text, oldest record first.
+ *
+ * @param[in] path The file to decode.
+ * @param[in] f The file to write the text to.
+ * @return `true` on success, otherwise `false`.
+ */
+bool trace_decode(const char *path, FILE *f);
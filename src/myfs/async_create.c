@@ -0,0 +1,387 @@
+/**
+ * @file async_create.c
+ *
+ * Pending creates are kept in the order they were made, so a directory is always inserted before the files
+ * in it, and hashed by File ID and by name for lookups. The lock is held for a whole flush, so a lookup
+ * never misses a file that's between the table and MariaDB.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../common/log.h"
+#include "../common/config.h"
+#include "../common/string.h"
+#include "../common/db.h"
+#include "util.h"
+#include "myfs_db.h"
+#include "async_create.h"
+
+#define MODULE "Async Create"
+
+/** The most creates kept pending. Adding another flushes them first. */
+#define ASYNC_CREATE_MAX 10000
+
+/** The number of hash buckets for each of the File ID and name lookups. */
+#define ASYNC_CREATE_BUCKETS 4096
+
+typedef struct {
+    myfs_t *myfs;                                               //!< The MyFS context, or `NULL` if async creates are off.
+    db_t db;                                                    //!< The database connection. Only used with the lock held.
+    pthread_t thread;                                           //!< The thread.
+    _Atomic bool running;                                       //!< If the thread is running or not.
+    unsigned int flush_ms;                                      //!< The number of milliseconds between flushes.
+    pthread_mutex_t lock;                                       //!< Protects everything below.
+    async_create_file_t **files;                                //!< The pending creates, oldest first.
+    _Atomic unsigned int count;                                 //!< The number of pending creates. Read without the lock to skip empty flushes.
+    async_create_file_t *by_id[ASYNC_CREATE_BUCKETS];           //!< The pending creates hashed by File ID.
+    async_create_file_t *by_name[ASYNC_CREATE_BUCKETS];         //!< The pending creates hashed by parent and name.
+    _Atomic uint64_t created;                                   //!< Creates made pending.
+    _Atomic uint64_t inserted;                                  //!< Pending creates inserted into MariaDB.
+    _Atomic uint64_t dropped;                                   //!< Pending creates dropped because they couldn't be inserted.
+    _Atomic uint64_t flushes;                                   //!< Batches sent to MariaDB.
+} async_create_t;
+
+static async_create_t async_create;
+
+/**
+ * Hashes a File ID into a bucket.
+ */
+static unsigned int
+async_create_hash_id(unsigned int file_id) {
+    return (file_id * 2654435761u) % ASYNC_CREATE_BUCKETS;
+}
+
+/**
+ * Hashes a parent's File ID and a name into a bucket with FNV-1a.
+ */
+static unsigned int
+async_create_hash_name(unsigned int parent_id, const char *name) {
+    unsigned int hash = 2166136261u ^ parent_id;
+
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+
+    return hash % ASYNC_CREATE_BUCKETS;
+}
+
+/**
+ * Adds a pending create to both lookups. The lock must be held.
+ */
+static void
+async_create_hash(async_create_file_t *file) {
+    unsigned int bucket;
+
+    bucket = async_create_hash_id(file->file_id);
+    file->next_id = async_create.by_id[bucket];
+    async_create.by_id[bucket] = file;
+
+    bucket = async_create_hash_name(file->parent_id, file->name);
+    file->next_name = async_create.by_name[bucket];
+    async_create.by_name[bucket] = file;
+}
+
+/**
+ * Inserts the pending creates into MariaDB. The files that were inserted, or that could never be, are
+ * removed. Files that are left are tried again on the next flush. The lock must be held.
+ *
+ * @return `true` if nothing is left pending, otherwise `false`.
+ */
+static bool
+async_create_flush_locked() {
+    unsigned int i, count, done = 0, dropped = 0;
+    bool success;
+
+    count = async_create.count;
+    if (count == 0 || async_create.myfs == NULL) {
+        return count == 0;
+    }
+
+    success = myfs_db_file_create_batch(&async_create.db, async_create.myfs, async_create.files, count, &done, &dropped);
+
+    async_create.flushes++;
+    async_create.inserted += done - dropped;
+    async_create.dropped += dropped;
+
+    if (!success) {
+        log_err(MODULE, "Error inserting %u pending creates: Trying again on the next flush", count - done);
+    }
+
+    if (done == 0) {
+        return false;
+    }
+
+    for (i = 0; i < done; i++) {
+        free(async_create.files[i]);
+    }
+    memmove(async_create.files, async_create.files + done, (count - done) * sizeof(async_create_file_t *));
+    async_create.count = count - done;
+
+    //Rehash what's left. It's usually nothing.
+    memset(async_create.by_id, 0, sizeof(async_create.by_id));
+    memset(async_create.by_name, 0, sizeof(async_create.by_name));
+    for (i = 0; i < async_create.count; i++) {
+        async_create_hash(async_create.files[i]);
+    }
+
+    return async_create.count == 0;
+}
+
+/**
+ * The thread that inserts the pending creates.
+ */
+static void *
+async_create_process(void *data) {
+    log_info(MODULE, "Started");
+
+    while (async_create.running) {
+        util_sleep_ms(async_create.flush_ms);
+
+        async_create_flush();
+    }
+
+    log_info(MODULE, "Stopped");
+
+    return NULL;
+}
+
+void
+async_create_init() {
+    memset(&async_create, 0, sizeof(async_create));
+
+    db_init(&async_create.db);
+    pthread_mutex_init(&async_create.lock, NULL);
+}
+
+void
+async_create_free() {
+    unsigned int i;
+
+    for (i = 0; i < async_create.count; i++) {
+        free(async_create.files[i]);
+    }
+    free(async_create.files);
+
+    db_free(&async_create.db);
+    pthread_mutex_destroy(&async_create.lock);
+}
+
+bool
+async_create_start(myfs_t *myfs, unsigned int flush_ms) {
+    bool success;
+    int ret;
+
+    log_info(MODULE, "Starting");
+
+    //Flushes run a transaction, so they can't share FUSE's connection. They're made by whichever thread
+    //finds the table full or needs it empty, so the lock guards the connection too.
+    success = db_connect(&async_create.db, config_get("mariadb_host"), config_get("mariadb_user"), config_get("mariadb_password"), config_get("mariadb_database"), config_get_uint("mariadb_port"));
+    if (!success) {
+        log_err(MODULE, "Error connecting to MariaDB: %s", db_error(&async_create.db));
+        return false;
+    }
+
+    //Only log slow queries. Its statements aren't summarized along with MyFS's own.
+    db_set_profile_options(&async_create.db, config_get_uint("slow_query_ms"), 0, 0);
+
+    async_create.flush_ms = flush_ms;
+    async_create.files = malloc(ASYNC_CREATE_MAX * sizeof(async_create_file_t *));
+    if (async_create.files == NULL) {
+        log_err(MODULE, "Error starting: Out of memory");
+        db_disconnect(&async_create.db);
+        return false;
+    }
+
+    async_create.myfs = myfs;
+
+    //Start the thread.
+    async_create.running = true;
+    ret = pthread_create(&async_create.thread, NULL, async_create_process, NULL);
+    if (ret != 0) {
+        async_create.running = false;
+        async_create.myfs = NULL;
+        log_err(MODULE, "Error starting thread: %s", strerror(ret));
+    }
+
+    return async_create.running;
+}
+
+void
+async_create_stop() {
+    bool success;
+
+    if (async_create.running) {
+        async_create.running = false;
+        log_info(MODULE, "Stopping");
+
+        pthread_join(async_create.thread, NULL);
+    }
+
+    pthread_mutex_lock(&async_create.lock);
+    if (async_create.myfs != NULL) {
+        success = async_create_flush_locked();
+        if (!success) {
+            log_err(MODULE, "Error inserting pending creates: %u files were lost", async_create.count);
+        }
+        async_create.myfs = NULL;
+    }
+    pthread_mutex_unlock(&async_create.lock);
+
+    db_disconnect(&async_create.db);
+}
+
+bool
+async_create_add(unsigned int file_id, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode) {
+    async_create_file_t *file;
+    bool success = false;
+
+    pthread_mutex_lock(&async_create.lock);
+
+    if (async_create.myfs == NULL) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Not started", name, parent_id);
+        goto done;
+    }
+
+    //Another create of the same name can't have reached MariaDB yet, so its unique key can't catch it.
+    for (file = async_create.by_name[async_create_hash_name(parent_id, name)]; file != NULL; file = file->next_name) {
+        if (file->parent_id == parent_id && strcmp(file->name, name) == 0) {
+            log_err(MODULE, "Error creating file '%s' with Parent ID %u: File ID %u is already pending with that name", name, parent_id, file->file_id);
+            goto done;
+        }
+    }
+
+    if (async_create.count == ASYNC_CREATE_MAX && !async_create_flush_locked()) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Too many creates pending", name, parent_id);
+        goto done;
+    }
+
+    file = malloc(sizeof(*file));
+    if (file == NULL) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Out of memory", name, parent_id);
+        goto done;
+    }
+
+    file->file_id = file_id;
+    file->parent_id = parent_id;
+    strlcpy(file->name, name, sizeof(file->name));
+    file->type = type;
+    file->mode = mode;
+    file->created_on = time(NULL);
+
+    async_create_hash(file);
+    async_create.files[async_create.count++] = file;
+    async_create.created++;
+    success = true;
+
+done:
+    pthread_mutex_unlock(&async_create.lock);
+
+    return success;
+}
+
+bool
+async_create_get(unsigned int file_id, async_create_file_t *file) {
+    async_create_file_t *pending;
+
+    if (async_create.count == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&async_create.lock);
+
+    for (pending = async_create.by_id[async_create_hash_id(file_id)]; pending != NULL; pending = pending->next_id) {
+        if (pending->file_id == file_id) {
+            *file = *pending;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&async_create.lock);
+
+    return pending != NULL;
+}
+
+bool
+async_create_get_name(const char *name, unsigned int parent_id, async_create_file_t *file) {
+    async_create_file_t *pending;
+
+    if (name == NULL || async_create.count == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&async_create.lock);
+
+    for (pending = async_create.by_name[async_create_hash_name(parent_id, name)]; pending != NULL; pending = pending->next_name) {
+        if (pending->parent_id == parent_id && strcmp(pending->name, name) == 0) {
+            *file = *pending;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&async_create.lock);
+
+    return pending != NULL;
+}
+
+unsigned int
+async_create_children(unsigned int parent_id, async_create_file_t **files) {
+    unsigned int i, count = 0, size = 0;
+    async_create_file_t *files_new;
+
+    *files = NULL;
+
+    if (async_create.count == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&async_create.lock);
+
+    for (i = 0; i < async_create.count; i++) {
+        if (async_create.files[i]->parent_id != parent_id) {
+            continue;
+        }
+
+        if (count == size) {
+            size = size == 0 ? 16 : size * 2;
+            files_new = realloc(*files, size * sizeof(async_create_file_t));
+            if (files_new == NULL) {
+                log_err(MODULE, "Error listing the pending creates in Parent ID %u: Out of memory", parent_id);
+                break;
+            }
+            *files = files_new;
+        }
+
+        (*files)[count++] = *async_create.files[i];
+    }
+
+    pthread_mutex_unlock(&async_create.lock);
+
+    return count;
+}
+
+bool
+async_create_flush() {
+    bool success;
+
+    if (async_create.count == 0) {
+        return true;
+    }
+
+    pthread_mutex_lock(&async_create.lock);
+    success = async_create_flush_locked();
+    pthread_mutex_unlock(&async_create.lock);
+
+    return success;
+}
+
+void
+async_create_write(FILE *f) {
+    fprintf(f, "async_create                     %s\n", async_create.running ? "on" : "off");
+    fprintf(f, "async_create_pending             %u\n", async_create.count);
+    fprintf(f, "async_create_created             %lu\n", async_create.created);
+    fprintf(f, "async_create_inserted            %lu\n", async_create.inserted);
+    fprintf(f, "async_create_dropped             %lu\n", async_create.dropped);
+    fprintf(f, "async_create_flushes             %lu\n", async_create.flushes);
+}
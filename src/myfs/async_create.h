@@ -0,0 +1,117 @@
+#pragma once
+
+/**
+ * @file async_create.h
+ *
+ * Asynchronous creates. When `async_create` is on, creating a file, directory or link only hands out the
+ * next File ID from the mount's reserved range and adds the file to a table of pending creates, and the
+ * create returns without waiting for MariaDB. A background thread inserts the pending files every
+ * `async_create_flush_ms` with one multi-row INSERT, so unpacking an archive or checking out a tree costs
+ * a statement per batch instead of a transaction per file.
+ *
+ * Lookups see pending files as if they were already in MariaDB. Anything else that touches the database
+ * flushes the pending creates first, so writes, renames, deletes and attribute changes always find their
+ * rows and parents. A pending file whose name turns out to be taken by another mount when it's flushed is
+ * dropped and logged.
+ *
+ * Only MariaDB has asynchronous creates, and they need File ID ranges (`id_range_size`).
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include "myfs.h"
+
+/**
+ * A file that's been created but not inserted yet.
+ */
+typedef struct async_create_file_t {
+    unsigned int file_id;                       //!< The File ID, from the mount's reserved range.
+    unsigned int parent_id;                     //!< The File ID of its directory.
+    char name[MYFS_FILE_NAME_MAX_LEN + 1];      //!< Its name.
+    myfs_file_type_t type;                      //!< Its type.
+    mode_t mode;                                //!< Its mode, including the file type bits.
+    time_t created_on;                          //!< When it was created. Used for every one of its times.
+    struct async_create_file_t *next_id;        //!< The next pending file in the same File ID bucket.
+    struct async_create_file_t *next_name;      //!< The next pending file in the same name bucket.
+} async_create_file_t;
+
+/**
+ * Initializes asynchronous creates. This must be called before any other async create functions are called.
+ */
+void async_create_init();
+
+/**
+ * Frees asynchronous creates. No more async create functions can be called after this.
+ */
+void async_create_free();
+
+/**
+ * Connects to MariaDB and starts inserting pending creates in the background. Until this is called
+ * nothing is ever pending.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] flush_ms How many milliseconds to wait between inserts of the pending creates.
+ * @return `true` on success, otherwise `false`.
+ */
+bool async_create_start(myfs_t *myfs, unsigned int flush_ms);
+
+/**
+ * Stops the background thread, inserts whatever is still pending and disconnects.
+ */
+void async_create_stop();
+
+/**
+ * Adds a pending create. If the table of pending creates is full, it's flushed first.
+ *
+ * @param[in] file_id The new file's File ID.
+ * @param[in] name The new file's name.
+ * @param[in] type The new file's type.
+ * @param[in] parent_id The File ID of the directory it's created in.
+ * @param[in] mode The new file's mode, including the file type bits.
+ * @return `true` on success, or `false` if a pending file already has the name or the table couldn't be flushed.
+ */
+bool async_create_add(unsigned int file_id, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode);
+
+/**
+ * Gets a pending create by its File ID.
+ *
+ * @param[in] file_id The File ID.
+ * @param[out] file A copy of the pending file, if it's found.
+ * @return `true` if the file is pending, otherwise `false`.
+ */
+bool async_create_get(unsigned int file_id, async_create_file_t *file);
+
+/**
+ * Gets a pending create by its name.
+ *
+ * @param[in] name The name. `NULL` is never found.
+ * @param[in] parent_id The File ID of its directory.
+ * @param[out] file A copy of the pending file, if it's found.
+ * @return `true` if the file is pending, otherwise `false`.
+ */
+bool async_create_get_name(const char *name, unsigned int parent_id, async_create_file_t *file);
+
+/**
+ * Gets the pending creates in a directory.
+ *
+ * @param[in] parent_id The File ID of the directory.
+ * @param[out] files Set to an array of copies of the pending files, which must be free()'d, or `NULL` if there are none.
+ * @return The number of pending files in the directory, or fewer if they couldn't all be copied.
+ */
+unsigned int async_create_children(unsigned int parent_id, async_create_file_t **files);
+
+/**
+ * Inserts every pending create. Returns right away if nothing is pending.
+ *
+ * @return `true` on success, otherwise `false`.
+ */
+bool async_create_flush();
+
+/**
+ * Writes how many creates are pending and how many have been inserted as text.
+ *
+ * @param[in] f The file to write to.
+ */
+void async_create_write(FILE *f);
@@ -0,0 +1,738 @@
+/**
+ * @file block_cache.c
+ *
+ * Every slot of the data file has an entry in `block_cache.slots`. Cached blocks are found through a hash
+ * table of (File ID, block index), and every slot is on one LRU list, most recently used first, with free
+ * slots at the end so they're used before anything is evicted. Cached blocks are also on a list per bucket
+ * of a second hash table keyed by File ID alone, so a file's blocks are invalidated without a scan.
+ *
+ * The lock only covers the entries. Block data is read and written without it; a slot's `gen` is bumped
+ * whenever it's given to another block, so a reader checks it again after reading and treats a change as
+ * a miss. A slot being written isn't in the hash table until the write is done.
+ *
+ * The index file is a `block_cache_header_t` followed by one `block_cache_record_t` per cached block, most
+ * recently used first. Its header is marked dirty when the cache starts and clean when it stops, since a
+ * crash can leave the data file out of step with the index.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "../common/log.h"
+#include "../common/string.h"
+#include "../common/metrics.h"
+#include "block_cache.h"
+
+#define MODULE "Block Cache"
+
+/** Identifies an index file. */
+#define BLOCK_CACHE_MAGIC 0x4548434143534659ULL
+
+/** The version of the index file's layout. */
+#define BLOCK_CACHE_FORMAT 1
+
+/** Marks the end of a list or an empty bucket. */
+#define BLOCK_CACHE_NONE UINT32_MAX
+
+/**
+ * The start of the index file.
+ */
+typedef struct {
+    uint64_t magic;                 //!< BLOCK_CACHE_MAGIC.
+    uint32_t format;                //!< BLOCK_CACHE_FORMAT.
+    uint32_t block_size;            //!< MYFS_FILE_BLOCK_SIZE when the index was written.
+    uint32_t count;                 //!< The number of records after the header.
+    uint32_t clean;                 //!< 1 if MyFS stopped cleanly and the records can be trusted.
+} block_cache_header_t;
+
+/**
+ * A cached block in the index file.
+ */
+typedef struct {
+    uint32_t file_id;               //!< The File ID.
+    uint32_t index;                 //!< The block's index in the file.
+    uint64_t version;               //!< The file's version when the block was cached.
+    uint32_t slot;                  //!< Where the block is in the data file.
+    uint32_t len;                   //!< The length of the block.
+} block_cache_record_t;
+
+/**
+ * A slot in the data file.
+ */
+typedef struct {
+    uint32_t file_id;               //!< The File ID of the block in this slot.
+    uint32_t index;                 //!< The index of the block in this slot.
+    uint64_t version;               //!< The file's version when the block was cached.
+    uint32_t len;                   //!< The length of the block. 0 if the slot is free or being written.
+    uint32_t gen;                   //!< Bumped whenever the slot is given to another block.
+    bool hashed;                    //!< Whether the slot is in the hash table.
+    uint32_t hash_next;             //!< The next slot in the same bucket.
+    uint32_t file_prev;             //!< The previous slot in the same File ID bucket.
+    uint32_t file_next;             //!< The next slot in the same File ID bucket.
+    uint32_t lru_prev;              //!< The next more recently used slot.
+    uint32_t lru_next;              //!< The next less recently used slot.
+} block_cache_slot_t;
+
+typedef struct {
+    bool enabled;                   //!< Whether the cache was started.
+    char path_index[PATH_MAX];      //!< The index file.
+    int fd_index;                   //!< The index file, locked so only one MyFS uses the cache.
+    int fd_data;                    //!< The data file.
+    pthread_mutex_t lock;           //!< Protects everything below.
+    block_cache_slot_t *slots;      //!< Every slot.
+    uint32_t slots_count;           //!< The number of slots.
+    uint32_t *buckets;              //!< The hash table, the first slot in each bucket.
+    uint32_t *file_buckets;         //!< The hash table by File ID alone, the first slot in each bucket. The same size as `buckets`.
+    uint32_t buckets_mask;          //!< The number of buckets minus one. The number is a power of two.
+    uint32_t lru_head;              //!< The most recently used slot.
+    uint32_t lru_tail;              //!< The least recently used slot.
+    uint32_t used;                  //!< The number of cached blocks.
+    _Atomic uint64_t hits;          //!< Reads served from the cache.
+    _Atomic uint64_t misses;        //!< Reads that went to the backend.
+    _Atomic uint64_t evictions;     //!< Blocks replaced to make room.
+} block_cache_t;
+
+static block_cache_t block_cache;
+
+static uint32_t
+block_cache_bucket(uint32_t file_id, uint32_t index) {
+    uint64_t hash;
+
+    hash = ((uint64_t)file_id << 32 | index) * 0x9e3779b97f4a7c15ULL;
+
+    return (hash >> 32) & block_cache.buckets_mask;
+}
+
+static uint32_t
+block_cache_file_bucket(uint32_t file_id) {
+    return ((uint64_t)file_id * 0x9e3779b97f4a7c15ULL >> 32) & block_cache.buckets_mask;
+}
+
+/**
+ * Finds the slot of a block. The lock must be held.
+ */
+static uint32_t
+block_cache_find(uint32_t file_id, uint32_t index) {
+    uint32_t slot;
+
+    slot = block_cache.buckets[block_cache_bucket(file_id, index)];
+    while (slot != BLOCK_CACHE_NONE && (block_cache.slots[slot].file_id != file_id || block_cache.slots[slot].index != index)) {
+        slot = block_cache.slots[slot].hash_next;
+    }
+
+    return slot;
+}
+
+static void
+block_cache_hash_add(uint32_t slot) {
+    block_cache_slot_t *entry = &block_cache.slots[slot];
+    uint32_t bucket;
+
+    bucket = block_cache_bucket(entry->file_id, entry->index);
+    entry->hash_next = block_cache.buckets[bucket];
+    block_cache.buckets[bucket] = slot;
+
+    bucket = block_cache_file_bucket(entry->file_id);
+    entry->file_prev = BLOCK_CACHE_NONE;
+    entry->file_next = block_cache.file_buckets[bucket];
+    if (entry->file_next != BLOCK_CACHE_NONE) {
+        block_cache.slots[entry->file_next].file_prev = slot;
+    }
+    block_cache.file_buckets[bucket] = slot;
+
+    entry->hashed = true;
+    block_cache.used++;
+}
+
+static void
+block_cache_hash_remove(uint32_t slot) {
+    block_cache_slot_t *entry = &block_cache.slots[slot];
+    uint32_t *link;
+
+    if (!entry->hashed) {
+        return;
+    }
+
+    link = &block_cache.buckets[block_cache_bucket(entry->file_id, entry->index)];
+    while (*link != slot) {
+        link = &block_cache.slots[*link].hash_next;
+    }
+    *link = entry->hash_next;
+
+    if (entry->file_prev != BLOCK_CACHE_NONE) {
+        block_cache.slots[entry->file_prev].file_next = entry->file_next;
+    }
+    else {
+        block_cache.file_buckets[block_cache_file_bucket(entry->file_id)] = entry->file_next;
+    }
+    if (entry->file_next != BLOCK_CACHE_NONE) {
+        block_cache.slots[entry->file_next].file_prev = entry->file_prev;
+    }
+
+    entry->hashed = false;
+    entry->len = 0;
+    block_cache.used--;
+}
+
+static void
+block_cache_lru_unlink(uint32_t slot) {
+    block_cache_slot_t *entry = &block_cache.slots[slot];
+
+    if (entry->lru_prev != BLOCK_CACHE_NONE) {
+        block_cache.slots[entry->lru_prev].lru_next = entry->lru_next;
+    }
+    else {
+        block_cache.lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next != BLOCK_CACHE_NONE) {
+        block_cache.slots[entry->lru_next].lru_prev = entry->lru_prev;
+    }
+    else {
+        block_cache.lru_tail = entry->lru_prev;
+    }
+}
+
+/**
+ * Moves a slot to the front of the LRU list, or to the back if `used` is `false` so it's reused first.
+ */
+static void
+block_cache_lru_move(uint32_t slot, bool used) {
+    block_cache_slot_t *entry = &block_cache.slots[slot];
+
+    block_cache_lru_unlink(slot);
+
+    if (used) {
+        entry->lru_prev = BLOCK_CACHE_NONE;
+        entry->lru_next = block_cache.lru_head;
+        if (block_cache.lru_head != BLOCK_CACHE_NONE) {
+            block_cache.slots[block_cache.lru_head].lru_prev = slot;
+        }
+        block_cache.lru_head = slot;
+        if (block_cache.lru_tail == BLOCK_CACHE_NONE) {
+            block_cache.lru_tail = slot;
+        }
+    }
+    else {
+        entry->lru_next = BLOCK_CACHE_NONE;
+        entry->lru_prev = block_cache.lru_tail;
+        if (block_cache.lru_tail != BLOCK_CACHE_NONE) {
+            block_cache.slots[block_cache.lru_tail].lru_next = slot;
+        }
+        block_cache.lru_tail = slot;
+        if (block_cache.lru_head == BLOCK_CACHE_NONE) {
+            block_cache.lru_head = slot;
+        }
+    }
+}
+
+/**
+ * Frees a slot. The lock must be held.
+ */
+static void
+block_cache_drop(uint32_t slot) {
+    block_cache_hash_remove(slot);
+    block_cache.slots[slot].gen++;
+    block_cache_lru_move(slot, false);
+}
+
+/**
+ * Loads the records of a cleanly stopped cache. Slots are put on the LRU list in the order of the records
+ * so the most recently used blocks stay the longest. The lock must be held.
+ */
+static void
+block_cache_load(const block_cache_header_t *header) {
+    block_cache_record_t record;
+    block_cache_slot_t *entry;
+    uint32_t i;
+    off_t offset;
+
+    offset = sizeof(*header);
+
+    for (i = 0; i < header->count; i++, offset += sizeof(record)) {
+        if (pread(block_cache.fd_index, &record, sizeof(record), offset) != sizeof(record)) {
+            break;
+        }
+
+        //The cache may have been made smaller since.
+        if (record.slot >= block_cache.slots_count || record.len == 0 || record.len > MYFS_FILE_BLOCK_SIZE) {
+            continue;
+        }
+
+        entry = &block_cache.slots[record.slot];
+        if (entry->hashed || block_cache_find(record.file_id, record.index) != BLOCK_CACHE_NONE) {
+            continue;
+        }
+
+        entry->file_id = record.file_id;
+        entry->index = record.index;
+        entry->version = record.version;
+        entry->len = record.len;
+        block_cache_hash_add(record.slot);
+
+        //Each loaded slot goes after the ones loaded before it, ahead of the free slots.
+        block_cache_lru_move(record.slot, false);
+    }
+
+    //The free slots were at the back before loading; move them behind every loaded slot.
+    for (i = 0; i < block_cache.slots_count; i++) {
+        if (!block_cache.slots[i].hashed) {
+            block_cache_lru_move(i, false);
+        }
+    }
+}
+
+/**
+ * Writes the index file's header.
+ */
+static bool
+block_cache_header_write(uint32_t count, bool clean) {
+    block_cache_header_t header;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = BLOCK_CACHE_MAGIC;
+    header.format = BLOCK_CACHE_FORMAT;
+    header.block_size = MYFS_FILE_BLOCK_SIZE;
+    header.count = count;
+    header.clean = clean;
+
+    return pwrite(block_cache.fd_index, &header, sizeof(header), 0) == sizeof(header) &&
+           fdatasync(block_cache.fd_index) == 0;
+}
+
+void
+block_cache_init() {
+    memset(&block_cache, 0, sizeof(block_cache));
+    block_cache.fd_index = -1;
+    block_cache.fd_data = -1;
+    pthread_mutex_init(&block_cache.lock, NULL);
+}
+
+void
+block_cache_free() {
+    pthread_mutex_destroy(&block_cache.lock);
+}
+
+bool
+block_cache_start(const char *dir, uint64_t size) {
+    block_cache_header_t header;
+    char path[PATH_MAX];
+    uint32_t buckets, i;
+
+    if (dir == NULL || dir[0] == '\0') {
+        return true;
+    }
+
+    block_cache.slots_count = size / MYFS_FILE_BLOCK_SIZE;
+    if (block_cache.slots_count == 0) {
+        log_err(MODULE, "Error starting the block cache: 'cache_size' must be at least %d bytes", MYFS_FILE_BLOCK_SIZE);
+        return false;
+    }
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        log_err(MODULE, "Error creating cache directory '%s': %s", dir, strerror(errno));
+        return false;
+    }
+
+    snprintf(block_cache.path_index, sizeof(block_cache.path_index), "%s/index", dir);
+    snprintf(path, sizeof(path), "%s/data", dir);
+
+    block_cache.fd_index = open(block_cache.path_index, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (block_cache.fd_index == -1) {
+        log_err(MODULE, "Error opening '%s': %s", block_cache.path_index, strerror(errno));
+        goto fail;
+    }
+
+    if (flock(block_cache.fd_index, LOCK_EX | LOCK_NB) != 0) {
+        log_err(MODULE, "Error locking '%s': %s: Is another MyFS using the cache?", block_cache.path_index, strerror(errno));
+        goto fail;
+    }
+
+    block_cache.fd_data = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (block_cache.fd_data == -1) {
+        log_err(MODULE, "Error opening '%s': %s", path, strerror(errno));
+        goto fail;
+    }
+
+    //The data file is sparse, so space is only used by blocks that were cached.
+    if (ftruncate(block_cache.fd_data, (off_t)block_cache.slots_count * MYFS_FILE_BLOCK_SIZE) != 0) {
+        log_err(MODULE, "Error sizing '%s': %s", path, strerror(errno));
+        goto fail;
+    }
+
+    for (buckets = 1; buckets < block_cache.slots_count; buckets *= 2);
+    block_cache.buckets_mask = buckets - 1;
+    block_cache.buckets = malloc(buckets * sizeof(*block_cache.buckets));
+    block_cache.file_buckets = malloc(buckets * sizeof(*block_cache.file_buckets));
+    block_cache.slots = calloc(block_cache.slots_count, sizeof(*block_cache.slots));
+    if (block_cache.buckets == NULL || block_cache.file_buckets == NULL || block_cache.slots == NULL) {
+        log_err(MODULE, "Error starting the block cache: Out of memory");
+        goto fail;
+    }
+
+    memset(block_cache.buckets, 0xff, buckets * sizeof(*block_cache.buckets));
+    memset(block_cache.file_buckets, 0xff, buckets * sizeof(*block_cache.file_buckets));
+
+    //Every slot starts free, in order.
+    for (i = 0; i < block_cache.slots_count; i++) {
+        block_cache.slots[i].lru_prev = i == 0 ? BLOCK_CACHE_NONE : i - 1;
+        block_cache.slots[i].lru_next = i + 1 == block_cache.slots_count ? BLOCK_CACHE_NONE : i + 1;
+    }
+    block_cache.lru_head = 0;
+    block_cache.lru_tail = block_cache.slots_count - 1;
+
+    if (pread(block_cache.fd_index, &header, sizeof(header), 0) == sizeof(header) &&
+        header.magic == BLOCK_CACHE_MAGIC && header.format == BLOCK_CACHE_FORMAT && header.block_size == MYFS_FILE_BLOCK_SIZE) {
+        if (header.clean) {
+            block_cache_load(&header);
+        }
+        else {
+            log_warn(MODULE, "The block cache in '%s' wasn't closed cleanly, starting it empty", dir);
+        }
+    }
+
+    //Until it's stopped, the data file may not match the index.
+    if (!block_cache_header_write(0, false)) {
+        log_err(MODULE, "Error writing '%s': %s", block_cache.path_index, strerror(errno));
+        goto fail;
+    }
+
+    block_cache.enabled = true;
+
+    log_info(MODULE, "Caching up to %u blocks in '%s', %u cached", block_cache.slots_count, dir, block_cache.used);
+
+    return true;
+
+fail:
+    free(block_cache.slots);
+    free(block_cache.buckets);
+    free(block_cache.file_buckets);
+    block_cache.slots = NULL;
+    block_cache.buckets = NULL;
+    block_cache.file_buckets = NULL;
+
+    if (block_cache.fd_data != -1) {
+        close(block_cache.fd_data);
+        block_cache.fd_data = -1;
+    }
+    if (block_cache.fd_index != -1) {
+        close(block_cache.fd_index);
+        block_cache.fd_index = -1;
+    }
+
+    return false;
+}
+
+void
+block_cache_stop() {
+    block_cache_record_t record;
+    block_cache_slot_t *entry;
+    uint32_t slot, count = 0;
+    bool success = true;
+    off_t offset;
+
+    if (!block_cache.enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&block_cache.lock);
+    block_cache.enabled = false;
+
+    //The blocks must be on disk before an index that points to them.
+    if (fdatasync(block_cache.fd_data) != 0) {
+        success = false;
+    }
+
+    offset = sizeof(block_cache_header_t);
+    for (slot = block_cache.lru_head; success && slot != BLOCK_CACHE_NONE; slot = entry->lru_next) {
+        entry = &block_cache.slots[slot];
+        if (!entry->hashed) {
+            continue;
+        }
+
+        memset(&record, 0, sizeof(record));
+        record.file_id = entry->file_id;
+        record.index = entry->index;
+        record.version = entry->version;
+        record.slot = slot;
+        record.len = entry->len;
+
+        success = pwrite(block_cache.fd_index, &record, sizeof(record), offset) == sizeof(record);
+        offset += sizeof(record);
+        count++;
+    }
+
+    success = success && ftruncate(block_cache.fd_index, offset) == 0 && block_cache_header_write(count, true);
+    if (!success) {
+        log_err(MODULE, "Error writing '%s': %s: The cache will start empty", block_cache.path_index, strerror(errno));
+    }
+    else {
+        log_info(MODULE, "Saved %u cached blocks", count);
+    }
+
+    pthread_mutex_unlock(&block_cache.lock);
+
+    close(block_cache.fd_data);
+    close(block_cache.fd_index);
+    block_cache.fd_data = -1;
+    block_cache.fd_index = -1;
+
+    free(block_cache.slots);
+    free(block_cache.buckets);
+    free(block_cache.file_buckets);
+    block_cache.slots = NULL;
+    block_cache.buckets = NULL;
+    block_cache.file_buckets = NULL;
+}
+
+uint64_t
+block_cache_version(const myfs_file_t *file) {
+    //The version alone would do if File IDs were never handed out twice, but AUTO_INCREMENT can start
+    //below a deleted file's ID after the server restarts. The modified time and size tell those apart.
+    return file->version * 0x9e3779b97f4a7c15ULL ^ (uint64_t)file->st.st_mtime * 0xc2b2ae3d27d4eb4fULL ^ (uint64_t)file->st.st_size;
+}
+
+bool
+block_cache_read(unsigned int file_id, uint64_t version, char *buf, size_t size, off_t offset) {
+    size_t block_offset, len;
+    block_cache_slot_t *entry;
+    uint32_t index, slot, gen = 0;
+    bool hit = true;
+
+    if (!block_cache.enabled || size == 0) {
+        return false;
+    }
+
+    while (hit && size > 0) {
+        index = offset / MYFS_FILE_BLOCK_SIZE;
+        block_offset = offset % MYFS_FILE_BLOCK_SIZE;
+        len = MYFS_FILE_BLOCK_SIZE - block_offset;
+        if (len > size) {
+            len = size;
+        }
+
+        pthread_mutex_lock(&block_cache.lock);
+
+        slot = block_cache_find(file_id, index);
+        hit = slot != BLOCK_CACHE_NONE;
+        if (hit) {
+            entry = &block_cache.slots[slot];
+
+            //A block of another version is stale, free it for something else.
+            if (entry->version != version || entry->len < block_offset + len) {
+                block_cache_drop(slot);
+                hit = false;
+            }
+            else {
+                gen = entry->gen;
+                block_cache_lru_move(slot, true);
+            }
+        }
+
+        pthread_mutex_unlock(&block_cache.lock);
+
+        if (!hit) {
+            break;
+        }
+
+        hit = pread(block_cache.fd_data, buf, len, (off_t)slot * MYFS_FILE_BLOCK_SIZE + block_offset) == (ssize_t)len;
+
+        //The slot may have been given to another block while it was being read.
+        pthread_mutex_lock(&block_cache.lock);
+        hit = hit && block_cache.slots[slot].gen == gen;
+        pthread_mutex_unlock(&block_cache.lock);
+
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+
+    if (hit) {
+        block_cache.hits++;
+        METRICS_COUNT("block_cache_hits", 1);
+    }
+    else {
+        block_cache.misses++;
+        METRICS_COUNT("block_cache_misses", 1);
+    }
+
+    return hit;
+}
+
+/**
+ * Caches one block.
+ */
+static void
+block_cache_store_block(unsigned int file_id, uint64_t version, uint32_t index, const char *data, uint32_t len) {
+    block_cache_slot_t *entry;
+    uint32_t slot, gen;
+    bool success;
+
+    pthread_mutex_lock(&block_cache.lock);
+
+    //It's already cached, eg. by another thread reading the same block.
+    slot = block_cache_find(file_id, index);
+    if (slot != BLOCK_CACHE_NONE && block_cache.slots[slot].version == version) {
+        pthread_mutex_unlock(&block_cache.lock);
+        return;
+    }
+
+    //Reuse the slot of an older version, or take the least recently used one.
+    if (slot == BLOCK_CACHE_NONE) {
+        slot = block_cache.lru_tail;
+        if (block_cache.slots[slot].hashed) {
+            block_cache.evictions++;
+            METRICS_COUNT("block_cache_evictions", 1);
+        }
+    }
+
+    block_cache_hash_remove(slot);
+
+    entry = &block_cache.slots[slot];
+    entry->gen++;
+    entry->file_id = file_id;
+    entry->index = index;
+    entry->version = version;
+    gen = entry->gen;
+    block_cache_lru_move(slot, true);
+
+    pthread_mutex_unlock(&block_cache.lock);
+
+    success = pwrite(block_cache.fd_data, data, len, (off_t)slot * MYFS_FILE_BLOCK_SIZE) == (ssize_t)len;
+
+    pthread_mutex_lock(&block_cache.lock);
+
+    //Only publish the block if the slot wasn't taken in the meantime and no one else cached it first.
+    entry = &block_cache.slots[slot];
+    if (entry->gen == gen) {
+        if (success && block_cache_find(file_id, index) == BLOCK_CACHE_NONE) {
+            entry->len = len;
+            block_cache_hash_add(slot);
+        }
+        else {
+            block_cache_drop(slot);
+        }
+    }
+
+    pthread_mutex_unlock(&block_cache.lock);
+}
+
+void
+block_cache_store(unsigned int file_id, uint64_t version, const char *data, size_t size, off_t offset, off_t file_size) {
+    size_t skip, len;
+
+    if (!block_cache.enabled) {
+        return;
+    }
+
+    //Skip to the first whole block.
+    skip = (MYFS_FILE_BLOCK_SIZE - offset % MYFS_FILE_BLOCK_SIZE) % MYFS_FILE_BLOCK_SIZE;
+    if (skip >= size) {
+        return;
+    }
+
+    data += skip;
+    offset += skip;
+    size -= skip;
+
+    while (size > 0) {
+        len = size < MYFS_FILE_BLOCK_SIZE ? size : MYFS_FILE_BLOCK_SIZE;
+
+        //A short block is only complete if it's the end of the file.
+        if (len < MYFS_FILE_BLOCK_SIZE && offset + (off_t)len != file_size) {
+            break;
+        }
+
+        block_cache_store_block(file_id, version, offset / MYFS_FILE_BLOCK_SIZE, data, len);
+
+        data += len;
+        offset += len;
+        size -= len;
+    }
+}
+
+void
+block_cache_invalidate(unsigned int file_id, off_t offset, size_t size) {
+    uint32_t index, last, slot;
+
+    if (!block_cache.enabled || size == 0) {
+        return;
+    }
+
+    index = offset / MYFS_FILE_BLOCK_SIZE;
+    last = (offset + size - 1) / MYFS_FILE_BLOCK_SIZE;
+
+    pthread_mutex_lock(&block_cache.lock);
+
+    for (; index <= last; index++) {
+        slot = block_cache_find(file_id, index);
+        if (slot != BLOCK_CACHE_NONE) {
+            block_cache_drop(slot);
+        }
+    }
+
+    pthread_mutex_unlock(&block_cache.lock);
+}
+
+void
+block_cache_invalidate_file(unsigned int file_id) {
+    uint32_t slot, next;
+
+    if (!block_cache.enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&block_cache.lock);
+
+    //Only the file's blocks and the few of other files sharing its bucket are looked at.
+    for (slot = block_cache.file_buckets[block_cache_file_bucket(file_id)]; slot != BLOCK_CACHE_NONE; slot = next) {
+        next = block_cache.slots[slot].file_next;
+        if (block_cache.slots[slot].file_id == file_id) {
+            block_cache_drop(slot);
+        }
+    }
+
+    pthread_mutex_unlock(&block_cache.lock);
+}
+
+void
+block_cache_flush() {
+    uint32_t slot;
+
+    if (!block_cache.enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&block_cache.lock);
+
+    for (slot = 0; slot < block_cache.slots_count; slot++) {
+        if (block_cache.slots[slot].hashed) {
+            block_cache_drop(slot);
+        }
+    }
+
+    pthread_mutex_unlock(&block_cache.lock);
+}
+
+void
+block_cache_write(FILE *f) {
+    uint32_t used;
+
+    pthread_mutex_lock(&block_cache.lock);
+    used = block_cache.used;
+    pthread_mutex_unlock(&block_cache.lock);
+
+    fprintf(f, "block_cache                      %s\n", block_cache.enabled ? "on" : "off");
+    fprintf(f, "block_cache_blocks               %u\n", used);
+    fprintf(f, "block_cache_blocks_max           %u\n", block_cache.slots_count);
+    fprintf(f, "block_cache_hits                 %lu\n", block_cache.hits);
+    fprintf(f, "block_cache_misses               %lu\n", block_cache.misses);
+    fprintf(f, "block_cache_evictions            %lu\n", block_cache.evictions);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+/**
+ * @file block_cache.h
+ *
+ * A persistent block cache on a local disk. File data blocks read from the backend are kept in
+ * `<cache_dir>/data`, one MYFS_FILE_BLOCK_SIZE slot per block, and found through an index of
+ * (File ID, block index, version) kept in memory. When the cache is full the least recently used block is
+ * replaced. The index is written to `<cache_dir>/index` when MyFS stops, so the cache is still warm after
+ * a restart. If MyFS didn't stop cleanly the cache starts empty.
+ *
+ * A block is only used if it was cached with the same file version the reader has, see
+ * `block_cache_version()`, so blocks changed by another client are read again after the file is reopened.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "myfs.h"
+
+/**
+ * Initializes the block cache. This must be called before any other block cache functions are called.
+ */
+void block_cache_init();
+
+/**
+ * Frees the block cache. No more block cache functions can be called after this.
+ */
+void block_cache_free();
+
+/**
+ * Opens the cache in `dir`, creating it if needed, and loads the index if MyFS stopped cleanly. Only one
+ * MyFS can use a cache directory at a time.
+ *
+ * @param[in] dir The cache directory. If `NULL` or empty, the cache stays off.
+ * @param[in] size The most file data to keep, in bytes.
+ * @return `true` on success, otherwise `false`.
+ */
+bool block_cache_start(const char *dir, uint64_t size);
+
+/**
+ * Writes the index and closes the cache.
+ */
+void block_cache_stop();
+
+/**
+ * Gets the version blocks of a file are cached with. It changes whenever the file's data version, size or
+ * modified time does.
+ *
+ * @param[in] file The file.
+ * @return The version.
+ */
+uint64_t block_cache_version(const myfs_file_t *file);
+
+/**
+ * Reads file data from the cache. Either every block in the range is cached and the whole range is read,
+ * or nothing is.
+ *
+ * @param[in] file_id The File ID.
+ * @param[in] version The file's version, from `block_cache_version()`.
+ * @param[out] buf Where to read to.
+ * @param[in] size The number of bytes to read. The range must end at or before the end of the file.
+ * @param[in] offset Where to start reading.
+ * @return `true` if the range was read, `false` on a miss.
+ */
+bool block_cache_read(unsigned int file_id, uint64_t version, char *buf, size_t size, off_t offset);
+
+/**
+ * Adds the blocks wholly inside of data read from the backend to the cache. A partial block is only added
+ * if it's the last block of the file.
+ *
+ * @param[in] file_id The File ID.
+ * @param[in] version The file's version, from `block_cache_version()`.
+ * @param[in] data The data that was read.
+ * @param[in] size The length of `data`.
+ * @param[in] offset Where `data` starts in the file.
+ * @param[in] file_size The file's size.
+ */
+void block_cache_store(unsigned int file_id, uint64_t version, const char *data, size_t size, off_t offset, off_t file_size);
+
+/**
+ * Drops the cached blocks that overlap a range of a file, eg. after it's written to.
+ *
+ * @param[in] file_id The File ID.
+ * @param[in] offset The start of the range.
+ * @param[in] size The length of the range.
+ */
+void block_cache_invalidate(unsigned int file_id, off_t offset, size_t size);
+
+/**
+ * Drops every cached block of a file, eg. after it's truncated or deleted.
+ *
+ * @param[in] file_id The File ID.
+ */
+void block_cache_invalidate_file(unsigned int file_id);
+
+/**
+ * Drops every cached block.
+ */
+void block_cache_flush();
+
+/**
+ * Writes the cache's size and hit counts as text.
+ *
+ * @param[in] f The file to write to.
+ */
+void block_cache_write(FILE *f);
@@ -0,0 +1,589 @@
+/**
+ * @file change_log.c
+ *
+ * `change_id` is an AUTO_INCREMENT, so IDs are handed out when a change is made but only seen once its
+ * transaction commits. A change that commits after a later one would be skipped by just reading past the
+ * highest ID, so IDs that are skipped over are kept as holes and read again for a while in case they show
+ * up. Holes left by rolled back transactions never do, and are dropped after CHANGE_LOG_HOLE_TTL.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../common/log.h"
+#include "../common/config.h"
+#include "../common/string.h"
+#include "../common/db.h"
+#include "../common/metrics.h"
+#include "util.h"
+#include "block_cache.h"
+#include "change_log.h"
+
+#define MODULE "Change Log"
+
+/** The number of seconds to wait before retrying a failed query. */
+#define CHANGE_LOG_QUERY_RETRY_TIME 5
+
+/** The most changes read at once. */
+#define CHANGE_LOG_BATCH_MAX 1000
+
+/** The number of files whose newest applied write is remembered. Must be a power of two. */
+#define CHANGE_LOG_SEEN_SIZE 4096
+
+/** The most skipped IDs to keep reading again. */
+#define CHANGE_LOG_HOLES_MAX 256
+
+/** The number of seconds to keep reading a skipped ID again. */
+#define CHANGE_LOG_HOLE_TTL 10
+
+/** The number of seconds changes are kept in the table. */
+#define CHANGE_LOG_RETENTION (60 * 60)
+
+/** The number of seconds between removing changes older than CHANGE_LOG_RETENTION. */
+#define CHANGE_LOG_PRUNE_INTERVAL 60
+
+/** The most old changes removed per statement, so pruning doesn't hold locks for long. */
+#define CHANGE_LOG_PRUNE_MAX 10000
+
+/**
+ * A change ID that was skipped over.
+ */
+typedef struct {
+    uint64_t change_id;                 //!< The skipped ID.
+    time_t seen_on;                     //!< When it was skipped.
+} change_log_hole_t;
+
+/**
+ * Another mount's change, read in a batch.
+ */
+typedef struct {
+    unsigned int file_id;                       //!< The File ID.
+    unsigned int parent_id;                     //!< The File ID of its directory when the change was made.
+    char name[MYFS_FILE_NAME_MAX_LEN + 1];      //!< Its name when the change was made.
+    change_log_op_t op;                         //!< The change.
+    uint64_t version;                           //!< The file's version when the change was made.
+    bool skip;                                  //!< Whether a newer change already covers it.
+} change_log_entry_t;
+
+/**
+ * The newest write applied to a file.
+ */
+typedef struct {
+    unsigned int file_id;               //!< The File ID.
+    uint64_t version;                   //!< The file's version after the write. 0 if the entry is unused.
+} change_log_seen_t;
+
+typedef struct {
+    db_t db;                                        //!< The database connection.
+    pthread_t thread;                               //!< The thread.
+    _Atomic bool running;                           //!< If the thread is running or not.
+    unsigned int mount_id;                          //!< This mount's ID. Its own changes are skipped.
+    unsigned int poll_ms;                           //!< Milliseconds between reads.
+    _Atomic uint64_t last_id;                       //!< The highest change ID read.
+    change_log_hole_t holes[CHANGE_LOG_HOLES_MAX];  //!< Skipped IDs, oldest first.
+    unsigned int holes_count;                       //!< The number of skipped IDs.
+    time_t last_read;                               //!< When the change log was last read.
+    time_t last_prune;                              //!< When old changes were last removed.
+    struct fuse *fuse;                              //!< Where to send kernel invalidations, or `NULL`.
+    pthread_mutex_t fuse_lock;                      //!< Protects `fuse`, and is held while invalidating so it isn't destroyed underneath.
+    change_log_entry_t entries[CHANGE_LOG_BATCH_MAX];   //!< Other mounts' changes in the batch being applied.
+    unsigned int order[CHANGE_LOG_BATCH_MAX];       //!< Positions in `entries`, sorted by File ID.
+    change_log_seen_t seen[CHANGE_LOG_SEEN_SIZE];   //!< The newest writes applied, hashed by File ID.
+    _Atomic uint64_t applied;                       //!< Other mounts' changes that were applied.
+    _Atomic uint64_t skipped;                       //!< Other mounts' changes skipped because a newer one was applied.
+} change_log_t;
+
+static change_log_t change_log;
+
+/** The names of the changes, indexed by `change_log_op_t`. They match the `op` column's enum. */
+static const char *change_log_ops[] = {
+    [CHANGE_LOG_OP_CREATE] = "Create",
+    [CHANGE_LOG_OP_DELETE] = "Delete",
+    [CHANGE_LOG_OP_WRITE] = "Write",
+    [CHANGE_LOG_OP_ATTR] = "Attr",
+    [CHANGE_LOG_OP_RENAME] = "Rename"
+};
+
+const char *
+change_log_op_str(change_log_op_t op) {
+    return change_log_ops[op];
+}
+
+/**
+ * Parses the `op` column.
+ */
+static change_log_op_t
+change_log_op_parse(const char *str) {
+    change_log_op_t op;
+
+    for (op = 0; op < sizeof(change_log_ops) / sizeof(change_log_ops[0]); op++) {
+        if (strcmp(change_log_ops[op], str) == 0) {
+            return op;
+        }
+    }
+
+    return CHANGE_LOG_OP_ATTR;
+}
+
+/**
+ * Adds skipped IDs, dropping the oldest ones if there are too many.
+ */
+static void
+change_log_holes_add(uint64_t from, uint64_t to, time_t now) {
+    unsigned int drop;
+
+    if (to - from > CHANGE_LOG_HOLES_MAX) {
+        from = to - CHANGE_LOG_HOLES_MAX;
+    }
+
+    for (; from < to; from++) {
+        if (change_log.holes_count == CHANGE_LOG_HOLES_MAX) {
+            drop = CHANGE_LOG_HOLES_MAX / 4;
+            memmove(change_log.holes, change_log.holes + drop, (CHANGE_LOG_HOLES_MAX - drop) * sizeof(change_log.holes[0]));
+            change_log.holes_count -= drop;
+        }
+
+        change_log.holes[change_log.holes_count].change_id = from;
+        change_log.holes[change_log.holes_count].seen_on = now;
+        change_log.holes_count++;
+    }
+}
+
+/**
+ * Removes a skipped ID once it's been read.
+ */
+static void
+change_log_holes_remove(uint64_t change_id) {
+    unsigned int i;
+
+    for (i = 0; i < change_log.holes_count; i++) {
+        if (change_log.holes[i].change_id == change_id) {
+            change_log.holes_count--;
+            memmove(change_log.holes + i, change_log.holes + i + 1, (change_log.holes_count - i) * sizeof(change_log.holes[0]));
+            return;
+        }
+    }
+}
+
+/**
+ * Drops skipped IDs that have been waited on for long enough. Holes are oldest first.
+ */
+static void
+change_log_holes_expire(time_t now) {
+    unsigned int count = 0;
+
+    while (count < change_log.holes_count && now - change_log.holes[count].seen_on > CHANGE_LOG_HOLE_TTL) {
+        count++;
+    }
+
+    if (count > 0) {
+        change_log.holes_count -= count;
+        memmove(change_log.holes, change_log.holes + count, change_log.holes_count * sizeof(change_log.holes[0]));
+    }
+}
+
+/**
+ * Builds the path of a directory from the database. The whole chain of parents is read with one query.
+ *
+ * @param[in] dir_id The File ID of the directory.
+ * @param[out] path Where to write the path.
+ * @param[in] size The size of `path`.
+ * @return `true` if the directory was found, otherwise `false`.
+ */
+static bool
+change_log_dir_path(unsigned int dir_id, char *path, size_t size) {
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    size_t len = 0;
+
+    if (dir_id == 0) {
+        strlcpy(path, "/", size);
+        return true;
+    }
+
+    res = db_selectf(&change_log.db, "WITH RECURSIVE `path` (`file_id`,`parent_id`,`name`,`depth`) AS (\n"
+                                     "    SELECT `file_id`,`parent_id`,`name`,0\n"
+                                     "    FROM `files`\n"
+                                     "    WHERE `file_id`=%u\n"
+                                     "    UNION ALL\n"
+                                     "    SELECT `f`.`file_id`,`f`.`parent_id`,`f`.`name`,`p`.`depth`+1\n"
+                                     "    FROM `files` `f`\n"
+                                     "    JOIN `path` `p` ON `f`.`file_id`=`p`.`parent_id`\n"
+                                     "    WHERE `p`.`file_id`!=0\n"
+                                     ")\n"
+                                     "SELECT `name`\n"
+                                     "FROM `path`\n"
+                                     "WHERE `file_id`!=0\n"
+                                     "ORDER BY `depth` DESC",
+                                     dir_id);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error getting the path of File ID %u: %s", dir_id, db_error(&change_log.db));
+        return false;
+    }
+
+    path[0] = '\0';
+    while ((row = mysql_fetch_row(res)) != NULL && len < size) {
+        len += snprintf(path + len, size - len, "/%s", row[0]);
+    }
+    mysql_free_result(res);
+
+    return len > 0 && len < size;
+}
+
+/**
+ * Tells the kernel to forget the attributes and pages it cached for a path. Paths the kernel doesn't
+ * know about are skipped by FUSE.
+ */
+static void
+change_log_invalidate_path(const char *path) {
+    pthread_mutex_lock(&change_log.fuse_lock);
+    if (change_log.fuse != NULL) {
+        fuse_invalidate_path(change_log.fuse, path);
+    }
+    pthread_mutex_unlock(&change_log.fuse_lock);
+}
+
+/**
+ * Drops what the kernel cached about a file another mount changed.
+ *
+ * @param[in] entry The change.
+ */
+static void
+change_log_apply(const change_log_entry_t *entry) {
+    char path[MYFS_PATH_NAME_MAX_LEN + 1];
+    size_t len;
+
+    log_debug(MODULE, "%s of File ID %u in Parent ID %u", change_log_op_str(entry->op), entry->file_id, entry->parent_id);
+
+    //The root is its own parent.
+    if (entry->file_id == 0) {
+        change_log_invalidate_path("/");
+        change_log.applied++;
+        return;
+    }
+
+    if (!change_log_dir_path(entry->parent_id, path, sizeof(path))) {
+        return;
+    }
+
+    //The directory's entries or times changed too, unless only the file's attributes did.
+    if (entry->op != CHANGE_LOG_OP_WRITE && entry->op != CHANGE_LOG_OP_ATTR) {
+        change_log_invalidate_path(path);
+    }
+
+    len = strlen(path);
+    snprintf(path + len, sizeof(path) - len, "%s%s", len > 1 ? "/" : "", entry->name);
+    change_log_invalidate_path(path);
+
+    change_log.applied++;
+}
+
+/**
+ * Orders positions in `entries` by File ID, then by position.
+ */
+static int
+change_log_order_compare(const void *a, const void *b) {
+    const change_log_entry_t *entry_a = &change_log.entries[*(const unsigned int *)a];
+    const change_log_entry_t *entry_b = &change_log.entries[*(const unsigned int *)b];
+
+    if (entry_a->file_id != entry_b->file_id) {
+        return entry_a->file_id < entry_b->file_id ? -1 : 1;
+    }
+
+    return (int)*(const unsigned int *)a - (int)*(const unsigned int *)b;
+}
+
+/**
+ * Applies a batch of other mounts' changes, oldest first.
+ *
+ * A write is skipped if a newer write to the same file was already applied, going by the file's version,
+ * or comes later in the batch. Each file whose data changed has its cached blocks dropped once, however
+ * many of its changes are in the batch.
+ *
+ * @param[in] count The number of changes in `entries`.
+ */
+static void
+change_log_apply_batch(unsigned int count) {
+    unsigned int i, end, last_write, skipped = 0;
+    change_log_entry_t *entry;
+    change_log_seen_t *seen;
+    bool data;
+
+    for (i = 0; i < count; i++) {
+        change_log.order[i] = i;
+    }
+    qsort(change_log.order, count, sizeof(change_log.order[0]), change_log_order_compare);
+
+    for (i = 0; i < count; i = end) {
+        entry = &change_log.entries[change_log.order[i]];
+        seen = &change_log.seen[entry->file_id & (CHANGE_LOG_SEEN_SIZE - 1)];
+        last_write = CHANGE_LOG_BATCH_MAX;
+        data = false;
+
+        //The file's changes, oldest first.
+        for (end = i; end < count && change_log.entries[change_log.order[end]].file_id == entry->file_id; end++) {
+            entry = &change_log.entries[change_log.order[end]];
+
+            if (entry->op == CHANGE_LOG_OP_DELETE) {
+                //File IDs can be handed out again, and a new file's versions start over.
+                if (seen->file_id == entry->file_id) {
+                    seen->version = 0;
+                }
+                last_write = CHANGE_LOG_BATCH_MAX;
+                data = true;
+            }
+            else if (entry->op == CHANGE_LOG_OP_WRITE) {
+                if (seen->version != 0 && seen->file_id == entry->file_id && entry->version <= seen->version) {
+                    entry->skip = true;
+                    continue;
+                }
+
+                if (last_write != CHANGE_LOG_BATCH_MAX) {
+                    change_log.entries[last_write].skip = true;
+                }
+                last_write = change_log.order[end];
+                seen->file_id = entry->file_id;
+                seen->version = entry->version;
+                data = true;
+            }
+        }
+
+        if (data) {
+            block_cache_invalidate_file(entry->file_id);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (change_log.entries[i].skip) {
+            skipped++;
+            continue;
+        }
+
+        change_log_apply(&change_log.entries[i]);
+    }
+
+    change_log.skipped += skipped;
+    METRICS_COUNT("change_log_skipped", skipped);
+}
+
+/**
+ * Reads the changes made since the last read, and the skipped IDs, and applies the ones made by other
+ * mounts.
+ *
+ * @param[out] more Set to `true` if there may be more changes waiting.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+change_log_read(bool *more) {
+    char sql[1024 + CHANGE_LOG_HOLES_MAX * 22];
+    unsigned int i, count = 0, applying = 0;
+    change_log_entry_t *entry;
+    uint64_t change_id;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    time_t now;
+    int len;
+
+    now = time(NULL);
+    change_log_holes_expire(now);
+
+    len = snprintf(sql, sizeof(sql), "SELECT `change_id`,`file_id`,`parent_id`,`name`,`op`,`mount_id`,`version`\n"
+                                     "FROM `change_log`\n"
+                                     "WHERE `change_id`>%lu",
+                                     change_log.last_id);
+    if (change_log.holes_count > 0) {
+        len += snprintf(sql + len, sizeof(sql) - len, " OR `change_id` IN (");
+        for (i = 0; i < change_log.holes_count; i++) {
+            len += snprintf(sql + len, sizeof(sql) - len, "%s%lu", i > 0 ? "," : "", change_log.holes[i].change_id);
+        }
+        len += snprintf(sql + len, sizeof(sql) - len, ")");
+    }
+    len += snprintf(sql + len, sizeof(sql) - len, "\nORDER BY `change_id` ASC\nLIMIT %u", CHANGE_LOG_BATCH_MAX);
+
+    res = db_select(&change_log.db, sql, len);
+    if (res == NULL) {
+        log_err(MODULE, "Error reading changes: %s", db_error(&change_log.db));
+        return false;
+    }
+
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        change_id = strtoull(row[0], NULL, 10);
+        count++;
+
+        if (change_id <= change_log.last_id) {
+            change_log_holes_remove(change_id);
+        }
+        else {
+            change_log_holes_add(change_log.last_id + 1, change_id, now);
+            change_log.last_id = change_id;
+        }
+
+        if (strtoul(row[5], NULL, 10) != change_log.mount_id) {
+            entry = &change_log.entries[applying++];
+            entry->file_id = strtoul(row[1], NULL, 10);
+            entry->parent_id = strtoul(row[2], NULL, 10);
+            strlcpy(entry->name, row[3], sizeof(entry->name));
+            entry->op = change_log_op_parse(row[4]);
+            entry->version = row[6] == NULL ? 0 : strtoull(row[6], NULL, 10);
+            entry->skip = false;
+        }
+    }
+    mysql_free_result(res);
+
+    change_log_apply_batch(applying);
+
+    METRICS_COUNT("change_log_read", count);
+
+    *more = count == CHANGE_LOG_BATCH_MAX;
+
+    return true;
+}
+
+/**
+ * Removes changes older than CHANGE_LOG_RETENTION. Every mount does this, whichever gets there first.
+ */
+static void
+change_log_prune() {
+    bool success;
+
+    success = db_queryf(&change_log.db, "DELETE FROM `change_log`\n"
+                                        "WHERE `created_on`<UNIX_TIMESTAMP()-%d\n"
+                                        "LIMIT %d",
+                                        CHANGE_LOG_RETENTION, CHANGE_LOG_PRUNE_MAX);
+
+    if (!success) {
+        log_warn(MODULE, "Error removing old changes: %s", db_error(&change_log.db));
+    }
+}
+
+static void *
+change_log_process(void *user_data) {
+    time_t next_try = 0, now;
+    bool success, more = false;
+
+    while (change_log.running) {
+        if (!more) {
+            util_sleep_ms(change_log.poll_ms);
+        }
+
+        //If a previous query failed, pause until it's ready to retry.
+        now = time(NULL);
+        if (next_try > now) {
+            continue;
+        }
+
+        success = change_log_read(&more);
+        if (!success) {
+            log_err(MODULE, "Trying again in %d seconds", CHANGE_LOG_QUERY_RETRY_TIME);
+            next_try = now + CHANGE_LOG_QUERY_RETRY_TIME;
+            more = false;
+            continue;
+        }
+
+        //Changes older than the retention may have been removed while the log couldn't be read, so
+        //nothing cached can be trusted.
+        if (now - change_log.last_read > CHANGE_LOG_RETENTION) {
+            log_warn(MODULE, "The change log wasn't read for %ld seconds, emptying the block cache", (long)(now - change_log.last_read));
+            block_cache_flush();
+        }
+        change_log.last_read = now;
+
+        if (now - change_log.last_prune >= CHANGE_LOG_PRUNE_INTERVAL) {
+            change_log_prune();
+            change_log.last_prune = now;
+        }
+    }
+
+    return NULL;
+}
+
+void
+change_log_init() {
+    memset(&change_log, 0, sizeof(change_log));
+
+    db_init(&change_log.db);
+    pthread_mutex_init(&change_log.fuse_lock, NULL);
+}
+
+void
+change_log_free() {
+    db_free(&change_log.db);
+    pthread_mutex_destroy(&change_log.fuse_lock);
+}
+
+bool
+change_log_start(myfs_t *myfs, unsigned int poll_ms) {
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    bool success;
+    int ret;
+
+    log_info(MODULE, "Starting");
+
+    change_log.mount_id = myfs->mount_id;
+    change_log.poll_ms = poll_ms;
+
+    success = db_connect(&change_log.db, config_get("mariadb_host"), config_get("mariadb_user"), config_get("mariadb_password"), config_get("mariadb_database"), config_get_uint("mariadb_port"));
+    if (!success) {
+        log_err(MODULE, "Error connecting to MariaDB: %s", db_error(&change_log.db));
+        return false;
+    }
+
+    //Only log the change log's slow queries. Its statements aren't summarized along with MyFS's own.
+    db_set_profile_options(&change_log.db, config_get_uint("slow_query_ms"), 0, 0);
+
+    //Nothing is cached yet, so start from the newest change.
+    res = db_select(&change_log.db, "SELECT COALESCE(MAX(`change_id`),0) FROM `change_log`", 51);
+    if (res == NULL) {
+        log_err(MODULE, "Error getting the newest change: %s", db_error(&change_log.db));
+        return false;
+    }
+
+    row = mysql_fetch_row(res);
+    if (row != NULL) {
+        change_log.last_id = strtoull(row[0], NULL, 10);
+    }
+    mysql_free_result(res);
+
+    change_log.last_read = time(NULL);
+    change_log.last_prune = 0;
+
+    //Start the thread.
+    change_log.running = true;
+    ret = pthread_create(&change_log.thread, NULL, change_log_process, NULL);
+    if (ret != 0) {
+        change_log.running = false;
+        log_err(MODULE, "Error starting thread: %s", strerror(ret));
+    }
+
+    return change_log.running;
+}
+
+void
+change_log_stop() {
+    if (change_log.running) {
+        change_log.running = false;
+        log_info(MODULE, "Stopping");
+
+        pthread_join(change_log.thread, NULL);
+    }
+
+    db_disconnect(&change_log.db);
+}
+
+void
+change_log_attach(struct fuse *fuse) {
+    pthread_mutex_lock(&change_log.fuse_lock);
+    change_log.fuse = fuse;
+    pthread_mutex_unlock(&change_log.fuse_lock);
+}
+
+void
+change_log_write(FILE *f) {
+    fprintf(f, "change_log                       %s\n", change_log.running ? "on" : "off");
+    fprintf(f, "change_log_last_id               %lu\n", change_log.last_id);
+    fprintf(f, "change_log_applied               %lu\n", change_log.applied);
+    fprintf(f, "change_log_skipped               %lu\n", change_log.skipped);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+/**
+ * @file change_log.h
+ *
+ * Lets mounts on different hosts see each other's changes. When `change_log` is on, every change a mount
+ * makes to a file is also added to the `change_log` table in the same transaction, with the file's
+ * parent, name and version and the ID of the mount that made it. A background thread on each mount reads
+ * the table by `change_id` and, for changes made by other mounts, drops the file's blocks from the block
+ * cache and tells the kernel to forget what it cached about the file and its directory. That makes it
+ * safe to let the kernel cache pages and attributes for much longer.
+ *
+ * Only MariaDB has a change log. The other backends are only ever used by one mount.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "myfs.h"
+
+/**
+ * The kinds of changes in the change log.
+ */
+typedef enum {
+    CHANGE_LOG_OP_CREATE,               //!< A file, directory or link was made.
+    CHANGE_LOG_OP_DELETE,               //!< A file was deleted. It's logged before the row is gone.
+    CHANGE_LOG_OP_WRITE,                //!< A file's data was written, appended to or truncated.
+    CHANGE_LOG_OP_ATTR,                 //!< A file's times, owner or mode changed.
+    CHANGE_LOG_OP_RENAME                //!< A file was moved. It's logged at both its old and new place.
+} change_log_op_t;
+
+/**
+ * Gets the name of a change, as it's stored in the `op` column.
+ *
+ * @param[in] op The change.
+ * @return The name.
+ */
+const char * change_log_op_str(change_log_op_t op);
+
+/**
+ * Initializes the change log. This must be called before any other change log functions are called.
+ */
+void change_log_init();
+
+/**
+ * Frees the change log. No more change log functions can be called after this.
+ */
+void change_log_free();
+
+/**
+ * Connects to MariaDB and starts reading other mounts' changes from the newest one on.
+ *
+ * @param[in] myfs The MyFS context. Its `mount_id` tells this mount's own changes apart.
+ * @param[in] poll_ms How many milliseconds to wait between reads of the change log.
+ * @return `true` on success, otherwise `false`.
+ */
+bool change_log_start(myfs_t *myfs, unsigned int poll_ms);
+
+/**
+ * Stops reading the change log and disconnects.
+ */
+void change_log_stop();
+
+/**
+ * Sets the FUSE instance to send the kernel invalidations through. Until it's set, and after it's set back
+ * to `NULL`, only the block cache is invalidated.
+ *
+ * @param[in] fuse The FUSE instance, or `NULL` once it's being destroyed.
+ */
+void change_log_attach(struct fuse *fuse);
+
+/**
+ * Writes where the change log is at and how many changes were applied as text.
+ *
+ * @param[in] f The file to write to.
+ */
+void change_log_write(FILE *f);
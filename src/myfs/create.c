@@ -321,12 +321,55 @@ create_run_create_config(create_params_t *params) {
         return false;
     }
 
+    fprintf(f, "# Whether or not creates return before the new file is inserted. New files are inserted in batches every\n");
+    fprintf(f, "# async_create_flush_ms, or before anything else changes. A new file whose name another mount took first is\n");
+    fprintf(f, "# dropped. Needs id_range_size. Only used with the mariadb backend.\n");
+    fprintf(f, "async_create = false\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Number of milliseconds between inserts of files created asynchronously.\n");
+    fprintf(f, "async_create_flush_ms = 100\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Where files are stored.\n");
+    fprintf(f, "#   mariadb stores them in MariaDB.\n");
+    fprintf(f, "#   sqlite stores them in the local SQLite database sqlite_file, for mounts only used on this host.\n");
+    fprintf(f, "#   memory keeps them in memory and loses them when MyFS exits, for measuring MyFS's own overhead.\n");
+    fprintf(f, "backend = mariadb\n");
+    fprintf(f, "\n");
+    fprintf(f, "# A directory on a local disk to cache file data blocks in. The cache is kept across restarts. If blank,\n");
+    fprintf(f, "# blocks are not cached.\n");
+    fprintf(f, "block_cache_dir =\n");
+    fprintf(f, "\n");
+    fprintf(f, "# The number of bytes of file data to keep in the block cache. The least recently used blocks are\n");
+    fprintf(f, "# replaced when it's full.\n");
+    fprintf(f, "block_cache_size = 1073741824\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Whether or not to record every change in the change_log table and watch it for other mounts' changes.\n");
+    fprintf(f, "# This lets the kernel cache file data and attributes for longer. Every mount of the database must turn\n");
+    fprintf(f, "# it on. Only used with the mariadb backend.\n");
+    fprintf(f, "change_log = false\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Number of milliseconds between reads of the change log for other mounts' changes.\n");
+    fprintf(f, "change_log_poll_ms = 250\n");
+    fprintf(f, "\n");
     fprintf(f, "# Number of seconds to wait before retrying a failed query. -1 means do not retry.\n");
     fprintf(f, "failed_query_retry_count = %d\n", config_get_int("failed_query_retry_count"));
     fprintf(f, "\n");
     fprintf(f, "# The total number of failed queries to retry. If `retry_wait` is -1, this option is ignored. -1 means retry forever.\n");
     fprintf(f, "failed_query_retry_wait = %d\n", config_get_int("failed_query_retry_wait"));
     fprintf(f, "\n");
+    fprintf(f, "# Number of seconds to cache user and group lookups for, including lookups that found nothing. 0 disables the cache.\n");
+    fprintf(f, "id_cache_ttl = %d\n", config_get_int("id_cache_ttl"));
+    fprintf(f, "\n");
+    fprintf(f, "# Number of File IDs each mount reserves from the id_ranges table at a time, so creates don't wait on\n");
+    fprintf(f, "# MariaDB's AUTO_INCREMENT. 0 lets MariaDB assign them. Every mount of the database must use ranges, since\n");
+    fprintf(f, "# IDs MariaDB assigns can fall in another mount's range, which fails that mount's creates until it reserves\n");
+    fprintf(f, "# a new one.\n");
+    fprintf(f, "id_range_size = 10000\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Number of seconds a write lease lasts without being renewed. A mount that recalls a lease from a mount\n");
+    fprintf(f, "# that's gone waits this long.\n");
+    fprintf(f, "lease_ttl = 30\n");
+    fprintf(f, "\n");
     fprintf(f, "# Whether or not to log to the console.\n");
     fprintf(f, "log_stdout = true\n");
     fprintf(f, "\n");
@@ -348,14 +391,53 @@ create_run_create_config(create_params_t *params) {
     fprintf(f, "# The MariaDB user.\n");
     fprintf(f, "mariadb_user = %s\n", params->mariadb_user);
     fprintf(f, "\n");
+    fprintf(f, "# The file to periodically write counters and latency histograms to. If blank, metrics are only kept in\n");
+    fprintf(f, "# memory.\n");
+    fprintf(f, "metrics_file =\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Number of seconds between writes to the metrics file.\n");
+    fprintf(f, "metrics_interval = 10\n");
+    fprintf(f, "\n");
     fprintf(f, "# The mount point for the file system.\n");
     fprintf(f, "mount = %s\n", params->mount);
     fprintf(f, "\n");
+    fprintf(f, "# How file ownership is read.\n");
+    fprintf(f, "#   name looks up the stored user and group names on this host, so hosts only need matching names.\n");
+    fprintf(f, "#   id reads the stored UID and GID, so hosts need matching IDs.\n");
+    fprintf(f, "ownership_mode = name\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Number of seconds between logging the database statements that took the most time. 0 means do not\n");
+    fprintf(f, "# log them.\n");
+    fprintf(f, "query_summary_interval = 0\n");
+    fprintf(f, "\n");
+    fprintf(f, "# The number of statements to log in each summary.\n");
+    fprintf(f, "query_summary_top = 10\n");
+    fprintf(f, "\n");
+    fprintf(f, "# The number of bytes of file data reported as the file system's size. 0 means no quota.\n");
+    fprintf(f, "quota_bytes = 0\n");
+    fprintf(f, "\n");
+    fprintf(f, "# The number of files reported as the file system's inode count. 0 means no quota.\n");
+    fprintf(f, "quota_files = 0\n");
+    fprintf(f, "\n");
     fprintf(f, "# Determines when reclaimer should run.\n");
     fprintf(f, "#   0 is off.\n");
     fprintf(f, "#   1 is optimistic and will run whenever it thinks nothing is going on.\n");
     fprintf(f, "#   2 is aggressive and will run whenever a database operation occurs where space can be reclaimed.\n");
     fprintf(f, "reclaimer_level = 1\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Database queries that take at least this many milliseconds are logged in full. 0 means do not log them.\n");
+    fprintf(f, "slow_query_ms = 1000\n");
+    fprintf(f, "\n");
+    fprintf(f, "# The SQLite database to store files in when backend is sqlite. It's created if it doesn't exist.\n");
+    fprintf(f, "sqlite_file = /var/lib/myfs/myfs.db\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Whether or not to lease files to the mount writing them, so it can keep writes in memory and send them\n");
+    fprintf(f, "# in large batches. Other mounts that open the file recall the lease first. Only used with the mariadb backend.\n");
+    fprintf(f, "write_leases = false\n");
+    fprintf(f, "\n");
+    fprintf(f, "# Whether or not to let the kernel cache writes and send them in large batches. File sizes and modified\n");
+    fprintf(f, "# times are kept by the kernel until the writes are flushed.\n");
+    fprintf(f, "writeback_cache = false\n");
     fclose(f);
 
     params->config_created = true;
@@ -414,6 +496,38 @@ create_run_create_database(create_params_t *params) {
         return false;
     }
 
+    //Create the `fs_stats` table
+    create_get_sql_database_table4(sql, sizeof(sql));
+    success = db_queryf(&params->db, "%s", sql);
+    if (!success) {
+        printf("  Error creating table 'fs_stats': %s\n", db_error(&params->db));
+        return false;
+    }
+
+    //Create the `change_log` table
+    create_get_sql_database_table5(sql, sizeof(sql));
+    success = db_queryf(&params->db, "%s", sql);
+    if (!success) {
+        printf("  Error creating table 'change_log': %s\n", db_error(&params->db));
+        return false;
+    }
+
+    //Create the `leases` table
+    create_get_sql_database_table6(sql, sizeof(sql));
+    success = db_queryf(&params->db, "%s", sql);
+    if (!success) {
+        printf("  Error creating table 'leases': %s\n", db_error(&params->db));
+        return false;
+    }
+
+    //Create the `id_ranges` table
+    create_get_sql_database_table7(sql, sizeof(sql));
+    success = db_queryf(&params->db, "%s", sql);
+    if (!success) {
+        printf("  Error creating table 'id_ranges': %s\n", db_error(&params->db));
+        return false;
+    }
+
     //Insert data.
     printf("Adding root directory and protecting it.\n");
 
@@ -438,6 +552,13 @@ create_run_create_database(create_params_t *params) {
         return false;
     }
 
+    create_get_sql_database_insert4(sql, sizeof(sql));
+    success = db_queryf(&params->db, "%s", sql);
+    if (!success) {
+        printf("  Error inserting File ID range: %s\n", db_error(&params->db));
+        return false;
+    }
+
     //Create the users if needed.
     if (params->create_database_user) {
         printf("Creating database user '%s'\n", params->mariadb_user);
@@ -541,8 +662,11 @@ create_get_sql_database_table1(char *dst, size_t size) {
                         "    `type` enum('File','Directory','Soft Link') NOT NULL,\n"
                         "    `user` varchar(%u) NOT NULL,\n"
                         "    `group` varchar(%u) NOT NULL,\n"
+                        "    `uid` int(10) unsigned DEFAULT NULL,\n"
+                        "    `gid` int(10) unsigned DEFAULT NULL,\n"
                         "    `mode` smallint(5) unsigned NOT NULL,\n"
                         "    `size` bigint(20) unsigned NOT NULL,\n"
+                        "    `version` bigint(20) unsigned NOT NULL DEFAULT 0,\n"
                         "    `created_on` bigint(20) NOT NULL,\n"
                         "    `last_accessed_on` bigint(20) NOT NULL,\n"
                         "    `last_modified_on` bigint(20) NOT NULL,\n"
@@ -582,6 +706,59 @@ create_get_sql_database_table3(char *dst, size_t size) {
                         CREATE_ENGINE, CREATE_CHARSET, CREATE_COLLATE);
 }
 
+void
+create_get_sql_database_table4(char *dst, size_t size) {
+    snprintf(dst, size, "CREATE TABLE `fs_stats` (\n"
+                        "    `shard` tinyint(3) unsigned NOT NULL,\n"
+                        "    `files` bigint(20) NOT NULL,\n"
+                        "    `bytes` bigint(20) NOT NULL,\n"
+                        "    PRIMARY KEY (`shard`)\n"
+                        ") ENGINE=%s DEFAULT CHARSET=%s COLLATE=%s;",
+                        CREATE_ENGINE, CREATE_CHARSET, CREATE_COLLATE);
+}
+
+void
+create_get_sql_database_table5(char *dst, size_t size) {
+    snprintf(dst, size, "CREATE TABLE `change_log` (\n"
+                        "    `change_id` bigint(20) unsigned NOT NULL AUTO_INCREMENT,\n"
+                        "    `file_id` int(10) unsigned NOT NULL,\n"
+                        "    `parent_id` int(10) unsigned NOT NULL,\n"
+                        "    `name` varchar(%u) NOT NULL,\n"
+                        "    `version` bigint(20) unsigned NOT NULL,\n"
+                        "    `op` enum('Create','Delete','Write','Attr','Rename') NOT NULL,\n"
+                        "    `mount_id` int(10) unsigned NOT NULL,\n"
+                        "    `created_on` bigint(20) NOT NULL,\n"
+                        "    PRIMARY KEY (`change_id`),\n"
+                        "    KEY `k_changelog_createdon` (`created_on`)\n"
+                        ") ENGINE=%s DEFAULT CHARSET=%s COLLATE=%s;",
+                        MYFS_FILE_NAME_MAX_LEN,
+                        CREATE_ENGINE, CREATE_CHARSET, CREATE_COLLATE);
+}
+
+void
+create_get_sql_database_table6(char *dst, size_t size) {
+    snprintf(dst, size, "CREATE TABLE `leases` (\n"
+                        "    `file_id` int(10) unsigned NOT NULL,\n"
+                        "    `mount_id` int(10) unsigned NOT NULL,\n"
+                        "    `expires_on` bigint(20) NOT NULL,\n"
+                        "    `recalled` tinyint(1) unsigned NOT NULL DEFAULT 0,\n"
+                        "    PRIMARY KEY (`file_id`),\n"
+                        "    KEY `k_leases_mountid` (`mount_id`),\n"
+                        "    CONSTRAINT `fk_leases_fileid` FOREIGN KEY (`file_id`) REFERENCES `files` (`file_id`) ON DELETE CASCADE ON UPDATE CASCADE\n"
+                        ") ENGINE=%s DEFAULT CHARSET=%s COLLATE=%s;",
+                        CREATE_ENGINE, CREATE_CHARSET, CREATE_COLLATE);
+}
+
+void
+create_get_sql_database_table7(char *dst, size_t size) {
+    snprintf(dst, size, "CREATE TABLE `id_ranges` (\n"
+                        "    `name` varchar(32) NOT NULL,\n"
+                        "    `next_id` int(10) unsigned NOT NULL,\n"
+                        "    PRIMARY KEY (`name`)\n"
+                        ") ENGINE=%s DEFAULT CHARSET=%s COLLATE=%s;",
+                        CREATE_ENGINE, CREATE_CHARSET, CREATE_COLLATE);
+}
+
 void
 create_get_sql_database_insert1(char *dst, size_t size) {
     strlcpy(dst, "SET SESSION sql_mode=CONCAT(@@SESSION.sql_mode,',','NO_AUTO_VALUE_ON_ZERO');", size);
@@ -589,8 +766,8 @@ create_get_sql_database_insert1(char *dst, size_t size) {
 
 void
 create_get_sql_database_insert2(char *dst, size_t size, const char *user, const char *group) {
-    snprintf(dst, size, "INSERT INTO `files` (`file_id`,`parent_id`,`name`,`type`,`user`,`group`,`mode`,`content`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\n"
-                        "VALUES (0,0,'','Directory','%s','%s',16893,'',UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP());",
+    snprintf(dst, size, "INSERT INTO `files` (`file_id`,`parent_id`,`name`,`type`,`user`,`group`,`mode`,`size`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\n"
+                        "VALUES (0,0,'','Directory','%s','%s',16893,0,UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP());",
                         user, group);
 }
 
@@ -599,6 +776,11 @@ create_get_sql_database_insert3(char *dst, size_t size) {
     strlcpy(dst, "INSERT INTO `file_protection` (`file_id`)\nVALUES (0);", size);
 }
 
+void
+create_get_sql_database_insert4(char *dst, size_t size) {
+    strlcpy(dst, "INSERT INTO `id_ranges` (`name`,`next_id`)\nVALUES ('files',1);", size);
+}
+
 void
 create_get_sql_database_user_create(char *dst, size_t size, const char *user, const char *host, const char *password) {
     snprintf(dst, size, "CREATE USER '%s'@'%s' IDENTIFIED BY '%s';", user, host, password);
@@ -6,9 +6,14 @@ void create_get_sql_database(char *dst, size_t size, const char *name);
 void create_get_sql_database_table1(char *dst, size_t size);
 void create_get_sql_database_table2(char *dst, size_t size);
 void create_get_sql_database_table3(char *dst, size_t size);
+void create_get_sql_database_table4(char *dst, size_t size);
+void create_get_sql_database_table5(char *dst, size_t size);
+void create_get_sql_database_table6(char *dst, size_t size);
+void create_get_sql_database_table7(char *dst, size_t size);
 void create_get_sql_database_insert1(char *dst, size_t size);
 void create_get_sql_database_insert2(char *dst, size_t size, const char *user, const char *group);
 void create_get_sql_database_insert3(char *dst, size_t size);
+void create_get_sql_database_insert4(char *dst, size_t size);
 void create_get_sql_database_user_create(char *dst, size_t size, const char *user, const char *host, const char *password);
 void create_get_sql_database_user_grant1(char *dst, size_t size, const char *user, const char *host, const char *database);
 void create_get_sql_database_user_grant2(char *dst, size_t size, const char *user, const char *host, const char *database);
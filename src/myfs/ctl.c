@@ -0,0 +1,423 @@
+/**
+ * @file ctl.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "../common/log.h"
+#include "../common/metrics.h"
+#include "../common/trace.h"
+#include "myfs_db.h"
+#include "block_cache.h"
+#include "change_log.h"
+#include "lease.h"
+#include "async_create.h"
+#include "util.h"
+#include "ctl.h"
+
+#define MODULE "Ctl"
+
+/** The longest line that can be written to the `ctl` file. */
+#define CTL_COMMAND_MAX_LEN 256
+
+typedef void (*ctl_contents_t)(myfs_t *myfs, FILE *f);
+
+/**
+ * A file in the control directory.
+ */
+typedef struct {
+    const char *name;               //!< The file's name.
+    mode_t mode;                    //!< The file's permissions.
+    ctl_contents_t contents;        //!< Writes the file's contents when it's opened.
+} ctl_entry_t;
+
+/**
+ * An open control file or directory.
+ */
+typedef struct {
+    bool in_use;                    //!< Whether this handle is open.
+    const ctl_entry_t *entry;       //!< The open file, or `NULL` for the directory.
+    char *data;                     //!< The file's contents, or `NULL` for the directory.
+    size_t len;                     //!< The length of `data`.
+} ctl_file_t;
+
+typedef struct {
+    ctl_file_t files[CTL_HANDLES_MAX];
+    pthread_mutex_t lock;           //!< Protects `files`.
+    time_t mounted;                 //!< Used as the times of every control file.
+} ctl_t;
+
+static ctl_t ctl;
+
+static void
+ctl_contents_stats(myfs_t *myfs, FILE *f) {
+    metrics_write(f, NULL);
+}
+
+static void
+ctl_contents_cache(myfs_t *myfs, FILE *f) {
+    unsigned int i, open = 0;
+
+    util_id_cache_write(f);
+    block_cache_write(f);
+    change_log_write(f);
+    lease_write(f);
+    async_create_write(f);
+
+    for (i = 0; i < MYFS_FILES_OPEN_MAX; i++) {
+        open += myfs->files[i] != NULL;
+    }
+
+    fprintf(f, "open_files                       %u\n", open);
+    fprintf(f, "open_files_max                   %d\n", MYFS_FILES_OPEN_MAX);
+}
+
+static void
+ctl_contents_pool(myfs_t *myfs, FILE *f) {
+    unsigned int i, stmts = 0;
+
+    for (i = 0; i < DB_STMT_CACHE_MAX; i++) {
+        stmts += myfs->db.stmts[i].stmt != NULL;
+    }
+
+    fprintf(f, "backend                          %s\n", myfs->backend->name);
+
+    if (myfs->backend == &myfs_db_backend) {
+        fprintf(f, "connections                      1\n");
+        fprintf(f, "host                             %s\n", mysql_get_host_info(&myfs->db.mysql));
+        fprintf(f, "thread_id                        %lu\n", mysql_thread_id(&myfs->db.mysql));
+        fprintf(f, "stmt_cache                       %u\n", stmts);
+        fprintf(f, "stmt_cache_max                   %d\n", DB_STMT_CACHE_MAX);
+        fprintf(f, "max_allowed_packet               %u\n", myfs->max_allowed_packet);
+    }
+
+    fprintf(f, "blocks_per_insert                %u\n", myfs->blocks_per_insert);
+    fprintf(f, "request_size                     %u\n", myfs->request_size);
+}
+
+static void
+ctl_contents_queries(myfs_t *myfs, FILE *f) {
+    metrics_write(f, "db_");
+    db_profile_write(&myfs->db, f, 0);
+}
+
+static void
+ctl_contents_trace(myfs_t *myfs, FILE *f) {
+    trace_write(f);
+}
+
+static void
+ctl_contents_ctl(myfs_t *myfs, FILE *f) {
+    fprintf(f, "# Write one of these commands to this file, eg. echo flush_id_cache > %s/ctl\n", CTL_PATH);
+    fprintf(f, "flush_block_cache                Empties the block cache.\n");
+    fprintf(f, "flush_id_cache                   Empties the user and group lookup cache.\n");
+    fprintf(f, "id_cache_ttl <seconds>           Sets how long user and group lookups are cached. 0 disables the cache.\n");
+    fprintf(f, "log_level <level>                Sets the minimum log level: error, warn, info or debug.\n");
+    fprintf(f, "trace_dump <path>                Dumps the trace to a file that can be read with --trace-decode.\n");
+}
+
+static const ctl_entry_t ctl_entries[] = {
+    {"stats",   0444, ctl_contents_stats},
+    {"cache",   0444, ctl_contents_cache},
+    {"pool",    0444, ctl_contents_pool},
+    {"queries", 0444, ctl_contents_queries},
+    {"trace",   0444, ctl_contents_trace},
+    {"ctl",     0644, ctl_contents_ctl}
+};
+
+#define CTL_ENTRIES_COUNT (sizeof(ctl_entries) / sizeof(ctl_entries[0]))
+
+/**
+ * Finds the control file for `path`.
+ *
+ * @param[in] path The control path.
+ * @param[out] entry Set to the control file, or `NULL` if `path` is the control directory.
+ * @return `true` if the path exists, otherwise `false`.
+ */
+static bool
+ctl_entry(const char *path, const ctl_entry_t **entry) {
+    const char *name;
+    unsigned int i;
+
+    name = path + strlen(CTL_PATH);
+
+    if (name[0] == '\0') {
+        *entry = NULL;
+        return true;
+    }
+
+    //Skip the slash.
+    name++;
+
+    for (i = 0; i < CTL_ENTRIES_COUNT; i++) {
+        if (strcmp(ctl_entries[i].name, name) == 0) {
+            *entry = &ctl_entries[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int
+ctl_command(const char *command) {
+    char name[32], arg[CTL_COMMAND_MAX_LEN + 1];
+    int count, ttl;
+
+    count = sscanf(command, "%31s %256s", name, arg);
+    if (count < 1) {
+        return 0;
+    }
+
+    if (strcmp(name, "flush_block_cache") == 0 && count == 1) {
+        block_cache_flush();
+    }
+    else if (strcmp(name, "flush_id_cache") == 0 && count == 1) {
+        util_id_cache_flush();
+    }
+    else if (strcmp(name, "id_cache_ttl") == 0 && count == 2) {
+        ttl = atoi(arg);
+        if (ttl < 0) {
+            log_err(MODULE, "Error setting user and group cache TTL: %d is not valid", ttl);
+            return -EINVAL;
+        }
+
+        util_id_cache_set_ttl(ttl);
+    }
+    else if (strcmp(name, "log_level") == 0 && count == 2) {
+        if (strcmp(arg, "error") == 0) {
+            log_set_severity(LOG_SEVERITY_ERR);
+        }
+        else if (strcmp(arg, "warn") == 0) {
+            log_set_severity(LOG_SEVERITY_WARN);
+        }
+        else if (strcmp(arg, "info") == 0) {
+            log_set_severity(LOG_SEVERITY_INFO);
+        }
+        else if (strcmp(arg, "debug") == 0) {
+            log_set_severity(LOG_SEVERITY_DEBUG);
+        }
+        else {
+            log_err(MODULE, "Error setting log level: '%s' is not valid", arg);
+            return -EINVAL;
+        }
+    }
+    else if (strcmp(name, "trace_dump") == 0 && count == 2) {
+        if (!trace_dump(arg)) {
+            return -EIO;
+        }
+    }
+    else {
+        log_err(MODULE, "Unknown command '%s'", command);
+        return -EINVAL;
+    }
+
+    log_info(MODULE, "Ran '%s'", command);
+
+    return 0;
+}
+
+void
+ctl_init() {
+    memset(&ctl, 0, sizeof(ctl));
+
+    pthread_mutex_init(&ctl.lock, NULL);
+    ctl.mounted = time(NULL);
+}
+
+void
+ctl_free() {
+    unsigned int i;
+
+    for (i = 0; i < CTL_HANDLES_MAX; i++) {
+        free(ctl.files[i].data);
+    }
+
+    pthread_mutex_destroy(&ctl.lock);
+}
+
+bool
+ctl_path(const char *path) {
+    size_t len = strlen(CTL_PATH);
+
+    return strncmp(path, CTL_PATH, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+bool
+ctl_handle(struct fuse_file_info *fi) {
+    return fi->fh >= MYFS_FILES_OPEN_MAX && fi->fh < MYFS_FILES_OPEN_MAX + CTL_HANDLES_MAX;
+}
+
+int
+ctl_getattr(const char *path, struct stat *st) {
+    const ctl_entry_t *entry;
+
+    if (!ctl_entry(path, &entry)) {
+        return -ENOENT;
+    }
+
+    memset(st, 0, sizeof(*st));
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_atime = ctl.mounted;
+    st->st_mtime = ctl.mounted;
+    st->st_ctime = ctl.mounted;
+
+    //Files are reported as empty like in /proc. They're opened with direct I/O so they're read anyway.
+    if (entry == NULL) {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+    }
+    else {
+        st->st_mode = S_IFREG | entry->mode;
+        st->st_nlink = 1;
+    }
+
+    return 0;
+}
+
+int
+ctl_open(myfs_t *myfs, const char *path, struct fuse_file_info *fi) {
+    const ctl_entry_t *entry;
+    char *data = NULL;
+    size_t len = 0;
+    unsigned int i;
+    FILE *f;
+
+    if (!ctl_entry(path, &entry)) {
+        return -ENOENT;
+    }
+
+    //Only files with a writable mode can be written to, whatever the modes say to root.
+    if ((fi->flags & O_ACCMODE) != O_RDONLY && (entry == NULL || !(entry->mode & S_IWUSR))) {
+        return -EACCES;
+    }
+
+    if (entry != NULL) {
+        f = open_memstream(&data, &len);
+        if (f == NULL) {
+            return -ENOMEM;
+        }
+
+        entry->contents(myfs, f);
+        fclose(f);
+    }
+
+    pthread_mutex_lock(&ctl.lock);
+
+    for (i = 0; i < CTL_HANDLES_MAX; i++) {
+        if (!ctl.files[i].in_use) {
+            ctl.files[i].in_use = true;
+            ctl.files[i].entry = entry;
+            ctl.files[i].data = data;
+            ctl.files[i].len = len;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&ctl.lock);
+
+    if (i == CTL_HANDLES_MAX) {
+        log_err(MODULE, "Error opening '%s': Maximum number of control files are open", path);
+        free(data);
+        return -EMFILE;
+    }
+
+    //Control file handles come after MyFS's own so the two can be told apart.
+    fi->fh = MYFS_FILES_OPEN_MAX + i;
+    fi->direct_io = 1;
+
+    return 0;
+}
+
+int
+ctl_readdir(const char *path, void *buffer, fuse_fill_dir_t filler) {
+    unsigned int i;
+
+    filler(buffer, ".", NULL, 0, 0);
+    filler(buffer, "..", NULL, 0, 0);
+
+    for (i = 0; i < CTL_ENTRIES_COUNT; i++) {
+        filler(buffer, ctl_entries[i].name, NULL, 0, 0);
+    }
+
+    return 0;
+}
+
+int
+ctl_read(struct fuse_file_info *fi, char *buf, size_t size, off_t offset) {
+    ctl_file_t *file;
+
+    file = &ctl.files[fi->fh - MYFS_FILES_OPEN_MAX];
+
+    if (file->data == NULL) {
+        return -EISDIR;
+    }
+
+    if ((size_t)offset >= file->len) {
+        return 0;
+    }
+
+    if (offset + size > file->len) {
+        size = file->len - offset;
+    }
+
+    memcpy(buf, file->data + offset, size);
+
+    return size;
+}
+
+int
+ctl_write(struct fuse_file_info *fi, const char *buf, size_t size) {
+    char commands[CTL_COMMAND_MAX_LEN + 1], *command, *save;
+    ctl_file_t *file;
+    int ret;
+
+    file = &ctl.files[fi->fh - MYFS_FILES_OPEN_MAX];
+
+    //Only the `ctl` file takes commands.
+    if (file->entry == NULL || !(file->entry->mode & S_IWUSR)) {
+        return -EACCES;
+    }
+
+    if (size > CTL_COMMAND_MAX_LEN) {
+        return -EINVAL;
+    }
+
+    memcpy(commands, buf, size);
+    commands[size] = '\0';
+
+    command = strtok_r(commands, "\n", &save);
+    while (command != NULL) {
+        ret = ctl_command(command);
+        if (ret != 0) {
+            return ret;
+        }
+
+        command = strtok_r(NULL, "\n", &save);
+    }
+
+    return size;
+}
+
+int
+ctl_release(struct fuse_file_info *fi) {
+    ctl_file_t *file;
+
+    file = &ctl.files[fi->fh - MYFS_FILES_OPEN_MAX];
+
+    pthread_mutex_lock(&ctl.lock);
+    free(file->data);
+    file->entry = NULL;
+    file->data = NULL;
+    file->len = 0;
+    file->in_use = false;
+    pthread_mutex_unlock(&ctl.lock);
+
+    return 0;
+}
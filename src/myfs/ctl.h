@@ -0,0 +1,109 @@
+#pragma once
+
+/**
+ * @file ctl.h
+ *
+ * The control directory. MyFS serves a read-only directory at `CTL_PATH` from memory, without touching
+ * MariaDB, so its live state can be read with `cat`:
+ *
+ * - `stats`   All counters and latency histograms.
+ * - `cache`   The user and group lookup cache, the block cache, the change log and the open file table.
+ * - `pool`    The database connection and how requests are sized for it.
+ * - `queries` The database counters, the `myfs_db_*` latency histograms and the profile of every statement.
+ * - `trace`   The trace records of every thread, oldest first.
+ * - `ctl`     Commands written here change MyFS while it's running. Reading it lists the commands.
+ */
+
+#include <stdbool.h>
+#include "myfs.h"
+
+/** The path of the control directory in the mount. */
+#define CTL_PATH "/.myfs"
+
+/** The maximum number of control files and directories that can be open at once. */
+#define CTL_HANDLES_MAX 16
+
+/**
+ * Initializes the control directory. This must be called before any other ctl functions are called.
+ */
+void ctl_init();
+
+/**
+ * Frees the control directory. No more ctl functions can be called after this.
+ */
+void ctl_free();
+
+/**
+ * Determines if `path` is the control directory or something in it.
+ *
+ * @param[in] path The path from FUSE.
+ * @return `true` if it's a control path, otherwise `false`.
+ */
+bool ctl_path(const char *path);
+
+/**
+ * Determines if an open file handle belongs to the control directory.
+ *
+ * @param[in] fi FUSE's file info structure for the open file.
+ * @return `true` if it's a control handle, otherwise `false`.
+ */
+bool ctl_handle(struct fuse_file_info *fi);
+
+/**
+ * Fills in a `struct stat` for a control path.
+ *
+ * @param[in] path The control path.
+ * @param[out] st The buffer to fill in.
+ * @return 0 on success, or a negative errno on failure.
+ */
+int ctl_getattr(const char *path, struct stat *st);
+
+/**
+ * Opens a control file or the control directory. The contents of a file are made when it's opened, so
+ * every read of one open file sees the same snapshot. Only `ctl` can be opened for writing.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] path The control path.
+ * @param[in] fi FUSE's file info structure.
+ * @return 0 on success, or a negative errno on failure.
+ */
+int ctl_open(myfs_t *myfs, const char *path, struct fuse_file_info *fi);
+
+/**
+ * Lists the control directory.
+ *
+ * @param[in] path The control path.
+ * @param[in] buffer The buffer from FUSE.
+ * @param[in] filler FUSE's function to add an entry to `buffer`.
+ * @return 0 on success, or a negative errno on failure.
+ */
+int ctl_readdir(const char *path, void *buffer, fuse_fill_dir_t filler);
+
+/**
+ * Reads from an open control file.
+ *
+ * @param[in] fi FUSE's file info structure for the open file.
+ * @param[out] buf The buffer to read into.
+ * @param[in] size The size of `buf`.
+ * @param[in] offset Where in the file to start reading.
+ * @return The number of bytes read, or a negative errno on failure.
+ */
+int ctl_read(struct fuse_file_info *fi, char *buf, size_t size, off_t offset);
+
+/**
+ * Runs the commands written to the `ctl` file, one per line.
+ *
+ * @param[in] fi FUSE's file info structure for the open file.
+ * @param[in] buf The commands.
+ * @param[in] size The length of `buf`.
+ * @return `size` on success, or a negative errno on failure.
+ */
+int ctl_write(struct fuse_file_info *fi, const char *buf, size_t size);
+
+/**
+ * Closes an open control file or directory.
+ *
+ * @param[in] fi FUSE's file info structure for the open file.
+ * @return 0 on success, or a negative errno on failure.
+ */
+int ctl_release(struct fuse_file_info *fi);
@@ -0,0 +1,1004 @@
+/**
+ * @file import.c
+ *
+ * A directory's rows are committed before its subdirectories are queued, so every row's parent is already
+ * in `files` when it's inserted. The queue is shared by the workers, and the import is done when it's
+ * empty and no worker is still importing a directory that could add to it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../common/log.h"
+#include "../common/config.h"
+#include "../common/string.h"
+#include "../common/db.h"
+#include "util.h"
+#include "change_log.h"
+#include "myfs.h"
+#include "myfs_db.h"
+#include "import.h"
+
+#define MODULE "Import"
+
+/** The number of File IDs reserved from `id_ranges` at a time. */
+#define IMPORT_ID_RANGE_SIZE 100000
+
+/** The most bytes of `files` rows to insert in one statement. It's lowered to `max_allowed_packet` if that's smaller. */
+#define IMPORT_ROWS_SIZE (1024 * 1024)
+
+/** The most bytes one `files` row takes in an INSERT, with its name, user and group escaped. */
+#define IMPORT_ROW_SIZE 512
+
+/** The most entries of a directory imported at once. Their files are all open at the same time. */
+#define IMPORT_OPEN_MAX 256
+
+/** The number of bytes of file data each worker inserts before it commits. */
+#define IMPORT_COMMIT_SIZE (64 * 1024 * 1024)
+
+/** The start of the INSERT for `files` rows. */
+#define IMPORT_FILES_SQL "INSERT INTO `files` (`file_id`,`parent_id`,`name`,`type`,`user`,`group`,`uid`,`gid`,`mode`,`size`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\nVALUES "
+
+/**
+ * A directory waiting to be imported.
+ */
+typedef struct import_dir_t {
+    unsigned int file_id;               //!< Its File ID in MyFS.
+    char *path;                         //!< Its local path.
+    struct import_dir_t *next;          //!< The next directory waiting.
+} import_dir_t;
+
+/**
+ * An entry of the directory being imported.
+ */
+typedef struct {
+    unsigned int file_id;                       //!< Its new File ID.
+    char name[MYFS_FILE_NAME_MAX_LEN + 1];      //!< Its name.
+    myfs_file_type_t type;                      //!< Its type.
+    struct stat st;                             //!< Its local attributes.
+    int fd;                                     //!< A regular file, opened before its row is inserted, otherwise -1.
+    char *target;                               //!< A soft link's target, read before its row is inserted, otherwise `NULL`.
+} import_file_t;
+
+/**
+ * A worker, with the blocks it hasn't inserted yet.
+ */
+typedef struct {
+    pthread_t thread;                                   //!< The thread.
+    db_t db;                                            //!< The worker's database connection.
+    char *sql;                                          //!< Where `files` INSERTs are built.
+    char *ids;                                          //!< Where `change_log` INSERTs are built.
+    char *data;                                         //!< The blocks that haven't been inserted, MYFS_FILE_BLOCK_SIZE apart.
+    unsigned int file_ids[MYFS_INSERT_BLOCKS_MAX];      //!< The File ID of each block.
+    unsigned int indexes[MYFS_INSERT_BLOCKS_MAX];       //!< The index of each block in its file.
+    unsigned long lengths[MYFS_INSERT_BLOCKS_MAX];      //!< The length of each block.
+    unsigned int blocks;                                //!< The number of blocks in `data`.
+    size_t uncommitted;                                 //!< Bytes of data inserted since the last commit.
+    bool transaction;                                   //!< Whether a transaction is open for data.
+} import_worker_t;
+
+typedef struct {
+    char user_esc[MYFS_USER_NAME_MAX_LEN * 2 + 1];      //!< The user that owns the files, escaped for queries.
+    char group_esc[MYFS_GROUP_NAME_MAX_LEN * 2 + 1];    //!< The group that owns the files, escaped for queries.
+    char uid_sql[16];                                   //!< The UID of the user for queries, or NULL.
+    char gid_sql[16];                                   //!< The GID of the group for queries, or NULL.
+    bool change_log;                                    //!< Whether new files are recorded in `change_log`.
+    size_t rows_size;                                   //!< The most bytes of `files` rows per statement.
+    unsigned int blocks_per_insert;                     //!< The most blocks per `file_data` statement.
+    pthread_mutex_t lock;                               //!< Protects everything below.
+    pthread_cond_t cond;                                //!< Signaled when a directory is queued or a worker finishes one.
+    import_dir_t *dirs;                                 //!< The directories waiting to be imported.
+    unsigned int busy;                                  //!< The number of workers importing a directory.
+    bool failed;                                        //!< Set when a worker fails, so the others stop.
+    unsigned int id_next;                               //!< The next reserved File ID.
+    unsigned int id_end;                                //!< The end of the reserved range.
+    _Atomic uint64_t files;                             //!< Files imported.
+    _Atomic uint64_t bytes;                             //!< Bytes of data imported.
+    _Atomic uint64_t skipped;                           //!< Entries that couldn't be imported.
+} import_t;
+
+static import_t import;
+
+/**
+ * Connects to MariaDB with the settings from the config.
+ */
+static bool
+import_connect(db_t *db) {
+    bool success;
+
+    success = db_connect(db, config_get("mariadb_host"), config_get("mariadb_user"), config_get("mariadb_password"), config_get("mariadb_database"), config_get_uint("mariadb_port"));
+    if (!success) {
+        log_err(MODULE, "Error connecting to MariaDB: %s", db_error(db));
+        return false;
+    }
+
+    db_set_failed_query_options(db, config_get_int("failed_query_retry_wait"), config_get_int("failed_query_retry_count"));
+    db_set_profile_options(db, config_get_uint("slow_query_ms"), 0, 0);
+
+    return true;
+}
+
+/**
+ * Escapes the owner for queries, looks up its IDs and sizes statements from MariaDB's `max_allowed_packet`.
+ */
+static bool
+import_setup(db_t *db) {
+    unsigned int max_allowed_packet = 0, blocks;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    uid_t uid;
+    gid_t gid;
+    char *esc;
+
+    esc = db_escape(db, config_get("user"), NULL);
+    strlcpy(import.user_esc, esc, sizeof(import.user_esc));
+    free(esc);
+
+    esc = db_escape(db, config_get("group"), NULL);
+    strlcpy(import.group_esc, esc, sizeof(import.group_esc));
+    free(esc);
+
+    //Like a mount, both the names and the IDs are stored so clients in either ownership mode can read the files.
+    strlcpy(import.uid_sql, "NULL", sizeof(import.uid_sql));
+    if (util_user_id(config_get("user"), &uid) == 0) {
+        snprintf(import.uid_sql, sizeof(import.uid_sql), "%u", uid);
+    }
+
+    strlcpy(import.gid_sql, "NULL", sizeof(import.gid_sql));
+    if (util_group_id(config_get("group"), &gid) == 0) {
+        snprintf(import.gid_sql, sizeof(import.gid_sql), "%u", gid);
+    }
+
+    res = db_select(db, "SHOW VARIABLES LIKE 'max_allowed_packet'", 40);
+    if (res == NULL) {
+        log_err(MODULE, "Error getting 'max_allowed_packet' variable: %s", db_error(db));
+        return false;
+    }
+
+    row = mysql_fetch_row(res);
+    if (row != NULL && row[1] != NULL) {
+        max_allowed_packet = strtoul(row[1], NULL, 10);
+    }
+    mysql_free_result(res);
+
+    if (max_allowed_packet == 0) {
+        log_err(MODULE, "Error getting 'max_allowed_packet' variable: Not found");
+        return false;
+    }
+
+    import.rows_size = IMPORT_ROWS_SIZE;
+    if (import.rows_size > max_allowed_packet) {
+        import.rows_size = max_allowed_packet;
+    }
+
+    //The same sizes a mount writes with. See `myfs_db_request_sizes()`.
+    blocks = max_allowed_packet / (MYFS_FILE_BLOCK_SIZE + 64);
+
+    import.blocks_per_insert = 1;
+    while (import.blocks_per_insert * 2 <= blocks && import.blocks_per_insert < MYFS_INSERT_BLOCKS_MAX) {
+        import.blocks_per_insert *= 2;
+    }
+
+    import.change_log = config_equals("change_log", "true");
+
+    return true;
+}
+
+/**
+ * Finds the MyFS directory to import into.
+ *
+ * @param[in] db The database connection.
+ * @param[in] into The directory's path.
+ * @param[out] file_id Set to the directory's File ID.
+ * @return `true` if it was found and is a directory, otherwise `false`.
+ */
+static bool
+import_resolve(db_t *db, const char *into, unsigned int *file_id) {
+    myfs_file_type_t type = MYFS_FILE_TYPE_DIRECTORY;
+    char path[MYFS_PATH_NAME_MAX_LEN + 1];
+    char *name, *name_esc, *save;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    bool found;
+
+    //Start at the root.
+    *file_id = 0;
+    strlcpy(path, into, sizeof(path));
+
+    for (name = strtok_r(path, "/", &save); name != NULL; name = strtok_r(NULL, "/", &save)) {
+        name_esc = db_escape(db, name, NULL);
+
+        res = db_selectf(db, "SELECT `file_id`,`type`\n"
+                             "FROM `files`\n"
+                             "WHERE `parent_id`=%u\n"
+                             "AND `name`='%s'\n"
+                             "AND `file_id`!=0",
+                             *file_id, name_esc);
+
+        free(name_esc);
+
+        if (res == NULL) {
+            log_err(MODULE, "Error finding '%s': %s", into, db_error(db));
+            return false;
+        }
+
+        row = mysql_fetch_row(res);
+        found = row != NULL;
+        if (found) {
+            *file_id = strtoul(row[0], NULL, 10);
+            type = myfs_file_type(row[1]);
+        }
+        mysql_free_result(res);
+
+        if (!found || type != MYFS_FILE_TYPE_DIRECTORY) {
+            log_err(MODULE, "Error finding '%s': %s", into, found ? "Not a directory" : "Not found");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Queues a directory whose row is committed, for a worker to import its entries.
+ *
+ * @return `true` on success, or `false` if it couldn't be allocated.
+ */
+static bool
+import_queue(unsigned int file_id, const char *path) {
+    import_dir_t *dir;
+
+    dir = malloc(sizeof(*dir));
+    if (dir == NULL || (dir->path = strdup(path)) == NULL) {
+        log_err(MODULE, "Error queueing '%s': Out of memory", path);
+        free(dir);
+        return false;
+    }
+
+    dir->file_id = file_id;
+
+    pthread_mutex_lock(&import.lock);
+    dir->next = import.dirs;
+    import.dirs = dir;
+    pthread_cond_signal(&import.cond);
+    pthread_mutex_unlock(&import.lock);
+
+    return true;
+}
+
+/**
+ * Hands out File IDs for a directory's entries, reserving ranges from `id_ranges` as they're used up.
+ */
+static bool
+import_ids(db_t *db, import_file_t *files, unsigned int count) {
+    bool success = true;
+    unsigned int i;
+
+    pthread_mutex_lock(&import.lock);
+
+    for (i = 0; i < count && success; i++) {
+        if (import.id_next == import.id_end) {
+            success = myfs_db_id_reserve(db, IMPORT_ID_RANGE_SIZE, &import.id_next);
+            import.id_end = success ? import.id_next + IMPORT_ID_RANGE_SIZE : import.id_next;
+        }
+
+        if (success) {
+            files[i].file_id = import.id_next++;
+        }
+    }
+
+    pthread_mutex_unlock(&import.lock);
+
+    return success;
+}
+
+/**
+ * Adds file system stats for new files.
+ */
+static bool
+import_stats_add(db_t *db, unsigned int file_id, long long files, long long bytes) {
+    bool success;
+
+    success = db_queryf(db, "INSERT INTO `fs_stats` (`shard`,`files`,`bytes`)\n"
+                            "VALUES (%u,%lld,%lld)\n"
+                            "ON DUPLICATE KEY UPDATE `files`=`files`+VALUES(`files`),`bytes`=`bytes`+VALUES(`bytes`)",
+                            file_id % MYFS_DB_STATS_SHARDS, files, bytes);
+
+    if (!success) {
+        log_err(MODULE, "Error updating file system stats: %s", db_error(db));
+    }
+
+    return success;
+}
+
+/**
+ * Formats an entry as a row of `IMPORT_FILES_SQL` values. Its accessed and modified times are kept, and
+ * it's created and changed now.
+ *
+ * @return The length of the row. If it's `size` or more, the row didn't fit.
+ */
+static size_t
+import_row_sql(db_t *db, char *dst, size_t size, unsigned int parent_id, const import_file_t *file, time_t now) {
+    char *name_esc;
+    int len;
+
+    name_esc = db_escape(db, file->name, NULL);
+
+    len = snprintf(dst, size, "(%u,%u,'%s','%s','%s','%s',%s,%s,%u,%lld,%lld,%lld,%lld,%lld)",
+                   file->file_id, parent_id, name_esc, myfs_file_type_str(file->type), import.user_esc, import.group_esc, import.uid_sql, import.gid_sql, file->st.st_mode,
+                   file->type == MYFS_FILE_TYPE_DIRECTORY ? 0LL : (long long)file->st.st_size,
+                   (long long)now, (long long)file->st.st_atime, (long long)file->st.st_mtime, (long long)now);
+
+    free(name_esc);
+
+    return len;
+}
+
+/**
+ * Inserts the `files` rows for a directory's entries in one transaction, with as many rows per statement
+ * as fit in a packet.
+ */
+static bool
+import_files_insert(import_worker_t *worker, import_dir_t *dir, import_file_t *files, unsigned int count) {
+    size_t sql_len, ids_len, len;
+    char row[IMPORT_ROW_SIZE];
+    unsigned int i, start;
+    long long bytes = 0;
+    bool success;
+    time_t now;
+
+    if (count == 0) {
+        return true;
+    }
+
+    success = import_ids(&worker->db, files, count);
+    if (!success) {
+        return false;
+    }
+
+    success = db_transaction_start(&worker->db);
+    if (!success) {
+        log_err(MODULE, "Error importing '%s': Failed to start transaction: %s", dir->path, db_error(&worker->db));
+        return false;
+    }
+
+    now = time(NULL);
+
+    for (i = 0; i < count && success;) {
+        sql_len = strlcpy(worker->sql, IMPORT_FILES_SQL, import.rows_size);
+        ids_len = snprintf(worker->ids, import.rows_size, "INSERT INTO `change_log` (`file_id`,`parent_id`,`name`,`version`,`op`,`mount_id`,`created_on`)\n"
+                                                          "SELECT `file_id`,`parent_id`,`name`,`version`,'%s',0,UNIX_TIMESTAMP()\n"
+                                                          "FROM `files`\n"
+                                                          "WHERE `file_id` IN (",
+                                                          change_log_op_str(CHANGE_LOG_OP_CREATE));
+
+        for (start = i; i < count; i++) {
+            len = import_row_sql(&worker->db, row, sizeof(row), dir->file_id, &files[i], now);
+            if (sql_len + len + 1 >= import.rows_size && i > start) {
+                break;
+            }
+
+            if (i > start) {
+                worker->sql[sql_len++] = ',';
+                worker->ids[ids_len++] = ',';
+            }
+            memcpy(worker->sql + sql_len, row, len);
+            sql_len += len;
+            ids_len += snprintf(worker->ids + ids_len, import.rows_size - ids_len, "%u", files[i].file_id);
+
+            if (files[i].type != MYFS_FILE_TYPE_DIRECTORY) {
+                bytes += files[i].st.st_size;
+            }
+        }
+
+        success = db_query(&worker->db, worker->sql, sql_len);
+        if (!success) {
+            log_err(MODULE, "Error importing '%s': %s", dir->path, db_error(&worker->db));
+            break;
+        }
+
+        //Mounts that read the change log drop what they cached about the directory.
+        if (import.change_log) {
+            ids_len += snprintf(worker->ids + ids_len, import.rows_size - ids_len, ")");
+
+            success = db_query(&worker->db, worker->ids, ids_len);
+            if (!success) {
+                log_err(MODULE, "Error importing '%s': Error logging creates: %s", dir->path, db_error(&worker->db));
+            }
+        }
+    }
+
+    success = success && import_stats_add(&worker->db, dir->file_id, count, bytes);
+
+    success = db_transaction_stop(&worker->db, success) && success;
+
+    if (success) {
+        import.files += count;
+    }
+
+    return success;
+}
+
+/**
+ * Commits the data inserted since the last commit.
+ */
+static bool
+import_commit(import_worker_t *worker) {
+    bool success;
+
+    if (!worker->transaction) {
+        return true;
+    }
+
+    success = db_transaction_stop(&worker->db, true);
+    if (!success) {
+        log_err(MODULE, "Error committing file data: %s", db_error(&worker->db));
+    }
+
+    worker->transaction = false;
+    worker->uncommitted = 0;
+
+    return success;
+}
+
+/**
+ * Inserts the buffered blocks with prepared statements of up to `import.blocks_per_insert` rows. Like a
+ * mount's, batches are always a power of two so only a handful of statements are ever prepared.
+ */
+static bool
+import_blocks_insert(import_worker_t *worker) {
+    MYSQL_BIND params[MYFS_INSERT_BLOCKS_MAX * 3];
+    char query[64 + MYFS_INSERT_BLOCKS_MAX * 8];
+    unsigned int first = 0, batch, i;
+    bool success;
+    int query_len;
+
+    if (worker->blocks == 0) {
+        return true;
+    }
+
+    if (!worker->transaction) {
+        success = db_transaction_start(&worker->db);
+        if (!success) {
+            log_err(MODULE, "Error inserting file data: Failed to start transaction: %s", db_error(&worker->db));
+            return false;
+        }
+
+        worker->transaction = true;
+    }
+
+    while (first < worker->blocks) {
+        batch = import.blocks_per_insert;
+        while (batch > worker->blocks - first) {
+            batch /= 2;
+        }
+
+        query_len = snprintf(query, sizeof(query), "INSERT INTO `file_data` (`file_id`,`index`,`data`)\n"
+                                                   "VALUES (?,?,?)");
+
+        for (i = first; i < first + batch; i++) {
+            db_bind_uint(&params[(i - first) * 3], &worker->file_ids[i]);
+            db_bind_uint(&params[(i - first) * 3 + 1], &worker->indexes[i]);
+            db_bind_blob(&params[(i - first) * 3 + 2], worker->data + (size_t)i * MYFS_FILE_BLOCK_SIZE, &worker->lengths[i]);
+
+            if (i > first) {
+                query_len += snprintf(query + query_len, sizeof(query) - query_len, ",(?,?,?)");
+            }
+
+            worker->uncommitted += worker->lengths[i];
+        }
+
+        success = db_stmt_execute(&worker->db, query, params);
+        if (!success) {
+            log_err(MODULE, "Error inserting %u blocks for File ID %u: %s", batch, worker->file_ids[first], db_error(&worker->db));
+            return false;
+        }
+
+        first += batch;
+    }
+
+    worker->blocks = 0;
+
+    if (worker->uncommitted >= IMPORT_COMMIT_SIZE) {
+        return import_commit(worker);
+    }
+
+    return true;
+}
+
+/**
+ * Adds `len` bytes that were read into `worker->data` after the buffered blocks as the next blocks of a
+ * file, and inserts the blocks once the buffer is full.
+ */
+static bool
+import_blocks_add(import_worker_t *worker, unsigned int file_id, unsigned int *index, size_t len) {
+    while (len > 0) {
+        worker->lengths[worker->blocks] = len < MYFS_FILE_BLOCK_SIZE ? len : MYFS_FILE_BLOCK_SIZE;
+        worker->file_ids[worker->blocks] = file_id;
+        worker->indexes[worker->blocks] = (*index)++;
+
+        len -= worker->lengths[worker->blocks];
+        worker->blocks++;
+    }
+
+    if (worker->blocks == import.blocks_per_insert) {
+        return import_blocks_insert(worker);
+    }
+
+    return true;
+}
+
+/**
+ * Reads until `size` bytes are read or the end of the file.
+ *
+ * @return The number of bytes read, or -1 on error.
+ */
+static ssize_t
+import_read(int fd, char *buf, size_t size) {
+    size_t total = 0;
+    ssize_t len;
+
+    while (total < size) {
+        len = read(fd, buf + total, size - total);
+        if (len == 0) {
+            break;
+        }
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        total += len;
+    }
+
+    return total;
+}
+
+/**
+ * Opens a regular file or reads a soft link's target, so an entry that can't be read is skipped before its
+ * row is inserted.
+ *
+ * @return `true` if the entry can be imported, otherwise `false`.
+ */
+static bool
+import_file_open(int dir_fd, import_dir_t *dir, import_file_t *file) {
+    char target[MYFS_FILE_BLOCK_SIZE];
+    ssize_t len;
+
+    file->fd = -1;
+    file->target = NULL;
+
+    if (file->type == MYFS_FILE_TYPE_FILE) {
+        file->fd = openat(dir_fd, file->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (file->fd == -1) {
+            log_warn(MODULE, "Skipping '%s/%s': %s", dir->path, file->name, strerror(errno));
+            return false;
+        }
+    }
+    else if (file->type == MYFS_FILE_TYPE_SOFT_LINK) {
+        //Targets are shorter than a block, so they always fit in one.
+        len = readlinkat(dir_fd, file->name, target, sizeof(target));
+        if (len < 0 || (size_t)len == sizeof(target)) {
+            log_warn(MODULE, "Skipping '%s/%s': %s", dir->path, file->name, len < 0 ? strerror(errno) : "Target too long");
+            return false;
+        }
+
+        file->target = strndup(target, len);
+        file->st.st_size = len;
+    }
+
+    return true;
+}
+
+/**
+ * Closes what `import_file_open()` opened.
+ */
+static void
+import_file_close(import_file_t *file) {
+    if (file->fd != -1) {
+        close(file->fd);
+        file->fd = -1;
+    }
+
+    free(file->target);
+    file->target = NULL;
+}
+
+/**
+ * Streams a regular file's data, or a soft link's target, into the worker's blocks. Small files share
+ * statements with the files after them. If a file's size changed since its row was inserted, or it
+ * couldn't be read to the end, the row is fixed to the data that was imported.
+ */
+static bool
+import_file_data(import_worker_t *worker, import_dir_t *dir, import_file_t *file) {
+    unsigned int index = 0;
+    ssize_t len = 0;
+    off_t size = 0;
+    bool success = true;
+    size_t space;
+
+    //A block is always free, since the buffer is inserted as soon as it fills.
+    if (file->type == MYFS_FILE_TYPE_SOFT_LINK) {
+        size = file->st.st_size;
+        memcpy(worker->data + (size_t)worker->blocks * MYFS_FILE_BLOCK_SIZE, file->target, size);
+        success = import_blocks_add(worker, file->file_id, &index, size);
+    }
+    else {
+        //Read straight into the free blocks. A short read means the end of the file.
+        do {
+            space = (size_t)(import.blocks_per_insert - worker->blocks) * MYFS_FILE_BLOCK_SIZE;
+
+            len = import_read(file->fd, worker->data + (size_t)worker->blocks * MYFS_FILE_BLOCK_SIZE, space);
+            if (len < 0) {
+                log_warn(MODULE, "Error reading '%s/%s': %s: Keeping the first %lld bytes", dir->path, file->name, strerror(errno), (long long)size);
+                break;
+            }
+
+            size += len;
+            success = import_blocks_add(worker, file->file_id, &index, len);
+        } while (success && (size_t)len == space);
+    }
+
+    if (!success) {
+        return false;
+    }
+
+    import.bytes += size;
+
+    if (size == file->st.st_size) {
+        return true;
+    }
+
+    if (len >= 0) {
+        log_warn(MODULE, "'%s/%s' changed while it was imported: Its size is now %lld", dir->path, file->name, (long long)size);
+    }
+
+    //The blocks have to be in the same transaction as the fix.
+    success = import_blocks_insert(worker);
+    if (!success) {
+        return false;
+    }
+
+    if (!worker->transaction) {
+        success = db_transaction_start(&worker->db);
+        if (!success) {
+            log_err(MODULE, "Error fixing the size of File ID %u: Failed to start transaction: %s", file->file_id, db_error(&worker->db));
+            return false;
+        }
+
+        worker->transaction = true;
+    }
+
+    success = db_queryf(&worker->db, "UPDATE `files`\n"
+                                     "SET `size`=%lld\n"
+                                     "WHERE `file_id`=%u",
+                                     (long long)size,
+                                     file->file_id);
+
+    if (!success) {
+        log_err(MODULE, "Error fixing the size of File ID %u: %s", file->file_id, db_error(&worker->db));
+        return false;
+    }
+
+    return import_stats_add(&worker->db, file->file_id, 0, size - file->st.st_size);
+}
+
+/**
+ * Imports some of a directory's entries. Their files are opened first, and the ones that can't be read are
+ * skipped. Then their rows are inserted, subdirectories are queued and their data is streamed.
+ */
+static bool
+import_entries(import_worker_t *worker, int dir_fd, import_dir_t *dir, import_file_t *files, unsigned int count) {
+    char path[PATH_MAX + 1];
+    unsigned int opened = 0, i;
+    bool success;
+
+    for (i = 0; i < count; i++) {
+        if (!import_file_open(dir_fd, dir, &files[i])) {
+            import.skipped++;
+            continue;
+        }
+
+        files[opened++] = files[i];
+    }
+
+    //The rows get their own transaction, so the earlier entries' data is committed first.
+    success = import_blocks_insert(worker) && import_commit(worker) && import_files_insert(worker, dir, files, opened);
+
+    for (i = 0; i < opened && success; i++) {
+        if (files[i].type == MYFS_FILE_TYPE_DIRECTORY) {
+            snprintf(path, sizeof(path), "%s/%s", dir->path, files[i].name);
+            success = import_queue(files[i].file_id, path);
+        }
+    }
+
+    for (i = 0; i < opened && success; i++) {
+        if (files[i].type != MYFS_FILE_TYPE_DIRECTORY) {
+            success = import_file_data(worker, dir, &files[i]);
+        }
+    }
+
+    for (i = 0; i < opened; i++) {
+        import_file_close(&files[i]);
+    }
+
+    return success;
+}
+
+/**
+ * Imports a directory's entries, `IMPORT_OPEN_MAX` at a time: their rows, then their data. Subdirectories
+ * are queued once their rows are committed.
+ */
+static bool
+import_dir(import_worker_t *worker, import_dir_t *dir) {
+    unsigned int count = 0, size = 0, i, batch;
+    import_file_t *files = NULL, *files_new, *file;
+    struct dirent *entry;
+    bool success = true;
+    DIR *d;
+    int fd;
+
+    d = opendir(dir->path);
+    if (d == NULL) {
+        log_err(MODULE, "Error opening directory '%s': %s", dir->path, strerror(errno));
+        return false;
+    }
+
+    fd = dirfd(d);
+
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        if (strlen(entry->d_name) > MYFS_FILE_NAME_MAX_LEN) {
+            log_warn(MODULE, "Skipping '%s/%s': Names can't be longer than %d characters", dir->path, entry->d_name, MYFS_FILE_NAME_MAX_LEN);
+            import.skipped++;
+            continue;
+        }
+
+        if (count == size) {
+            size = size == 0 ? 64 : size * 2;
+            files_new = realloc(files, size * sizeof(import_file_t));
+            if (files_new == NULL) {
+                log_err(MODULE, "Error reading directory '%s': Out of memory", dir->path);
+                success = false;
+                break;
+            }
+
+            files = files_new;
+        }
+
+        file = &files[count];
+
+        if (fstatat(fd, entry->d_name, &file->st, AT_SYMLINK_NOFOLLOW) != 0) {
+            log_warn(MODULE, "Skipping '%s/%s': %s", dir->path, entry->d_name, strerror(errno));
+            import.skipped++;
+            continue;
+        }
+
+        if (S_ISREG(file->st.st_mode)) {
+            file->type = MYFS_FILE_TYPE_FILE;
+        }
+        else if (S_ISDIR(file->st.st_mode)) {
+            file->type = MYFS_FILE_TYPE_DIRECTORY;
+        }
+        else if (S_ISLNK(file->st.st_mode)) {
+            file->type = MYFS_FILE_TYPE_SOFT_LINK;
+        }
+        else {
+            log_warn(MODULE, "Skipping '%s/%s': Only regular files, directories and soft links are imported", dir->path, entry->d_name);
+            import.skipped++;
+            continue;
+        }
+
+        strlcpy(file->name, entry->d_name, sizeof(file->name));
+        count++;
+    }
+
+    for (i = 0; i < count && success; i += batch) {
+        batch = count - i < IMPORT_OPEN_MAX ? count - i : IMPORT_OPEN_MAX;
+        success = import_entries(worker, fd, dir, files + i, batch);
+    }
+
+    //The buffer never holds blocks from another directory's files.
+    success = success && import_blocks_insert(worker) && import_commit(worker);
+
+    if (!success && worker->transaction) {
+        db_transaction_stop(&worker->db, false);
+        worker->transaction = false;
+    }
+
+    closedir(d);
+    free(files);
+
+    return success;
+}
+
+/**
+ * A worker. Imports queued directories until none are left or another worker fails.
+ */
+static void *
+import_worker(void *data) {
+    import_worker_t *worker = data;
+    import_dir_t *dir;
+    bool success;
+
+    while (true) {
+        pthread_mutex_lock(&import.lock);
+
+        while (import.dirs == NULL && import.busy > 0 && !import.failed) {
+            pthread_cond_wait(&import.cond, &import.lock);
+        }
+
+        dir = import.failed ? NULL : import.dirs;
+        if (dir != NULL) {
+            import.dirs = dir->next;
+            import.busy++;
+        }
+
+        pthread_mutex_unlock(&import.lock);
+
+        if (dir == NULL) {
+            break;
+        }
+
+        success = import_dir(worker, dir);
+
+        free(dir->path);
+        free(dir);
+
+        pthread_mutex_lock(&import.lock);
+        import.busy--;
+        if (!success) {
+            import.failed = true;
+        }
+        pthread_cond_broadcast(&import.cond);
+        pthread_mutex_unlock(&import.lock);
+    }
+
+    return NULL;
+}
+
+bool
+import_run(const char *src, const char *into, unsigned int threads) {
+    unsigned int file_id, connected = 0, started = 0, i;
+    struct timespec start, end;
+    import_worker_t *workers;
+    import_dir_t *dir;
+    struct stat st;
+    double seconds;
+    bool success;
+    db_t db;
+    int ret;
+
+    if (stat(src, &st) != 0) {
+        log_err(MODULE, "Error importing '%s': %s", src, strerror(errno));
+        return false;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        log_err(MODULE, "Error importing '%s': Not a directory", src);
+        return false;
+    }
+
+    memset(&import, 0, sizeof(import));
+    pthread_mutex_init(&import.lock, NULL);
+    pthread_cond_init(&import.cond, NULL);
+
+    db_init(&db);
+
+    success = import_connect(&db);
+    if (!success) {
+        goto done;
+    }
+
+    success = import_setup(&db) &&
+              import_resolve(&db, into, &file_id);
+
+    db_disconnect(&db);
+
+    if (!success) {
+        goto done;
+    }
+
+    log_info(MODULE, "Importing '%s' into '%s' with %u workers, %u blocks per insert", src, into, threads, import.blocks_per_insert);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    success = import_queue(file_id, src);
+    if (!success) {
+        goto done;
+    }
+
+    workers = calloc(threads, sizeof(*workers));
+    if (workers == NULL) {
+        log_err(MODULE, "Error starting workers: Out of memory");
+        success = false;
+        goto done;
+    }
+
+    for (i = 0; i < threads; i++) {
+        db_init(&workers[i].db);
+        workers[i].sql = malloc(import.rows_size);
+        workers[i].ids = malloc(import.rows_size);
+        workers[i].data = malloc((size_t)import.blocks_per_insert * MYFS_FILE_BLOCK_SIZE);
+
+        if (workers[i].sql == NULL || workers[i].ids == NULL || workers[i].data == NULL) {
+            success = false;
+        }
+    }
+
+    if (!success) {
+        log_err(MODULE, "Error starting workers: Out of memory");
+    }
+
+    for (i = 0; i < threads && success; i++) {
+        success = import_connect(&workers[i].db);
+        if (!success) {
+            break;
+        }
+        connected++;
+
+        ret = pthread_create(&workers[i].thread, NULL, import_worker, &workers[i]);
+        if (ret != 0) {
+            log_err(MODULE, "Error starting worker: %s", strerror(ret));
+            success = false;
+            break;
+        }
+        started++;
+    }
+
+    //Stop the workers that did start.
+    if (!success) {
+        pthread_mutex_lock(&import.lock);
+        import.failed = true;
+        pthread_cond_broadcast(&import.cond);
+        pthread_mutex_unlock(&import.lock);
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    success = success && !import.failed;
+
+    for (i = 0; i < threads; i++) {
+        if (i < connected) {
+            db_disconnect(&workers[i].db);
+        }
+        db_free(&workers[i].db);
+        free(workers[i].sql);
+        free(workers[i].ids);
+        free(workers[i].data);
+    }
+    free(workers);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    log_info(MODULE, "%s %lu files and %lu bytes in %.1f seconds (%.0f files/s, %.1f MB/s), skipped %lu",
+             success ? "Imported" : "Failed after importing", import.files, import.bytes, seconds,
+             seconds > 0 ? import.files / seconds : 0, seconds > 0 ? import.bytes / seconds / (1024 * 1024) : 0, import.skipped);
+
+done:
+    while ((dir = import.dirs) != NULL) {
+        import.dirs = dir->next;
+        free(dir->path);
+        free(dir);
+    }
+
+    db_free(&db);
+    pthread_cond_destroy(&import.cond);
+    pthread_mutex_destroy(&import.lock);
+
+    return success;
+}
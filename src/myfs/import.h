@@ -0,0 +1,33 @@
+#pragma once
+
+/**
+ * @file import.h
+ *
+ * Bulk import. `myfs --import <dir> --into <path>` copies a local directory tree into MyFS straight
+ * through MariaDB instead of through a mount, so loading a dataset doesn't cost a FUSE request and a
+ * round trip per file and per block.
+ *
+ * Directories are imported by `import_threads` workers, each with its own connection. A worker reads a
+ * directory, inserts every entry's `files` row with multi-row INSERTs and queues the subdirectories for
+ * the other workers. It then streams the files' data into `file_data` with prepared multi-row INSERTs
+ * that fill as many blocks per statement as `max_allowed_packet` allows, packing the blocks of small
+ * files together. File IDs come from `id_ranges` like a mount's, so the import can run while the
+ * database is mounted.
+ *
+ * Regular files, directories and soft links are imported with their modes and their accessed and
+ * modified times. They're owned by the configured `user` and `group`, like files made through a mount.
+ * Anything else is skipped.
+ */
+
+#include <stdbool.h>
+
+/**
+ * Imports a local directory tree into a MyFS directory. Uses the MariaDB settings from the config.
+ *
+ * @param[in] src The local directory whose contents are imported.
+ * @param[in] into The MyFS directory to import into. It must already exist, and none of the names in `src`
+ *            may exist in it yet.
+ * @param[in] threads The number of workers.
+ * @return `true` if everything was imported, otherwise `false`.
+ */
+bool import_run(const char *src, const char *into, unsigned int threads);
@@ -0,0 +1,843 @@
+/**
+ * @file lease.c
+ *
+ * Every file open on this mount has an entry, whether or not its lease is held, so the last close can be
+ * told apart. Leases are compared against MariaDB's clock, so mounts don't need their clocks in sync.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../common/log.h"
+#include "../common/config.h"
+#include "../common/db.h"
+#include "../common/metrics.h"
+#include "util.h"
+#include "myfs_backend.h"
+#include "myfs_db.h"
+#include "block_cache.h"
+#include "async_create.h"
+#include "lease.h"
+
+#define MODULE "Lease"
+
+/** The number of seconds to wait before retrying a failed query. */
+#define LEASE_QUERY_RETRY_TIME 5
+
+/** The number of milliseconds between checks for recalled leases. */
+#define LEASE_POLL_MS 100
+
+/** The number of milliseconds between checks while waiting for another mount to give a lease up. */
+#define LEASE_RECALL_POLL_MS 50
+
+/** The most bytes of writes kept per file. Larger writes get a buffer of their own size. */
+#define LEASE_BUFFER_SIZE (8 * 1024 * 1024)
+
+/**
+ * A file open on this mount.
+ */
+typedef struct lease_file_t {
+    unsigned int file_id;               //!< The File ID.
+    unsigned int refs;                  //!< Open handles, plus the thread while it's working on the file. Protected by `lease.lock`.
+    pthread_mutex_t lock;               //!< Protects everything below.
+    bool held;                          //!< Whether this mount holds the file's lease.
+    time_t renewed_on;                  //!< When the lease's expiry was last pushed back.
+    off_t size;                         //!< The file's size, including buffered writes. Only kept while `held`.
+    char *data;                         //!< Buffered writes.
+    size_t len;                         //!< The number of bytes in `data`.
+    size_t cap;                         //!< The size of `data`.
+    off_t offset;                       //!< Where `data` starts in the file.
+    bool lost;                          //!< Whether the lease was lost with writes buffered. They were dropped, and the next write or flush fails.
+    struct lease_file_t *next;          //!< The next open file.
+} lease_file_t;
+
+typedef struct {
+    myfs_t *myfs;                       //!< The MyFS context, or `NULL` if leases are off.
+    db_t db;                            //!< The database connection.
+    pthread_t thread;                   //!< The thread.
+    _Atomic bool running;               //!< If the thread is running or not.
+    unsigned int ttl;                   //!< The number of seconds a lease lasts without being renewed.
+    pthread_mutex_t lock;               //!< Protects `files` and every file's `refs`.
+    lease_file_t *files;                //!< The files open on this mount.
+    _Atomic uint64_t held;              //!< The number of leases held.
+    _Atomic uint64_t buffered;          //!< Writes kept in memory.
+    _Atomic uint64_t flushes;           //!< Writes sent to the backend from the buffers.
+    _Atomic uint64_t recalls;           //!< Other mounts' leases this mount recalled.
+    _Atomic uint64_t recalled;          //!< This mount's leases other mounts recalled.
+} lease_t;
+
+static lease_t lease;
+
+/**
+ * Finds a file's entry and takes a reference to it.
+ *
+ * @param[in] file_id The File ID.
+ * @param[in] create `true` to add an entry if there isn't one.
+ * @return The entry, or `NULL` if there isn't one and `create` is `false` or it couldn't be added.
+ */
+static lease_file_t *
+lease_file_get(unsigned int file_id, bool create) {
+    lease_file_t *file;
+
+    pthread_mutex_lock(&lease.lock);
+
+    for (file = lease.files; file != NULL; file = file->next) {
+        if (file->file_id == file_id) {
+            break;
+        }
+    }
+
+    if (file == NULL && create) {
+        file = calloc(1, sizeof(*file));
+        if (file != NULL) {
+            file->file_id = file_id;
+            pthread_mutex_init(&file->lock, NULL);
+            file->next = lease.files;
+            lease.files = file;
+        }
+    }
+
+    if (file != NULL) {
+        file->refs++;
+    }
+
+    pthread_mutex_unlock(&lease.lock);
+
+    return file;
+}
+
+/**
+ * Writes a file's buffered writes to MariaDB. The file's lock must be held.
+ *
+ * @param[in] file The file.
+ * @param[in] db The connection to write on: `lease.db` on the lease thread, otherwise `myfs->db`.
+ * @return `true` on success or if there was nothing to write, otherwise `false`.
+ */
+static bool
+lease_file_flush(lease_file_t *file, db_t *db) {
+    bool success;
+
+    if (file->len == 0) {
+        return true;
+    }
+
+    success = myfs_db_file_write_db(db, lease.myfs, file->file_id, file->data, file->len, file->offset, NULL, NULL);
+    if (!success) {
+        log_err(MODULE, "Error flushing %zu bytes of writes to File ID %u", file->len, file->file_id);
+        return false;
+    }
+
+    block_cache_invalidate(file->file_id, file->offset, file->len);
+
+    file->len = 0;
+    lease.flushes++;
+
+    return true;
+}
+
+/**
+ * Reports writes that were dropped when a lease was lost, once. The file's lock must be held.
+ *
+ * @return `true` if no writes were dropped since the last call, otherwise `false`.
+ */
+static bool
+lease_file_check_lost(lease_file_t *file) {
+    if (!file->lost) {
+        return true;
+    }
+
+    file->lost = false;
+
+    return false;
+}
+
+/**
+ * Gives up a lease. The file's lock must be held and its writes flushed.
+ */
+static void
+lease_file_release(lease_file_t *file, db_t *db) {
+    bool success;
+
+    file->held = false;
+    lease.held--;
+
+    success = db_queryf(db, "DELETE FROM `leases`\n"
+                            "WHERE `file_id`=%u\n"
+                            "AND `mount_id`=%u",
+                            file->file_id, lease.myfs->mount_id);
+
+    //Other mounts wait for it to expire instead.
+    if (!success) {
+        log_warn(MODULE, "Error giving up the lease on File ID %u: %s", file->file_id, db_error(db));
+    }
+}
+
+/**
+ * Drops a reference to a file's entry. Once the last one is gone, its writes are flushed, its lease is
+ * given up and the entry is freed.
+ *
+ * @param[in] file The file.
+ * @param[in] db The connection to flush and give up the lease on, as for `lease_file_flush()`.
+ */
+static void
+lease_file_put(lease_file_t *file, db_t *db) {
+    lease_file_t **prev;
+    bool last;
+
+    pthread_mutex_lock(&lease.lock);
+
+    last = --file->refs == 0;
+    if (last) {
+        for (prev = &lease.files; *prev != file; prev = &(*prev)->next);
+        *prev = file->next;
+    }
+
+    pthread_mutex_unlock(&lease.lock);
+
+    if (!last) {
+        return;
+    }
+
+    //Nothing else can find the entry now.
+    pthread_mutex_lock(&file->lock);
+    if (!lease_file_flush(file, db)) {
+        log_err(MODULE, "Dropping %zu bytes of writes to File ID %u", file->len, file->file_id);
+    }
+    if (file->held) {
+        lease_file_release(file, db);
+    }
+    pthread_mutex_unlock(&file->lock);
+
+    pthread_mutex_destroy(&file->lock);
+    free(file->data);
+    free(file);
+}
+
+/**
+ * Gets which mount holds a file's lease.
+ *
+ * @param[in] file_id The File ID.
+ * @param[out] mount_id The holder's Mount ID, or 0 if the lease isn't held or has expired.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+lease_holder(unsigned int file_id, unsigned int *mount_id) {
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    res = db_selectf(&lease.myfs->db, "SELECT `mount_id`\n"
+                                      "FROM `leases`\n"
+                                      "WHERE `file_id`=%u\n"
+                                      "AND `expires_on`>=UNIX_TIMESTAMP()",
+                                      file_id);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error getting the lease on File ID %u: %s", file_id, db_error(&lease.myfs->db));
+        return false;
+    }
+
+    row = mysql_fetch_row(res);
+    *mount_id = row != NULL ? strtoul(row[0], NULL, 10) : 0;
+    mysql_free_result(res);
+
+    return true;
+}
+
+/**
+ * Asks the mount holding a file's lease to flush and give it up, and waits until it does or the lease
+ * expires.
+ *
+ * @param[in] file_id The File ID.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+lease_recall(unsigned int file_id) {
+    unsigned int mount_id, waited = 0;
+    bool success;
+
+    success = db_queryf(&lease.myfs->db, "UPDATE `leases`\n"
+                                         "SET `recalled`=1\n"
+                                         "WHERE `file_id`=%u\n"
+                                         "AND `mount_id`!=%u",
+                                         file_id, lease.myfs->mount_id);
+
+    if (!success) {
+        log_err(MODULE, "Error recalling the lease on File ID %u: %s", file_id, db_error(&lease.myfs->db));
+        return false;
+    }
+
+    lease.recalls++;
+
+    //The holder gives up the lease on its next poll. If it's gone, the lease expires within a TTL.
+    do {
+        util_sleep_ms(LEASE_RECALL_POLL_MS);
+        waited += LEASE_RECALL_POLL_MS;
+
+        success = lease_holder(file_id, &mount_id);
+        if (!success) {
+            return false;
+        }
+    } while (mount_id != 0 && mount_id != lease.myfs->mount_id && waited <= (lease.ttl + 1) * 1000);
+
+    if (mount_id != 0 && mount_id != lease.myfs->mount_id) {
+        log_warn(MODULE, "Mount ID %u didn't give up the lease on File ID %u", mount_id, file_id);
+    }
+
+    return true;
+}
+
+/**
+ * Tries to take a file's lease. It's taken if nobody holds it or the holder's lease expired. The file's
+ * lock must be held.
+ *
+ * @param[in] file The file.
+ * @param[in] size The file's size in the backend.
+ * @return `true` on success, whether or not the lease was taken, otherwise `false`.
+ */
+static bool
+lease_acquire(lease_file_t *file, off_t size) {
+    unsigned int mount_id;
+    bool success;
+
+    //The lease's row refers to the file's, which an asynchronous create may not have inserted yet.
+    success = async_create_flush();
+    if (!success) {
+        return false;
+    }
+
+    //Assignments are made in order, so `mount_id` is only taken over while `expires_on` is still the old
+    //holder's, and `expires_on` is only pushed back once `mount_id` is this mount's.
+    success = db_queryf(&lease.myfs->db, "INSERT INTO `leases` (`file_id`,`mount_id`,`expires_on`,`recalled`)\n"
+                                         "VALUES (%u,%u,UNIX_TIMESTAMP()+%u,0)\n"
+                                         "ON DUPLICATE KEY UPDATE\n"
+                                         "`recalled`=IF(`mount_id`=VALUES(`mount_id`) OR `expires_on`<UNIX_TIMESTAMP(),0,`recalled`),\n"
+                                         "`mount_id`=IF(`expires_on`<UNIX_TIMESTAMP(),VALUES(`mount_id`),`mount_id`),\n"
+                                         "`expires_on`=IF(`mount_id`=VALUES(`mount_id`),VALUES(`expires_on`),`expires_on`)",
+                                         file->file_id, lease.myfs->mount_id, lease.ttl);
+
+    if (!success) {
+        log_err(MODULE, "Error taking the lease on File ID %u: %s", file->file_id, db_error(&lease.myfs->db));
+        return false;
+    }
+
+    success = lease_holder(file->file_id, &mount_id);
+    if (!success) {
+        return false;
+    }
+
+    if (mount_id == lease.myfs->mount_id) {
+        file->held = true;
+        file->renewed_on = time(NULL);
+        file->size = size;
+        lease.held++;
+    }
+
+    return true;
+}
+
+/**
+ * Pushes back the expiry of every lease this mount holds.
+ *
+ * @param[in] files The files whose leases are held.
+ * @param[in] count The number of files.
+ * @param[in] now The time now.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+lease_renew(lease_file_t **files, unsigned int count, time_t now) {
+    unsigned int i;
+    bool success;
+
+    success = db_queryf(&lease.db, "UPDATE `leases`\n"
+                                   "SET `expires_on`=UNIX_TIMESTAMP()+%u\n"
+                                   "WHERE `mount_id`=%u",
+                                   lease.ttl, lease.myfs->mount_id);
+
+    if (!success) {
+        log_err(MODULE, "Error renewing leases: %s", db_error(&lease.db));
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        pthread_mutex_lock(&files[i]->lock);
+        files[i]->renewed_on = now;
+        pthread_mutex_unlock(&files[i]->lock);
+    }
+
+    return true;
+}
+
+/**
+ * Flushes and gives up the leases other mounts recalled, and drops the ones that are no longer this
+ * mount's.
+ *
+ * @param[in] files The files whose leases are held.
+ * @param[in] count The number of files.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+lease_check(lease_file_t **files, unsigned int count) {
+    bool found[MYFS_FILES_OPEN_MAX], recalled[MYFS_FILES_OPEN_MAX];
+    unsigned int i, file_id;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    res = db_selectf(&lease.db, "SELECT `file_id`,`recalled`\n"
+                                "FROM `leases`\n"
+                                "WHERE `mount_id`=%u",
+                                lease.myfs->mount_id);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error checking for recalled leases: %s", db_error(&lease.db));
+        return false;
+    }
+
+    memset(found, 0, sizeof(found));
+    memset(recalled, 0, sizeof(recalled));
+
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        file_id = strtoul(row[0], NULL, 10);
+
+        for (i = 0; i < count; i++) {
+            if (files[i]->file_id == file_id) {
+                found[i] = true;
+                recalled[i] = strcmp(row[1], "0") != 0;
+                break;
+            }
+        }
+    }
+    mysql_free_result(res);
+
+    for (i = 0; i < count; i++) {
+        if (found[i] && !recalled[i]) {
+            continue;
+        }
+
+        pthread_mutex_lock(&files[i]->lock);
+
+        if (files[i]->held) {
+            if (!found[i]) {
+                //The lease expired and was taken, or the file was deleted. Another mount may have written
+                //the same range since, so writes still buffered can't be sent after the fact.
+                if (files[i]->len > 0) {
+                    log_err(MODULE, "Lost the lease on File ID %u: Dropping %zu bytes of writes", files[i]->file_id, files[i]->len);
+                    files[i]->len = 0;
+                    files[i]->lost = true;
+                }
+                else {
+                    log_warn(MODULE, "Lost the lease on File ID %u", files[i]->file_id);
+                }
+                files[i]->held = false;
+                lease.held--;
+            }
+            else if (lease_file_flush(files[i], &lease.db)) {
+                log_debug(MODULE, "Giving up the lease on File ID %u", files[i]->file_id);
+                lease_file_release(files[i], &lease.db);
+                lease.recalled++;
+            }
+        }
+
+        pthread_mutex_unlock(&files[i]->lock);
+    }
+
+    return true;
+}
+
+/**
+ * Stops using leases that couldn't be renewed in time, since another mount may take them once they expire.
+ */
+static void
+lease_expire(lease_file_t **files, unsigned int count, time_t now) {
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        pthread_mutex_lock(&files[i]->lock);
+
+        if (files[i]->held && now - files[i]->renewed_on > lease.ttl / 2) {
+            log_warn(MODULE, "Couldn't renew the lease on File ID %u, no longer buffering its writes", files[i]->file_id);
+            files[i]->held = false;
+            lease.held--;
+            lease_file_flush(files[i], &lease.db);
+        }
+
+        pthread_mutex_unlock(&files[i]->lock);
+    }
+}
+
+static void *
+lease_process(void *user_data) {
+    lease_file_t *files[MYFS_FILES_OPEN_MAX], *file;
+    time_t next_try = 0, now;
+    unsigned int i, count;
+    bool success, renew;
+
+    while (lease.running) {
+        util_sleep_ms(LEASE_POLL_MS);
+
+        //If a previous query failed, pause until it's ready to retry.
+        now = time(NULL);
+        if (next_try > now) {
+            continue;
+        }
+
+        //Hold on to the files whose leases are held so they can't be freed while they're checked.
+        count = 0;
+        renew = false;
+        pthread_mutex_lock(&lease.lock);
+        for (file = lease.files; file != NULL && count < MYFS_FILES_OPEN_MAX; file = file->next) {
+            if (file->held) {
+                file->refs++;
+                files[count++] = file;
+
+                //Renew well before the lease expires, so a slow query doesn't lose it.
+                if (now - file->renewed_on >= (time_t)(lease.ttl / 3)) {
+                    renew = true;
+                }
+            }
+        }
+        pthread_mutex_unlock(&lease.lock);
+
+        if (count == 0) {
+            continue;
+        }
+
+        success = true;
+        if (renew) {
+            success = lease_renew(files, count, now);
+        }
+
+        if (success) {
+            success = lease_check(files, count);
+        }
+
+        if (!success) {
+            lease_expire(files, count, now);
+            log_err(MODULE, "Trying again in %d seconds", LEASE_QUERY_RETRY_TIME);
+            next_try = now + LEASE_QUERY_RETRY_TIME;
+        }
+
+        for (i = 0; i < count; i++) {
+            lease_file_put(files[i], &lease.db);
+        }
+    }
+
+    return NULL;
+}
+
+void
+lease_init() {
+    memset(&lease, 0, sizeof(lease));
+
+    db_init(&lease.db);
+    pthread_mutex_init(&lease.lock, NULL);
+}
+
+void
+lease_free() {
+    lease_file_t *file, *next;
+
+    for (file = lease.files; file != NULL; file = next) {
+        next = file->next;
+        pthread_mutex_destroy(&file->lock);
+        free(file->data);
+        free(file);
+    }
+
+    db_free(&lease.db);
+    pthread_mutex_destroy(&lease.lock);
+}
+
+bool
+lease_start(myfs_t *myfs, unsigned int ttl) {
+    bool success;
+    int ret;
+
+    log_info(MODULE, "Starting");
+
+    lease.ttl = ttl;
+
+    success = db_connect(&lease.db, config_get("mariadb_host"), config_get("mariadb_user"), config_get("mariadb_password"), config_get("mariadb_database"), config_get_uint("mariadb_port"));
+    if (!success) {
+        log_err(MODULE, "Error connecting to MariaDB: %s", db_error(&lease.db));
+        return false;
+    }
+
+    //Only log the lease thread's slow queries. Its statements aren't summarized along with MyFS's own.
+    db_set_profile_options(&lease.db, config_get_uint("slow_query_ms"), 0, 0);
+
+    //Leases left behind by an earlier run of this mount can't be told apart from another mount's, but
+    //Mount IDs are random, so they just expire.
+    lease.myfs = myfs;
+
+    //Start the thread.
+    lease.running = true;
+    ret = pthread_create(&lease.thread, NULL, lease_process, NULL);
+    if (ret != 0) {
+        lease.running = false;
+        lease.myfs = NULL;
+        log_err(MODULE, "Error starting thread: %s", strerror(ret));
+    }
+
+    return lease.running;
+}
+
+void
+lease_stop() {
+    lease_file_t *file;
+
+    if (lease.running) {
+        lease.running = false;
+        log_info(MODULE, "Stopping");
+
+        pthread_join(lease.thread, NULL);
+    }
+
+    //Files still open when FUSE exits are never released.
+    if (lease.myfs != NULL) {
+        pthread_mutex_lock(&lease.lock);
+        for (file = lease.files; file != NULL; file = file->next) {
+            pthread_mutex_lock(&file->lock);
+            lease_file_flush(file, &lease.myfs->db);
+            if (file->held) {
+                lease_file_release(file, &lease.myfs->db);
+            }
+            pthread_mutex_unlock(&file->lock);
+        }
+        pthread_mutex_unlock(&lease.lock);
+
+        lease.myfs = NULL;
+    }
+
+    db_disconnect(&lease.db);
+}
+
+bool
+lease_open(myfs_file_t **file, bool write) {
+    lease_file_t *lease_file;
+    unsigned int file_id, mount_id;
+    myfs_file_t *reread;
+    bool success;
+
+    if (lease.myfs == NULL) {
+        return true;
+    }
+
+    file_id = (*file)->file_id;
+    lease_file = lease_file_get(file_id, true);
+    if (lease_file == NULL) {
+        log_err(MODULE, "Error opening File ID %u: Out of memory", file_id);
+        return false;
+    }
+
+    pthread_mutex_lock(&lease_file->lock);
+
+    //Another handle on this mount holds the lease, so only it knows the size.
+    if (lease_file->held) {
+        (*file)->st.st_size = lease_file->size;
+        pthread_mutex_unlock(&lease_file->lock);
+        return true;
+    }
+
+    success = lease_holder(file_id, &mount_id);
+    if (!success) {
+        goto done;
+    }
+
+    //The file was read before the holder flushed its writes, so read it again.
+    if (mount_id != 0 && mount_id != lease.myfs->mount_id) {
+        success = lease_recall(file_id);
+        if (!success) {
+            goto done;
+        }
+
+        reread = lease.myfs->backend->file_query(lease.myfs, file_id, false);
+        if (reread == NULL) {
+            success = false;
+            goto done;
+        }
+
+        myfs_file_free(*file);
+        *file = reread;
+    }
+
+    if (write) {
+        success = lease_acquire(lease_file, (*file)->st.st_size);
+    }
+
+done:
+    pthread_mutex_unlock(&lease_file->lock);
+
+    if (!success) {
+        lease_file_put(lease_file, &lease.myfs->db);
+    }
+
+    return success;
+}
+
+void
+lease_close(unsigned int file_id) {
+    lease_file_t *file;
+
+    if (lease.myfs == NULL) {
+        return;
+    }
+
+    //Drop this lookup's reference and the one taken when the file was opened.
+    file = lease_file_get(file_id, false);
+    if (file != NULL) {
+        lease_file_put(file, &lease.myfs->db);
+        lease_file_put(file, &lease.myfs->db);
+    }
+}
+
+bool
+lease_buffer(unsigned int file_id, const char *data, size_t size, off_t *offset, bool append, off_t *file_size, bool *buffered) {
+    lease_file_t *file;
+    bool success = true;
+    char *data_new;
+    size_t cap;
+    off_t end;
+
+    *buffered = false;
+
+    if (lease.myfs == NULL) {
+        return true;
+    }
+
+    file = lease_file_get(file_id, false);
+    if (file == NULL) {
+        return true;
+    }
+
+    pthread_mutex_lock(&file->lock);
+
+    success = lease_file_check_lost(file);
+
+    if (success && append && file->held) {
+        *offset = file->size;
+    }
+
+    //Writes that don't carry on from the buffered ones, or don't fit, go after them. So does anything left
+    //from a lease that couldn't be renewed.
+    if (success && file->len > 0 && (!file->held || *offset != file->offset + (off_t)file->len || file->len + size > file->cap)) {
+        success = lease_file_flush(file, &lease.myfs->db);
+    }
+
+    if (success && file->held && file->len + size > file->cap) {
+        cap = size > LEASE_BUFFER_SIZE ? size : LEASE_BUFFER_SIZE;
+        data_new = realloc(file->data, cap);
+        if (data_new == NULL) {
+            log_err(MODULE, "Error buffering writes for File ID %u: Out of memory", file_id);
+            success = false;
+        }
+        else {
+            file->data = data_new;
+            file->cap = cap;
+        }
+    }
+
+    if (success && file->held) {
+        if (file->len == 0) {
+            file->offset = *offset;
+        }
+
+        memcpy(file->data + file->len, data, size);
+        file->len += size;
+
+        end = *offset + size;
+        if (end > file->size) {
+            file->size = end;
+        }
+        if (end > *file_size) {
+            *file_size = end;
+        }
+
+        *buffered = true;
+        lease.buffered++;
+    }
+
+    pthread_mutex_unlock(&file->lock);
+    lease_file_put(file, &lease.myfs->db);
+
+    METRICS_COUNT("lease_buffered", *buffered ? 1 : 0);
+
+    return success;
+}
+
+bool
+lease_flush(unsigned int file_id) {
+    lease_file_t *file;
+    bool success;
+
+    if (lease.myfs == NULL) {
+        return true;
+    }
+
+    file = lease_file_get(file_id, false);
+    if (file == NULL) {
+        return true;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    success = lease_file_check_lost(file) && lease_file_flush(file, &lease.myfs->db);
+    pthread_mutex_unlock(&file->lock);
+
+    lease_file_put(file, &lease.myfs->db);
+
+    return success;
+}
+
+void
+lease_resize(unsigned int file_id, off_t size) {
+    lease_file_t *file;
+
+    if (lease.myfs == NULL) {
+        return;
+    }
+
+    file = lease_file_get(file_id, false);
+    if (file == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    if (file->held) {
+        file->size = size;
+    }
+    pthread_mutex_unlock(&file->lock);
+
+    lease_file_put(file, &lease.myfs->db);
+}
+
+void
+lease_size(unsigned int file_id, off_t *size) {
+    lease_file_t *file;
+
+    if (lease.myfs == NULL) {
+        return;
+    }
+
+    file = lease_file_get(file_id, false);
+    if (file == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    if (file->held) {
+        *size = file->size;
+    }
+    pthread_mutex_unlock(&file->lock);
+
+    lease_file_put(file, &lease.myfs->db);
+}
+
+void
+lease_write(FILE *f) {
+    fprintf(f, "write_leases                     %s\n", lease.running ? "on" : "off");
+    fprintf(f, "lease_held                       %lu\n", lease.held);
+    fprintf(f, "lease_buffered                   %lu\n", lease.buffered);
+    fprintf(f, "lease_flushes                    %lu\n", lease.flushes);
+    fprintf(f, "lease_recalls                    %lu\n", lease.recalls);
+    fprintf(f, "lease_recalled                   %lu\n", lease.recalled);
+}
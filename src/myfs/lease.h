@@ -0,0 +1,114 @@
+#pragma once
+
+/**
+ * @file lease.h
+ *
+ * Write leases. When `write_leases` is on, a mount that opens a file for writing takes a lease on it: a
+ * row in the `leases` table with the mount's ID and when the lease expires. While a mount holds a file's
+ * lease no other mount writes to it, so writes are kept in memory and sent to the backend as one large
+ * write when they stop being contiguous, the buffer fills, the file is read, truncated or closed, or the
+ * lease is recalled. The file's size is answered from the lease as well.
+ *
+ * A mount that opens a file another mount holds the lease on marks the lease recalled and waits for the
+ * holder to flush its writes and give the lease up, or for the lease to expire. Holders renew their
+ * leases in the background well before they expire. A holder that finds its lease taken anyway drops the
+ * writes it still has buffered, and the file's next write or flush fails with EIO.
+ *
+ * Only MariaDB has leases. The other backends are only ever used by one mount.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "myfs.h"
+
+/**
+ * Initializes the leases. This must be called before any other lease functions are called.
+ */
+void lease_init();
+
+/**
+ * Frees the leases. No more lease functions can be called after this.
+ */
+void lease_free();
+
+/**
+ * Connects to MariaDB and starts renewing this mount's leases and watching for recalls. Until this is
+ * called every lease function does nothing.
+ *
+ * @param[in] myfs The MyFS context. Its `mount_id` marks this mount's leases.
+ * @param[in] ttl The number of seconds a lease lasts without being renewed.
+ * @return `true` on success, otherwise `false`.
+ */
+bool lease_start(myfs_t *myfs, unsigned int ttl);
+
+/**
+ * Flushes every file's writes, gives up this mount's leases and disconnects.
+ */
+void lease_stop();
+
+/**
+ * Called when a file is opened. If another mount holds the file's lease, it's recalled and `*file` is
+ * read again once that mount has flushed. If `write` is `true`, this mount then tries to take the lease.
+ *
+ * @param[in,out] file The file being opened. Its size includes writes this mount hasn't flushed yet.
+ * @param[in] write `true` if the file is being opened for writing.
+ * @return `true` on success, otherwise `false`. On failure there's nothing to close, but `*file` may
+ *         still have been replaced.
+ */
+bool lease_open(myfs_file_t **file, bool write);
+
+/**
+ * Called when a file is closed. When its last handle on this mount is closed, its writes are flushed and
+ * its lease is given up.
+ *
+ * @param[in] file_id The File ID.
+ */
+void lease_close(unsigned int file_id);
+
+/**
+ * Keeps a write in memory if this mount holds the file's lease.
+ *
+ * @param[in] file_id The File ID.
+ * @param[in] data The data to write.
+ * @param[in] size The length of `data`.
+ * @param[in,out] offset Where to write. For appends, set to where the data went.
+ * @param[in] append `true` to write at the end of the file instead of at `offset`.
+ * @param[in,out] file_size The size of the open file, which is raised to include the write.
+ * @param[out] buffered Set to `true` if the write was kept. If `false`, it has to be written to the backend.
+ * @return `true` on success, or `false` if earlier writes couldn't be flushed to make room or were dropped
+ *         when the lease was lost, or the buffer couldn't grow.
+ */
+bool lease_buffer(unsigned int file_id, const char *data, size_t size, off_t *offset, bool append, off_t *file_size, bool *buffered);
+
+/**
+ * Writes a file's buffered writes to the backend.
+ *
+ * @param[in] file_id The File ID.
+ * @return `true` on success or if there was nothing to write, otherwise `false`. Also `false` once after
+ *         buffered writes were dropped because the lease was lost.
+ */
+bool lease_flush(unsigned int file_id);
+
+/**
+ * Records a file's new size after it was truncated. Its writes must have been flushed first.
+ *
+ * @param[in] file_id The File ID.
+ * @param[in] size The new size.
+ */
+void lease_resize(unsigned int file_id, off_t size);
+
+/**
+ * Gets the size of a file this mount holds the lease on, which includes writes that haven't been flushed.
+ *
+ * @param[in] file_id The File ID.
+ * @param[in,out] size Set to the file's size if this mount holds its lease, otherwise left alone.
+ */
+void lease_size(unsigned int file_id, off_t *size);
+
+/**
+ * Writes how many leases are held and how many writes were kept as text.
+ *
+ * @param[in] f The file to write to.
+ */
+void lease_write(FILE *f);
@@ -6,11 +6,19 @@
 #include <fuse.h>
 #include "../common/log.h"
 #include "../common/config.h"
+#include "../common/metrics.h"
+#include "../common/trace.h"
 #include "../common/db.h"
 #include "version.h"
 #include "util.h"
 #include "create.h"
 #include "reclaimer.h"
+#include "block_cache.h"
+#include "change_log.h"
+#include "lease.h"
+#include "async_create.h"
+#include "import.h"
+#include "ctl.h"
 #include "myfs.h"
 
 #define MODULE "Main"
@@ -20,6 +28,14 @@
 #define MYFS_RETURN_CONFIG    1
 #define MYFS_RETURN_DATABASE  2
 #define MYFS_RETURN_RECLAIMER 3
+#define MYFS_RETURN_METRICS   4
+#define MYFS_RETURN_TRACE     5
+#define MYFS_RETURN_LOG       6
+#define MYFS_RETURN_CACHE     7
+#define MYFS_RETURN_CHANGES   8
+#define MYFS_RETURN_LEASES    9
+#define MYFS_RETURN_CREATES   10
+#define MYFS_RETURN_IMPORT    11
 
 static void
 config_error(const char *message) {
@@ -50,6 +66,18 @@ config_handle_print_create_sql(const char *name, const char *value) {
     create_get_sql_database_table3(sql, sizeof(sql));
     printf("%s\n", sql);
     printf("\n");
+    create_get_sql_database_table4(sql, sizeof(sql));
+    printf("%s\n", sql);
+    printf("\n");
+    create_get_sql_database_table5(sql, sizeof(sql));
+    printf("%s\n", sql);
+    printf("\n");
+    create_get_sql_database_table6(sql, sizeof(sql));
+    printf("%s\n", sql);
+    printf("\n");
+    create_get_sql_database_table7(sql, sizeof(sql));
+    printf("%s\n", sql);
+    printf("\n");
     create_get_sql_database_insert1(sql, sizeof(sql));
     printf("%s\n", sql);
     printf("\n");
@@ -59,6 +87,9 @@ config_handle_print_create_sql(const char *name, const char *value) {
     create_get_sql_database_insert3(sql, sizeof(sql));
     printf("%s\n", sql);
     printf("\n");
+    create_get_sql_database_insert4(sql, sizeof(sql));
+    printf("%s\n", sql);
+    printf("\n");
     create_get_sql_database_user_create(sql, sizeof(sql), "<myfs_user>", "<myfs_user_host>", "<myfs_user_password>");
     printf("%s\n", sql);
     printf("\n");
@@ -102,6 +133,122 @@ config_handle_log_syslog(const char *name, const char *value) {
     return true;
 }
 
+static bool
+config_handle_id_cache_ttl(const char *name, const char *value) {
+    int ttl;
+
+    ttl = atoi(value);
+
+    if (ttl < 0) {
+        log_err(MODULE, "Error setting user and group cache TTL: %d is not valid", ttl);
+        return false;
+    }
+
+    util_id_cache_set_ttl(ttl);
+    return config_set_int(name, ttl);
+}
+
+static bool
+config_handle_change_log_poll(const char *name, const char *value) {
+    int poll_ms;
+
+    poll_ms = atoi(value);
+
+    if (poll_ms <= 0) {
+        log_err(MODULE, "Error setting change log poll time: %d is not valid", poll_ms);
+        return false;
+    }
+
+    return config_set_int(name, poll_ms);
+}
+
+static bool
+config_handle_id_range_size(const char *name, const char *value) {
+    int size;
+
+    size = atoi(value);
+
+    if (size < 0) {
+        log_err(MODULE, "Error setting File ID range size: %d is not valid", size);
+        return false;
+    }
+
+    return config_set_int(name, size);
+}
+
+static bool
+config_handle_lease_ttl(const char *name, const char *value) {
+    int ttl;
+
+    ttl = atoi(value);
+
+    if (ttl <= 0) {
+        log_err(MODULE, "Error setting lease TTL: %d is not valid", ttl);
+        return false;
+    }
+
+    return config_set_int(name, ttl);
+}
+
+static bool
+config_handle_async_flush(const char *name, const char *value) {
+    int flush_ms;
+
+    flush_ms = atoi(value);
+
+    if (flush_ms <= 0) {
+        log_err(MODULE, "Error setting async create flush time: %d is not valid", flush_ms);
+        return false;
+    }
+
+    return config_set_int(name, flush_ms);
+}
+
+static bool
+config_handle_import_threads(const char *name, const char *value) {
+    int threads;
+
+    threads = atoi(value);
+
+    if (threads <= 0) {
+        log_err(MODULE, "Error setting import threads: %d is not valid", threads);
+        return false;
+    }
+
+    return config_set_int(name, threads);
+}
+
+static bool
+config_handle_metrics_interval(const char *name, const char *value) {
+    int interval;
+
+    interval = atoi(value);
+
+    if (interval <= 0) {
+        log_err(MODULE, "Error setting metrics interval: %d is not valid", interval);
+        return false;
+    }
+
+    return config_set_int(name, interval);
+}
+
+static bool
+config_handle_ownership_mode(const char *name, const char *value) {
+    if (strcmp(value, "name") != 0 && strcmp(value, "id") != 0) {
+        log_err(MODULE, "Error setting ownership mode: '%s' is not valid", value);
+        return false;
+    }
+
+    return config_set(name, value);
+}
+
+static bool
+config_handle_trace_decode(const char *name, const char *value) {
+    trace_decode(value, stdout);
+
+    return false;
+}
+
 static bool
 config_handle_reclaimer_level(const char *name, const char *value) {
     int level;
@@ -120,12 +267,12 @@ config_handle_reclaimer_level(const char *name, const char *value) {
 }
 
 static char **
-fargs_create(const char *name, int *fargc) {
+fargs_create(const char *name, unsigned int max_read, int *fargc) {
     int index = 0;
     char **fargv;
 
-    //Space for the program name, just like argc[0]
-    *fargc = 1;
+    //Space for the program name, just like argc[0], and -o max_read
+    *fargc = 3;
 
     //If --mount is being used, then we need to replicate FUSE's -f option
     if (config_has("mount")) {
@@ -137,6 +284,10 @@ fargs_create(const char *name, int *fargc) {
     //Start with argv[0], the program name
     fargv[index++] = strdup(name);
 
+    //FUSE only sends reads larger than the kernel's default if max_read is also given as a mount option.
+    fargv[index++] = strdup("-o");
+    asprintf(&fargv[index++], "max_read=%u", max_read);
+
     //Replicate -f if needed
     if (config_has("mount")) {
         fargv[index++] = strdup("-f");
@@ -190,10 +341,28 @@ confirm_config() {
     }
 
     printf("\n");
-    printf("Database:                 %s@%s:%s/%s\n", config_get("mariadb_user"), config_get("mariadb_host"), config_get("mariadb_port"), config_get("mariadb_database"));
-    printf("Mount point:              %s\n", config_get("mount"));
+    if (config_equals("backend", "memory")) {
+        printf("Database:                 None, files are kept in memory\n");
+    }
+    else if (config_equals("backend", "sqlite")) {
+        printf("Database:                 SQLite %s\n", config_get("sqlite_file"));
+    }
+    else {
+        printf("Database:                 %s@%s:%s/%s\n", config_get("mariadb_user"), config_get("mariadb_host"), config_get("mariadb_port"), config_get("mariadb_database"));
+    }
+    if (config_has("import") && !config_equals("import", "")) {
+        printf("Import:                   %s into %s\n", config_get("import"), config_get("import_into"));
+    }
+    else {
+        printf("Mount point:              %s\n", config_get("mount"));
+    }
     printf("User:                     %s\n", config_get("user"));
     printf("Group:                    %s\n", config_get("group"));
+    printf("Ownership mode:           %s\n", config_get("ownership_mode"));
+    printf("Writeback cache:          %s\n", config_get("writeback_cache"));
+    printf("Change log:               %s\n", config_get("change_log"));
+    printf("Write leases:             %s\n", config_get("write_leases"));
+    printf("Block cache:              %s\n", config_has("block_cache_dir") && !config_equals("block_cache_dir", "") ? config_get("block_cache_dir") : "Off");
     if (config_equals("failed_query_retry_wait", "-1")) {
         printf("Failed query retry wait:  Not retrying\n");
         printf("Failed query retry count: Not retrying\n");
@@ -225,10 +394,18 @@ main(int argc, char **argv) {
 
     mysql_library_init(0, NULL, NULL);
     log_init();
+    metrics_init();
+    trace_init();
     config_init();
     reclaimer_init();
+    block_cache_init();
+    change_log_init();
+    lease_init();
+    async_create_init();
+    ctl_init();
 
     memset(&myfs, 0, sizeof(myfs));
+    pthread_mutex_init(&myfs.files_lock, NULL);
     util_username(getuid(), user, sizeof(user));
     util_groupname(getgid(), group, sizeof(group));
 
@@ -236,11 +413,24 @@ main(int argc, char **argv) {
     config_set_description("%s v%d.%d.%d", VERSION_NAME, VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
 
     //Set default config options.
+    config_set_default_bool("async_create",             "--async-create",               "async_create",              false,                     NULL,                            "Whether or not creates return before the new file is inserted. New files are inserted in batches every `async_create_flush_ms`, or before anything else changes. A new file whose name another mount took first is dropped. Needs `id_range_size`. Only used with the 'mariadb' backend.");
+    config_set_default_int("async_create_flush_ms",     "--async-create-flush-ms",      "async_create_flush_ms",     100,                       config_handle_async_flush,       "Number of milliseconds between inserts of files created asynchronously.");
+    config_set_default("backend",                       "--backend",                    "backend",                   "mariadb",                 NULL,                            "Where files are stored. 'mariadb' stores them in MariaDB. 'sqlite' stores them in the local SQLite database `sqlite_file`, for mounts only used on this host. 'memory' keeps them in memory and loses them when MyFS exits, for measuring MyFS's own overhead.");
+    config_set_default("block_cache_dir",               "--block-cache-dir",            "block_cache_dir",           NULL,                      NULL,                            "A directory on a local disk to cache file data blocks in. The cache is kept across restarts. If blank, blocks are not cached.");
+    config_set_default("block_cache_size",              "--block-cache-size",           "block_cache_size",          "1073741824",              NULL,                            "The number of bytes of file data to keep in the block cache. The least recently used blocks are replaced when it's full.");
+    config_set_default_bool("change_log",               "--change-log",                 "change_log",                false,                     NULL,                            "Whether or not to record every change in the `change_log` table and watch it for other mounts' changes. This lets the kernel cache file data and attributes for longer. Every mount of the database must turn it on. Only used with the 'mariadb' backend.");
+    config_set_default_int("change_log_poll_ms",        "--change-log-poll-ms",         "change_log_poll_ms",        250,                       config_handle_change_log_poll,   "Number of milliseconds between reads of the change log for other mounts' changes.");
     config_set_default("config_file",                   "--config-file",                NULL,                        "/etc/myfs.d/myfs.conf",   NULL,                            "The MariaDB database name.");
     config_set_default_bool("create",                   "--create",                     NULL,                        false,                     config_handle_create,            "Runs the process to create a new MyFS database and exits.");
     config_set_default_int("failed_query_retry_wait",   "--failed-query-retry-wait",    "failed_query_retry_wait",   -1,                        NULL,                            "Number of seconds to wait before retrying a failed query. -1 means do not retry.");
     config_set_default_int("failed_query_retry_count",  "--failed-query-retry-count",   "failed_query_retry_count",  -1,                        NULL,                            "The total number of failed queries to retry. If `retry_wait` is -1, this option is ignored. -1 means retry forever.");
     config_set_default("group",                         "--group",                      "group",                     group,                     NULL,                            "The Linux group to create files and directories with. If blank, the current group will be used.");
+    config_set_default_int("id_cache_ttl",              "--id-cache-ttl",               "id_cache_ttl",              UTIL_ID_CACHE_TTL_DEFAULT, config_handle_id_cache_ttl,      "Number of seconds to cache user and group lookups for, including lookups that found nothing. 0 disables the cache.");
+    config_set_default_int("id_range_size",             "--id-range-size",              "id_range_size",             10000,                     config_handle_id_range_size,     "Number of File IDs each mount reserves from the `id_ranges` table at a time, so creates don't wait on MariaDB's AUTO_INCREMENT. 0 lets MariaDB assign them. Every mount of the database must use ranges, since IDs MariaDB assigns can fall in another mount's range, which fails that mount's creates until it reserves a new one. Only used with the 'mariadb' backend.");
+    config_set_default("import",                        "--import",                     NULL,                        NULL,                      NULL,                            "Copies the local directory tree at this path into MyFS straight through MariaDB, without mounting, and exits. See `import_into` and `import_threads`.");
+    config_set_default("import_into",                   "--into",                       NULL,                        "/",                       NULL,                            "The MyFS directory `import` copies the tree into. It must already exist.");
+    config_set_default_int("import_threads",            "--import-threads",             NULL,                        8,                         config_handle_import_threads,    "Number of directories `import` copies at once, each over its own MariaDB connection.");
+    config_set_default_int("lease_ttl",                 "--lease-ttl",                  "lease_ttl",                 30,                        config_handle_lease_ttl,         "Number of seconds a write lease lasts without being renewed. A mount that recalls a lease from a mount that's gone waits this long.");
     config_set_default_bool("log_stdout",               "--log-stdout",                 "log_stdout",                true,                      config_handle_log_stdout,        "Whether or not to log to stdout.");
     config_set_default_bool("log_syslog",               "--log-syslog",                 "log_syslog",                false,                     config_handle_log_syslog,        "Whether or not to log to syslog.");
     config_set_default("mariadb_database",              "--mariadb-database",           "mariadb_database",          "myfs",                    NULL,                            "The MariaDB database name.");
@@ -248,15 +438,29 @@ main(int argc, char **argv) {
     config_set_default("mariadb_password",              "--mariadb-password",           "mariadb_password",          NULL,                      NULL,                            "The MariaDB user's password.");
     config_set_default("mariadb_port",                  "--mariadb-port",               "mariadb_port",              "3306",                    NULL,                            "The MariaDB port.");
     config_set_default("mariadb_user",                  "--mariadb-user",               "mariadb_user",              "myfs",                    NULL,                            "The MariaDB user.");
+    config_set_default("metrics_file",                  "--metrics-file",               "metrics_file",              NULL,                      NULL,                            "The file to periodically write counters and latency histograms to. If blank, metrics are only kept in memory.");
+    config_set_default_int("metrics_interval",          "--metrics-interval",           "metrics_interval",          10,                        config_handle_metrics_interval,  "Number of seconds between writes to the metrics file.");
     config_set_default("mount",                         "--mount",                      "mount",                     "/mnt/myfs",               NULL,                            "The mount point for the file system.");
+    config_set_default("ownership_mode",                "--ownership-mode",             "ownership_mode",            "name",                    config_handle_ownership_mode,    "How file ownership is read. 'name' looks up the stored user and group names on this host, so hosts only need matching names. 'id' reads the stored UID and GID, so hosts need matching IDs.");
     config_set_default_bool("print_create_sql",         "--print-create-sql",           NULL,                        false,                     config_handle_print_create_sql,  "Prints the SQL statements needed to create a MyFS database and exits.");
+    config_set_default_int("query_summary_interval",    "--query-summary-interval",     "query_summary_interval",    0,                         NULL,                            "Number of seconds between logging the database statements that took the most time. 0 means do not log them.");
+    config_set_default_int("query_summary_top",         "--query-summary-top",          "query_summary_top",         10,                        NULL,                            "The number of statements to log in each summary.");
+    config_set_default("quota_bytes",                   "--quota-bytes",                "quota_bytes",               "0",                       NULL,                            "The number of bytes of file data reported as the file system's size. 0 means no quota.");
+    config_set_default("quota_files",                   "--quota-files",                "quota_files",               "0",                       NULL,                            "The number of files reported as the file system's inode count. 0 means no quota.");
     config_set_default_int("reclaimer_level",           "--reclaimer-level",            "reclaimer_level",           1,                         config_handle_reclaimer_level,   "Determines when reclaimer should run. 0 is off. 1 is optimistic and will run whenever it thinks nothing is going on. 2 is aggressive and will run whenever a database operation occurs where space can be reclaimed.");
+    config_set_default_int("slow_query_ms",             "--slow-query-ms",              "slow_query_ms",             1000,                      NULL,                            "Database queries that take at least this many milliseconds are logged in full. 0 means do not log them.");
+    config_set_default("sqlite_file",                   "--sqlite-file",                "sqlite_file",               "/var/lib/myfs/myfs.db",   NULL,                            "The SQLite database to store files in when `backend` is 'sqlite'. It's created if it doesn't exist.");
+    config_set_default("trace_decode",                  "--trace-decode",               NULL,                        NULL,                      config_handle_trace_decode,      "Decodes a trace dump into text and exits.");
+    config_set_default("trace_file",                    "--trace-file",                 "trace_file",                NULL,                      NULL,                            "The file the trace is dumped to when MyFS gets SIGUSR2. It's never written through a symbolic link. If blank, SIGUSR2 is not handled.");
     config_set_default("user",                          "--user",                       "user",                      user,                      NULL,                            "The Linux user to create files and directories with. If blank, the current user will be used.");
+    config_set_default_bool("write_leases",             "--write-leases",               "write_leases",              false,                     NULL,                            "Whether or not to lease files to the mount writing them, so it can keep writes in memory and send them in large batches. Other mounts that open the file recall the lease first. Only used with the 'mariadb' backend.");
+    config_set_default_bool("writeback_cache",          "--writeback-cache",            "writeback_cache",           false,                     NULL,                            "Whether or not to let the kernel cache writes and send them in large batches. File sizes and modified times are kept by the kernel until the writes are flushed.");
 
     //These command line configs should be parsed before the config file.
     config_set_priority("config_file");
     config_set_priority("create");
     config_set_priority("print_create_sql");
+    config_set_priority("trace_decode");
 
     success = config_read_command_line(argc, argv, true) &&
               config_read_file(config_get("config_file")) &&
@@ -276,21 +480,80 @@ main(int argc, char **argv) {
         goto done;
     }
 
+    //This has to be started before any other threads so they don't get SIGUSR2.
+    success = trace_start(config_get("trace_file"));
+    if (!success) {
+        ret = MYFS_RETURN_TRACE;
+        goto done;
+    }
+
+    //From here on messages are written by the log thread so logging never holds up a FUSE thread.
+    success = log_start();
+    if (!success) {
+        ret = MYFS_RETURN_LOG;
+        goto done;
+    }
+
+    //Importing runs instead of mounting.
+    if (config_has("import") && !config_equals("import", "")) {
+        if (!config_equals("backend", "mariadb")) {
+            log_err(MODULE, "Error importing: Only the 'mariadb' backend can be imported into");
+            success = false;
+        }
+        else {
+            success = import_run(config_get("import"), config_get("import_into"), config_get_uint("import_threads"));
+        }
+
+        ret = success ? MYFS_RETURN_SUCCESS : MYFS_RETURN_IMPORT;
+        goto done;
+    }
+
     success = myfs_connect(&myfs);
     if (!success) {
         ret = MYFS_RETURN_DATABASE;
         goto done;
     }
 
-    success = reclaimer_start();
+    //Reclaiming space is done with MariaDB's OPTIMIZE TABLE, so only MariaDB needs it.
+    success = !config_equals("backend", "mariadb") || reclaimer_start();
     if (!success) {
         ret = MYFS_RETURN_RECLAIMER;
         goto done;
     }
 
+    success = !myfs.change_log || change_log_start(&myfs, config_get_uint("change_log_poll_ms"));
+    if (!success) {
+        ret = MYFS_RETURN_CHANGES;
+        goto done;
+    }
+
+    success = !myfs.write_leases || lease_start(&myfs, config_get_uint("lease_ttl"));
+    if (!success) {
+        ret = MYFS_RETURN_LEASES;
+        goto done;
+    }
+
+    success = !myfs.async_create || async_create_start(&myfs, config_get_uint("async_create_flush_ms"));
+    if (!success) {
+        ret = MYFS_RETURN_CREATES;
+        goto done;
+    }
+
+    success = block_cache_start(config_get("block_cache_dir"), strtoull(config_get("block_cache_size"), NULL, 10));
+    if (!success) {
+        ret = MYFS_RETURN_CACHE;
+        goto done;
+    }
+
+    success = metrics_start(config_get("metrics_file"), config_get_uint("metrics_interval"));
+    if (!success) {
+        ret = MYFS_RETURN_METRICS;
+        goto done;
+    }
+
     memset(&operations, 0, sizeof(operations));
-    //operations.init = myfs_init;
-    //operations.destroy = myfs_destroy;
+    operations.init = myfs_init;
+    operations.destroy = myfs_destroy;
     operations.statfs = myfs_statfs;
     operations.getattr = myfs_getattr;
     operations.access = myfs_access;
@@ -307,10 +570,13 @@ main(int argc, char **argv) {
     operations.mkdir = myfs_mkdir;
     operations.create = myfs_create;
     operations.flush = myfs_flush;
+    operations.fsync = myfs_fsync;
     operations.open = myfs_open;
     operations.release = myfs_release;
     operations.read = myfs_read;
+    operations.read_buf = myfs_read_buf;
     operations.write = myfs_write;
+    operations.write_buf = myfs_write_buf;
     operations.rename = myfs_rename;
     operations.symlink = myfs_symlink;
     operations.readlink = myfs_readlink;
@@ -318,7 +584,7 @@ main(int argc, char **argv) {
     //Since MyFS has its own command line arguments, create a new argc/argv duo for FUSE. If we don't,
     //FUSE will choke on MyFS's command line arguments. Likewise, MyFS will choke on FUSE arguments.
     //all we really care about is -f <mount point>
-    fargv = fargs_create(argv[0], &fargc);
+    fargv = fargs_create(argv[0], myfs.request_size, &fargc);
 
     log_info(MODULE, "Running");
     ret = fuse_main(fargc, fargv, &operations, &myfs);
@@ -326,15 +592,29 @@ main(int argc, char **argv) {
     fargs_free(fargc, fargv);
 
 done:
+    lease_stop();
+    async_create_stop();
+    change_log_stop();
+    block_cache_stop();
     myfs_disconnect(&myfs);
     reclaimer_stop();
+    metrics_stop();
+    trace_stop();
 
     log_info(MODULE, "Goodbye");
 
+    ctl_free();
+    async_create_free();
+    lease_free();
+    change_log_free();
+    block_cache_free();
     reclaimer_free();
     config_free();
+    metrics_free();
+    trace_free();
     log_free();
     mysql_library_end();
+    pthread_mutex_destroy(&myfs.files_lock);
 
     return ret;
 }
@@ -7,25 +7,24 @@
 #include "../common/log.h"
 #include "../common/config.h"
 #include "../common/string.h"
+#include "../common/metrics.h"
+#include "../common/trace.h"
 #include "util.h"
+#include "myfs_backend.h"
 #include "myfs_db.h"
+#include "myfs_mem.h"
+#include "myfs_sqlite.h"
 #include "reclaimer.h"
+#include "block_cache.h"
+#include "change_log.h"
+#include "lease.h"
+#include "ctl.h"
 #include "myfs.h"
 
 #define MODULE "MyFS"
 
-//#define MYFS_TRACE
-#if defined(MYFS_TRACE)
-# define MYFS_LOG_TRACE(fmt, ...)                   \
-        do {                                        \
-            printf("[%s] ", __FUNCTION__);          \
-            printf(fmt, ##__VA_ARGS__);             \
-            printf("\n");                           \
-            fflush(stdout);                         \
-        } while(0)
-#else
-# define MYFS_LOG_TRACE(fmt, ...)
-#endif
+/** The number of seconds the kernel may cache entries and attributes for when the change log is on. */
+#define MYFS_CHANGE_LOG_CACHE_TIMEOUT 60.0
 
 void
 myfs_file_init(myfs_file_t *file) {
@@ -85,27 +84,24 @@ myfs_file_type_str(myfs_file_type_t type) {
 }
 
 /**
- * Queries MariaDB for MyFS file based on a full file path. For example, if `path` is /path/to/file, then
+ * Looks up a MyFS file based on a full file path. For example, if `path` is /path/to/file, then
  * the MyFS represnted by the name 'file' with parent 'to' will be returned.
  *
  * @param[in] myfs The MyFS context.
  * @param[in] path The path to the MyFS file.
- * @param[in] include_children `true` to also query for the MyFS's children.
  * @return The MyFS file or `NULL` if an error occurred.
  */
 static myfs_file_t *
-myfs_file_get(myfs_t *myfs, const char *path, bool include_children) {
+myfs_file_get(myfs_t *myfs, const char *path) {
     char *path_dupe, *name, *save;
     unsigned int parent_id;
     myfs_file_t *file = NULL;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; IncludeChildren[%s]", path, include_children ? "Yes" : "No");
-
     //skip the first /
     path_dupe = strdup(path + 1);
 
     //Get the root folder.
-    file = myfs_db_file_query_name(myfs, NULL, 0, include_children);
+    file = myfs->backend->file_query_name(myfs, NULL, 0, false);
 
     //Loop through each name part and get the child until we get to the last one.
     name = strtok_r(path_dupe, "/", &save);
@@ -113,14 +109,12 @@ myfs_file_get(myfs_t *myfs, const char *path, bool include_children) {
         parent_id = file->file_id;
         myfs_file_free(file);
 
-        file = myfs_db_file_query_name(myfs, name, parent_id, include_children);
+        file = myfs->backend->file_query_name(myfs, name, parent_id, false);
         name = strtok_r(NULL, "/", &save);
     }
 
     free(path_dupe);
 
-    MYFS_LOG_TRACE("End");
-
     return file;
 }
 
@@ -136,7 +130,7 @@ static bool
 myfs_file_get_file_id(myfs_t *myfs, const char *path, unsigned int *file_id) {
     myfs_file_t *file;
 
-    file = myfs_file_get(myfs, path, false);
+    file = myfs_file_get(myfs, path);
     if (file == NULL) {
         return false;
     }
@@ -148,7 +142,32 @@ myfs_file_get_file_id(myfs_t *myfs, const char *path, unsigned int *file_id) {
 }
 
 /**
- * Queries MariaDB to determine if the given file exists.
+ * Looks up a directory based on a full path, along with its children.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] path The path to the directory.
+ * @param[out] file On success, stores the directory.
+ * @return 0 on success, `-ENOENT` if it doesn't exist or `-EIO` if its children couldn't all be read.
+ */
+static int
+myfs_file_get_children(myfs_t *myfs, const char *path, myfs_file_t **file) {
+    unsigned int file_id;
+
+    if (!myfs_file_get_file_id(myfs, path, &file_id)) {
+        return -ENOENT;
+    }
+
+    //A partial list would pass for the whole directory, so it's an error instead.
+    *file = myfs->backend->file_query(myfs, file_id, true);
+    if (*file == NULL) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/**
+ * Determines if the given file exists.
  *
  * @param[in] myfs THe MyFS context.
  * @param[in] path The path to the MyFS file.
@@ -161,7 +180,7 @@ myfs_file_exists(myfs_t *myfs, const char *path, bool *exists) {
 
     //TODO: handle query error vs exists!
 
-    file = myfs_file_get(myfs, path, false);
+    file = myfs_file_get(myfs, path);
 
     if (file == NULL) {
         *exists = false;
@@ -174,53 +193,72 @@ myfs_file_exists(myfs_t *myfs, const char *path, bool *exists) {
     return true;
 }
 
-bool
-myfs_connect(myfs_t *myfs) {
-    bool success;
-    MYSQL_RES *res;
-    MYSQL_ROW row;
+/**
+ * Resolves the config values used while mounted into `myfs->config`.
+ *
+ * @param[in] myfs The MyFS context.
+ */
+static void
+myfs_config_load(myfs_t *myfs) {
+    myfs_config_t *config = &myfs->config;
 
-    db_init(&myfs->db);
-    success = db_connect(&myfs->db, config_get("mariadb_host"), config_get("mariadb_user"), config_get("mariadb_password"), config_get("mariadb_database"),config_get_uint("mariadb_port"));
+    strlcpy(config->user, config_get("user"), sizeof(config->user));
+    config->uid_found = util_user_id(config->user, &config->uid) == 0;
+    if (!config->uid_found) {
+        log_warn(MODULE, "Unable to find the UID of user '%s'", config->user);
+    }
 
-    if (!success) {
-        log_err(MODULE, "Error connecting to MariaDB: %s", db_error(&myfs->db));
-        return false;
+    strlcpy(config->group, config_get("group"), sizeof(config->group));
+    config->gid_found = util_group_id(config->group, &config->gid) == 0;
+    if (!config->gid_found) {
+        log_warn(MODULE, "Unable to find the GID of group '%s'", config->group);
     }
 
-    db_set_failed_query_options(&myfs->db, config_get_int("failed_query_retry_wait"), config_get_int("failed_query_retry_count"));
+    config->quota_bytes = strtoull(config_get("quota_bytes"), NULL, 10);
+    config->quota_files = strtoull(config_get("quota_files"), NULL, 10);
 
-    //Query to get MariaDB's max_allowed_packet variable.
-    res = db_select(&myfs->db, "SHOW VARIABLES LIKE 'max_allowed_packet'", 40);
-    if (res == NULL) {
-        log_err(MODULE, "Error getting 'max_allowed_packet' variable: %s", db_error(&myfs->db));
-        return false;
+    myfs->ownership_mode = config_equals("ownership_mode", "id") ? MYFS_OWNERSHIP_ID : MYFS_OWNERSHIP_NAME;
+}
+
+const myfs_backend_t *
+myfs_backend_find(const char *name) {
+    if (strcmp(name, myfs_db_backend.name) == 0) {
+        return &myfs_db_backend;
     }
 
-    row = mysql_fetch_row(res);
-    if (row == NULL) {
-        log_err(MODULE, "Error getting 'max_allowed_packet' variable: Not found");
-        success = false;
+    if (strcmp(name, myfs_sqlite_backend.name) == 0) {
+        return &myfs_sqlite_backend;
     }
-    else if (row[1] == NULL) {
-        log_err(MODULE, "Error getting 'max_allowed_packet' variable: Value is NULL");
-        success = false;
+
+    if (strcmp(name, myfs_mem_backend.name) == 0) {
+        return &myfs_mem_backend;
     }
-    else {
-        myfs->max_allowed_packet = strtoul(row[1], NULL, 10);
-        log_info(MODULE, "'max_allowed_packet' is %u", myfs->max_allowed_packet);
+
+    return NULL;
+}
+
+bool
+myfs_connect(myfs_t *myfs) {
+    myfs->backend = myfs_backend_find(config_get("backend"));
+    if (myfs->backend == NULL) {
+        log_err(MODULE, "Error connecting: Unknown backend '%s'", config_get("backend"));
+        return false;
     }
 
-    mysql_free_result(res);
-    return success;
+    log_info(MODULE, "Storing files in %s", myfs->backend->name);
+
+    myfs_config_load(myfs);
+
+    return myfs->backend->connect(myfs);
 }
 
 void
 myfs_disconnect(myfs_t *myfs) {
     uint64_t i;
 
-    db_disconnect(&myfs->db);
-    db_free(&myfs->db);
+    if (myfs->backend != NULL) {
+        myfs->backend->disconnect(myfs);
+    }
 
     for (i = 0; i < MYFS_FILES_OPEN_MAX; i++) {
         if (myfs->files[i] != NULL) {
@@ -264,45 +302,66 @@ myfs_get_file_id(myfs_t *myfs, const char *path, struct fuse_file_info *fi, unsi
     return true;
 }
 
-int
-myfs_open_helper(const char *path, bool dir, bool truncate, struct fuse_file_info *fi) {
-    myfs_file_t *file;
-    myfs_t *myfs;
+/**
+ * Puts a file that's already been looked up into the open file table.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] path The path to the file, for logging.
+ * @param[in] file The file. It's owned by the open file table on success and freed on failure.
+ * @param[in] dir `true` if a directory is being opened.
+ * @param[in] truncate `true` to truncate the file.
+ * @param[in] fi FUSE's file info structure, which is given the file handle.
+ * @return 0 on success, otherwise a negative errno.
+ */
+static int
+myfs_open_file(myfs_t *myfs, const char *path, myfs_file_t *file, bool dir, bool truncate, struct fuse_file_info *fi) {
     bool success;
     uint64_t fh = 0;
 
-    myfs = (myfs_t *)fuse_get_context()->private_data;
-
-    //Look for the first available file handle.
+    //Claim the first available file handle. Recalling a lease can block for seconds, so the slot is taken
+    //before that, and another open can't pick the same one in the meantime.
+    pthread_mutex_lock(&myfs->files_lock);
     for (fh = 0; fh < MYFS_FILES_OPEN_MAX; fh++) {
         if (myfs->files[fh] == NULL) {
+            myfs->files[fh] = file;
             break;
         }
     }
+    pthread_mutex_unlock(&myfs->files_lock);
 
     if (fh == MYFS_FILES_OPEN_MAX) {
         log_err(MODULE, "Error opening file '%s': Maximum number of files are open", path);
+        myfs_file_free(file);
         return -EMFILE;
     }
 
-    //If a directory is being opened, get the children
-    file = myfs_file_get(myfs, path, dir ? true : false);
-    if (file == NULL) {
-        return -ENOENT;
+    //Recall the file from another mount that's buffering writes to it, or take it for this one.
+    if (!dir) {
+        success = lease_open(&file, (fi->flags & O_ACCMODE) != O_RDONLY);
+        if (!success) {
+            myfs->files[fh] = NULL;
+            myfs_file_free(file);
+            return -EIO;
+        }
     }
 
     //If a file is being opened, truncate if asked.
     if (!dir && truncate) {
-        success = myfs_db_file_truncate(myfs, file->file_id, 0);
+        success = lease_flush(file->file_id) &&
+                  myfs->backend->file_truncate(myfs, file->file_id, 0, &file->version);
         if (!success) {
+            lease_close(file->file_id);
+            myfs->files[fh] = NULL;
             myfs_file_free(file);
             return -EIO;
         }
 
-        //file->st.st_size = 0;
+        block_cache_invalidate(file->file_id, 0, file->st.st_size);
+        lease_resize(file->file_id, 0);
+        file->st.st_size = 0;
     }
 
-    //Put the file into the open files table
+    //Put the file into the open files table. lease_open() may have replaced it.
     myfs->files[fh] = file;
 
     //Put the file handle into Fuse's file info struct so we can get it in other file operations
@@ -311,12 +370,50 @@ myfs_open_helper(const char *path, bool dir, bool truncate, struct fuse_file_inf
     return 0;
 }
 
+int
+myfs_open_helper(const char *path, bool dir, bool truncate, struct fuse_file_info *fi) {
+    myfs_file_t *file;
+    myfs_t *myfs;
+    int ret;
+
+    myfs = (myfs_t *)fuse_get_context()->private_data;
+
+    if (ctl_path(path)) {
+        return ctl_open(myfs, path, fi);
+    }
+
+    //If a directory is being opened, get the children
+    if (dir) {
+        ret = myfs_file_get_children(myfs, path, &file);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    else {
+        file = myfs_file_get(myfs, path);
+        if (file == NULL) {
+            return -ENOENT;
+        }
+    }
+
+    return myfs_open_file(myfs, path, file, dir, truncate, fi);
+}
+
 int
 myfs_release_helper(const char *path, struct fuse_file_info *fi) {
     myfs_t *myfs;
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    if (ctl_handle(fi)) {
+        return ctl_release(fi);
+    }
+
+    //The last handle on this mount flushes the file's writes and gives up its lease.
+    if (myfs->files[fi->fh]->type != MYFS_FILE_TYPE_DIRECTORY) {
+        lease_close(myfs->files[fi->fh]->file_id);
+    }
+
     //Free the file and make the file handle available again.
     myfs_file_free(myfs->files[fi->fh]);
     myfs->files[fi->fh] = NULL;
@@ -328,28 +425,105 @@ myfs_release_helper(const char *path, struct fuse_file_info *fi) {
  *                  FUSE CALLBACKS
  *****************************************************************************************************/
 
+void *
+myfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+    myfs_t *myfs;
+
+    myfs = (myfs_t *)fuse_get_context()->private_data;
+
+    //Let libfuse splice read replies to the kernel instead of copying them through a userspace buffer.
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE) {
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+    }
+    if (conn->capable & FUSE_CAP_SPLICE_MOVE) {
+        conn->want |= FUSE_CAP_SPLICE_MOVE;
+    }
+
+    //Let the kernel keep several reads in flight, including readahead, for the same file.
+    if (conn->capable & FUSE_CAP_ASYNC_READ) {
+        conn->want |= FUSE_CAP_ASYNC_READ;
+    }
+
+    //In writeback mode the kernel caches small writes and sends them as large, page aligned ones. While it
+    //does, it owns the file's size and modified time.
+    if (config_equals("writeback_cache", "true")) {
+        if (conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+            conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+            myfs->writeback_cache = true;
+        }
+        else {
+            log_warn(MODULE, "The kernel does not support 'writeback_cache', writes will not be cached");
+        }
+    }
+
+    //Ask for requests sized to a few block inserts. The kernel and libfuse lower these if they can't
+    //support them. max_read also has to be given as a mount option, see main.c.
+    conn->max_write = myfs->request_size;
+    conn->max_read = myfs->request_size;
+    conn->max_readahead = myfs->request_size;
+
+    //Other mounts' changes are pushed to the kernel as they're read from the change log, so it can keep
+    //pages across opens and hold on to entries and attributes for longer.
+    if (myfs->change_log) {
+        cfg->kernel_cache = 1;
+        cfg->entry_timeout = MYFS_CHANGE_LOG_CACHE_TIMEOUT;
+        cfg->attr_timeout = MYFS_CHANGE_LOG_CACHE_TIMEOUT;
+        change_log_attach(fuse_get_context()->fuse);
+    }
+
+    log_debug(MODULE, "FUSE connection; Capable[0x%x]; Want[0x%x]; MaxWrite[%u]; MaxRead[%u]; MaxReadahead[%u]", conn->capable, conn->want, conn->max_write, conn->max_read, conn->max_readahead);
+
+    //The return value becomes the private data for every other callback, so hand back the MyFS context.
+    return myfs;
+}
+
+void
+myfs_destroy(void *private_data) {
+    //FUSE is going away, so the change log can't send the kernel anything else.
+    change_log_attach(NULL);
+}
+
 int
 myfs_statfs(const char *path, struct statvfs *stv) {
+    uint64_t files, bytes, used;
     myfs_t *myfs;
     bool success;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]", path);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
     memset(stv, 0, sizeof(*stv));
-    stv->f_bsize = 1;
-    stv->f_frsize = 1;
+    stv->f_bsize = MYFS_FILE_BLOCK_SIZE;
+    stv->f_frsize = MYFS_FILE_BLOCK_SIZE;
     stv->f_namemax = MYFS_FILE_NAME_MAX_LEN;
 
-    success = myfs_db_get_num_files(myfs, &stv->f_files) &&
-              myfs_db_get_space_used(myfs, &stv->f_blocks);
-
+    success = myfs->backend->get_stats(myfs, &files, &bytes);
     if (!success) {
         return -EIO;
     }
 
-    MYFS_LOG_TRACE("End");
+    used = (bytes + MYFS_FILE_BLOCK_SIZE - 1) / MYFS_FILE_BLOCK_SIZE;
+
+    //Without a quota there's no size to report free space against, so the file system is reported as full.
+    if (myfs->config.quota_bytes > 0) {
+        stv->f_blocks = myfs->config.quota_bytes / MYFS_FILE_BLOCK_SIZE;
+        stv->f_bfree = stv->f_blocks > used ? stv->f_blocks - used : 0;
+        stv->f_bavail = stv->f_bfree;
+    }
+    else {
+        stv->f_blocks = used;
+    }
+
+    if (myfs->config.quota_files > 0) {
+        stv->f_files = myfs->config.quota_files;
+        stv->f_ffree = stv->f_files > files ? stv->f_files - files : 0;
+        stv->f_favail = stv->f_ffree;
+    }
+    else {
+        stv->f_files = files;
+    }
 
     return 0;
 }
@@ -359,34 +533,45 @@ myfs_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
     myfs_file_t *file;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; FI[%p]", path, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
-    file = myfs_file_get(myfs, path, false);
+    if (ctl_path(path)) {
+        return ctl_getattr(path, st);
+    }
+
+    file = myfs_file_get(myfs, path);
     if (file == NULL) {
         return -ENOENT;
     }
 
-    //Simply copy the file's struct stat into the output buffer.
+    //Simply copy the file's struct stat into the output buffer. If writes are being buffered, the backend
+    //doesn't have the file's size yet.
     memcpy(st, &file->st, sizeof(*st));
+    lease_size(file->file_id, &st->st_size);
     myfs_file_free(file);
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
 int
 myfs_access(const char *path, int mode) {
     myfs_file_t *file;
+    struct stat st;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Mode[%d]", path, mode);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
-    file = myfs_file_get(myfs, path, false);
+    if (ctl_path(path)) {
+        return ctl_getattr(path, &st);
+    }
+
+    file = myfs_file_get(myfs, path);
     if (file == NULL) {
         return -ENOENT;
     }
@@ -394,58 +579,100 @@ myfs_access(const char *path, int mode) {
     //TODO: Check permissions if we implement them.
     myfs_file_free(file);
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
 int
 myfs_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
-    myfs_file_t *file;
+    unsigned int file_id;
     myfs_t *myfs;
     bool success;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Size[%zu]; FI[%p]", path, size, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, size);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
-    //Get the file from the open file table
-    file = myfs->files[fi->fh];
+    //Shells truncate the `ctl` file before writing a command to it. Control files are made when they're
+    //opened, so there's nothing to truncate.
+    if (ctl_path(path)) {
+        return 0;
+    }
 
-    success = myfs_db_file_truncate(myfs, file->file_id, size);
+    //Get the file from the open file table or the path if it's not open
+    success = myfs_get_file_id(myfs, path, fi, &file_id);
+    if (!success) {
+        return -ENOENT;
+    }
+
+    success = lease_flush(file_id) &&
+              myfs->backend->file_truncate(myfs, file_id, size, fi != NULL ? &myfs->files[fi->fh]->version : NULL);
     if (!success) {
         return -EIO;
     }
 
-    //file->st.st_size = size;
+    lease_resize(file_id, size);
+
+    //The blocks past the new end are gone. Without the old size, drop every block of the file.
+    if (fi != NULL) {
+        if (size < myfs->files[fi->fh]->st.st_size) {
+            block_cache_invalidate(file_id, size, myfs->files[fi->fh]->st.st_size - size);
+        }
+        myfs->files[fi->fh]->st.st_size = size;
+    }
+    else {
+        block_cache_invalidate_file(file_id);
+    }
+
     reclaimer_notify(RECLAIMER_ACTION_DELETE);
 
-    MYFS_LOG_TRACE("End");
     return 0;
 }
 
 int
 myfs_utimens(const char *path, const struct timespec ts[2], struct fuse_file_info *fi) {
+    const time_t *times[2];
     unsigned int file_id;
+    time_t now;
     bool success;
+    int i;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; atime[%ld]; mtime[%ld]; FI[%p]", path, ts[0].tv_sec, ts[1].tv_sec, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
     //Get the file from the open file table or the path if it's not open
     success = myfs_get_file_id(myfs, path, fi, &file_id);
     if (!success) {
         return -ENOENT;
     }
 
-    success = myfs_db_file_set_times(myfs, file_id, ts[0].tv_sec, ts[1].tv_sec);
+    //Resolve UTIME_NOW and UTIME_OMIT. Omitted times are left unchanged.
+    now = time(NULL);
+    for (i = 0; i < 2; i++) {
+        if (ts[i].tv_nsec == UTIME_OMIT) {
+            times[i] = NULL;
+        }
+        else if (ts[i].tv_nsec == UTIME_NOW) {
+            times[i] = &now;
+        }
+        else {
+            times[i] = &ts[i].tv_sec;
+        }
+    }
+
+    success = myfs->backend->file_set_times(myfs, file_id, times[0], times[1]);
     if (!success) {
         return -EIO;
     }
 
-    MYFS_LOG_TRACE("End");
     return 0;
 }
 
@@ -457,10 +684,16 @@ myfs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi) {
     int ret;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; UID[%u]; GID[%u]; FI[%p]", path, uid, gid, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
     //Get the file from the open file table or the path if it's not open
     success = myfs_get_file_id(myfs, path, fi, &file_id);
     if (!success) {
@@ -477,9 +710,13 @@ myfs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi) {
     user[0] = '\0';
     group[0] = '\0';
 
+    //In ID mode the ID is what matters, so an ID without a name on this host is stored with the ID as its name.
     if (uid != (uid_t)-1) {
         ret = util_username(uid, user, sizeof(user));
-        if (ret != 0) {
+        if (ret == ENOENT && myfs->ownership_mode == MYFS_OWNERSHIP_ID) {
+            snprintf(user, sizeof(user), "%u", uid);
+        }
+        else if (ret != 0) {
             log_err(MODULE, "Error changing owner on File ID %u: Error finding user %u: %s", file_id, uid, strerror(ret));
             return -ret;
         }
@@ -487,19 +724,20 @@ myfs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi) {
 
     if (gid != (gid_t)-1) {
         ret = util_groupname(gid, group, sizeof(group));
-        if (ret != 0) {
-            log_err(MODULE, "Error changing owner on File ID %u: Error finding group %u: %s", file_id, gid, strerror(errno));
+        if (ret == ENOENT && myfs->ownership_mode == MYFS_OWNERSHIP_ID) {
+            snprintf(group, sizeof(group), "%u", gid);
+        }
+        else if (ret != 0) {
+            log_err(MODULE, "Error changing owner on File ID %u: Error finding group %u: %s", file_id, gid, strerror(ret));
             return -ret;
         }
     }
 
-    success = myfs_db_file_chown(myfs, file_id, user, group);
+    success = myfs->backend->file_chown(myfs, file_id, user, uid, group, gid);
     if (!success) {
         return -EIO;
     }
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
@@ -509,10 +747,16 @@ myfs_chmod(const char *path, mode_t mode, struct fuse_file_info *fi) {
     bool success;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Mode[%u}; FI[%p]", path, mode, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
     //Get the file from the open file table or the path if it's not open
     success = myfs_get_file_id(myfs, path, fi, &file_id);
     if (!success) {
@@ -524,13 +768,11 @@ myfs_chmod(const char *path, mode_t mode, struct fuse_file_info *fi) {
         return -EPERM;
     }
 
-    success = myfs_db_file_chmod(myfs, file_id, mode);
+    success = myfs->backend->file_chmod(myfs, file_id, mode);
     if (!success) {
         return -EIO;
     }
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
@@ -538,12 +780,11 @@ int
 myfs_opendir(const char *path, struct fuse_file_info *fi) {
     int ret;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; FI[%p]", path, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     ret = myfs_open_helper(path, true, false, fi);
 
-    MYFS_LOG_TRACE("End");
-
     return ret;
 }
 
@@ -551,12 +792,11 @@ int
 myfs_releasedir(const char *path, struct fuse_file_info *fi) {
     int ret;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; FileHandle[%zu]; FI[%p]", path, fi->fh, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     ret = myfs_release_helper(path, fi);
 
-    MYFS_LOG_TRACE("End");
-
     return ret;
 }
 
@@ -566,10 +806,15 @@ myfs_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offse
     myfs_t *myfs;
     unsigned int i;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Offset[%zu]; FI[%p]", path, offset, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    if (ctl_handle(fi)) {
+        return ctl_readdir(path, buffer, filler);
+    }
+
     file = myfs->files[fi->fh];
 
     //Always at the current and previous directory special files.
@@ -578,12 +823,9 @@ myfs_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offse
 
     //Add the files in the directory.
     for (i = 0; i < file->children_count; i++) {
-        MYFS_LOG_TRACE("Adding [%s]", file->children[i]->name);
         filler(buffer, file->children[i]->name, NULL, 0, 0);
     }
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
@@ -593,18 +835,24 @@ myfs_unlink(const char *path) {
     myfs_t *myfs;
     bool success;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]", path);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
-    file = myfs_file_get(myfs, path, false);
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
+    file = myfs_file_get(myfs, path);
     if (file == NULL) {
         return -ENOENT;
     }
 
-    //Delete the file from MariaDB.
+    //Delete the file from the backend.
     //FUSE does the check already to see if the file being deleted is a regular file.
-    success = myfs_db_file_delete(myfs, file->file_id);
+    success = myfs->backend->file_delete(myfs, file->file_id);
     myfs_file_free(file);
 
     if (!success) {
@@ -613,8 +861,6 @@ myfs_unlink(const char *path) {
 
     reclaimer_notify(RECLAIMER_ACTION_DELETE);
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
@@ -623,14 +869,21 @@ myfs_rmdir(const char *path) {
     myfs_file_t *file;
     myfs_t *myfs;
     bool success;
+    int ret;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]", path);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
-    file = myfs_file_get(myfs, path, true);
-    if (file == NULL) {
-        return -ENOENT;
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
+    ret = myfs_file_get_children(myfs, path, &file);
+    if (ret != 0) {
+        return ret;
     }
 
     //Not allowed to update the root directory.
@@ -645,8 +898,8 @@ myfs_rmdir(const char *path) {
         return -ENOTEMPTY;
     }
 
-    //Delete the directory from MariaDB.
-    success = myfs_db_file_delete(myfs, file->file_id);
+    //Delete the directory from the backend.
+    success = myfs->backend->file_delete(myfs, file->file_id);
     myfs_file_free(file);
 
     if (!success) {
@@ -655,7 +908,6 @@ myfs_rmdir(const char *path) {
 
     reclaimer_notify(RECLAIMER_ACTION_DELETE);
 
-    MYFS_LOG_TRACE("End");
     return 0;
 }
 
@@ -667,24 +919,28 @@ myfs_mkdir(const char *path, mode_t mode) {
     myfs_file_t *parent;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Mode[%u]", path, mode);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
     //Get the path components.
     util_dirname(path, dir, sizeof(dir));
     util_basename(path, name, sizeof(name));
 
-    MYFS_LOG_TRACE("Creating folder '%s' in '%s'", name, dir);
-
     //Get the MyFS file that represents the parent folder.
-    parent = myfs_file_get(myfs, dir, false);
+    parent = myfs_file_get(myfs, dir);
     if (parent == NULL) {
         return -ENOENT;
     }
 
-    //Create the directory in MariaDB.
-    file_id = myfs_db_file_create(myfs, name, MYFS_FILE_TYPE_DIRECTORY, parent->file_id, mode);
+    //Create the directory in the backend.
+    file_id = myfs->backend->file_create(myfs, name, MYFS_FILE_TYPE_DIRECTORY, parent->file_id, mode);
     myfs_file_free(parent);
 
     if (file_id == 0) {
@@ -693,8 +949,6 @@ myfs_mkdir(const char *path, mode_t mode) {
 
     reclaimer_notify(RECLAIMER_ACTION_GENERAL);
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
@@ -704,50 +958,96 @@ myfs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     char name[MYFS_FILE_NAME_MAX_LEN + 1];
     unsigned int file_id;
     int ret;
-    myfs_file_t *parent;
+    myfs_file_t *parent, *file;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; FI[%p]", path, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
     //Get the path components.
     util_dirname(path, dir, sizeof(dir));
     util_basename(path, name, sizeof(name));
 
-    MYFS_LOG_TRACE("Creating file '%s' in '%s'", name, dir);
-
     //Get the MyFS file that represents the parent folder.
-    parent = myfs_file_get(myfs, dir, false);
+    parent = myfs_file_get(myfs, dir);
     if (parent == NULL) {
         return -ENOENT;
     }
 
-    //Create the file in MariaDB.
-    file_id = myfs_db_file_create(myfs, name, MYFS_FILE_TYPE_FILE, parent->file_id, 0640);
+    //Create the file in the backend.
+    file_id = myfs->backend->file_create(myfs, name, MYFS_FILE_TYPE_FILE, parent->file_id, 0640);
     myfs_file_free(parent);
 
     if (file_id == 0) {
         return -EIO;
     }
 
-    //This callback is also supposed to open the file.
-    ret = myfs_open_helper(path, false, false, fi);
+    //This callback is also supposed to open the file. Its ID is already known, so look it up by that
+    //instead of walking the path again.
+    file = myfs->backend->file_query(myfs, file_id, false);
+    if (file == NULL) {
+        return -EIO;
+    }
+
+    ret = myfs_open_file(myfs, path, file, false, false, fi);
     if (ret != 0) {
         return ret;
     }
 
     reclaimer_notify(RECLAIMER_ACTION_GENERAL);
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
 int
 myfs_flush(const char *path, struct fuse_file_info *fi) {
-    MYFS_LOG_TRACE("Begin; Path[%s]; FI[%p]", path, fi);
-    MYFS_LOG_TRACE("End");
+    myfs_t *myfs;
+    bool success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    myfs = (myfs_t *)fuse_get_context()->private_data;
+
+    if (ctl_handle(fi)) {
+        return 0;
+    }
+
+    //Writes buffered under a lease reach the backend by the time close() returns.
+    success = lease_flush(myfs->files[fi->fh]->file_id);
+    if (!success) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+int
+myfs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    myfs_t *myfs;
+    bool success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    myfs = (myfs_t *)fuse_get_context()->private_data;
+
+    if (fi == NULL || ctl_handle(fi)) {
+        return 0;
+    }
+
+    //Every other write is committed before it returns, so only writes buffered under a lease are left.
+    success = lease_flush(myfs->files[fi->fh]->file_id);
+    if (!success) {
+        return -EIO;
+    }
 
     return 0;
 }
@@ -756,12 +1056,11 @@ int
 myfs_open(const char *path, struct fuse_file_info *fi) {
     int ret;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Truncate[%s]; FI[%p]", path, fi->flags & O_TRUNC ? "Yes" : "No", fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     ret = myfs_open_helper(path, false, fi->flags & O_TRUNC, fi);
 
-    MYFS_LOG_TRACE("End");
-
     return ret;
 }
 
@@ -769,25 +1068,65 @@ int
 myfs_release(const char *path, struct fuse_file_info *fi) {
     int ret;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; FileHandle[%zu]; FI[%p]", path, fi->fh, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     ret = myfs_release_helper(path, fi);
 
-    MYFS_LOG_TRACE("End");
-
     return ret;
 }
 
+/**
+ * Reads data from an open file, from the block cache if every block is in it and otherwise from the
+ * backend. Shared by `myfs_read()` and `myfs_read_buf()`.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] file The open file.
+ * @param[out] buf Where to read to.
+ * @param[in] size The number of bytes to read. The range must end at or before the end of the file.
+ * @param[in] offset Where to start reading.
+ * @return The number of bytes read, or -1 on failure.
+ */
+static ssize_t
+myfs_read_data(myfs_t *myfs, myfs_file_t *file, char *buf, size_t size, off_t offset) {
+    uint64_t version;
+    ssize_t count;
+
+    //Buffered writes have to be in the backend before anything is read back.
+    if (!lease_flush(file->file_id)) {
+        return -1;
+    }
+
+    //The version is from when the file was opened, so another client's changes are seen on the next open.
+    version = block_cache_version(file);
+
+    if (block_cache_read(file->file_id, version, buf, size, offset)) {
+        return size;
+    }
+
+    count = myfs->backend->file_read(myfs, file->file_id, buf, size, offset);
+    if (count > 0) {
+        block_cache_store(file->file_id, version, buf, count, offset, file->st.st_size);
+    }
+
+    return count;
+}
+
 int
 myfs_read(const char *path, char *buffer, size_t size, off_t offset, struct fuse_file_info *fi) {
     ssize_t count;
     myfs_file_t *file;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Size[%zu]; Offset[%zu]; FileHandle[%zu]; FI[%p]", path, size, offset, fi->fh, fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, offset, size);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    if (ctl_handle(fi)) {
+        return ctl_read(fi, buffer, size, offset);
+    }
+
     //Get the file from the open file table
     file = myfs->files[fi->fh];
 
@@ -795,76 +1134,233 @@ myfs_read(const char *path, char *buffer, size_t size, off_t offset, struct fuse
     //Also handle muliple reads if the file is bigger than 4k (eg. `offset` > 0)
     if (offset + size > (size_t)file->st.st_size) {
         size = file->st.st_size - offset;
-        MYFS_LOG_TRACE("New Size[%zu]", size);
     }
 
-    count = myfs_db_file_read(myfs, file->file_id, buffer, size, offset);
+    count = myfs_read_data(myfs, file, buffer, size, offset);
     if (count == -1) {
         return -EIO;
     }
 
-    MYFS_LOG_TRACE("End");
-
     return count;
 }
 
 int
-myfs_write(const char *path, const char *buffer, size_t size, off_t offset, struct fuse_file_info *fi) {
+myfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct fuse_bufvec *bufv;
+    ssize_t count = 0;
     myfs_file_t *file;
     myfs_t *myfs;
-    bool success;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Size[%zu]; Offset[%zu]; FileHandle[%zu]; Append[%s]; FI[%p]", path, size, offset, fi->fh, fi->flags & O_APPEND ? "Yes" : "No", fi);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, offset, size);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    if (ctl_handle(fi)) {
+        bufv = malloc(sizeof(*bufv));
+        if (bufv == NULL) {
+            return -ENOMEM;
+        }
+
+        *bufv = FUSE_BUFVEC_INIT(size);
+        bufv->buf[0].mem = malloc(size);
+        if (bufv->buf[0].mem == NULL && size > 0) {
+            free(bufv);
+            return -ENOMEM;
+        }
+
+        count = ctl_read(fi, bufv->buf[0].mem, size, offset);
+        if (count < 0) {
+            free(bufv->buf[0].mem);
+            free(bufv);
+            return count;
+        }
+
+        bufv->buf[0].size = count;
+        *bufp = bufv;
+
+        return 0;
+    }
+
     //Get the file from the open file table
     file = myfs->files[fi->fh];
 
-    //Update the file's data
-    if (fi->flags & O_APPEND || file->st.st_size == offset) {
-        success = myfs_db_file_append(myfs, file->file_id, buffer, size);
-        if (success) {
-            //file->st.st_size += size;
-        }
+    //The kernel asks for up to max_read bytes regardless of the file's size. Only allocate what can actually be returned.
+    if (offset >= file->st.st_size) {
+        size = 0;
     }
-    else {
-        success = myfs_db_file_write(myfs, file->file_id, buffer, size, offset);
-        if (success) {
-            //file->st.st_size += (size - offset);
+    else if (offset + size > (size_t)file->st.st_size) {
+        size = file->st.st_size - offset;
+    }
+
+    bufv = malloc(sizeof(*bufv));
+    if (bufv == NULL) {
+        return -ENOMEM;
+    }
+
+    *bufv = FUSE_BUFVEC_INIT(size);
+
+    //The blocks are streamed straight into the buffer handed to FUSE. libfuse takes ownership of it and free()'s it
+    //after the reply is sent, so there's no intermediate buffer to assemble or copy out of.
+    if (size > 0) {
+        bufv->buf[0].mem = malloc(size);
+        if (bufv->buf[0].mem == NULL) {
+            free(bufv);
+            return -ENOMEM;
+        }
+
+        count = myfs_read_data(myfs, file, bufv->buf[0].mem, size, offset);
+        if (count == -1) {
+            free(bufv->buf[0].mem);
+            free(bufv);
+            return -EIO;
         }
     }
 
+    bufv->buf[0].size = count;
+    *bufp = bufv;
+
+    return 0;
+}
+
+/**
+ * Writes data to an open file. Shared by `myfs_write()` and `myfs_write_buf()`.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] data The data to write.
+ * @param[in] size The length of `data`.
+ * @param[in] offset The offset where to begin writing.
+ * @param[in] fi FUSE's file info structure for the open file.
+ * @return The number of bytes written, or a negative errno on failure.
+ */
+static int
+myfs_write_data(myfs_t *myfs, const char *data, size_t size, off_t offset, struct fuse_file_info *fi) {
+    myfs_file_t *file;
+    bool success, buffered, append;
+
+    if (ctl_handle(fi)) {
+        return ctl_write(fi, data, size);
+    }
+
+    //Get the file from the open file table
+    file = myfs->files[fi->fh];
+
+    //In writeback mode the kernel resolves O_APPEND against its own idea of the file's size and sends the
+    //real offset, so the offset must be honored instead.
+    append = (fi->flags & O_APPEND) && !myfs->writeback_cache;
+
+    //While this mount holds the file's lease, writes are kept in memory and flushed together.
+    success = lease_buffer(file->file_id, data, size, &offset, append, &file->st.st_size, &buffered);
     if (!success) {
         return -EIO;
     }
 
-    file->st.st_size += size;
+    if (buffered) {
+        return size;
+    }
 
-    MYFS_LOG_TRACE("End");
+    if (append) {
+        success = myfs->backend->file_append(myfs, file->file_id, data, size, &file->st.st_size, &file->version);
+        offset = file->st.st_size - size;
+    }
+    else {
+        success = myfs->backend->file_write(myfs, file->file_id, data, size, offset, &file->st.st_size, &file->version);
+    }
+
+    if (!success) {
+        return -EIO;
+    }
+
+    block_cache_invalidate(file->file_id, offset, size);
 
     return size;
 }
 
+int
+myfs_write(const char *path, const char *buffer, size_t size, off_t offset, struct fuse_file_info *fi) {
+    myfs_t *myfs;
+    int ret;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, offset, size);
+
+    myfs = (myfs_t *)fuse_get_context()->private_data;
+
+    ret = myfs_write_data(myfs, buffer, size, offset, fi);
+
+    return ret;
+}
+
+int
+myfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi) {
+    struct fuse_bufvec dst;
+    const char *data;
+    char *copy = NULL;
+    ssize_t copied;
+    size_t size;
+    myfs_t *myfs;
+    int ret;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, offset, fuse_buf_size(buf));
+
+    size = fuse_buf_size(buf);
+
+    myfs = (myfs_t *)fuse_get_context()->private_data;
+
+    if (buf->count == 1 && buf->idx == 0 && buf->off == 0 && !(buf->buf[0].flags & FUSE_BUF_IS_FD)) {
+        //The usual case, the request is a single buffer in memory. The blocks are bound straight from it.
+        data = buf->buf[0].mem;
+    }
+    else {
+        //The request was spliced into a pipe or is split across segments. Pull it into memory once so the
+        //blocks can be bound from it.
+        copy = malloc(size);
+        if (copy == NULL) {
+            return -ENOMEM;
+        }
+
+        dst = FUSE_BUFVEC_INIT(size);
+        dst.buf[0].mem = copy;
+
+        copied = fuse_buf_copy(&dst, buf, 0);
+        if (copied < 0) {
+            free(copy);
+            return copied;
+        }
+
+        data = copy;
+        size = copied;
+    }
+
+    ret = myfs_write_data(myfs, data, size, offset, fi);
+
+    if (copy != NULL) {
+        free(copy);
+    }
+
+    return ret;
+}
+
 static int
 myfs_rename_swap(myfs_t *myfs, const char *path_old, const char *path_new) {
     myfs_file_t *file_old = NULL, *file_new = NULL;
     bool success;
     int ret = 0;
 
-    file_old = myfs_file_get(myfs, path_old, false);
+    file_old = myfs_file_get(myfs, path_old);
     if (file_old == NULL) {
         ret = -ENOENT;
         goto done;
     }
 
-    file_new = myfs_file_get(myfs, path_new, false);
+    file_new = myfs_file_get(myfs, path_new);
     if (file_new == NULL) {
         ret = -ENOENT;
         goto done;
     }
 
-    success = myfs_db_file_swap(myfs, file_old, file_new);
+    success = myfs->backend->file_swap(myfs, file_old, file_new);
     if (!success) {
         ret = -EIO;
         goto done;
@@ -901,20 +1397,20 @@ myfs_rename_move(myfs_t *myfs, const char *path_old, const char *path_new) {
     }
 
     //Get the old file.
-    file_old = myfs_file_get(myfs, path_old, false);
+    file_old = myfs_file_get(myfs, path_old);
     if (file_old == NULL) {
         ret = -ENOENT;
         goto done;
     }
 
     //Get the file for the directory.
-    file_dir_new = myfs_file_get(myfs, path_dir_new, false);
+    file_dir_new = myfs_file_get(myfs, path_dir_new);
     if (file_dir_new == NULL) {
         ret = -ENOENT;
         goto done;
     }
 
-    success = myfs_db_file_rename(myfs, file_old->file_id, file_dir_new->file_id, path_name_new);
+    success = myfs->backend->file_rename(myfs, file_old->file_id, file_dir_new->file_id, path_name_new);
     if (!success) {
         ret = -EIO;
         goto done;
@@ -942,10 +1438,16 @@ myfs_rename(const char *path_old, const char *path_new, unsigned int flags) {
     myfs_t *myfs;
     int ret;
 
-    MYFS_LOG_TRACE("Begin; OldPath[%s]; NewPath[%s]; Flags[%u]", path_old, path_new, flags);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    //The control directory is read only.
+    if (ctl_path(path_old) || ctl_path(path_new)) {
+        return -EPERM;
+    }
+
     if (flags == RENAME_EXCHANGE) {
         ret = myfs_rename_swap(myfs, path_old, path_new);
     }
@@ -956,8 +1458,6 @@ myfs_rename(const char *path_old, const char *path_new, unsigned int flags) {
         ret = -EINVAL;
     }
 
-    MYFS_LOG_TRACE("End");
-
     return ret;
 }
 
@@ -969,34 +1469,38 @@ myfs_symlink(const char *target, const char *path) {
     myfs_t *myfs;
     bool success;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Target[%s]", path, target);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
+    //The control directory is read only.
+    if (ctl_path(path)) {
+        return -EPERM;
+    }
+
     //Get the directory and name of the soft link.
     util_dirname(path, dir, sizeof(dir));
     util_basename(path, name, sizeof(name));
 
     //Get the soft link's directory (parent).
-    parent = myfs_file_get(myfs, dir, false);
+    parent = myfs_file_get(myfs, dir);
     if (parent == NULL) {
         return -ENOENT;
     }
 
-    file_id = myfs_db_file_create(myfs, name, MYFS_FILE_TYPE_SOFT_LINK, parent->file_id, 0777);
+    file_id = myfs->backend->file_create(myfs, name, MYFS_FILE_TYPE_SOFT_LINK, parent->file_id, 0777);
     myfs_file_free(parent);
 
     if (file_id == 0) {
         return -EIO;
     }
 
-    success = myfs_db_file_append(myfs, file_id, target, strlen(target));
+    success = myfs->backend->file_append(myfs, file_id, target, strlen(target), NULL, NULL);
     if (!success) {
         return -EIO;
     }
 
-    MYFS_LOG_TRACE("End");
-
     return 0;
 }
 
@@ -1006,11 +1510,16 @@ myfs_readlink(const char *path, char *buf, size_t size) {
     myfs_file_t *file;
     myfs_t *myfs;
 
-    MYFS_LOG_TRACE("Begin; Path[%s]; Size[%zu]", path, size);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
     myfs = (myfs_t *)fuse_get_context()->private_data;
 
-    file = myfs_file_get(myfs, path, false);
+    if (ctl_path(path)) {
+        return -EINVAL;
+    }
+
+    file = myfs_file_get(myfs, path);
     if (file == NULL) {
         return -ENOENT;
     }
@@ -1020,7 +1529,7 @@ myfs_readlink(const char *path, char *buf, size_t size) {
         return -EINVAL;
     }
 
-    count = myfs_db_file_read(myfs, file->file_id, buf, size, 0);
+    count = myfs->backend->file_read(myfs, file->file_id, buf, size, 0);
     myfs_file_free(file);
 
     if (count <= 0) {
@@ -1035,6 +1544,5 @@ myfs_readlink(const char *path, char *buf, size_t size) {
 
     buf[count] = '\0';
 
-    MYFS_LOG_TRACE("End");
     return 0;
 }
@@ -5,7 +5,9 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 #define FUSE_USE_VERSION 30
 #include <fuse.h>
 #include "../common/db.h"
@@ -22,6 +24,12 @@
 /** The maxium size of a file data block in bytes. */
 #define MYFS_FILE_BLOCK_SIZE 4096
 
+/** The maximum number of file data blocks inserted by a single statement. Must be a power of two. */
+#define MYFS_INSERT_BLOCKS_MAX 64
+
+/** The largest read or write request MyFS will ask FUSE for, in bytes. */
+#define MYFS_REQUEST_SIZE_MAX (1024 * 1024)
+
 /** The maximum length of a user name and group name, as specified in Linux's useradd and groupadd programs. */
 #define MYFS_USER_NAME_MAX_LEN  32
 #define MYFS_GROUP_NAME_MAX_LEN 32
@@ -36,6 +44,14 @@ typedef enum {
     MYFS_FILE_TYPE_SOFT_LINK        //!< Symbolic or Soft Link.
 } myfs_file_type_t;
 
+/**
+ * How file ownership is stored and read.
+ */
+typedef enum {
+    MYFS_OWNERSHIP_NAME,            //!< Ownership is read from the `user` and `group` names. Each client maps the names to its own IDs.
+    MYFS_OWNERSHIP_ID               //!< Ownership is read from the `uid` and `gid` columns. Every client must share the same IDs.
+} myfs_ownership_mode_t;
+
 /**
  *  Represents a file from the database.
  */
@@ -46,18 +62,56 @@ struct myfs_file_t {
     char name[64 + 1];                  //!< The basename of the file.
     myfs_file_type_t type;              //!< The type of file this is.
     struct stat st;                     //!< Linux's struct stat for this file.
+    uint64_t version;                   //!< The file's data version. It goes up each time the file's data is written or truncated.
     myfs_file_t *parent;                //!< The parent of this file or NULL if this file represents the root directory.
     myfs_file_t **children;             //!< The files in this directory or NULL if this file is not a directory.
     unsigned int children_count;        //!< The number of files in this directory.
 };
 
+/**
+ * Config values used while the file system is mounted. They are resolved once when MyFS connects so FUSE
+ * callbacks don't look them up by name, escape them, or resolve them through NSS on every call.
+ */
+typedef struct {
+    char user[MYFS_USER_NAME_MAX_LEN + 1];              //!< The user to create files with.
+    char user_esc[MYFS_USER_NAME_MAX_LEN * 2 + 1];      //!< `user`, escaped for queries.
+    uid_t uid;                                          //!< The UID of `user`.
+    bool uid_found;                                     //!< Whether `uid` could be looked up.
+    char group[MYFS_GROUP_NAME_MAX_LEN + 1];            //!< The group to create files with.
+    char group_esc[MYFS_GROUP_NAME_MAX_LEN * 2 + 1];    //!< `group`, escaped for queries.
+    gid_t gid;                                          //!< The GID of `group`.
+    bool gid_found;                                     //!< Whether `gid` could be looked up.
+    uint64_t quota_bytes;                               //!< The number of bytes reported as the file system's size, or 0 for no quota.
+    uint64_t quota_files;                               //!< The number of files reported as the file system's inode count, or 0 for no quota.
+} myfs_config_t;
+
+/**
+ * A storage backend. See myfs_backend.h.
+ */
+typedef struct myfs_backend_t myfs_backend_t;
+
 /**
  * The MyFS context that will be available in FUSE callbacks.
  */
 typedef struct {
-    db_t db;                                    //!< The database connection.
+    const myfs_backend_t *backend;              //!< Where files are stored.
+    db_t db;                                    //!< The database connection, if files are stored in MariaDB.
+    myfs_config_t config;                       //!< Config values resolved when MyFS connected.
     myfs_file_t *files[MYFS_FILES_OPEN_MAX];    //!< An array of open file descriptors for FUSE, indexed by file descriptor.
+    pthread_mutex_t files_lock;                 //!< Held while a free slot of `files` is found and claimed.
     unsigned int max_allowed_packet;            //!< Maximum packet size for MariaDB. Queries will fail if the packet size is larger than this value.
+    unsigned int blocks_per_insert;             //!< The number of file data blocks to insert per statement. Always a power of two.
+    unsigned int request_size;                  //!< The largest read and write request size to ask FUSE for, in bytes.
+    myfs_ownership_mode_t ownership_mode;       //!< How file ownership is read.
+    bool writeback_cache;                       //!< Whether the kernel's writeback cache is enabled. If so, the kernel owns file sizes and modified times while writes are cached.
+    bool change_log;                            //!< Whether changes are recorded in `change_log` for other mounts. See change_log.h.
+    bool write_leases;                          //!< Whether files are leased to the mount writing them. See lease.h.
+    unsigned int mount_id;                      //!< A random ID that marks this mount's own entries in `change_log` and `leases`.
+    unsigned int id_range_size;                 //!< The number of File IDs reserved from `id_ranges` at a time, or 0 to let MariaDB assign them.
+    unsigned int id_next;                       //!< The next reserved File ID to hand out.
+    unsigned int id_end;                        //!< The end of the reserved range. It's used up when `id_next` reaches it.
+    pthread_mutex_t id_lock;                    //!< Protects `id_next` and `id_end`.
+    bool async_create;                          //!< Whether creates return before the file is inserted. See async_create.h.
 } myfs_t;
 
 /**
@@ -91,7 +145,7 @@ myfs_file_type_t myfs_file_type(const char *type);
 const char * myfs_file_type_str(myfs_file_type_t type);
 
 /**
- * Connects MyFS to MariaDB.
+ * Connects MyFS to the backend selected by the `backend` config.
  *
  * @param[in] myfs The MyFS context.
  * @return `true` on success, otherwise `false`.
@@ -99,7 +153,7 @@ const char * myfs_file_type_str(myfs_file_type_t type);
 bool myfs_connect(myfs_t *myfs);
 
 /**
- * Disconnects MyFS from MariaDB and cleans up.
+ * Disconnects MyFS from its backend and cleans up.
  *
  * @param[in] myfs The MyFS context.
  */
@@ -108,6 +162,8 @@ void myfs_disconnect(myfs_t *myfs);
 /**
  * FUSE callbacks below.
  */
+void * myfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg);
+void myfs_destroy(void *private_data);
 int myfs_statfs(const char *path, struct statvfs *stv);
 int myfs_getattr(const char *path, struct stat *st, struct fuse_file_info *fi);
 int myfs_access(const char *path, int mode);
@@ -123,10 +179,13 @@ int myfs_rmdir(const char *path);
 int myfs_mkdir(const char *path, mode_t mode);
 int myfs_create(const char *path, mode_t mode, struct fuse_file_info *fi);
 int myfs_flush(const char *path, struct fuse_file_info *fi);
+int myfs_fsync(const char *path, int datasync, struct fuse_file_info *fi);
 int myfs_open(const char *path, struct fuse_file_info *fi);
 int myfs_release(const char *path, struct fuse_file_info *fi);
 int myfs_read(const char *path, char *buffer, size_t size, off_t offset, struct fuse_file_info *fi);
+int myfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi);
 int myfs_write(const char *path, const char *buffer, size_t size, off_t offset, struct fuse_file_info *fi);
+int myfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi);
 int myfs_rename(const char *path_old, const char *path_new, unsigned int flags);
 int myfs_symlink(const char *target, const char *path);
 int myfs_readlink(const char *path, char *buf, size_t size);
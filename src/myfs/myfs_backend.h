@@ -0,0 +1,60 @@
+#pragma once
+
+/**
+ * @file myfs_backend.h
+ *
+ * The storage backend. The FUSE callbacks in myfs.c never store anything themselves; they call the
+ * backend in `myfs->backend`, so the same file system can run against MariaDB (`myfs_db_backend`) or
+ * entirely in memory (`myfs_mem_backend`). The in-memory backend makes it possible to measure and profile
+ * MyFS's own overhead apart from the database.
+ *
+ * Every function has the same contract as the `myfs_db_*` function of the same name in myfs_db.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "myfs.h"
+
+struct myfs_backend_t {
+    const char *name;                   //!< The name used to select the backend in the `backend` config.
+
+    /**
+     * Connects to the backend's storage and gets it ready to use. This is called once by `myfs_connect()`
+     * after `myfs->config` has been loaded.
+     *
+     * @param[in] myfs The MyFS context.
+     * @return `true` on success, otherwise `false`.
+     */
+    bool (*connect)(myfs_t *myfs);
+
+    /**
+     * Disconnects from the backend's storage and frees everything it holds.
+     *
+     * @param[in] myfs The MyFS context.
+     */
+    void (*disconnect)(myfs_t *myfs);
+
+    unsigned int (*file_create)(myfs_t *myfs, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode);
+    bool (*file_delete)(myfs_t *myfs, unsigned int file_id);
+    bool (*file_write)(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version);
+    bool (*file_append)(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t *size, uint64_t *version);
+    bool (*file_set_times)(myfs_t *myfs, unsigned int file_id, const time_t *last_accessed_on, const time_t *last_modified_on);
+    bool (*file_chown)(myfs_t *myfs, unsigned int file_id, const char *user, uid_t uid, const char *group, gid_t gid);
+    bool (*file_chmod)(myfs_t *myfs, unsigned int file_id, mode_t mode);
+    bool (*file_swap)(myfs_t *myfs, myfs_file_t *file1, myfs_file_t *file2);
+    bool (*file_rename)(myfs_t *myfs, unsigned int file_id, unsigned int parent_id, const char *name);
+    ssize_t (*file_read)(myfs_t *myfs, unsigned int file_id, char *buf, size_t size, off_t offset);
+    bool (*file_truncate)(myfs_t *myfs, unsigned int file_id, off_t size, uint64_t *version);
+    myfs_file_t * (*file_query)(myfs_t *myfs, unsigned int file_id, bool include_children);
+    myfs_file_t * (*file_query_name)(myfs_t *myfs, const char *name, unsigned int parent_id, bool include_children);
+    bool (*get_stats)(myfs_t *myfs, uint64_t *files, uint64_t *bytes);
+};
+
+/**
+ * Finds a backend by name.
+ *
+ * @param[in] name The backend's name.
+ * @return The backend, or `NULL` if there's none by that name.
+ */
+const myfs_backend_t * myfs_backend_find(const char *name);
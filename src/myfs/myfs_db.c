@@ -1,26 +1,30 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/random.h>
+#include <mariadb/mysqld_error.h>
 #include "../common/log.h"
 #include "../common/config.h"
 #include "../common/string.h"
 #include "../common/db.h"
+#include "../common/metrics.h"
+#include "../common/trace.h"
 #include "util.h"
+#include "create.h"
+#include "change_log.h"
 #include "myfs_db.h"
 
 #define MODULE "MyFS DB"
 
-#define MYFSDB_TRACE
-#if defined(MYFSDB_TRACE)
-# define MYFSDB_LOG_TRACE(fmt, ...)                 \
-        do {                                        \
-            printf("[%s] ", __FUNCTION__);          \
-            printf(fmt, ##__VA_ARGS__);             \
-            printf("\n");                           \
-            fflush(stdout);                         \
-        } while(0)
-#else
-# define MYFSDB_LOG_TRACE(fmt, ...)
-#endif
+/** The most bytes of pending creates to insert in one statement. It's lowered to `max_allowed_packet` if that's smaller. */
+#define MYFS_DB_CREATE_BATCH_SIZE (1024 * 1024)
+
+/** The most bytes one pending create takes in an INSERT, with its name, user and group escaped. */
+#define MYFS_DB_CREATE_ROW_SIZE 512
+
+/** The start of the INSERT for pending creates. Every time is the time the file was created. */
+#define MYFS_DB_CREATE_SQL "INSERT INTO `files` (`file_id`,`parent_id`,`name`,`type`,`user`,`group`,`uid`,`gid`,`mode`,`size`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\nVALUES "
 
 /**
  * Takes a global offset and determines which block index the offset is in.
@@ -66,368 +70,1174 @@ myfs_db_file_block_count(size_t len) {
     return count;
 }
 
-unsigned int
-myfs_db_file_create(myfs_t *myfs, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode) {
-    char *name_esc, *user_esc, *group_esc;
-    bool success;
+/**
+ * Inserts new blocks for a file, starting at block `index`. The data is bound straight from `data`
+ * so it is never escaped or copied into a query.
+ *
+ * Up to `myfs->blocks_per_insert` blocks are inserted per statement. Batches are always a power of two
+ * so only a handful of distinct statements are ever prepared.
+ *
+ * @param[in] db The connection to insert on.
+ * @param[in] myfs The MyFS context.
+ * @param[in] file_id The File ID of the file to add blocks to.
+ * @param[in] index The index of the first block to insert.
+ * @param[in] data The data to write.
+ * @param[in] len The total length of `data`.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_file_blocks_insert(db_t *db, myfs_t *myfs, unsigned int file_id, unsigned int index, const char *data, size_t len) {
+    MYSQL_BIND params[MYFS_INSERT_BLOCKS_MAX * 3];
+    unsigned int indexes[MYFS_INSERT_BLOCKS_MAX];
+    unsigned long lengths[MYFS_INSERT_BLOCKS_MAX];
+    char query[64 + MYFS_INSERT_BLOCKS_MAX * 8];
+    size_t written = 0, blocks, batch, i;
+    bool success = true;
+    int query_len;
+
+    blocks = myfs_db_file_block_count(len);
+
+    while (blocks > 0) {
+        batch = myfs->blocks_per_insert;
+        while (batch > blocks) {
+            batch /= 2;
+        }
 
-    name_esc = db_escape(&myfs->db, name, NULL);
-    user_esc = db_escape(&myfs->db, config_get("user"), NULL);
-    group_esc = db_escape(&myfs->db, config_get("group"), NULL);
+        query_len = snprintf(query, sizeof(query), "INSERT INTO `file_data` (`file_id`,`index`,`data`)\n"
+                                                   "VALUES (?,?,?)");
 
-    switch (type) {
-        case MYFS_FILE_TYPE_FILE:
-            if (!(mode & S_IFREG)) {
-                mode |= S_IFREG;
+        for (i = 0; i < batch; i++) {
+            lengths[i] = len - written;
+            if (lengths[i] > MYFS_FILE_BLOCK_SIZE) {
+                lengths[i] = MYFS_FILE_BLOCK_SIZE;
             }
-            break;
-        case MYFS_FILE_TYPE_DIRECTORY:
-            if (!(mode & S_IFDIR)) {
-                mode |= S_IFDIR;
-            }
-            break;
-        case MYFS_FILE_TYPE_SOFT_LINK:
-            if (!(mode & S_IFLNK)) {
-                mode |= S_IFLNK;
+            indexes[i] = index + i;
+
+            db_bind_uint(&params[i * 3], &file_id);
+            db_bind_uint(&params[i * 3 + 1], &indexes[i]);
+            db_bind_blob(&params[i * 3 + 2], data + written, &lengths[i]);
+
+            if (i > 0) {
+                query_len += snprintf(query + query_len, sizeof(query) - query_len, ",(?,?,?)");
             }
+
+            written += lengths[i];
+        }
+
+        success = db_stmt_execute(db, query, params);
+
+        if (!success) {
+            log_err(MODULE, "Error writing data for File ID %u: Failed adding blocks %u-%zu: %s", file_id, index, index + batch - 1, db_error(db));
             break;
-        case MYFS_FILE_TYPE_INVALID:
-            break;
+        }
+
+        index += batch;
+        blocks -= batch;
     }
 
-    success = db_queryf(&myfs->db, "INSERT INTO `files` (`parent_id`,`name`,`type`,`user`,`group`,`mode`,`size`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\n"
-                                   "VALUES (%u,'%s','%s','%s','%s',%u,0,UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP())",
-                                   parent_id, name_esc, myfs_file_type_str(type), user_esc, group_esc, mode);
+    return success;
+}
 
-    free(name_esc);
-    free(user_esc);
-    free(group_esc);
+/**
+ * Adds to the file and byte counts in `fs_stats`. This should be called inside of the transaction making
+ * the change so the counts can't drift. The row is picked by File ID so unrelated files don't contend.
+ *
+ * @param[in] db The connection with the transaction open.
+ * @param[in] file_id The File ID of the file that changed.
+ * @param[in] files The number of files added, or negative if removed.
+ * @param[in] bytes The number of bytes added, or negative if removed.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_stats_add(db_t *db, unsigned int file_id, long long files, long long bytes) {
+    bool success;
+
+    success = db_queryf(db, "INSERT INTO `fs_stats` (`shard`,`files`,`bytes`)\n"
+                                   "VALUES (%u,%lld,%lld)\n"
+                                   "ON DUPLICATE KEY UPDATE `files`=`files`+VALUES(`files`),`bytes`=`bytes`+VALUES(`bytes`)",
+                                   file_id % MYFS_DB_STATS_SHARDS, files, bytes);
 
     if (!success) {
-        log_err(MODULE, "Error creating file '%s' with Parent ID %u: %s", name, parent_id, db_error(&myfs->db));
-        return 0;
+        log_err(MODULE, "Error updating file system stats for File ID %u: %s", file_id, db_error(db));
     }
 
-    return db_insert_id(&myfs->db);
+    return success;
 }
 
-bool
-myfs_db_file_delete(myfs_t *myfs, unsigned int file_id) {
+/**
+ * Returns the SQL to append to a `files` UPDATE when file data changes. In writeback mode the kernel owns the
+ * file's modified time and sends it with utimens() when it flushes, so it must not be overwritten with the
+ * time the data happened to reach MariaDB.
+ *
+ * @param[in] myfs The MyFS context.
+ * @return The SQL to append, which is blank in writeback mode.
+ */
+static const char *
+myfs_db_file_mtime_sql(myfs_t *myfs) {
+    return myfs->writeback_cache ? "" : ",`last_modified_on`=UNIX_TIMESTAMP()";
+}
+
+/**
+ * Adds a change to `change_log` so other mounts can drop what they cached about the file. The file's
+ * parent, name and version are copied from its row, so it must still exist. Does nothing unless
+ * `change_log` is on.
+ *
+ * @param[in] db The connection with the transaction open.
+ * @param[in] myfs The MyFS context.
+ * @param[in] file_id The File ID of the file that changed.
+ * @param[in] op The change.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_change_log(db_t *db, myfs_t *myfs, unsigned int file_id, change_log_op_t op) {
     bool success;
 
-    //TODO: Support soft delete?
+    if (!myfs->change_log) {
+        return true;
+    }
 
-    success = db_queryf(&myfs->db, "DELETE FROM `files`\n"
+    success = db_queryf(db, "INSERT INTO `change_log` (`file_id`,`parent_id`,`name`,`version`,`op`,`mount_id`,`created_on`)\n"
+                                   "SELECT `file_id`,`parent_id`,`name`,`version`,'%s',%u,UNIX_TIMESTAMP()\n"
+                                   "FROM `files`\n"
                                    "WHERE `file_id`=%u",
+                                   change_log_op_str(op), myfs->mount_id,
                                    file_id);
 
     if (!success) {
-        log_err(MODULE, "Error deleting File ID %u: %s", file_id, db_error(&myfs->db));
-        return false;
+        log_err(MODULE, "Error logging a change to File ID %u: %s", file_id, db_error(db));
     }
 
-    return true;
+    return success;
 }
 
-bool
-myfs_db_file_write(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset) {
-    unsigned int file_data_id, file_data_length, index, limit;
-    size_t left, write_size, written, page_offset;
-    char *data_esc;
-    bool success;
+/**
+ * Inserts the pending creates before a change, so the file, its parents and anything it's moved or
+ * swapped with are all in MariaDB. Does nothing unless `async_create` is on.
+ *
+ * @param[in] myfs The MyFS context.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_pending_flush(myfs_t *myfs) {
+    return !myfs->async_create || async_create_flush();
+}
+
+/**
+ * Adds `len` zero bytes to the end of a file's data. Fills the last block first, then adds new blocks. The
+ * file's size is not updated. This must be called inside of a transaction.
+ *
+ * @param[in] db The connection with the transaction open.
+ * @param[in] file_id The File ID of the file to extend.
+ * @param[in] len The number of zero bytes to add.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_file_extend(db_t *db, unsigned int file_id, off_t len) {
+    off_t write_size, file_data_length, left;
+    unsigned int file_data_id, index;
+    bool success = true;
     MYSQL_RES *res;
     MYSQL_ROW row;
 
-    MYFSDB_LOG_TRACE("Begin");
-    MYFSDB_LOG_TRACE("  FileID[%u]; Len[%zu]; Offset[%zd]", file_id, len, offset);
-
-    index = myfs_db_file_block_index(offset);
-    page_offset = myfs_db_file_block_offset(offset);
-    limit = myfs_db_file_block_count(len);
-
-    MYFSDB_LOG_TRACE("  Index[%u]; PageOffset[%zu]; Limit[%u]", index, page_offset, limit);
-
-    success = db_transaction_start(&myfs->db);
-    if (!success) {
-        log_err(MODULE, "Error adding data for File ID %u: Failed to start transaction: %s", file_id, db_error(&myfs->db));
-        return false;
-    }
+    left = len;
 
-    //Get the block to write to.
-    res = db_selectf(&myfs->db, "SELECT `file_data_id`,`index`,LENGTH(`data`)\n"
+    //Get the last block, if there is one, and fill in any remaining space.
+    res = db_selectf(db, "SELECT `file_data_id`,`index`,LENGTH(`data`)\n"
                                 "FROM `file_data`\n"
                                 "WHERE `file_id`=%u\n"
-                                "AND `index`>=%u\n"
-                                "ORDER BY `index` ASC\n"
-                                "LIMIT %u",
-                                file_id,
-                                index,
-                                limit);
+                                "ORDER BY `index` DESC\n"
+                                "LIMIT 1",
+                                file_id);
 
     if (res == NULL) {
-        log_err(MODULE, "Error writing data for File ID %u: Failed getting block %u: %s", file_id, index, db_error(&myfs->db));
-        success = false;
-        goto done;
+        log_err(MODULE, "Error extending File ID %u: Error getting last block: %s", file_id, db_error(db));
+        return false;
     }
 
-    MYFSDB_LOG_TRACE("  Found %lld blocks to update", mysql_num_rows(res));
-
     file_data_id = 0;
+    index = 0;
     file_data_length = 0;
-    written = 0;
-    left = len;
 
-    //Loop through the blocks that are being overwritten.
-    while (left > 0 && (row = mysql_fetch_row(res)) != NULL) {
+    row = mysql_fetch_row(res);
+    if (row != NULL) {
         file_data_id = strtoul(row[0], NULL, 10);
-        index = strtoul(row[1], NULL, 10);
+        index = strtoul(row[1], NULL, 10) + 1;
         file_data_length = strtoul(row[2], NULL, 10);
+    }
+    mysql_free_result(res);
 
-        //The first write may start at any offset inside the block.
-        if (written == 0) {
-            write_size = left;
-            //if (write_size > MYFS_FILE_BLOCK_SIZE - file_data_length) {
-            //    write_size = MYFS_FILE_BLOCK_SIZE - file_data_length;
-            //}
-            if (write_size > MYFS_FILE_BLOCK_SIZE - page_offset) {
-                write_size = MYFS_FILE_BLOCK_SIZE - page_offset;
-            }
-        }
-        else {
+    //If the last block has a data size smaller than the max block size, update this block.
+    if (file_data_id > 0) {
+        if (file_data_length < MYFS_FILE_BLOCK_SIZE) {
             write_size = left;
-            if (write_size > MYFS_FILE_BLOCK_SIZE) {
-                write_size = MYFS_FILE_BLOCK_SIZE;
+            if (write_size > MYFS_FILE_BLOCK_SIZE - file_data_length) {
+                write_size = MYFS_FILE_BLOCK_SIZE - file_data_length;
             }
-        }
-
-        MYFSDB_LOG_TRACE("  Updating Block; Index[%u]; FileDataID[%u]; FileDataLength[%u]; WriteSize[%zu]; Written[%zu]; Left[%zu]", index, file_data_id, file_data_length, write_size, written, left);
 
-        data_esc = db_escape_len(&myfs->db, data + written, write_size);
+            success = db_queryf(db, "UPDATE `file_data`\n"
+                                           "SET `data`=CONCAT(`data`,REPEAT(X'00',%zd))\n"
+                                           "WHERE `file_data_id`=%u",
+                                           write_size,
+                                           file_data_id);
 
-        //MariaDB indexes start at 1 so page_offset+1 is necessary
-        success = db_queryf(&myfs->db, "UPDATE `file_data`\n"
-                                       "SET `data`=INSERT(`data`,%zu,%zu,'%s')\n"
-                                       "WHERE `file_data_id`=%u",
-                                       page_offset + 1, write_size, data_esc,
-                                       file_data_id);
-        free(data_esc);
+            if (!success) {
+                log_err(MODULE, "Error extending File ID %u: Error updating last block: %s", file_id, db_error(db));
+                return false;
+            }
 
-        if (!success) {
-            log_err(MODULE, "Error writing data for File ID %u: Failed writing to block %u: %s", file_id, index, db_error(&myfs->db));
-            goto done;
+            left -= write_size;
         }
-
-        left -= write_size;
-        written += write_size;
-        page_offset = 0;
-
-        //Keep track of next block to write incase this is the last one and new blocks need to inserted.
-        index++;
     }
 
-    mysql_free_result(res);
-
-    MYFSDB_LOG_TRACE("  Left[%zu]; Written[%zu]", left, written);
+    //Now add blocks until the entire size has been written.
+    while (left > 0) {
+        write_size = left;
+        if (write_size > MYFS_FILE_BLOCK_SIZE) {
+            write_size = MYFS_FILE_BLOCK_SIZE;
+        }
 
-    //Write any new blocks that need to be written.
-    if (left > 0) {
-        MYFSDB_LOG_TRACE("  Adding block; Index[%u]", index);
+        success = db_queryf(db, "INSERT INTO `file_data` (`file_id`,`index`,`data`)\n"
+                                       "VALUES (%u,%u,REPEAT(X'00',%zd))",
+                                       file_id, index, write_size);
 
-        //If new blocks are being written, the file size will increase so do that now.
-        success = db_queryf(&myfs->db, "UPDATE `files`\n"
-                                       "SET `size`=`size`+%zu\n"
-                                       "WHERE `file_id`=%u",
-                                       left,
-                                       file_id);
         if (!success) {
-            log_err(MODULE, "Error writing data for File ID %u: Failed updating file size: %s", file_id, db_error(&myfs->db));
-            goto done;
+            log_err(MODULE, "Error extending File ID %u: Error adding block %u: %s", file_id, index, db_error(db));
+            return false;
         }
 
-        while (left > 0) {
-            write_size = left;
-            if (write_size > MYFS_FILE_BLOCK_SIZE) {
-                write_size = MYFS_FILE_BLOCK_SIZE;
-            }
-            
-            data_esc = db_escape_len(&myfs->db, data + written, write_size);
-
-            success = db_queryf(&myfs->db, "INSERT INTO `file_data` (`file_id`,`index`,`data`)\n"
-                                           "VALUES (%u,%u,'%s')",
-                                           file_id, index, data_esc);
-
-            free(data_esc);
-
-            if (!success) {
-                log_err(MODULE, "Error writing data for File ID %u: Failed adding block %u: %s", file_id, index, db_error(&myfs->db));
-                goto done;
-            }
-
-            left -= write_size;
-            written += write_size;
-            index++;
-        }
+        index++;
+        left -= write_size;
     }
 
-done:
-    db_transaction_stop(&myfs->db, success);
+    return success;
+}
 
-    MYFSDB_LOG_TRACE("  Written[%zd]", written);
-    MYFSDB_LOG_TRACE("End");
+/**
+ * Formats an ID for a query, or NULL if it isn't known.
+ */
+static const char *
+myfs_db_id_sql(char *dst, size_t size, bool found, unsigned int id) {
+    if (!found) {
+        strlcpy(dst, "NULL", size);
+    }
+    else {
+        snprintf(dst, size, "%u", id);
+    }
 
-    return success;
+    return dst;
 }
 
 bool
-myfs_db_file_append(myfs_t *myfs, unsigned int file_id, const char *data, size_t len) {
-    unsigned int file_data_id = 0, index = 0, file_data_length = 0;
-    size_t write_size, written = 0, left;
-    char *data_esc;
+myfs_db_id_reserve(db_t *db, unsigned int count, unsigned int *first) {
+    uint64_t next_id = 0, end_id;
     bool success;
     MYSQL_RES *res;
     MYSQL_ROW row;
 
-    MYFSDB_LOG_TRACE("Begin");
-    MYFSDB_LOG_TRACE("  FileID[%u]; Len[%zu]", file_id, len);
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
 
-    success = db_transaction_start(&myfs->db);
+    success = db_transaction_start(db);
     if (!success) {
-        log_err(MODULE, "Error appending data to File ID %u: Failed starting transaction: %s", file_id, db_error(&myfs->db));
+        log_err(MODULE, "Error reserving File IDs: Failed to start transaction: %s", db_error(db));
         return false;
     }
 
-    //Get the latest block if there is one
-    res = db_selectf(&myfs->db, "SELECT `file_data_id`,`index`,LENGTH(`data`)\n"
-                                "FROM `file_data`\n"
-                                "WHERE `file_id`=%u\n"
-                                "ORDER BY `index` DESC\n"
-                                "LIMIT 1",
-                                file_id);
+    res = db_selectf(db, "SELECT GREATEST(`next_id`,(SELECT COALESCE(MAX(`file_id`),0)+1 FROM `files`))\n"
+                         "FROM `id_ranges`\n"
+                         "WHERE `name`='files'\n"
+                         "FOR UPDATE");
 
     if (res == NULL) {
-        log_err(MODULE, "Error appending data to File ID %u: Failed getting last block: %s", file_id, db_error(&myfs->db));
+        log_err(MODULE, "Error reserving File IDs: %s", db_error(db));
         success = false;
         goto done;
     }
 
     row = mysql_fetch_row(res);
     if (row != NULL) {
-        file_data_id = strtoul(row[0], NULL, 10);
-        index = strtoul(row[1], NULL, 10);
-        file_data_length = strtoul(row[2], NULL, 10);
+        next_id = strtoull(row[0], NULL, 10);
     }
     mysql_free_result(res);
 
-    MYFSDB_LOG_TRACE("  FileDataID[%u]; Index[%u]; FileDataLength[%u]", file_data_id, index, file_data_length);
+    end_id = next_id + count;
+    if (next_id == 0 || end_id > UINT32_MAX) {
+        log_err(MODULE, "Error reserving File IDs: %s", next_id == 0 ? "No range in 'id_ranges'" : "File IDs are used up");
+        success = false;
+        goto done;
+    }
 
-    //Update the file's size
-    success = db_queryf(&myfs->db, "UPDATE `files`\n"
-                                   "SET `size`=`size`+%zu\n"
-                                   "WHERE `file_id`=%u",
-                                   len,
-                                   file_id);
+    success = db_queryf(db, "UPDATE `id_ranges`\n"
+                            "SET `next_id`=%" PRIu64 "\n"
+                            "WHERE `name`='files'",
+                            end_id);
 
     if (!success) {
-        log_err(MODULE, "Error appending data to File ID %u: Failed updating file size: %s", file_id, db_error(&myfs->db));
+        log_err(MODULE, "Error reserving File IDs: %s", db_error(db));
         goto done;
     }
 
-    written = 0;
-    left = len;
-
-    //Update the last block if there is one and it's not full.
-    if (file_data_id > 0) {
-        if (file_data_length < MYFS_FILE_BLOCK_SIZE) {
-            write_size = left;
-            if (write_size > MYFS_FILE_BLOCK_SIZE - file_data_length) {
-                write_size = MYFS_FILE_BLOCK_SIZE - file_data_length;
-            }
-
-            MYFSDB_LOG_TRACE("  Updating Last Block; Index[%u]; WriteSize[%zu]", index, write_size);
-
-            data_esc = db_escape_len(&myfs->db, data, write_size);
-
-            success = db_queryf(&myfs->db, "UPDATE `file_data`\n"
-                                           "SET `data`=CONCAT(`data`,'%s')\n"
-                                           "WHERE `file_data_id`=%u",
-                                           data_esc,
-                                           file_data_id);
+done:
+    success = db_transaction_stop(db, success) && success;
 
-            free(data_esc);
+    if (success) {
+        log_debug(MODULE, "Reserved File IDs %" PRIu64 " to %" PRIu64, next_id, end_id - 1);
+        *first = next_id;
+    }
 
-            if (!success) {
-                log_err(MODULE, "Error appending data to File ID %u: Failed updating last block: %s", file_id, db_error(&myfs->db));
-                goto done;
-            }
+    return success;
+}
 
-            written += write_size;
-            left -= write_size;
-        }
+/**
+ * Reserves the next range of `myfs->id_range_size` File IDs for this mount. `myfs->id_lock` must be held.
+ *
+ * @param[in] myfs The MyFS context.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_id_range_reserve(myfs_t *myfs) {
+    unsigned int first;
+    bool success;
 
-        //Next block will be new, increase the index regardless of whether we were able to update the last block or not.
-        index++;
+    success = myfs_db_id_reserve(&myfs->db, myfs->id_range_size, &first);
+    if (success) {
+        myfs->id_next = first;
+        myfs->id_end = first + myfs->id_range_size;
     }
 
-    //Add new blocks.
-    while (left > 0) {
-        write_size = left;
-        if (write_size > MYFS_FILE_BLOCK_SIZE) {
-            write_size = MYFS_FILE_BLOCK_SIZE;
-        }
+    return success;
+}
 
-        MYFSDB_LOG_TRACE("  Adding Block; Index[%u]; WriteSize[%zu]; Written[%zu]", index, write_size, written);
+/**
+ * Gives up the rest of this mount's range after one of its File IDs turned out to be taken, so the next ID
+ * comes from a new range. Does nothing if another range was already reserved since.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] file_id The File ID that was taken.
+ */
+static void
+myfs_db_id_range_skip(myfs_t *myfs, unsigned int file_id) {
+    pthread_mutex_lock(&myfs->id_lock);
+    if (file_id >= myfs->id_end - myfs->id_range_size && file_id < myfs->id_end) {
+        myfs->id_next = myfs->id_end;
+    }
+    pthread_mutex_unlock(&myfs->id_lock);
+}
 
-        data_esc = db_escape_len(&myfs->db, data + written, write_size);
+/**
+ * Tells whether an INSERT into `files` that failed with `ER_DUP_ENTRY` failed on its File ID rather than its
+ * name, which is the other unique key.
+ *
+ * @param[in] db The connection.
+ * @param[in] file_id The File ID that was inserted.
+ * @return `true` if a file already has the File ID, otherwise `false`.
+ */
+static bool
+myfs_db_file_id_taken(db_t *db, unsigned int file_id) {
+    MYSQL_RES *res;
+    bool taken;
 
-        success = db_queryf(&myfs->db, "INSERT INTO `file_data` (`file_id`,`index`,`data`)\n"
-                                       "VALUES (%u,%u,'%s')",
-                                       file_id, index, data_esc);
+    res = db_selectf(db, "SELECT 1\n"
+                         "FROM `files`\n"
+                         "WHERE `file_id`=%u",
+                         file_id);
 
-        free(data_esc);
+    if (res == NULL) {
+        return false;
+    }
+
+    taken = mysql_fetch_row(res) != NULL;
+    mysql_free_result(res);
+
+    return taken;
+}
+
+/**
+ * Hands out the next File ID from this mount's range, reserving another range when it's used up.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[out] file_id Stores the File ID on success.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_id_next(myfs_t *myfs, unsigned int *file_id) {
+    bool success = true;
+
+    pthread_mutex_lock(&myfs->id_lock);
+
+    if (myfs->id_next == myfs->id_end) {
+        success = myfs_db_id_range_reserve(myfs);
+    }
+
+    if (success) {
+        *file_id = myfs->id_next++;
+    }
+
+    pthread_mutex_unlock(&myfs->id_lock);
+
+    return success;
+}
+
+unsigned int
+myfs_db_file_create(myfs_t *myfs, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode) {
+    char uid_sql[16], gid_sql[16], file_id_sql[16], error[sizeof(myfs->db.error)];
+    bool success, retried = false;
+    unsigned int file_id = 0;
+    char *name_esc;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    //Take a File ID from this mount's range before the transaction, so the INSERT below doesn't wait on
+    //AUTO_INCREMENT and `id_ranges` is never locked for longer than a reservation.
+    if (myfs->id_range_size > 0) {
+        success = myfs_db_id_next(myfs, &file_id);
+        if (!success) {
+            return 0;
+        }
+    }
+
+    switch (type) {
+        case MYFS_FILE_TYPE_FILE:
+            if (!(mode & S_IFREG)) {
+                mode |= S_IFREG;
+            }
+            break;
+        case MYFS_FILE_TYPE_DIRECTORY:
+            if (!(mode & S_IFDIR)) {
+                mode |= S_IFDIR;
+            }
+            break;
+        case MYFS_FILE_TYPE_SOFT_LINK:
+            if (!(mode & S_IFLNK)) {
+                mode |= S_IFLNK;
+            }
+            break;
+        case MYFS_FILE_TYPE_INVALID:
+            break;
+    }
+
+    //The file is inserted later with the rest of the pending creates. Until then lookups find it there.
+    if (myfs->async_create) {
+        return async_create_add(file_id, name, type, parent_id, mode) ? file_id : 0;
+    }
+
+    name_esc = db_escape(&myfs->db, name, NULL);
+
+    //Both the names and the IDs are stored so clients in either ownership mode can read the file.
+    myfs_db_id_sql(uid_sql, sizeof(uid_sql), myfs->config.uid_found, myfs->config.uid);
+    myfs_db_id_sql(gid_sql, sizeof(gid_sql), myfs->config.gid_found, myfs->config.gid);
+
+    while (true) {
+        myfs_db_id_sql(file_id_sql, sizeof(file_id_sql), myfs->id_range_size > 0, file_id);
+
+        success = db_transaction_start(&myfs->db);
+        if (!success) {
+            log_err(MODULE, "Error creating file '%s' with Parent ID %u: Failed to start transaction: %s", name, parent_id, db_error(&myfs->db));
+            free(name_esc);
+            return 0;
+        }
+
+        //A NULL `file_id` is assigned by AUTO_INCREMENT.
+        success = db_queryf(&myfs->db, "INSERT INTO `files` (`file_id`,`parent_id`,`name`,`type`,`user`,`group`,`uid`,`gid`,`mode`,`size`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\n"
+                                       "VALUES (%s,%u,'%s','%s','%s','%s',%s,%s,%u,0,UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP(),UNIX_TIMESTAMP())",
+                                       file_id_sql, parent_id, name_esc, myfs_file_type_str(type), myfs->config.user_esc, myfs->config.group_esc, uid_sql, gid_sql, mode);
+
+        if (success) {
+            break;
+        }
+
+        //Checking the File ID below clears the error.
+        strlcpy(error, db_error(&myfs->db), sizeof(error));
+        if (retried || myfs->id_range_size == 0 || db_errno(&myfs->db) != ER_DUP_ENTRY || !myfs_db_file_id_taken(&myfs->db, file_id)) {
+            break;
+        }
+
+        //A mount that lets MariaDB assign IDs took one from this mount's range. Start a new range past it
+        //and try once more.
+        log_warn(MODULE, "Error creating file '%s' with Parent ID %u: File ID %u is taken: Trying again with a new range", name, parent_id, file_id);
+        db_transaction_stop(&myfs->db, false);
+        myfs_db_id_range_skip(myfs, file_id);
+        retried = true;
+
+        success = myfs_db_id_next(myfs, &file_id);
+        if (!success) {
+            free(name_esc);
+            return 0;
+        }
+    }
+
+    free(name_esc);
+
+    if (!success) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: %s", name, parent_id, error);
+        goto done;
+    }
+
+    //Get the ID now, the stats update below resets it.
+    if (myfs->id_range_size == 0) {
+        file_id = db_insert_id(&myfs->db);
+    }
+
+    success = myfs_db_stats_add(&myfs->db, file_id, 1, 0) &&
+              myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_CREATE);
+
+done:
+    db_transaction_stop(&myfs->db, success);
+
+    return success ? file_id : 0;
+}
+
+/**
+ * Formats a pending create as a row of `MYFS_DB_CREATE_COLUMNS` values.
+ *
+ * @param[in] db The connection, used to escape the name.
+ * @param[in] myfs The MyFS context.
+ * @param[out] dst Where to write the row.
+ * @param[in] size The size of `dst`.
+ * @param[in] file The pending create.
+ * @return The length of the row. If it's `size` or more, the row didn't fit.
+ */
+static size_t
+myfs_db_file_values_sql(db_t *db, myfs_t *myfs, char *dst, size_t size, const async_create_file_t *file) {
+    char uid_sql[16], gid_sql[16];
+    char *name_esc;
+    int len;
+
+    name_esc = db_escape(db, file->name, NULL);
+
+    myfs_db_id_sql(uid_sql, sizeof(uid_sql), myfs->config.uid_found, myfs->config.uid);
+    myfs_db_id_sql(gid_sql, sizeof(gid_sql), myfs->config.gid_found, myfs->config.gid);
+
+    len = snprintf(dst, size, "(%u,%u,'%s','%s','%s','%s',%s,%s,%u,0,%lld,%lld,%lld,%lld)",
+                   file->file_id, file->parent_id, name_esc, myfs_file_type_str(file->type), myfs->config.user_esc, myfs->config.group_esc, uid_sql, gid_sql, file->mode,
+                   (long long)file->created_on, (long long)file->created_on, (long long)file->created_on, (long long)file->created_on);
+
+    free(name_esc);
+
+    return len;
+}
+
+/**
+ * Inserts one pending create in its own transaction.
+ *
+ * @param[in] db The connection to insert on.
+ * @param[in] myfs The MyFS context.
+ * @param[in] file The pending create.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_file_create_pending(db_t *db, myfs_t *myfs, const async_create_file_t *file) {
+    char sql[MYFS_DB_CREATE_ROW_SIZE + sizeof(MYFS_DB_CREATE_SQL)];
+    size_t len;
+    bool success;
+
+    success = db_transaction_start(db);
+    if (!success) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Failed to start transaction: %s", file->name, file->parent_id, db_error(db));
+        return false;
+    }
+
+    len = strlcpy(sql, MYFS_DB_CREATE_SQL, sizeof(sql));
+    len += myfs_db_file_values_sql(db, myfs, sql + len, sizeof(sql) - len, file);
+
+    success = db_query(db, sql, len);
+    if (!success) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: %s", file->name, file->parent_id, db_error(db));
+        goto done;
+    }
+
+    success = myfs_db_stats_add(db, file->file_id, 1, 0) &&
+              myfs_db_change_log(db, myfs, file->file_id, CHANGE_LOG_OP_CREATE);
+
+done:
+    db_transaction_stop(db, success);
+
+    return success;
+}
+
+bool
+myfs_db_file_create_batch(db_t *db, myfs_t *myfs, async_create_file_t **files, unsigned int count, unsigned int *done, unsigned int *dropped) {
+    long long shards[MYFS_DB_STATS_SHARDS];
+    size_t size, sql_len, ids_len, len;
+    char row[MYFS_DB_CREATE_ROW_SIZE];
+    unsigned int i, start, shard, error;
+    char *sql, *ids;
+    bool success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, count);
+
+    *done = 0;
+    *dropped = 0;
+    memset(shards, 0, sizeof(shards));
+
+    size = MYFS_DB_CREATE_BATCH_SIZE;
+    if (size > myfs->max_allowed_packet) {
+        size = myfs->max_allowed_packet;
+    }
+
+    sql = malloc(size);
+    ids = malloc(size);
+    if (sql == NULL || ids == NULL) {
+        log_err(MODULE, "Error creating %u files: Out of memory", count);
+        success = false;
+        goto done;
+    }
+
+    success = db_transaction_start(db);
+    if (!success) {
+        log_err(MODULE, "Error creating %u files: Failed to start transaction: %s", count, db_error(db));
+        goto done;
+    }
+
+    //As many rows go in each INSERT as fit in a packet. The change log entries are copied from the new
+    //rows by their IDs, which take less room than the rows, so they always fit too.
+    for (i = 0; i < count && success;) {
+        sql_len = strlcpy(sql, MYFS_DB_CREATE_SQL, size);
+        ids_len = snprintf(ids, size, "INSERT INTO `change_log` (`file_id`,`parent_id`,`name`,`version`,`op`,`mount_id`,`created_on`)\n"
+                                      "SELECT `file_id`,`parent_id`,`name`,`version`,'%s',%u,UNIX_TIMESTAMP()\n"
+                                      "FROM `files`\n"
+                                      "WHERE `file_id` IN (",
+                                      change_log_op_str(CHANGE_LOG_OP_CREATE), myfs->mount_id);
+
+        for (start = i; i < count; i++) {
+            len = myfs_db_file_values_sql(db, myfs, row, sizeof(row), files[i]);
+            if (sql_len + len + 1 >= size && i > start) {
+                break;
+            }
+
+            if (i > start) {
+                sql[sql_len++] = ',';
+                ids[ids_len++] = ',';
+            }
+            memcpy(sql + sql_len, row, len);
+            sql_len += len;
+            ids_len += snprintf(ids + ids_len, size - ids_len, "%u", files[i]->file_id);
+
+            shards[files[i]->file_id % MYFS_DB_STATS_SHARDS]++;
+        }
+
+        success = db_query(db, sql, sql_len);
+        if (!success) {
+            log_err(MODULE, "Error creating %u files: %s", i - start, db_error(db));
+            break;
+        }
+
+        if (myfs->change_log) {
+            ids_len += snprintf(ids + ids_len, size - ids_len, ")");
+
+            success = db_query(db, ids, ids_len);
+            if (!success) {
+                log_err(MODULE, "Error logging %u creates: %s", i - start, db_error(db));
+            }
+        }
+    }
+
+    //One stats update per shard instead of one per file.
+    for (shard = 0; shard < MYFS_DB_STATS_SHARDS && success; shard++) {
+        if (shards[shard] > 0) {
+            success = myfs_db_stats_add(db, shard, shards[shard], 0);
+        }
+    }
+
+    success = db_transaction_stop(db, success) && success;
+    if (success) {
+        *done = count;
+        goto done;
+    }
+
+    //Something in the batch failed, usually a name another mount took first. Insert the files one at a
+    //time so only the ones that can never be inserted are dropped.
+    log_warn(MODULE, "Error creating %u files at once: Creating them one at a time", count);
+
+    for (i = 0; i < count; i++) {
+        success = myfs_db_file_create_pending(db, myfs, files[i]);
+        if (success) {
+            (*done)++;
+            continue;
+        }
+
+        //Anything other than a taken name or ID, or a missing parent, might work on the next try, so stop here.
+        error = db_errno(db);
+        if (error != ER_DUP_ENTRY && error != ER_NO_REFERENCED_ROW_2) {
+            goto done;
+        }
+
+        //A mount that lets MariaDB assign IDs took one from this mount's range. The next range starts past it.
+        //The pending file was already handed out with its ID, so it can't be given another one.
+        if (error == ER_DUP_ENTRY && myfs_db_file_id_taken(db, files[i]->file_id)) {
+            myfs_db_id_range_skip(myfs, files[i]->file_id);
+        }
+
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Dropping File ID %u", files[i]->name, files[i]->parent_id, files[i]->file_id);
+        (*done)++;
+        (*dropped)++;
+    }
+
+    success = true;
+
+done:
+    free(sql);
+    free(ids);
+
+    return success;
+}
+
+bool
+myfs_db_file_delete(myfs_t *myfs, unsigned int file_id) {
+    long long size = -1;
+    bool success;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
+    //TODO: Support soft delete?
+
+    success = db_transaction_start(&myfs->db);
+    if (!success) {
+        log_err(MODULE, "Error deleting File ID %u: Failed to start transaction: %s", file_id, db_error(&myfs->db));
+        return false;
+    }
+
+    //Get the file's size so it can be taken out of the stats.
+    res = db_selectf(&myfs->db, "SELECT `size`\n"
+                                "FROM `files`\n"
+                                "WHERE `file_id`=%u\n"
+                                "FOR UPDATE",
+                                file_id);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error deleting File ID %u: Error getting file size: %s", file_id, db_error(&myfs->db));
+        success = false;
+        goto done;
+    }
+
+    row = mysql_fetch_row(res);
+    if (row != NULL) {
+        size = strtoll(row[0], NULL, 10);
+    }
+    mysql_free_result(res);
+
+    if (size == -1) {
+        log_err(MODULE, "Error deleting File ID %u: Not found", file_id);
+        success = false;
+        goto done;
+    }
+
+    //Logged first, while the row is still there to copy from.
+    success = myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_DELETE);
+    if (!success) {
+        goto done;
+    }
+
+    success = db_queryf(&myfs->db, "DELETE FROM `files`\n"
+                                   "WHERE `file_id`=%u",
+                                   file_id);
+
+    if (!success) {
+        log_err(MODULE, "Error deleting File ID %u: %s", file_id, db_error(&myfs->db));
+        goto done;
+    }
+
+    success = myfs_db_stats_add(&myfs->db, file_id, -1, -size);
+
+done:
+    db_transaction_stop(&myfs->db, success);
+
+    return success;
+}
+
+bool
+myfs_db_file_write_db(db_t *db, myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version) {
+    unsigned int file_data_id, index, limit, position, length;
+    size_t left, written = 0, page_offset;
+    off_t current_size = -1, new_size = 0;
+    uint64_t new_version = 0;
+    unsigned long write_size;
+    MYSQL_BIND params[4];
+    bool success;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, offset, len);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
+    index = myfs_db_file_block_index(offset);
+    page_offset = myfs_db_file_block_offset(offset);
+    //An unaligned write reaches into one more block than its length alone would.
+    limit = myfs_db_file_block_count(page_offset + len);
+
+    success = db_transaction_start(db);
+    if (!success) {
+        log_err(MODULE, "Error adding data for File ID %u: Failed to start transaction: %s", file_id, db_error(db));
+        return false;
+    }
+
+    //Get the file's size and version, locking its row so writes to the file happen one at a time.
+    res = db_selectf(db, "SELECT `size`,`version`\n"
+                                "FROM `files`\n"
+                                "WHERE `file_id`=%u\n"
+                                "FOR UPDATE",
+                                file_id);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error writing data for File ID %u: Failed getting file size: %s", file_id, db_error(db));
+        success = false;
+        goto done;
+    }
+
+    row = mysql_fetch_row(res);
+    if (row != NULL) {
+        current_size = strtoll(row[0], NULL, 10);
+        new_version = strtoull(row[1], NULL, 10) + 1;
+    }
+    mysql_free_result(res);
+
+    if (current_size == -1) {
+        log_err(MODULE, "Error writing data for File ID %u: Not found", file_id);
+        success = false;
+        goto done;
+    }
+
+    //Writing past the end of the file leaves a hole. The kernel does this when it writes back dirty pages
+    //out of order. Fill the hole with zeros so the blocks stay contiguous.
+    if (offset > current_size) {
+        success = myfs_db_file_extend(db, file_id, offset - current_size);
+        if (!success) {
+            goto done;
+        }
+    }
+
+    new_size = current_size;
+    if (offset + (off_t)len > new_size) {
+        new_size = offset + len;
+    }
+
+    //The row is locked, so the version can be set outright.
+    success = db_queryf(db, "UPDATE `files`\n"
+                                   "SET `size`=%zd,`version`=%" PRIu64 "%s\n"
+                                   "WHERE `file_id`=%u",
+                                   new_size,
+                                   new_version,
+                                   myfs_db_file_mtime_sql(myfs),
+                                   file_id);
+    if (!success) {
+        log_err(MODULE, "Error writing data for File ID %u: Failed updating file size: %s", file_id, db_error(db));
+        goto done;
+    }
+
+    success = myfs_db_change_log(db, myfs, file_id, CHANGE_LOG_OP_WRITE);
+    if (!success) {
+        goto done;
+    }
+
+    if (new_size != current_size) {
+        success = myfs_db_stats_add(db, file_id, 0, new_size - current_size);
+        if (!success) {
+            goto done;
+        }
+    }
+
+    //Get the block to write to.
+    res = db_selectf(db, "SELECT `file_data_id`,`index`,LENGTH(`data`)\n"
+                                "FROM `file_data`\n"
+                                "WHERE `file_id`=%u\n"
+                                "AND `index`>=%u\n"
+                                "ORDER BY `index` ASC\n"
+                                "LIMIT %u",
+                                file_id,
+                                index,
+                                limit);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error writing data for File ID %u: Failed getting block %u: %s", file_id, index, db_error(db));
+        success = false;
+        goto done;
+    }
+
+    file_data_id = 0;
+    left = len;
+
+    //Loop through the blocks that are being overwritten.
+    while (left > 0 && (row = mysql_fetch_row(res)) != NULL) {
+        file_data_id = strtoul(row[0], NULL, 10);
+        index = strtoul(row[1], NULL, 10);
+
+        //The first write may start at any offset inside the block.
+        if (written == 0) {
+            write_size = left;
+            if (write_size > MYFS_FILE_BLOCK_SIZE - page_offset) {
+                write_size = MYFS_FILE_BLOCK_SIZE - page_offset;
+            }
+        }
+        else {
+            write_size = left;
+            if (write_size > MYFS_FILE_BLOCK_SIZE) {
+                write_size = MYFS_FILE_BLOCK_SIZE;
+            }
+        }
+
+        //MariaDB indexes start at 1 so page_offset+1 is necessary
+        position = page_offset + 1;
+        length = write_size;
+
+        db_bind_uint(&params[0], &position);
+        db_bind_uint(&params[1], &length);
+        db_bind_blob(&params[2], data + written, &write_size);
+        db_bind_uint(&params[3], &file_data_id);
+
+        success = db_stmt_execute(db, "UPDATE `file_data`\n"
+                                             "SET `data`=INSERT(`data`,?,?,?)\n"
+                                             "WHERE `file_data_id`=?",
+                                             params);
+
+        if (!success) {
+            log_err(MODULE, "Error writing data for File ID %u: Failed writing to block %u: %s", file_id, index, db_error(db));
+            goto done;
+        }
+
+        left -= write_size;
+        written += write_size;
+        page_offset = 0;
+
+        //Keep track of next block to write incase this is the last one and new blocks need to inserted.
+        index++;
+    }
+
+    mysql_free_result(res);
+
+    //Write any new blocks that need to be written.
+    if (left > 0) {
+        success = myfs_db_file_blocks_insert(db, myfs, file_id, index, data + written, left);
+        if (!success) {
+            goto done;
+        }
+
+        written += left;
+    }
+
+done:
+    db_transaction_stop(db, success);
+
+    if (success) {
+        metrics_stat_add(METRICS_STAT_BYTES, len);
+        if (size != NULL) {
+            *size = new_size;
+        }
+        if (version != NULL) {
+            *version = new_version;
+        }
+    }
+
+    return success;
+}
+
+bool
+myfs_db_file_write(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version) {
+    METRICS_SCOPE();
+
+    return myfs_db_file_write_db(&myfs->db, myfs, file_id, data, len, offset, size, version);
+}
+
+bool
+myfs_db_file_append(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t *size, uint64_t *version) {
+    unsigned int file_data_id = 0, index = 0, file_data_length = 0;
+    size_t written = 0, left;
+    off_t end = 0;
+    uint64_t new_version = 0;
+    unsigned long write_size;
+    MYSQL_BIND params[2];
+    bool success;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, len);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
+    success = db_transaction_start(&myfs->db);
+    if (!success) {
+        log_err(MODULE, "Error appending data to File ID %u: Failed starting transaction: %s", file_id, db_error(&myfs->db));
+        return false;
+    }
+
+    //Get the latest block if there is one
+    res = db_selectf(&myfs->db, "SELECT `file_data_id`,`index`,LENGTH(`data`)\n"
+                                "FROM `file_data`\n"
+                                "WHERE `file_id`=%u\n"
+                                "ORDER BY `index` DESC\n"
+                                "LIMIT 1",
+                                file_id);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error appending data to File ID %u: Failed getting last block: %s", file_id, db_error(&myfs->db));
+        success = false;
+        goto done;
+    }
+
+    row = mysql_fetch_row(res);
+    if (row != NULL) {
+        file_data_id = strtoul(row[0], NULL, 10);
+        index = strtoul(row[1], NULL, 10);
+        file_data_length = strtoul(row[2], NULL, 10);
+    }
+    mysql_free_result(res);
+
+    //Blocks are always contiguous so the last one tells where the file ends.
+    if (file_data_id > 0) {
+        end = (off_t)index * MYFS_FILE_BLOCK_SIZE + file_data_length;
+    }
+
+    //Update the file's size and version. LAST_INSERT_ID() hands the new version back without another query.
+    success = db_queryf(&myfs->db, "UPDATE `files`\n"
+                                   "SET `size`=%zd,`version`=LAST_INSERT_ID(`version`+1)%s\n"
+                                   "WHERE `file_id`=%u",
+                                   end + len,
+                                   myfs_db_file_mtime_sql(myfs),
+                                   file_id);
+
+    if (!success) {
+        log_err(MODULE, "Error appending data to File ID %u: Failed updating file size: %s", file_id, db_error(&myfs->db));
+        goto done;
+    }
+
+    new_version = db_insert_id(&myfs->db);
+
+    success = myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_WRITE);
+    if (!success) {
+        goto done;
+    }
+
+    success = myfs_db_stats_add(&myfs->db, file_id, 0, len);
+    if (!success) {
+        goto done;
+    }
+
+    written = 0;
+    left = len;
+
+    //Update the last block if there is one and it's not full.
+    if (file_data_id > 0) {
+        if (file_data_length < MYFS_FILE_BLOCK_SIZE) {
+            write_size = left;
+            if (write_size > MYFS_FILE_BLOCK_SIZE - file_data_length) {
+                write_size = MYFS_FILE_BLOCK_SIZE - file_data_length;
+            }
 
+            db_bind_blob(&params[0], data, &write_size);
+            db_bind_uint(&params[1], &file_data_id);
+
+            success = db_stmt_execute(&myfs->db, "UPDATE `file_data`\n"
+                                                 "SET `data`=CONCAT(`data`,?)\n"
+                                                 "WHERE `file_data_id`=?",
+                                                 params);
+
+            if (!success) {
+                log_err(MODULE, "Error appending data to File ID %u: Failed updating last block: %s", file_id, db_error(&myfs->db));
+                goto done;
+            }
+
+            written += write_size;
+            left -= write_size;
+        }
+
+        //Next block will be new, increase the index regardless of whether we were able to update the last block or not.
+        index++;
+    }
+
+    //Add new blocks.
+    if (left > 0) {
+        success = myfs_db_file_blocks_insert(&myfs->db, myfs, file_id, index, data + written, left);
         if (!success) {
-            log_err(MODULE, "Error appending data to File ID %u: Failed adding block %u: %s", file_id, index, db_error(&myfs->db));
             goto done;
         }
 
-        written += write_size;
-        left -= write_size;
-        index++;
+        written += left;
     }
 
 done:
     db_transaction_stop(&myfs->db, success);
 
-    MYFSDB_LOG_TRACE("  Written[%zu]", written);
-    MYFSDB_LOG_TRACE("End");
+    if (success) {
+        metrics_stat_add(METRICS_STAT_BYTES, len);
+        if (size != NULL) {
+            *size = end + len;
+        }
+        if (version != NULL) {
+            *version = new_version;
+        }
+    }
 
     return success;
 }
 
 bool
-myfs_db_file_set_times(myfs_t *myfs, unsigned int file_id, time_t last_accessed_on, time_t last_modified_on) {
+myfs_db_file_set_times(myfs_t *myfs, unsigned int file_id, const time_t *last_accessed_on, const time_t *last_modified_on) {
+    char accessed[32] = "`last_accessed_on`", modified[32] = "`last_modified_on`";
     bool success;
 
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
+    //Setting a column to itself leaves it unchanged.
+    if (last_accessed_on != NULL) {
+        snprintf(accessed, sizeof(accessed), "%ld", *last_accessed_on);
+    }
+    if (last_modified_on != NULL) {
+        snprintf(modified, sizeof(modified), "%ld", *last_modified_on);
+    }
+
     success = db_queryf(&myfs->db, "UPDATE `files`\n"
-                                   "SET `last_accessed_on`=%ld,`last_modified_on`=%ld\n"
+                                   "SET `last_accessed_on`=%s,`last_modified_on`=%s\n"
                                    "WHERE `file_id`=%u",
-                                   last_accessed_on, last_modified_on,
+                                   accessed, modified,
                                    file_id);
 
     if (!success) {
         log_err(MODULE, "Error updating times for File ID %u: %s", file_id, db_error(&myfs->db));
     }
 
+    //Single statement changes aren't in a transaction, so the change is logged after it's made. If that
+    //fails, other mounts see the change once their cached attributes time out.
+    if (success) {
+        myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_ATTR);
+    }
+
     return success;
 }
 
 bool
-myfs_db_file_chown(myfs_t *myfs, unsigned int file_id, const char *user, const char *group) {
+myfs_db_file_chown(myfs_t *myfs, unsigned int file_id, const char *user, uid_t uid, const char *group, gid_t gid) {
     char *user_esc = NULL, *group_esc = NULL;
     char query[2048];
     int len;
     bool success;
 
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
     //Escape the user/group.
     if (user != NULL && user[0] != '\0') {
         user_esc = db_escape(&myfs->db, user, NULL);
@@ -440,24 +1250,25 @@ myfs_db_file_chown(myfs_t *myfs, unsigned int file_id, const char *user, const c
         return false;
     }
 
-    //Build the SQL based on whether the user, group, or both are being set.
+    //Build the SQL based on whether the user, group, or both are being set. The names and IDs are always
+    //set together so clients in either ownership mode see the change.
     len = strlcpy(query, "UPDATE `files`\nSET ", sizeof(query));
-    if (user_esc != NULL && group_esc != NULL) {
-        len += snprintf(query + len, sizeof(query) - len, "`user`='%s',`group`='%s'\n", user_esc, group_esc);
-    }
-    else if (user_esc != NULL) {
-        len += snprintf(query + len, sizeof(query) - len, "`user`='%s'\n", user_esc);
+    if (user_esc != NULL) {
+        len += snprintf(query + len, sizeof(query) - len, "`user`='%s',`uid`=%u", user_esc, uid);
     }
-    else if (group_esc != NULL) {
-        len += snprintf(query + len, sizeof(query) - len, "`group`='%s'\n", group_esc);
+    if (group_esc != NULL) {
+        len += snprintf(query + len, sizeof(query) - len, "%s`group`='%s',`gid`=%u", user_esc != NULL ? "," : "", group_esc, gid);
     }
-    len += snprintf(query + len, sizeof(query) - len, "WHERE `file_id`=%u", file_id);
+    len += snprintf(query + len, sizeof(query) - len, "\nWHERE `file_id`=%u", file_id);
 
     //Run!
     success = db_query(&myfs->db, query, len);
     if (!success) {
         log_err(MODULE, "Error setting user[%s] and group[%s] on File ID %u: %s", user, group, file_id, db_error(&myfs->db));
     }
+    else {
+        myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_ATTR);
+    }
 
     if (user_esc != NULL) {
         free(user_esc);
@@ -473,6 +1284,13 @@ bool
 myfs_db_file_chmod(myfs_t *myfs, unsigned int file_id, mode_t mode) {
     bool success;
 
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
     success = db_queryf(&myfs->db, "UPDATE `files`\n"
                                    "SET `mode`=%u\n"
                                    "WHERE `file_id`=%u",
@@ -482,6 +1300,9 @@ myfs_db_file_chmod(myfs_t *myfs, unsigned int file_id, mode_t mode) {
     if (!success) {
         log_err(MODULE, "Error setting mode[%u] on File ID %u: %s", mode, file_id, db_error(&myfs->db));
     }
+    else {
+        myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_ATTR);
+    }
 
     return success;
 }
@@ -491,6 +1312,13 @@ myfs_db_file_swap(myfs_t *myfs, myfs_file_t *file1, myfs_file_t *file2) {
     unsigned int parent1_id = 0, parent2_id = 0;
     bool success;
 
+    METRICS_SCOPE();
+    TRACE_SCOPE(file1->file_id, 0, 0);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
     if (file1->parent != NULL) {
         parent1_id = file1->parent->file_id;
     }
@@ -528,6 +1356,12 @@ myfs_db_file_swap(myfs_t *myfs, myfs_file_t *file1, myfs_file_t *file2) {
         }
     }
 
+    //Each file is logged at its new place, which is the other's old one.
+    if (success) {
+        success = myfs_db_change_log(&myfs->db, myfs, file1->file_id, CHANGE_LOG_OP_RENAME) &&
+                  myfs_db_change_log(&myfs->db, myfs, file2->file_id, CHANGE_LOG_OP_RENAME);
+    }
+
     //Commit or rollback the transaction.
     db_transaction_stop(&myfs->db, success);
 
@@ -539,8 +1373,18 @@ myfs_db_file_rename(myfs_t *myfs, unsigned int file_id, unsigned int parent_id,
     char *name_esc;
     bool success;
 
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
     name_esc = db_escape(&myfs->db, name, NULL);
 
+    //Logged at the old place now and the new place after, so other mounts forget both paths.
+    myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_RENAME);
+
     success = db_queryf(&myfs->db, "UPDATE `files`\n"
                                    "SET `parent_id`=%u,`name`='%s'\n"
                                    "WHERE `file_id`=%u",
@@ -552,36 +1396,40 @@ myfs_db_file_rename(myfs_t *myfs, unsigned int file_id, unsigned int parent_id,
     if (!success) {
         log_err(MODULE, "Error updating Parent ID for File ID %u: %s", file_id, db_error(&myfs->db));
     }
+    else {
+        myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_RENAME);
+    }
 
     return success;
 }
 
 ssize_t
 myfs_db_file_read(myfs_t *myfs, unsigned int file_id, char *buf, size_t size, off_t offset) {
-    unsigned int index, data_len, limit, page_offset;
+    unsigned int index, limit, page_offset;
+    unsigned long *lengths, data_len;
     ssize_t count;
-    const char *data;
     MYSQL_RES *res;
     MYSQL_ROW row;
 
-    MYFSDB_LOG_TRACE("Begin");
-    MYFSDB_LOG_TRACE("  FileID[%u]; Size[%zu]; Offset[%zd]", file_id, size, offset);
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, offset, size);
 
     index = myfs_db_file_block_index(offset);
     page_offset = myfs_db_file_block_offset(offset);
-    limit = myfs_db_file_block_count(size);
 
-    MYFSDB_LOG_TRACE("  Index[%u]; PageOffset[%u]; Limit[%u]", index, page_offset, limit);
+    //A read that starts inside a block spans one more block than its size alone would.
+    limit = myfs_db_file_block_count(page_offset + size);
 
-    res = db_selectf(&myfs->db, "SELECT `data`,LENGTH(`data`)\n"
-                                "FROM `file_data`\n"
-                                "WHERE `file_id`=%u\n"
-                                "AND `index`>=%u\n"
-                                "ORDER BY `index` ASC\n"
-                                "LIMIT %u",
-                                file_id,
-                                index,
-                                limit);
+    //Stream the blocks so each one is copied into `buf` as it arrives instead of buffering the whole result first.
+    res = db_select_streamf(&myfs->db, "SELECT `data`\n"
+                                       "FROM `file_data`\n"
+                                       "WHERE `file_id`=%u\n"
+                                       "AND `index`>=%u\n"
+                                       "ORDER BY `index` ASC\n"
+                                       "LIMIT %u",
+                                       file_id,
+                                       index,
+                                       limit);
 
     if (res == NULL) {
         log_err(MODULE, "Error reading data for File ID %u: Failed getting block %u: %s", file_id, index, db_error(&myfs->db));
@@ -589,43 +1437,66 @@ myfs_db_file_read(myfs_t *myfs, unsigned int file_id, char *buf, size_t size, of
     }
 
     count = 0;
-    while ((row = mysql_fetch_row(res)) != NULL) {
-        data = row[0];
-        data_len = strtoul(row[1], NULL, 10);
+    while (size > 0 && (row = mysql_fetch_row(res)) != NULL) {
+        lengths = mysql_fetch_lengths(res);
+        data_len = lengths[0];
+
+        //A short block can only be the last one, so there's nothing left to read past it.
+        if (page_offset >= data_len) {
+            break;
+        }
 
         //Adjust the amount of data to read if needed.
+        data_len -= page_offset;
         if (data_len > size) {
             data_len = size;
         }
 
-        MYFSDB_LOG_TRACE("  Reading; PageOffset[%u]; Count[%zd]; DataLen[%u]", page_offset, count, data_len);
-
-        //Copy the data into the output buffer.
-        memcpy(buf + count, data + page_offset, data_len);
+        //Copy the data straight from the row into the output buffer.
+        memcpy(buf + count, row[0] + page_offset, data_len);
 
         //If a second page has to be read, reset the page offset to 0.
         page_offset = 0;
 
         count += data_len;
-        size -= count;
+        size -= data_len;
     }
 
+    //mysql_fetch_row() also returns NULL on a failure, so make sure every row actually arrived.
+    if (size > 0 && db_stream_error(&myfs->db)) {
+        log_err(MODULE, "Error reading data for File ID %u: Failed fetching blocks: %s", file_id, db_error(&myfs->db));
+        count = -1;
+    }
+
+    //Streamed rows aren't counted by the DB module. mysql_num_rows() is the number fetched so far.
+    metrics_stat_add(METRICS_STAT_ROWS, mysql_num_rows(res));
+
+    //Any rows that were not fetched are discarded here.
     mysql_free_result(res);
 
-    MYFSDB_LOG_TRACE("  Count[%zd]", count);
-    MYFSDB_LOG_TRACE("Done");
+    if (count > 0) {
+        metrics_stat_add(METRICS_STAT_BYTES, count);
+    }
 
     return count;
 }
 
 bool
-myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size) {
+myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size, uint64_t *version) {
     MYSQL_RES *res;
     MYSQL_ROW row;
     off_t current_size = -1, diff, write_size, file_data_length, left;
-    unsigned int file_data_id, index;
+    uint64_t new_version = 0;
+    unsigned int file_data_id;
     bool success;
 
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, size);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
     success = db_transaction_start(&myfs->db);
     if (!success) {
         log_err(MODULE, "Error truncating File ID %u: Failed to start transaction: %s", file_id, db_error(&myfs->db));
@@ -633,9 +1504,10 @@ myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size) {
     }
 
     //First, get the current file size so we know if we need to shrink, grow, or do nothing.
-    res = db_selectf(&myfs->db, "SELECT `size`\n"
+    res = db_selectf(&myfs->db, "SELECT `size`,`version`\n"
                                 "FROM `files`\n"
-                                "WHERE `file_id`=%u",
+                                "WHERE `file_id`=%u\n"
+                                "FOR UPDATE",
                                 file_id);
 
     if (res == NULL) {
@@ -647,6 +1519,7 @@ myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size) {
     row = mysql_fetch_row(res);
     if (row != NULL) {
         current_size = strtoul(row[0], NULL, 10);
+        new_version = strtoull(row[1], NULL, 10);
     }
 
     mysql_free_result(res);
@@ -659,92 +1532,32 @@ myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size) {
 
     diff = size - current_size;
 
-    //Update the file's size
+    //Update the file's size and version.
     if (diff != 0) {
+        new_version++;
         success = db_queryf(&myfs->db, "UPDATE `files`\n"
-                                       "SET `size`=%zd\n"
+                                       "SET `size`=%zd,`version`=%" PRIu64 "%s\n"
                                        "WHERE `file_id`=%u",
                                        size,
+                                       new_version,
+                                       myfs_db_file_mtime_sql(myfs),
                                        file_id);
 
         if (!success) {
             log_err(MODULE, "Error truncating File ID %u: Error setting new file size to %zd: %s", file_id, size, db_error(&myfs->db));
             goto done;
         }
-    }
 
-    //Grow or shrink now.
-    if (diff > 0) {
-        left = diff;
-
-        //Get the last block, if there is one, and fill in any remaining space.
-        res = db_selectf(&myfs->db, "SELECT `file_data_id`,`index`,LENGTH(`data`)\n"
-                                    "FROM `file_data`\n"
-                                    "WHERE `file_id`=%u\n"
-                                    "ORDER BY `index` DESC\n"
-                                    "LIMIT 1",
-                                    file_id);
-
-        if (res == NULL) {
-            log_err(MODULE, "Error truncating File ID %u: Error getting last block: %s", file_id, db_error(&myfs->db));
-            success = false;
+        success = myfs_db_stats_add(&myfs->db, file_id, 0, diff) &&
+                  myfs_db_change_log(&myfs->db, myfs, file_id, CHANGE_LOG_OP_WRITE);
+        if (!success) {
             goto done;
         }
+    }
 
-        file_data_id = 0;
-        index = 0;
-        file_data_length = 0;
-
-        row = mysql_fetch_row(res);
-        if (row != NULL) {
-            file_data_id = strtoul(row[0], NULL, 10);
-            index = strtoul(row[1], NULL, 10) + 1;
-            file_data_length = strtoul(row[2], NULL, 10);
-        }
-        mysql_free_result(res);
-
-        //If the last block has a data size smaller than the max block size, update this block.
-        if (file_data_id > 0) {
-            if (file_data_length < MYFS_FILE_BLOCK_SIZE) {
-                write_size = left;
-                if (write_size > MYFS_FILE_BLOCK_SIZE - file_data_length) {
-                    write_size = MYFS_FILE_BLOCK_SIZE - file_data_length;
-                }
-
-                success = db_queryf(&myfs->db, "UPDATE `file_data`\n"
-                                               "SET `data`=CONCAT(`data`,REPEAT(' ',%zd))\n"
-                                               "WHERE `file_data_id`=%u",
-                                               write_size,
-                                               file_data_id);
-
-                if (!success) {
-                    log_err(MODULE, "Error truncating File ID %u: Error updating last block: %s", file_id, db_error(&myfs->db));
-                    goto done;
-                }
-
-                left -= write_size;
-            }
-        }
-
-        //Now add blocks until the entire size has been written.
-        while (left > 0) {
-            write_size = left;
-            if (write_size > MYFS_FILE_BLOCK_SIZE) {
-                write_size = MYFS_FILE_BLOCK_SIZE;
-            }
-
-            success = db_queryf(&myfs->db, "INSERT INTO `file_data` (`file_id`,`index`,`data`)\n"
-                                           "VALUES (%u,%u,REPEAT(' ',%zd))",
-                                           file_id, index, write_size);
-
-            if (!success) {
-                log_err(MODULE, "Error truncating File ID %u: Error adding block %u: %s", file_id, index, db_error(&myfs->db));
-                goto done;
-            }
-
-            index++;
-            left -= write_size;
-        }
+    //Grow or shrink now.
+    if (diff > 0) {
+        success = myfs_db_file_extend(&myfs->db, file_id, diff);
     }
     else if (diff < 0) {
         left = diff * -1;
@@ -803,7 +1616,7 @@ myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size) {
             else {
                 //The block needs to be shrunk.
                 success = db_queryf(&myfs->db, "UPDATE `file_data`\n"
-                                               "SET `data`=REPEAT(' ',%zd)\n"
+                                               "SET `data`=LEFT(`data`,%zd)\n"
                                                "WHERE `file_data_id`=%u",
                                                file_data_length - write_size,
                                                file_data_id);
@@ -822,143 +1635,288 @@ done:
 
     db_transaction_stop(&myfs->db, success);
 
+    if (success && version != NULL) {
+        *version = new_version;
+    }
+
     return success;
 }
 
+myfs_file_t *
+myfs_db_file_from_row(myfs_t *myfs, MYSQL_ROW row) {
+    struct fuse_context *fuse;
+    myfs_file_t *file;
+    int ret;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    fuse = fuse_get_context();
+
+    file = malloc(sizeof(*file));
+    myfs_file_init(file);
+
+    file->file_id = strtoul(row[0], NULL, 10);
+    strlcpy(file->name, row[1], sizeof(file->name));
+    file->type = myfs_file_type(row[3]);
+    file->st.st_mode = strtoul(row[6], NULL, 10);
+
+    //Setup the struct stat.
+    //TODO: I don't really need the `type` field anymore because I should be able to use st.st_mode to know what type it is. It's just kinda nice seeing the type in the database though. Easier to query too... so maybe it's a good idea to leave it.
+    switch (file->type) {
+        case MYFS_FILE_TYPE_FILE:
+            file->st.st_nlink = 1;
+            file->st.st_size = strtoul(row[7], NULL, 10);
+            break;
+        case MYFS_FILE_TYPE_DIRECTORY:
+            file->st.st_nlink = 2;
+            break;
+        case MYFS_FILE_TYPE_SOFT_LINK:
+            file->st.st_nlink = 1;
+            file->st.st_size = strtoul(row[7], NULL, 10);
+            break;
+        case MYFS_FILE_TYPE_INVALID:
+            break;
+    }
+
+    file->st.st_ino = file->file_id;
+    file->version = strtoull(row[13], NULL, 10);
+    //In ID mode ownership is read straight from the row. Rows written before the IDs were stored fall back
+    //to their names.
+    if (myfs->ownership_mode == MYFS_OWNERSHIP_ID && row[11] != NULL) {
+        file->st.st_uid = strtoul(row[11], NULL, 10);
+        ret = 0;
+    }
+    else {
+        ret = util_user_id(row[4], &file->st.st_uid);
+    }
+    if (ret != 0) {
+        //Did not find the user, fall back to the configured user and then to the UID from FUSE.
+        //TODO: Make a config option on how to handle this condition?
+        file->st.st_uid = myfs->config.uid_found ? myfs->config.uid : fuse->uid;
+
+        //Every file the user owns fails the same way, so it's only logged once per `id_cache_ttl`.
+        if (util_user_report(row[4])) {
+            log_err(MODULE, "Error getting user '%s' for File ID %u: %s: Using UID %u", row[4], file->file_id, strerror(ret), file->st.st_uid);
+        }
+    }
+    if (myfs->ownership_mode == MYFS_OWNERSHIP_ID && row[12] != NULL) {
+        file->st.st_gid = strtoul(row[12], NULL, 10);
+        ret = 0;
+    }
+    else {
+        ret = util_group_id(row[5], &file->st.st_gid);
+    }
+    if (ret != 0) {
+        //Did not find the group, fall back to the configured group and then to the GID from FUSE.
+        //TODO: Make a config option on how to handle this condition?
+        file->st.st_gid = myfs->config.gid_found ? myfs->config.gid : fuse->gid;
+
+        if (util_group_report(row[5])) {
+            log_err(MODULE, "Error getting group '%s' for File ID %u: %s: Using GID %u", row[5], file->file_id, strerror(ret), file->st.st_gid);
+        }
+    }
+    file->st.st_atime = strtoll(row[8], NULL, 10);
+    file->st.st_mtime = strtoll(row[9], NULL, 10);
+    file->st.st_ctime = strtoll(row[10], NULL, 10);
+
+    return file;
+}
+
+/**
+ * Builds a MyFS file from a pending create, the same way as from its row once it's inserted.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] pending The pending create.
+ * @return The MyFS file.
+ */
+static myfs_file_t *
+myfs_db_file_from_pending(myfs_t *myfs, const async_create_file_t *pending) {
+    char file_id[16], parent_id[16], mode[16], created_on[24], uid[16], gid[16];
+    char *row[14];
+
+    snprintf(file_id, sizeof(file_id), "%u", pending->file_id);
+    snprintf(parent_id, sizeof(parent_id), "%u", pending->parent_id);
+    snprintf(mode, sizeof(mode), "%u", pending->mode);
+    snprintf(created_on, sizeof(created_on), "%lld", (long long)pending->created_on);
+    snprintf(uid, sizeof(uid), "%u", myfs->config.uid);
+    snprintf(gid, sizeof(gid), "%u", myfs->config.gid);
+
+    row[0] = file_id;
+    row[1] = (char *)pending->name;
+    row[2] = parent_id;
+    row[3] = (char *)myfs_file_type_str(pending->type);
+    row[4] = myfs->config.user;
+    row[5] = myfs->config.group;
+    row[6] = mode;
+    row[7] = "0";
+    row[8] = created_on;
+    row[9] = created_on;
+    row[10] = created_on;
+    row[11] = myfs->config.uid_found ? uid : NULL;
+    row[12] = myfs->config.gid_found ? gid : NULL;
+    row[13] = "0";
+
+    return myfs_db_file_from_row(myfs, row);
+}
+
+/**
+ * Orders pending creates by File ID.
+ */
+static int
+myfs_db_pending_compare(const void *a, const void *b) {
+    const async_create_file_t *file1 = a, *file2 = b;
+
+    return (file1->file_id > file2->file_id) - (file1->file_id < file2->file_id);
+}
+
 /**
  * Queries MariaDB for a MyFS's file's children. The file must be a MYFS_FILE_TYPE_DIRECTORY.
  *
+ * The children are streamed in a single query and built straight from their rows, so large directories
+ * are not buffered twice and do not cost a query per child. The children's parent is not set since it's `file`.
+ *
  * @param[in] myfs The MyFS context.
  * @param[in,out] file The MyFS file to get children for.
+ * @return `true` on success, otherwise `false`. A list that was cut short by an error is freed, so it's never
+ *         mistaken for the whole directory.
  */
-
-static void
+static bool
 myfs_db_file_query_children(myfs_t *myfs, myfs_file_t *file) {
-    unsigned int i = 0;
+    unsigned int i, size = 0, pending_count;
+    async_create_file_t *pending, *found, key;
     MYSQL_RES *res;
     MYSQL_ROW row;
+    bool success;
 
     if (file->type != MYFS_FILE_TYPE_DIRECTORY) {
         log_err(MODULE, "Error getting children for file '%s': Not a directory", file->name);
-        return;
+        return false;
+    }
+
+    //Pending creates are gathered first. One that's inserted while the rows are read is in both, and is
+    //only taken from its row.
+    pending_count = async_create_children(file->file_id, &pending);
+    if (pending_count > 1) {
+        qsort(pending, pending_count, sizeof(*pending), myfs_db_pending_compare);
+    }
+
+    res = db_select_streamf(&myfs->db, "SELECT " MYFS_DB_FILE_COLUMNS "\n"
+                                       "FROM `files`\n"
+                                       "WHERE `parent_id`=%u\n"
+                                       "AND `file_id`!=0\n"
+                                       "ORDER BY `name` ASC",
+                                       file->file_id);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error getting children for File ID %u: %s", file->file_id, db_error(&myfs->db));
+        free(pending);
+        return false;
+    }
+
+    //The number of rows isn't known until they've all been fetched, so grow the array as they arrive.
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        if (file->children_count == size) {
+            size = size == 0 ? 16 : size * 2;
+            file->children = realloc(file->children, size * sizeof(myfs_file_t *));
+        }
+
+        file->children[file->children_count] = myfs_db_file_from_row(myfs, row);
+
+        //A pending create's name is cleared once it's been found in the rows.
+        if (pending_count > 0) {
+            key.file_id = file->children[file->children_count]->file_id;
+            found = bsearch(&key, pending, pending_count, sizeof(*pending), myfs_db_pending_compare);
+            if (found != NULL) {
+                found->name[0] = '\0';
+            }
+        }
+
+        file->children_count++;
+    }
+
+    success = !db_stream_error(&myfs->db);
+    mysql_free_result(res);
+
+    if (!success) {
+        log_err(MODULE, "Error getting children for File ID %u: %s", file->file_id, db_error(&myfs->db));
+
+        for (i = 0; i < file->children_count; i++) {
+            myfs_file_free(file->children[i]);
+        }
+        free(file->children);
+        file->children = NULL;
+        file->children_count = 0;
+
+        free(pending);
+        return false;
     }
 
-    res = db_selectf(&myfs->db, "SELECT `file_id`\n"
-                                "FROM `files`\n"
-                                "WHERE `parent_id`=%u\n"
-                                "AND `file_id`!=0\n"
-                                "ORDER BY `name` ASC",
-                                file->file_id);
+    for (i = 0; i < pending_count; i++) {
+        if (pending[i].name[0] == '\0') {
+            continue;
+        }
 
-    file->children_count = mysql_num_rows(res);
-    file->children = calloc(file->children_count, sizeof(myfs_file_t));
+        if (file->children_count == size) {
+            size = size == 0 ? 16 : size * 2;
+            file->children = realloc(file->children, size * sizeof(myfs_file_t *));
+        }
 
-    while ((row = mysql_fetch_row(res)) != NULL) {
-        file->children[i++] = myfs_db_file_query(myfs, strtoul(row[0], NULL, 10), false);
+        file->children[file->children_count++] = myfs_db_file_from_pending(myfs, &pending[i]);
     }
 
-    mysql_free_result(res);
+    free(pending);
+
+    return true;
 }
 
 myfs_file_t *
 myfs_db_file_query(myfs_t *myfs, unsigned int file_id, bool include_children) {
-    struct fuse_context *fuse;
+    async_create_file_t pending;
     myfs_file_t *file = NULL;
+    unsigned int parent_id = 0;
     MYSQL_RES *res;
     MYSQL_ROW row;
-    int ret;
-
-    fuse = fuse_get_context();
-
-    res = db_selectf(&myfs->db, "SELECT `file_id`,`name`,`parent_id`,`type`,`user`,`group`,`mode`,`size`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`\n"
-                                "FROM `files`\n"
-                                "WHERE `file_id`=%u",
-                                file_id);
 
-    if (res == NULL) {
-        log_err(MODULE, "Error getting file with File ID %u: %s", file_id, db_error(&myfs->db));
-        return NULL;
-    }
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
 
-    row = mysql_fetch_row(res);
-    if (row == NULL) {
-        log_err(MODULE, "Error getting file with File ID %u: Not found", file_id);
+    //A file that hasn't been inserted yet is only in the pending creates.
+    if (async_create_get(file_id, &pending)) {
+        file = myfs_db_file_from_pending(myfs, &pending);
+        parent_id = pending.parent_id;
     }
     else {
-        file = malloc(sizeof(*file));
-        myfs_file_init(file);
-
-        file->file_id = strtoul(row[0], NULL, 10);
-        strlcpy(file->name, row[1], sizeof(file->name));
-        if (file_id > 0) {
-            //Only grab the parent if this file is not the root.
-            file->parent = myfs_db_file_query(myfs, strtoul(row[2], NULL, 10), false);
-        }
-        file->type = myfs_file_type(row[3]);
-        file->st.st_mode = strtoul(row[6], NULL, 10);
-
-        //Setup the struct stat.
-        //TODO: I don't really need the `type` field anymore because I should be able to use st.st_mode to know what type it is. It's just kinda nice seeing the type in the database though. Easier to query too... so maybe it's a good idea to leave it.
-        switch (file->type) {
-            case MYFS_FILE_TYPE_FILE:
-                file->st.st_nlink = 1;
-                file->st.st_size = strtoul(row[7], NULL, 10);
-                break;
-            case MYFS_FILE_TYPE_DIRECTORY:
-                file->st.st_nlink = 2;
-                break;
-            case MYFS_FILE_TYPE_SOFT_LINK:
-                file->st.st_nlink = 1;
-                file->st.st_size = strtoul(row[7], NULL, 10);
-                break;
-            case MYFS_FILE_TYPE_INVALID:
-                break;
-        }
-
-        file->st.st_ino = file->file_id;
-        ret = util_user_id(row[4], &file->st.st_uid);
-        if (ret != 0) {
-            //Did not find the user in the database, fallback to the configured user
-
-            //TODO: Make a config option on how to handle this condition?
-            log_err(MODULE, "Error getting user '%s' for File ID %u: %s", row[4], file->file_id, strerror(ret));
-            log_err(MODULE, "Setting the user to the configured user '%s'", config_get("user"));
-
-            ret = util_user_id(config_get("user"), &file->st.st_uid);
-            if (ret != 0) {
-                //Did not find the configured user, use the UID from FUSE
+        res = db_selectf(&myfs->db, "SELECT " MYFS_DB_FILE_COLUMNS "\n"
+                                    "FROM `files`\n"
+                                    "WHERE `file_id`=%u",
+                                    file_id);
 
-                log_err(MODULE, "Error getting user '%s' for File ID %u: %s", config_get("user"), file->file_id, strerror(ret));
-                log_err(MODULE, "Setting the user to the program's UID %u", fuse->uid);
-                file->st.st_uid = fuse->uid;
-            }
+        if (res == NULL) {
+            log_err(MODULE, "Error getting file with File ID %u: %s", file_id, db_error(&myfs->db));
+            return NULL;
         }
-        ret = util_group_id(row[5], &file->st.st_gid);
-        if (ret != 0) {
-            //Did not find the group in the database, fallback to the configured group
-
-            //TODO: Make a config option on how to handle this condition?
-            log_err(MODULE, "Error getting group '%s' for File ID %u: %s", row[5], file->file_id, strerror(ret));
-            log_err(MODULE, "Setting the group to the configured group '%s'", config_get("group"));
 
-            ret = util_group_id(config_get("group"), &file->st.st_gid);
-            if (ret != 0) {
-                //Did not find the configured group, use the GID from FUSE
-
-                log_err(MODULE, "Error getting group '%s' for File ID %u: %s", config_get("group"), file->file_id, strerror(ret));
-                log_err(MODULE, "Setting the group to the configured group %u", fuse->gid);
-                file->st.st_gid = fuse->gid;
-            }
+        row = mysql_fetch_row(res);
+        if (row == NULL) {
+            log_err(MODULE, "Error getting file with File ID %u: Not found", file_id);
+        }
+        else {
+            file = myfs_db_file_from_row(myfs, row);
+            parent_id = strtoul(row[2], NULL, 10);
         }
-        file->st.st_atime = strtoll(row[8], NULL, 10);
-        file->st.st_mtime = strtoll(row[9], NULL, 10);
-        file->st.st_ctime = strtoll(row[10], NULL, 10);
+
+        mysql_free_result(res);
     }
 
-    mysql_free_result(res);
+    //Only grab the parent if this file is not the root.
+    if (file != NULL && file_id > 0) {
+        file->parent = myfs_db_file_query(myfs, parent_id, false);
+    }
 
-    if (file != NULL && include_children) {
-        myfs_db_file_query_children(myfs, file);
+    if (file != NULL && include_children && !myfs_db_file_query_children(myfs, file)) {
+        myfs_file_free(file);
+        file = NULL;
     }
 
     return file;
@@ -966,11 +1924,19 @@ myfs_db_file_query(myfs_t *myfs, unsigned int file_id, bool include_children) {
 
 myfs_file_t *
 myfs_db_file_query_name(myfs_t *myfs, const char *name, unsigned int parent_id, bool include_children) {
+    async_create_file_t pending;
     myfs_file_t *file = NULL;
     MYSQL_RES *res;
     MYSQL_ROW row;
     char *name_esc = NULL;
 
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    if (async_create_get_name(name, parent_id, &pending)) {
+        return myfs_db_file_query(myfs, pending.file_id, include_children);
+    }
+
     //Escape the name if needed.
     if (name != NULL && name[0] != '\0') {
         name_esc = db_escape(&myfs->db, name, NULL);
@@ -1005,25 +1971,33 @@ myfs_db_file_query_name(myfs_t *myfs, const char *name, unsigned int parent_id,
 }
 
 bool
-myfs_db_get_num_files(myfs_t *myfs, uint64_t *count) {
+myfs_db_get_stats(myfs_t *myfs, uint64_t *files, uint64_t *bytes) {
     MYSQL_RES *res;
     MYSQL_ROW row;
     bool success = false;
 
-    res = db_selectf(&myfs->db, "SELECT COUNT(*)\n"
-                                "FROM `files`");
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    if (!myfs_db_pending_flush(myfs)) {
+        return false;
+    }
+
+    res = db_selectf(&myfs->db, "SELECT COALESCE(SUM(`files`),0),COALESCE(SUM(`bytes`),0)\n"
+                                "FROM `fs_stats`");
 
     if (res == NULL) {
-        log_err(MODULE, "Error getting number of files: %s", db_error(&myfs->db));
+        log_err(MODULE, "Error getting file system stats: %s", db_error(&myfs->db));
         return false;
     }
 
     row = mysql_fetch_row(res);
     if (row == NULL) {
-        log_err(MODULE, "Error getting number of files: Not data returned");
+        log_err(MODULE, "Error getting file system stats: No data returned");
     }
     else {
-        *count = strtoul(row[0], NULL, 10);
+        *files = strtoull(row[0], NULL, 10);
+        *bytes = strtoull(row[1], NULL, 10);
         success = true;
     }
 
@@ -1032,32 +2006,436 @@ myfs_db_get_num_files(myfs_t *myfs, uint64_t *count) {
     return success;
 }
 
+/**
+ * Counts the files and bytes in `files` into `fs_stats` if it's empty, such as after the table was
+ * created. Afterwards `fs_stats` is kept up to date by every change.
+ *
+ * @param[in] myfs The MyFS context.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_stats_reconcile(myfs_t *myfs) {
+    bool empty, success;
+    MYSQL_RES *res;
+
+    success = db_transaction_start(&myfs->db);
+    if (!success) {
+        log_err(MODULE, "Error counting file system stats: Failed to start transaction: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    //Locking the empty table keeps another client mounting at the same time from counting too.
+    res = db_select(&myfs->db, "SELECT `shard` FROM `fs_stats` LIMIT 1 FOR UPDATE", 49);
+    if (res == NULL) {
+        log_err(MODULE, "Error counting file system stats: %s", db_error(&myfs->db));
+        success = false;
+        goto done;
+    }
+
+    empty = mysql_fetch_row(res) == NULL;
+    mysql_free_result(res);
+
+    if (empty) {
+        log_info(MODULE, "Counting files for 'fs_stats'");
+
+        success = db_queryf(&myfs->db, "INSERT INTO `fs_stats` (`shard`,`files`,`bytes`)\n"
+                                       "SELECT 0,COUNT(*),COALESCE(SUM(`size`),0)\n"
+                                       "FROM `files`");
+        if (!success) {
+            log_err(MODULE, "Error counting file system stats: %s", db_error(&myfs->db));
+        }
+    }
+
+done:
+    db_transaction_stop(&myfs->db, success);
+
+    return success;
+}
+
+bool
+myfs_db_schema_upgrade(myfs_t *myfs) {
+    char sql[2048];
+    MYSQL_RES *res;
+    bool exists, success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    //The `uid` and `gid` columns were added after the first release.
+    res = db_select(&myfs->db, "SHOW COLUMNS FROM `files` LIKE 'uid'", 36);
+    if (res == NULL) {
+        log_err(MODULE, "Error checking the database schema: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    exists = mysql_fetch_row(res) != NULL;
+    mysql_free_result(res);
+
+    if (!exists) {
+        log_info(MODULE, "Adding the 'uid' and 'gid' columns to 'files'");
+
+        success = db_queryf(&myfs->db, "ALTER TABLE `files`\n"
+                                       "ADD COLUMN IF NOT EXISTS `uid` int(10) unsigned DEFAULT NULL AFTER `group`,\n"
+                                       "ADD COLUMN IF NOT EXISTS `gid` int(10) unsigned DEFAULT NULL AFTER `uid`");
+        if (!success) {
+            log_err(MODULE, "Error adding the 'uid' and 'gid' columns to 'files': %s", db_error(&myfs->db));
+            return false;
+        }
+    }
+
+    //The `version` column was added after the first release. Existing files start at version 0.
+    res = db_select(&myfs->db, "SHOW COLUMNS FROM `files` LIKE 'version'", 40);
+    if (res == NULL) {
+        log_err(MODULE, "Error checking the database schema: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    exists = mysql_fetch_row(res) != NULL;
+    mysql_free_result(res);
+
+    if (!exists) {
+        log_info(MODULE, "Adding the 'version' column to 'files'");
+
+        success = db_queryf(&myfs->db, "ALTER TABLE `files`\n"
+                                       "ADD COLUMN IF NOT EXISTS `version` bigint(20) unsigned NOT NULL DEFAULT 0 AFTER `size`");
+        if (!success) {
+            log_err(MODULE, "Error adding the 'version' column to 'files': %s", db_error(&myfs->db));
+            return false;
+        }
+    }
+
+    //The `fs_stats` table was added after the first release. It's filled in by `myfs_db_stats_reconcile()`.
+    res = db_select(&myfs->db, "SHOW TABLES LIKE 'fs_stats'", 27);
+    if (res == NULL) {
+        log_err(MODULE, "Error checking the database schema: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    exists = mysql_fetch_row(res) != NULL;
+    mysql_free_result(res);
+
+    if (!exists) {
+        log_info(MODULE, "Adding the 'fs_stats' table");
+
+        create_get_sql_database_table4(sql, sizeof(sql));
+        success = db_queryf(&myfs->db, "%s", sql);
+        if (!success) {
+            log_err(MODULE, "Error adding the 'fs_stats' table: %s", db_error(&myfs->db));
+            return false;
+        }
+    }
+
+    //The `change_log` table was added after the first release.
+    res = db_select(&myfs->db, "SHOW TABLES LIKE 'change_log'", 29);
+    if (res == NULL) {
+        log_err(MODULE, "Error checking the database schema: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    exists = mysql_fetch_row(res) != NULL;
+    mysql_free_result(res);
+
+    if (!exists) {
+        log_info(MODULE, "Adding the 'change_log' table");
+
+        create_get_sql_database_table5(sql, sizeof(sql));
+        success = db_queryf(&myfs->db, "%s", sql);
+        if (!success) {
+            log_err(MODULE, "Error adding the 'change_log' table: %s", db_error(&myfs->db));
+            return false;
+        }
+    }
+
+    //The `leases` table was added after the first release.
+    res = db_select(&myfs->db, "SHOW TABLES LIKE 'leases'", 25);
+    if (res == NULL) {
+        log_err(MODULE, "Error checking the database schema: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    exists = mysql_fetch_row(res) != NULL;
+    mysql_free_result(res);
+
+    if (!exists) {
+        log_info(MODULE, "Adding the 'leases' table");
+
+        create_get_sql_database_table6(sql, sizeof(sql));
+        success = db_queryf(&myfs->db, "%s", sql);
+        if (!success) {
+            log_err(MODULE, "Error adding the 'leases' table: %s", db_error(&myfs->db));
+            return false;
+        }
+    }
+
+    //The `id_ranges` table was added after the first release. Ranges start after the highest File ID.
+    res = db_select(&myfs->db, "SHOW TABLES LIKE 'id_ranges'", 28);
+    if (res == NULL) {
+        log_err(MODULE, "Error checking the database schema: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    exists = mysql_fetch_row(res) != NULL;
+    mysql_free_result(res);
+
+    if (!exists) {
+        log_info(MODULE, "Adding the 'id_ranges' table");
+
+        create_get_sql_database_table7(sql, sizeof(sql));
+        success = db_queryf(&myfs->db, "%s", sql) &&
+                  db_queryf(&myfs->db, "INSERT IGNORE INTO `id_ranges` (`name`,`next_id`)\n"
+                                       "SELECT 'files',COALESCE(MAX(`file_id`),0)+1\n"
+                                       "FROM `files`");
+        if (!success) {
+            log_err(MODULE, "Error adding the 'id_ranges' table: %s", db_error(&myfs->db));
+            return false;
+        }
+    }
+
+    return myfs_db_stats_reconcile(myfs);
+}
+
+/**
+ * Fills in the `uid` or `gid` column for files that only have a name. Each distinct name is looked up once.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] user `true` to fill in user IDs, `false` to fill in group IDs.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_db_owner_backfill_column(myfs_t *myfs, bool user) {
+    const char *name_column, *id_column;
+    unsigned int id, count = 0;
+    char *name_esc;
+    bool success = true;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    uid_t uid;
+    gid_t gid;
+    int ret;
+
+    name_column = user ? "user" : "group";
+    id_column = user ? "uid" : "gid";
+
+    //The names are buffered since the table is updated while going through them.
+    res = db_selectf(&myfs->db, "SELECT DISTINCT `%s`\n"
+                                "FROM `files`\n"
+                                "WHERE `%s` IS NULL",
+                                name_column,
+                                id_column);
+
+    if (res == NULL) {
+        log_err(MODULE, "Error getting %s names without IDs: %s", name_column, db_error(&myfs->db));
+        return false;
+    }
+
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        if (user) {
+            ret = util_user_id(row[0], &uid);
+            id = uid;
+        }
+        else {
+            ret = util_group_id(row[0], &gid);
+            id = gid;
+        }
+
+        if (ret != 0) {
+            log_warn(MODULE, "Unable to get the ID of %s '%s', its files will keep using the name: %s", name_column, row[0], strerror(ret));
+            continue;
+        }
+
+        name_esc = db_escape(&myfs->db, row[0], NULL);
+        success = db_queryf(&myfs->db, "UPDATE `files`\n"
+                                       "SET `%s`=%u\n"
+                                       "WHERE `%s`='%s'\n"
+                                       "AND `%s` IS NULL",
+                                       id_column, id,
+                                       name_column, name_esc,
+                                       id_column);
+        free(name_esc);
+
+        if (!success) {
+            log_err(MODULE, "Error setting the ID of %s '%s': %s", name_column, row[0], db_error(&myfs->db));
+            break;
+        }
+
+        count++;
+    }
+
+    mysql_free_result(res);
+
+    if (count > 0) {
+        log_info(MODULE, "Filled in the %s ID for %u %s names", name_column, count, name_column);
+    }
+
+    return success;
+}
+
 bool
-myfs_db_get_space_used(myfs_t *myfs, uint64_t *space) {
+myfs_db_owner_backfill(myfs_t *myfs) {
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    return myfs_db_owner_backfill_column(myfs, true) &&
+           myfs_db_owner_backfill_column(myfs, false);
+}
+
+/**
+ * Sizes the file data inserts and FUSE requests from MariaDB's `max_allowed_packet`.
+ *
+ * As many blocks as fit in a packet are inserted per statement, up to MYFS_INSERT_BLOCKS_MAX. A FUSE
+ * request is then sized to a few of those statements, so a large read or write becomes a handful of
+ * queries in one transaction instead of one transaction per page.
+ *
+ * @param[in] myfs The MyFS context.
+ */
+static void
+myfs_db_request_sizes(myfs_t *myfs) {
+    unsigned int blocks, request_size;
+
+    //Leave room for the statement's parameters and the packet header of each row.
+    blocks = myfs->max_allowed_packet / (MYFS_FILE_BLOCK_SIZE + 64);
+
+    myfs->blocks_per_insert = 1;
+    while (myfs->blocks_per_insert * 2 <= blocks && myfs->blocks_per_insert < MYFS_INSERT_BLOCKS_MAX) {
+        myfs->blocks_per_insert *= 2;
+    }
+
+    request_size = myfs->blocks_per_insert * MYFS_FILE_BLOCK_SIZE * 4;
+    if (request_size > MYFS_REQUEST_SIZE_MAX) {
+        request_size = MYFS_REQUEST_SIZE_MAX;
+    }
+
+    myfs->request_size = request_size - request_size % MYFS_FILE_BLOCK_SIZE;
+}
+
+/**
+ * Escapes `str` for queries into a fixed size buffer.
+ */
+static void
+myfs_db_config_escape(myfs_t *myfs, const char *str, char *dst, size_t size) {
+    char *escaped;
+
+    escaped = db_escape(&myfs->db, str, NULL);
+    strlcpy(dst, escaped, size);
+    free(escaped);
+}
+
+/**
+ * Connects to MariaDB, sizes requests from its `max_allowed_packet` and brings the database up to date.
+ * Escaping depends on the connection's character set, so the config values used in queries are escaped here.
+ */
+static bool
+myfs_db_connect(myfs_t *myfs) {
+    myfs_config_t *config = &myfs->config;
+    bool success;
     MYSQL_RES *res;
     MYSQL_ROW row;
-    bool success = false;
 
-    res = db_selectf(&myfs->db, "SELECT `data_length`+`index_length`\n"
-                                "FROM `information_schema`.`tables`\n"
-                                "WHERE `table_schema`='%s'",
-                                config_get("mariadb_database"));
+    pthread_mutex_init(&myfs->id_lock, NULL);
+    db_init(&myfs->db);
+    success = db_connect(&myfs->db, config_get("mariadb_host"), config_get("mariadb_user"), config_get("mariadb_password"), config_get("mariadb_database"),config_get_uint("mariadb_port"));
+
+    if (!success) {
+        log_err(MODULE, "Error connecting to MariaDB: %s", db_error(&myfs->db));
+        return false;
+    }
+
+    db_set_failed_query_options(&myfs->db, config_get_int("failed_query_retry_wait"), config_get_int("failed_query_retry_count"));
+    db_set_profile_options(&myfs->db, config_get_uint("slow_query_ms"), config_get_uint("query_summary_interval"), config_get_uint("query_summary_top"));
 
+    myfs_db_config_escape(myfs, config->user, config->user_esc, sizeof(config->user_esc));
+    myfs_db_config_escape(myfs, config->group, config->group_esc, sizeof(config->group_esc));
+
+    //Query to get MariaDB's max_allowed_packet variable.
+    res = db_select(&myfs->db, "SHOW VARIABLES LIKE 'max_allowed_packet'", 40);
     if (res == NULL) {
-        log_err(MODULE, "Error getting used space: %s", db_error(&myfs->db));
+        log_err(MODULE, "Error getting 'max_allowed_packet' variable: %s", db_error(&myfs->db));
         return false;
     }
 
     row = mysql_fetch_row(res);
     if (row == NULL) {
-        log_err(MODULE, "Error getting used space: No data returned");
+        log_err(MODULE, "Error getting 'max_allowed_packet' variable: Not found");
+        success = false;
+    }
+    else if (row[1] == NULL) {
+        log_err(MODULE, "Error getting 'max_allowed_packet' variable: Value is NULL");
+        success = false;
     }
     else {
-        *space = strtoul(row[0], NULL, 10);
-        success = true;
+        myfs->max_allowed_packet = strtoul(row[1], NULL, 10);
+        log_info(MODULE, "'max_allowed_packet' is %u", myfs->max_allowed_packet);
+
+        myfs_db_request_sizes(myfs);
+        log_info(MODULE, "Inserting up to %u blocks per statement with %u byte requests", myfs->blocks_per_insert, myfs->request_size);
     }
 
     mysql_free_result(res);
 
+    if (!success) {
+        return false;
+    }
+
+    success = myfs_db_schema_upgrade(myfs);
+    if (!success) {
+        return false;
+    }
+
+    //Other mounts skip their own entries in the change log, and tell whose leases are whose, by this ID.
+    myfs->change_log = config_equals("change_log", "true");
+    myfs->write_leases = config_equals("write_leases", "true");
+    if (myfs->change_log || myfs->write_leases) {
+        while (myfs->mount_id == 0) {
+            if (getrandom(&myfs->mount_id, sizeof(myfs->mount_id), 0) != sizeof(myfs->mount_id)) {
+                log_err(MODULE, "Error making a mount ID: %s", strerror(errno));
+                return false;
+            }
+        }
+
+        log_info(MODULE, "Running as Mount ID %u", myfs->mount_id);
+    }
+
+    //Ranges are reserved on the first create.
+    myfs->id_range_size = config_get_uint("id_range_size");
+
+    //Pending creates already have their File IDs, so they can't wait on AUTO_INCREMENT.
+    myfs->async_create = config_equals("async_create", "true");
+    if (myfs->async_create && myfs->id_range_size == 0) {
+        log_warn(MODULE, "Not creating files asynchronously: 'id_range_size' is 0");
+        myfs->async_create = false;
+    }
+
+    //In ID mode, look up the IDs for files that only have names once now instead of on every stat.
+    if (myfs->ownership_mode == MYFS_OWNERSHIP_ID) {
+        success = myfs_db_owner_backfill(myfs);
+    }
+
     return success;
 }
+
+static void
+myfs_db_disconnect(myfs_t *myfs) {
+    db_disconnect(&myfs->db);
+    db_free(&myfs->db);
+    pthread_mutex_destroy(&myfs->id_lock);
+}
+
+const myfs_backend_t myfs_db_backend = {
+    .name = "mariadb",
+    .connect = myfs_db_connect,
+    .disconnect = myfs_db_disconnect,
+    .file_create = myfs_db_file_create,
+    .file_delete = myfs_db_file_delete,
+    .file_write = myfs_db_file_write,
+    .file_append = myfs_db_file_append,
+    .file_set_times = myfs_db_file_set_times,
+    .file_chown = myfs_db_file_chown,
+    .file_chmod = myfs_db_file_chmod,
+    .file_swap = myfs_db_file_swap,
+    .file_rename = myfs_db_file_rename,
+    .file_read = myfs_db_file_read,
+    .file_truncate = myfs_db_file_truncate,
+    .file_query = myfs_db_file_query,
+    .file_query_name = myfs_db_file_query_name,
+    .get_stats = myfs_db_get_stats
+};
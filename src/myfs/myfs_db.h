@@ -2,12 +2,51 @@
 
 /**
  * @file myfs_db.h
+ *
+ * The MariaDB backend. Files are stored in the `files` table and their data in `file_data`, one row per
+ * MYFS_FILE_BLOCK_SIZE block.
  */
 
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
 #include "myfs.h"
+#include "myfs_backend.h"
+#include "async_create.h"
+
+/** The MariaDB backend. */
+extern const myfs_backend_t myfs_db_backend;
+
+/** The number of rows `fs_stats` is spread over so concurrent updates don't all wait on one row lock. */
+#define MYFS_DB_STATS_SHARDS 64
+
+/** The columns selected from `files` to build a MyFS file. See `myfs_db_file_from_row()`. */
+#define MYFS_DB_FILE_COLUMNS "`file_id`,`name`,`parent_id`,`type`,`user`,`group`,`mode`,`size`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`,`uid`,`gid`,`version`"
+
+/**
+ * Builds a MyFS file from a row of `MYFS_DB_FILE_COLUMNS`. The file's parent and children are not set.
+ * This does not query MariaDB, so it is safe to call while streaming rows. Other backends that keep the
+ * same `files` columns build their files with it too, so ownership is resolved the same way everywhere.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] row The row from `files`, with every column as a string and NULL for NULL.
+ * @return The MyFS file.
+ */
+myfs_file_t * myfs_db_file_from_row(myfs_t *myfs, MYSQL_ROW row);
+
+/**
+ * Reserves a range of File IDs from `id_ranges`. The range starts after the highest File ID too, in case a
+ * mount that lets MariaDB assign IDs made files past the last range.
+ *
+ * This must not be called inside of a transaction. The range is committed on its own, so other mounts only
+ * wait on `id_ranges` for as long as it takes to reserve one.
+ *
+ * @param[in] db The database connection.
+ * @param[in] count The number of File IDs to reserve.
+ * @param[out] first Set to the first File ID in the range on success.
+ * @return `true` on success, otherwise `false`.
+ */
+bool myfs_db_id_reserve(db_t *db, unsigned int count, unsigned int *first);
 
 /**
  * Inserts a new file record into MariaDB with the given file type and parent.
@@ -21,6 +60,22 @@
  */
 unsigned int myfs_db_file_create(myfs_t *myfs, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode);
 
+/**
+ * Inserts pending creates, oldest first, in as few statements as fit in a packet and one transaction. If
+ * that fails they're inserted one at a time, and the ones that can never be inserted, because their name
+ * or File ID is taken or their directory was dropped, are dropped too. This never flushes the pending
+ * creates itself.
+ *
+ * @param[in] db The connection to insert on. It mustn't be `myfs->db`, which FUSE's threads use.
+ * @param[in] myfs The MyFS context.
+ * @param[in] files The pending creates.
+ * @param[in] count The number of pending creates.
+ * @param[out] done Set to how many of the first `files` were inserted or dropped. The rest should be tried again.
+ * @param[out] dropped Set to how many of those were dropped.
+ * @return `true` if every file was inserted or dropped, otherwise `false`.
+ */
+bool myfs_db_file_create_batch(db_t *db, myfs_t *myfs, async_create_file_t **files, unsigned int count, unsigned int *done, unsigned int *dropped);
+
 /**
  * Deletes a file from MariaDB. If this file is a parent to other files, all children will
  * be deleted in a cascading fashion.
@@ -32,50 +87,75 @@ unsigned int myfs_db_file_create(myfs_t *myfs, const char *name, myfs_file_type_
 bool myfs_db_file_delete(myfs_t *myfs, unsigned int file_id);
 
 /**
- * Adds data to the file in MYFS_FILE_BLOCK_SIZE chunks.
+ * Adds data to the file in MYFS_FILE_BLOCK_SIZE chunks. If `offset` is past the end of the file, the gap is
+ * filled with zeros. Unless the kernel's writeback cache is enabled, the file's modified time is updated. The
+ * file's version goes up by one in the same transaction.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[in] file_id The File ID of the file to add data to.
+ * @param[in] data The data to write.
+ * @param[in] len The total length of `data`.
+ * @param[in] offset The offset where to begin writing.
+ * @param[out] size On success, set to the file's size after the write. May be NULL.
+ * @param[out] version On success, set to the file's version after the write. May be NULL.
+ * @return `true` on success, otherwise `false`.
+ */
+bool myfs_db_file_write(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version);
+
+/**
+ * Like `myfs_db_file_write()`, but on another connection. Used by background threads, which can't share
+ * `myfs->db` with FUSE's threads.
  *
+ * @param[in] db The connection to write on.
  * @param[in] myfs The MyFS context.
  * @param[in] file_id The File ID of the file to add data to.
  * @param[in] data The data to write.
  * @param[in] len The total length of `data`.
  * @param[in] offset The offset where to begin writing.
+ * @param[out] size On success, set to the file's size after the write. May be NULL.
+ * @param[out] version On success, set to the file's version after the write. May be NULL.
  * @return `true` on success, otherwise `false`.
  */
-bool myfs_db_file_write(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset);
+bool myfs_db_file_write_db(db_t *db, myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version);
 
 /**
- * Appends data to the file in MYFS_FILE_BLOCK_SIZE chunks.
+ * Appends data to the file in MYFS_FILE_BLOCK_SIZE chunks. Unless the kernel's writeback cache is enabled,
+ * the file's modified time is updated. The file's version goes up by one in the same transaction.
  *
  * @param[in] myfs The MyFS context.
  * @param[in] file_id The File ID of the file to add data to.
  * @param[in] data The data to write.
  * @param[in] len The total length of `data`.
+ * @param[out] size On success, set to the file's size after the write. May be NULL.
+ * @param[out] version On success, set to the file's version after the write. May be NULL.
  * @return `true` on success, otherwise `false`.
  */
-bool myfs_db_file_append(myfs_t *myfs, unsigned int file_id, const char *data, size_t len);
+bool myfs_db_file_append(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t *size, uint64_t *version);
 
 /**
  * Update the last accessed and last modified timestamps of the given File ID.
  *
  * @param[in] myfs The MyFS context.
  * @param[in] file_id The File ID to update.
- * @param[in] last_accessed_on The last accessed timestamp to set.
- * @param[in] last_modified_on The last modified timestamp to set.
+ * @param[in] last_accessed_on The last accessed timestamp to set, or NULL to leave it unchanged.
+ * @param[in] last_modified_on The last modified timestamp to set, or NULL to leave it unchanged.
  * @return `true` if the file was updated, otherwise `false`.
  */
-bool myfs_db_file_set_times(myfs_t *myfs, unsigned int file_id, time_t last_accessed_on, time_t last_modified_on);
+bool myfs_db_file_set_times(myfs_t *myfs, unsigned int file_id, const time_t *last_accessed_on, const time_t *last_modified_on);
 
 /**
  * Sets the user and group of the given File ID. If either `user` or `group` are NULL or blank, then that
- * value will be ignored.
+ * value will be ignored. The name and ID are always stored together.
  *
  * @param[in] myfs The MyFS context.
  * @param[in] file_id The File ID to update.
  * @param[in] user The user to set, or NULL or blank to not set.
+ * @param[in] uid The UID of `user`.
  * @param[in] group The group to set, or NULL or blank to not set.
+ * @param[in] gid The GID of `group`.
  * @return `true` if the file was updated, otherwise `false`.
  */
-bool myfs_db_file_chown(myfs_t *myfs, unsigned int file_id, const char *user, const char *group);
+bool myfs_db_file_chown(myfs_t *myfs, unsigned int file_id, const char *user, uid_t uid, const char *group, gid_t gid);
 
 /**
  * Sets the mode of the given File ID.
@@ -121,14 +201,16 @@ bool myfs_db_file_rename(myfs_t *myfs, unsigned int file_id, unsigned int parent
 ssize_t myfs_db_file_read(myfs_t *myfs, unsigned int file_id, char *buf, size_t size, off_t offset);
 
 /**
- * Sets the size of the content. This is going to be interesting functionality in a database.
+ * Sets the size of the content. This is going to be interesting functionality in a database. Growing a file
+ * fills the new space with zeros. If the size changes, the file's version goes up by one in the same transaction.
  *
  * @param[in] myfs The MyFS context.
  * @param[in] file_id The File ID to update.
  * @param[in] size The size to set the content to.
+ * @param[out] version On success, set to the file's version after the truncate. May be NULL.
  * @return `true` if the file was updated, otherwise `false`.
  */
-bool myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size);
+bool myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size, uint64_t *version);
 
 /**
  * Queries MariaDB for a MyFS file's data, including its parent and possibly its children. If querying for
@@ -137,7 +219,7 @@ bool myfs_db_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size);
  * @param[in] myfs The MyFS context.
  * @param[in] file_id The File ID of the MyFS file.
  * @param[in] include_children `true` to also query for the MyFS's children.
- * @return The MyFS file or `NULL` if an error occurred.
+ * @return The MyFS file or `NULL` if an error occurred, including if its children couldn't all be read.
  */
 myfs_file_t * myfs_db_file_query(myfs_t *myfs, unsigned int file_id, bool include_children);
 
@@ -154,19 +236,31 @@ myfs_file_t * myfs_db_file_query(myfs_t *myfs, unsigned int file_id, bool includ
 myfs_file_t * myfs_db_file_query_name(myfs_t *myfs, const char *name, unsigned int parent_id, bool include_children);
 
 /**
- * Gets the number of files in the database.
+ * Gets the number of files and the total size of their data from `fs_stats`. This reads a handful of
+ * counter rows, so it doesn't slow down as the file system grows.
+ *
+ * @param[in] myfs The MyFS context.
+ * @param[out] files The number of files, including directories and links.
+ * @param[out] bytes The total size of the files' data in bytes.
+ * @return `true` on success, otherwise `false`.
+ */
+bool myfs_db_get_stats(myfs_t *myfs, uint64_t *files, uint64_t *bytes);
+
+/**
+ * Brings an existing MyFS database up to date with the current schema, and fills in `fs_stats` if it's
+ * empty.
  *
  * @param[in] myfs The MyFS context.
- * @param[out] count The number of files in the database.
  * @return `true` on success, otherwise `false`.
  */
-bool myfs_db_get_num_files(myfs_t *myfs, uint64_t *count);
+bool myfs_db_schema_upgrade(myfs_t *myfs);
 
 /**
- * Gets the disk spaced used by the database in bytes.
+ * Fills in the `uid` and `gid` columns for files that only have user and group names, such as files
+ * created by older versions of MyFS. Each distinct name is looked up once. Names that can't be found are
+ * left alone and keep being looked up by name.
  *
  * @param[in] myfs The MyFS context.
- * @param[out] space The spaced used in bytes.
  * @return `true` on success, otherwise `false`.
  */
-bool myfs_db_get_space_used(myfs_t *myfs, uint64_t *space);
+bool myfs_db_owner_backfill(myfs_t *myfs);
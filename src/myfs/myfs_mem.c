@@ -0,0 +1,948 @@
+/**
+ * @file myfs_mem.c
+ *
+ * Files are kept in an array indexed by File ID, and found by name through a hash table keyed on the
+ * Parent ID and name, the same way `uk_files` is used in MariaDB. File data is kept in
+ * MYFS_FILE_BLOCK_SIZE blocks like `file_data`; blocks that were never written are left unallocated and
+ * read as zeros.
+ *
+ * One reader-writer lock protects everything, so lookups and reads run in parallel.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include "../common/log.h"
+#include "../common/string.h"
+#include "../common/metrics.h"
+#include "../common/trace.h"
+#include "myfs_mem.h"
+
+#define MODULE "MyFS Mem"
+
+/** The number of name hash buckets to start with. Must be a power of two. */
+#define MYFS_MEM_NAMES_SIZE 1024
+
+/** The number of File IDs to make room for at a time. */
+#define MYFS_MEM_FILES_GROW 1024
+
+typedef struct myfs_mem_file_t myfs_mem_file_t;
+
+/**
+ * A file, the same as a row in `files`.
+ */
+struct myfs_mem_file_t {
+    unsigned int file_id;               //!< The File ID.
+    unsigned int parent_id;             //!< The File ID of the directory it's in.
+    char name[MYFS_FILE_NAME_MAX_LEN + 1]; //!< The file's name.
+    myfs_file_type_t type;              //!< The file's type.
+    mode_t mode;                        //!< The file's mode, including its type.
+    uid_t uid;                          //!< The owner.
+    gid_t gid;                          //!< The group.
+    off_t size;                         //!< The size of the file's data.
+    uint64_t version;                   //!< Goes up each time the file's data changes.
+    time_t last_accessed_on;
+    time_t last_modified_on;
+    time_t last_status_changed_on;
+    char **blocks;                      //!< The file's data blocks. `NULL` blocks are all zeros.
+    size_t blocks_size;                 //!< The number of slots in `blocks`.
+    myfs_mem_file_t *name_next;         //!< The next file in the same name hash bucket.
+    myfs_mem_file_t *children;          //!< The first file in this directory.
+    myfs_mem_file_t *sibling_prev;      //!< The previous file in the same directory.
+    myfs_mem_file_t *sibling_next;      //!< The next file in the same directory.
+};
+
+typedef struct {
+    pthread_rwlock_t lock;              //!< Protects everything below.
+    myfs_mem_file_t **files;            //!< Every file, indexed by File ID.
+    unsigned int files_size;            //!< The number of slots in `files`.
+    unsigned int files_next;            //!< The next File ID to hand out. IDs aren't reused, like AUTO_INCREMENT.
+    myfs_mem_file_t **names;            //!< The name hash table.
+    size_t names_size;                  //!< The number of buckets in `names`. Always a power of two.
+    size_t names_count;                 //!< The number of files in `names`.
+    uint64_t files_count;               //!< The number of files, for statfs.
+    uint64_t bytes_count;               //!< The total size of the files' data, for statfs.
+} myfs_mem_t;
+
+static myfs_mem_t mem;
+
+static size_t
+myfs_mem_name_hash(unsigned int parent_id, const char *name) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    hash = (hash ^ parent_id) * 1099511628211ULL;
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char)*name++) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Finds a file. The lock must be held.
+ */
+static myfs_mem_file_t *
+myfs_mem_file_get(unsigned int file_id) {
+    return file_id < mem.files_next ? mem.files[file_id] : NULL;
+}
+
+/**
+ * Finds a file by its name in a directory. The lock must be held.
+ */
+static myfs_mem_file_t *
+myfs_mem_file_get_name(unsigned int parent_id, const char *name) {
+    myfs_mem_file_t *file;
+
+    file = mem.names[myfs_mem_name_hash(parent_id, name) & (mem.names_size - 1)];
+    while (file != NULL && (file->parent_id != parent_id || strcmp(file->name, name) != 0)) {
+        file = file->name_next;
+    }
+
+    return file;
+}
+
+/**
+ * Doubles the name hash table. The write lock must be held.
+ */
+static bool
+myfs_mem_names_grow() {
+    myfs_mem_file_t **names, *file, *next;
+    size_t size, i, bucket;
+
+    size = mem.names_size * 2;
+    names = calloc(size, sizeof(*names));
+    if (names == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < mem.names_size; i++) {
+        for (file = mem.names[i]; file != NULL; file = next) {
+            next = file->name_next;
+            bucket = myfs_mem_name_hash(file->parent_id, file->name) & (size - 1);
+            file->name_next = names[bucket];
+            names[bucket] = file;
+        }
+    }
+
+    free(mem.names);
+    mem.names = names;
+    mem.names_size = size;
+
+    return true;
+}
+
+/**
+ * Adds a file to the name hash table and to its directory. The write lock must be held.
+ */
+static void
+myfs_mem_file_link(myfs_mem_file_t *file) {
+    myfs_mem_file_t *parent;
+    size_t bucket;
+
+    //Growing is best effort. A full table still works, just with longer chains.
+    if (mem.names_count >= mem.names_size) {
+        myfs_mem_names_grow();
+    }
+
+    bucket = myfs_mem_name_hash(file->parent_id, file->name) & (mem.names_size - 1);
+    file->name_next = mem.names[bucket];
+    mem.names[bucket] = file;
+    mem.names_count++;
+
+    //The root is its own parent, but isn't one of its children.
+    if (file->file_id == 0) {
+        return;
+    }
+
+    parent = myfs_mem_file_get(file->parent_id);
+    file->sibling_prev = NULL;
+    file->sibling_next = parent->children;
+    if (parent->children != NULL) {
+        parent->children->sibling_prev = file;
+    }
+    parent->children = file;
+}
+
+/**
+ * Removes a file from the name hash table and from its directory. The write lock must be held.
+ */
+static void
+myfs_mem_file_unlink(myfs_mem_file_t *file) {
+    myfs_mem_file_t **link, *parent;
+
+    link = &mem.names[myfs_mem_name_hash(file->parent_id, file->name) & (mem.names_size - 1)];
+    while (*link != file) {
+        link = &(*link)->name_next;
+    }
+    *link = file->name_next;
+    mem.names_count--;
+
+    if (file->file_id == 0) {
+        return;
+    }
+
+    if (file->sibling_prev != NULL) {
+        file->sibling_prev->sibling_next = file->sibling_next;
+    }
+    else {
+        parent = myfs_mem_file_get(file->parent_id);
+        parent->children = file->sibling_next;
+    }
+
+    if (file->sibling_next != NULL) {
+        file->sibling_next->sibling_prev = file->sibling_prev;
+    }
+
+    file->sibling_prev = NULL;
+    file->sibling_next = NULL;
+}
+
+/**
+ * Frees blocks from `index` on. The write lock must be held.
+ */
+static void
+myfs_mem_blocks_free(myfs_mem_file_t *file, size_t index) {
+    size_t i;
+
+    for (i = index; i < file->blocks_size; i++) {
+        free(file->blocks[i]);
+        file->blocks[i] = NULL;
+    }
+}
+
+/**
+ * Deletes a file and everything in it. The write lock must be held.
+ */
+static void
+myfs_mem_file_remove(myfs_mem_file_t *file) {
+    while (file->children != NULL) {
+        myfs_mem_file_remove(file->children);
+    }
+
+    myfs_mem_file_unlink(file);
+
+    mem.files[file->file_id] = NULL;
+    mem.files_count--;
+    mem.bytes_count -= file->size;
+
+    myfs_mem_blocks_free(file, 0);
+    free(file->blocks);
+    free(file);
+}
+
+/**
+ * Builds a MyFS file from a file, the same as `myfs_db_file_from_row()`. The lock must be held.
+ */
+static myfs_file_t *
+myfs_mem_file_build(myfs_mem_file_t *mem_file) {
+    myfs_file_t *file;
+
+    file = malloc(sizeof(*file));
+    myfs_file_init(file);
+
+    file->file_id = mem_file->file_id;
+    strlcpy(file->name, mem_file->name, sizeof(file->name));
+    file->type = mem_file->type;
+    file->st.st_mode = mem_file->mode;
+    file->st.st_nlink = mem_file->type == MYFS_FILE_TYPE_DIRECTORY ? 2 : 1;
+    if (mem_file->type != MYFS_FILE_TYPE_DIRECTORY) {
+        file->st.st_size = mem_file->size;
+    }
+    file->st.st_ino = mem_file->file_id;
+    file->version = mem_file->version;
+    file->st.st_uid = mem_file->uid;
+    file->st.st_gid = mem_file->gid;
+    file->st.st_atime = mem_file->last_accessed_on;
+    file->st.st_mtime = mem_file->last_modified_on;
+    file->st.st_ctime = mem_file->last_status_changed_on;
+
+    return file;
+}
+
+static int
+myfs_mem_file_compare(const void *a, const void *b) {
+    return strcmp((*(myfs_file_t **)a)->name, (*(myfs_file_t **)b)->name);
+}
+
+/**
+ * Builds a MyFS file with its parents up to the root and, optionally, its children sorted by name. The
+ * lock must be held.
+ */
+static myfs_file_t *
+myfs_mem_file_build_all(myfs_mem_file_t *mem_file, bool include_children) {
+    myfs_mem_file_t *child;
+    myfs_file_t *file, *last;
+    unsigned int size = 0;
+
+    file = myfs_mem_file_build(mem_file);
+
+    //Like `myfs_db_file_query()`, every parent is included up to the root.
+    last = file;
+    while (mem_file->file_id != 0) {
+        mem_file = myfs_mem_file_get(mem_file->parent_id);
+        last->parent = myfs_mem_file_build(mem_file);
+        last = last->parent;
+    }
+
+    if (include_children && file->type == MYFS_FILE_TYPE_DIRECTORY) {
+        mem_file = myfs_mem_file_get(file->file_id);
+
+        for (child = mem_file->children; child != NULL; child = child->sibling_next) {
+            if (file->children_count == size) {
+                size = size == 0 ? 16 : size * 2;
+                file->children = realloc(file->children, size * sizeof(myfs_file_t *));
+            }
+
+            file->children[file->children_count++] = myfs_mem_file_build(child);
+        }
+
+        qsort(file->children, file->children_count, sizeof(myfs_file_t *), myfs_mem_file_compare);
+    }
+
+    return file;
+}
+
+/**
+ * Makes room for File ID `mem.files_next`. The write lock must be held.
+ */
+static bool
+myfs_mem_files_grow() {
+    myfs_mem_file_t **files;
+    unsigned int size;
+
+    if (mem.files_next < mem.files_size) {
+        return true;
+    }
+
+    size = mem.files_size + MYFS_MEM_FILES_GROW;
+    files = realloc(mem.files, size * sizeof(*files));
+    if (files == NULL) {
+        return false;
+    }
+
+    memset(files + mem.files_size, 0, MYFS_MEM_FILES_GROW * sizeof(*files));
+    mem.files = files;
+    mem.files_size = size;
+
+    return true;
+}
+
+/**
+ * Makes a new file. The write lock must be held.
+ */
+static myfs_mem_file_t *
+myfs_mem_file_new(myfs_t *myfs, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode) {
+    struct fuse_context *fuse;
+    myfs_mem_file_t *file;
+
+    if (!myfs_mem_files_grow()) {
+        return NULL;
+    }
+
+    file = calloc(1, sizeof(*file));
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fuse = fuse_get_context();
+
+    file->file_id = mem.files_next++;
+    file->parent_id = parent_id;
+    strlcpy(file->name, name, sizeof(file->name));
+    file->type = type;
+    file->mode = mode;
+    file->uid = myfs->config.uid_found || fuse == NULL ? myfs->config.uid : fuse->uid;
+    file->gid = myfs->config.gid_found || fuse == NULL ? myfs->config.gid : fuse->gid;
+    file->last_accessed_on = time(NULL);
+    file->last_modified_on = file->last_accessed_on;
+    file->last_status_changed_on = file->last_accessed_on;
+
+    mem.files[file->file_id] = file;
+    mem.files_count++;
+    myfs_mem_file_link(file);
+
+    return file;
+}
+
+/**
+ * Copies data into a file's blocks, allocating them as needed, and moves its version. The write lock must
+ * be held.
+ */
+static bool
+myfs_mem_file_write_blocks(myfs_t *myfs, myfs_mem_file_t *file, const char *data, size_t len, off_t offset) {
+    size_t index, block_offset, length, blocks_size;
+    char **blocks;
+    off_t end;
+
+    end = offset + len;
+
+    blocks_size = (end + MYFS_FILE_BLOCK_SIZE - 1) / MYFS_FILE_BLOCK_SIZE;
+    if (blocks_size > file->blocks_size) {
+        //Grow by at least double so appends don't realloc every block.
+        if (blocks_size < file->blocks_size * 2) {
+            blocks_size = file->blocks_size * 2;
+        }
+
+        blocks = realloc(file->blocks, blocks_size * sizeof(*blocks));
+        if (blocks == NULL) {
+            return false;
+        }
+
+        memset(blocks + file->blocks_size, 0, (blocks_size - file->blocks_size) * sizeof(*blocks));
+        file->blocks = blocks;
+        file->blocks_size = blocks_size;
+    }
+
+    while (len > 0) {
+        index = offset / MYFS_FILE_BLOCK_SIZE;
+        block_offset = offset % MYFS_FILE_BLOCK_SIZE;
+        length = MYFS_FILE_BLOCK_SIZE - block_offset;
+        if (length > len) {
+            length = len;
+        }
+
+        //New blocks start as zeros, so gaps before `offset` read as zeros.
+        if (file->blocks[index] == NULL) {
+            file->blocks[index] = calloc(1, MYFS_FILE_BLOCK_SIZE);
+            if (file->blocks[index] == NULL) {
+                return false;
+            }
+        }
+
+        memcpy(file->blocks[index] + block_offset, data, length);
+
+        data += length;
+        offset += length;
+        len -= length;
+    }
+
+    if (end > file->size) {
+        mem.bytes_count += end - file->size;
+        file->size = end;
+    }
+    file->version++;
+
+    //With the writeback cache, the kernel owns the modified time and sends it with setattr.
+    if (!myfs->writeback_cache) {
+        file->last_modified_on = time(NULL);
+    }
+
+    return true;
+}
+
+unsigned int
+myfs_mem_file_create(myfs_t *myfs, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode) {
+    myfs_mem_file_t *parent, *file = NULL;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    switch (type) {
+        case MYFS_FILE_TYPE_FILE:
+            mode |= S_IFREG;
+            break;
+        case MYFS_FILE_TYPE_DIRECTORY:
+            mode |= S_IFDIR;
+            break;
+        case MYFS_FILE_TYPE_SOFT_LINK:
+            mode |= S_IFLNK;
+            break;
+        case MYFS_FILE_TYPE_INVALID:
+            break;
+    }
+
+    if (strlen(name) > MYFS_FILE_NAME_MAX_LEN) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Name is too long", name, parent_id);
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    parent = myfs_mem_file_get(parent_id);
+    if (parent == NULL || parent->type != MYFS_FILE_TYPE_DIRECTORY) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Parent not found", name, parent_id);
+    }
+    else if (myfs_mem_file_get_name(parent_id, name) != NULL) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: File exists", name, parent_id);
+    }
+    else {
+        file = myfs_mem_file_new(myfs, name, type, parent_id, mode);
+        if (file == NULL) {
+            log_err(MODULE, "Error creating file '%s' with Parent ID %u: Out of memory", name, parent_id);
+        }
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    return file != NULL ? file->file_id : 0;
+}
+
+bool
+myfs_mem_file_delete(myfs_t *myfs, unsigned int file_id) {
+    myfs_mem_file_t *file;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+
+    //The root is protected, like it is by `file_protection`.
+    if (file != NULL && file_id != 0) {
+        myfs_mem_file_remove(file);
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (file == NULL || file_id == 0) {
+        log_err(MODULE, "Error deleting File ID %u: %s", file_id, file == NULL ? "Not found" : "The root can't be deleted");
+        return false;
+    }
+
+    return true;
+}
+
+bool
+myfs_mem_file_write(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version) {
+    myfs_mem_file_t *file;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, offset, len);
+
+    metrics_stat_add(METRICS_STAT_BYTES, len);
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    if (file != NULL) {
+        success = myfs_mem_file_write_blocks(myfs, file, data, len, offset);
+        if (success && size != NULL) {
+            *size = file->size;
+        }
+        if (success && version != NULL) {
+            *version = file->version;
+        }
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (!success) {
+        log_err(MODULE, "Error writing data for File ID %u: %s", file_id, file == NULL ? "Not found" : "Out of memory");
+    }
+
+    return success;
+}
+
+bool
+myfs_mem_file_append(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t *size, uint64_t *version) {
+    myfs_mem_file_t *file;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, len);
+
+    metrics_stat_add(METRICS_STAT_BYTES, len);
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    if (file != NULL) {
+        success = myfs_mem_file_write_blocks(myfs, file, data, len, file->size);
+        if (success && size != NULL) {
+            *size = file->size;
+        }
+        if (success && version != NULL) {
+            *version = file->version;
+        }
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (!success) {
+        log_err(MODULE, "Error appending data for File ID %u: %s", file_id, file == NULL ? "Not found" : "Out of memory");
+    }
+
+    return success;
+}
+
+bool
+myfs_mem_file_set_times(myfs_t *myfs, unsigned int file_id, const time_t *last_accessed_on, const time_t *last_modified_on) {
+    myfs_mem_file_t *file;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    if (file != NULL) {
+        if (last_accessed_on != NULL) {
+            file->last_accessed_on = *last_accessed_on;
+        }
+        if (last_modified_on != NULL) {
+            file->last_modified_on = *last_modified_on;
+        }
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (file == NULL) {
+        log_err(MODULE, "Error updating times for File ID %u: Not found", file_id);
+    }
+
+    return file != NULL;
+}
+
+bool
+myfs_mem_file_chown(myfs_t *myfs, unsigned int file_id, const char *user, uid_t uid, const char *group, gid_t gid) {
+    myfs_mem_file_t *file;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    if ((user == NULL || user[0] == '\0') && (group == NULL || group[0] == '\0')) {
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    if (file != NULL) {
+        if (user != NULL && user[0] != '\0') {
+            file->uid = uid;
+        }
+        if (group != NULL && group[0] != '\0') {
+            file->gid = gid;
+        }
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (file == NULL) {
+        log_err(MODULE, "Error setting user[%s] and group[%s] on File ID %u: Not found", user, group, file_id);
+    }
+
+    return file != NULL;
+}
+
+bool
+myfs_mem_file_chmod(myfs_t *myfs, unsigned int file_id, mode_t mode) {
+    myfs_mem_file_t *file;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    if (file != NULL) {
+        file->mode = mode;
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (file == NULL) {
+        log_err(MODULE, "Error setting mode[%u] on File ID %u: Not found", mode, file_id);
+    }
+
+    return file != NULL;
+}
+
+bool
+myfs_mem_file_swap(myfs_t *myfs, myfs_file_t *file1, myfs_file_t *file2) {
+    myfs_mem_file_t *mem_file1, *mem_file2;
+    unsigned int parent1_id = 0, parent2_id = 0;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file1->file_id, 0, 0);
+
+    if (file1->parent != NULL) {
+        parent1_id = file1->parent->file_id;
+    }
+    if (file2->parent != NULL) {
+        parent2_id = file2->parent->file_id;
+    }
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    mem_file1 = myfs_mem_file_get(file1->file_id);
+    mem_file2 = myfs_mem_file_get(file2->file_id);
+
+    //Swap the parents, the same as `myfs_db_file_swap()`. Both moves have to fit or neither is made.
+    if (mem_file1 != NULL && mem_file2 != NULL &&
+        (parent1_id == parent2_id || (myfs_mem_file_get_name(parent2_id, mem_file1->name) == NULL && myfs_mem_file_get_name(parent1_id, mem_file2->name) == NULL))) {
+        myfs_mem_file_unlink(mem_file1);
+        myfs_mem_file_unlink(mem_file2);
+        mem_file1->parent_id = parent2_id;
+        mem_file2->parent_id = parent1_id;
+        myfs_mem_file_link(mem_file1);
+        myfs_mem_file_link(mem_file2);
+        success = true;
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (!success) {
+        log_err(MODULE, "Error swaping file File ID %u with File ID %u", file1->file_id, file2->file_id);
+    }
+
+    return success;
+}
+
+bool
+myfs_mem_file_rename(myfs_t *myfs, unsigned int file_id, unsigned int parent_id, const char *name) {
+    myfs_mem_file_t *file, *parent;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    if (strlen(name) > MYFS_FILE_NAME_MAX_LEN) {
+        log_err(MODULE, "Error updating Parent ID for File ID %u: Name is too long", file_id);
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    parent = myfs_mem_file_get(parent_id);
+
+    if (file != NULL && file_id != 0 && parent != NULL && parent->type == MYFS_FILE_TYPE_DIRECTORY && myfs_mem_file_get_name(parent_id, name) == NULL) {
+        myfs_mem_file_unlink(file);
+        file->parent_id = parent_id;
+        strlcpy(file->name, name, sizeof(file->name));
+        myfs_mem_file_link(file);
+        success = true;
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (!success) {
+        log_err(MODULE, "Error updating Parent ID for File ID %u: Not found or the name is taken", file_id);
+    }
+
+    return success;
+}
+
+ssize_t
+myfs_mem_file_read(myfs_t *myfs, unsigned int file_id, char *buf, size_t size, off_t offset) {
+    myfs_mem_file_t *file;
+    size_t index, block_offset, length, count = 0;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, offset, size);
+
+    pthread_rwlock_rdlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    if (file == NULL) {
+        pthread_rwlock_unlock(&mem.lock);
+        log_err(MODULE, "Error reading data for File ID %u: Not found", file_id);
+        return -1;
+    }
+
+    if (offset < file->size && (off_t)(offset + size) > file->size) {
+        size = file->size - offset;
+    }
+
+    while (count < size && offset < file->size) {
+        index = offset / MYFS_FILE_BLOCK_SIZE;
+        block_offset = offset % MYFS_FILE_BLOCK_SIZE;
+        length = MYFS_FILE_BLOCK_SIZE - block_offset;
+        if (length > size - count) {
+            length = size - count;
+        }
+
+        if (index < file->blocks_size && file->blocks[index] != NULL) {
+            memcpy(buf + count, file->blocks[index] + block_offset, length);
+        }
+        else {
+            memset(buf + count, 0, length);
+        }
+
+        count += length;
+        offset += length;
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    metrics_stat_add(METRICS_STAT_BYTES, count);
+
+    return count;
+}
+
+bool
+myfs_mem_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size, uint64_t *version) {
+    myfs_mem_file_t *file;
+    size_t index, block_offset;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, size, 0);
+
+    pthread_rwlock_wrlock(&mem.lock);
+
+    file = myfs_mem_file_get(file_id);
+    if (file != NULL && size < file->size) {
+        index = size / MYFS_FILE_BLOCK_SIZE;
+        block_offset = size % MYFS_FILE_BLOCK_SIZE;
+
+        //Zero what's left past the end of the last block so growing the file again reads zeros.
+        if (block_offset > 0 && index < file->blocks_size && file->blocks[index] != NULL) {
+            memset(file->blocks[index] + block_offset, 0, MYFS_FILE_BLOCK_SIZE - block_offset);
+            index++;
+        }
+
+        myfs_mem_blocks_free(file, index);
+    }
+
+    //Growing only moves the size. The new blocks aren't allocated, so they read as zeros.
+    if (file != NULL && size != file->size) {
+        mem.bytes_count += size - file->size;
+        file->size = size;
+        file->version++;
+        if (!myfs->writeback_cache) {
+            file->last_modified_on = time(NULL);
+        }
+    }
+    if (file != NULL && version != NULL) {
+        *version = file->version;
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (file == NULL) {
+        log_err(MODULE, "Error truncating File ID %u: Not found", file_id);
+    }
+
+    return file != NULL;
+}
+
+myfs_file_t *
+myfs_mem_file_query(myfs_t *myfs, unsigned int file_id, bool include_children) {
+    myfs_mem_file_t *mem_file;
+    myfs_file_t *file = NULL;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_rwlock_rdlock(&mem.lock);
+
+    mem_file = myfs_mem_file_get(file_id);
+    if (mem_file != NULL) {
+        file = myfs_mem_file_build_all(mem_file, include_children);
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    if (file == NULL) {
+        log_err(MODULE, "Error getting file with File ID %u: Not found", file_id);
+    }
+
+    return file;
+}
+
+myfs_file_t *
+myfs_mem_file_query_name(myfs_t *myfs, const char *name, unsigned int parent_id, bool include_children) {
+    myfs_mem_file_t *mem_file;
+    myfs_file_t *file = NULL;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    pthread_rwlock_rdlock(&mem.lock);
+
+    //The root is found with no name, the same as in `files`.
+    mem_file = myfs_mem_file_get_name(parent_id, name == NULL ? "" : name);
+    if (mem_file != NULL) {
+        file = myfs_mem_file_build_all(mem_file, include_children);
+    }
+
+    pthread_rwlock_unlock(&mem.lock);
+
+    return file;
+}
+
+bool
+myfs_mem_get_stats(myfs_t *myfs, uint64_t *files, uint64_t *bytes) {
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    pthread_rwlock_rdlock(&mem.lock);
+    *files = mem.files_count;
+    *bytes = mem.bytes_count;
+    pthread_rwlock_unlock(&mem.lock);
+
+    return true;
+}
+
+/**
+ * Sets up an empty file system with only the root directory in it.
+ */
+static bool
+myfs_mem_connect(myfs_t *myfs) {
+    memset(&mem, 0, sizeof(mem));
+    pthread_rwlock_init(&mem.lock, NULL);
+
+    mem.names_size = MYFS_MEM_NAMES_SIZE;
+    mem.names = calloc(mem.names_size, sizeof(*mem.names));
+    if (mem.names == NULL) {
+        log_err(MODULE, "Error creating the file system: Out of memory");
+        return false;
+    }
+
+    //The root is File ID 0, made the same way `create` inserts it.
+    if (myfs_mem_file_new(myfs, "", MYFS_FILE_TYPE_DIRECTORY, 0, S_IFDIR | 0775) == NULL) {
+        log_err(MODULE, "Error creating the root directory: Out of memory");
+        return false;
+    }
+
+    //There are no packets to fit in, so ask FUSE for the largest requests.
+    myfs->request_size = MYFS_REQUEST_SIZE_MAX;
+    myfs->blocks_per_insert = MYFS_INSERT_BLOCKS_MAX;
+
+    log_warn(MODULE, "Files are only kept in memory and will be lost when MyFS exits");
+
+    return true;
+}
+
+static void
+myfs_mem_disconnect(myfs_t *myfs) {
+    unsigned int i;
+
+    for (i = 0; i < mem.files_next; i++) {
+        if (mem.files[i] != NULL) {
+            myfs_mem_blocks_free(mem.files[i], 0);
+            free(mem.files[i]->blocks);
+            free(mem.files[i]);
+        }
+    }
+
+    free(mem.files);
+    free(mem.names);
+    pthread_rwlock_destroy(&mem.lock);
+    memset(&mem, 0, sizeof(mem));
+}
+
+const myfs_backend_t myfs_mem_backend = {
+    .name = "memory",
+    .connect = myfs_mem_connect,
+    .disconnect = myfs_mem_disconnect,
+    .file_create = myfs_mem_file_create,
+    .file_delete = myfs_mem_file_delete,
+    .file_write = myfs_mem_file_write,
+    .file_append = myfs_mem_file_append,
+    .file_set_times = myfs_mem_file_set_times,
+    .file_chown = myfs_mem_file_chown,
+    .file_chmod = myfs_mem_file_chmod,
+    .file_swap = myfs_mem_file_swap,
+    .file_rename = myfs_mem_file_rename,
+    .file_read = myfs_mem_file_read,
+    .file_truncate = myfs_mem_file_truncate,
+    .file_query = myfs_mem_file_query,
+    .file_query_name = myfs_mem_file_query_name,
+    .get_stats = myfs_mem_get_stats
+};
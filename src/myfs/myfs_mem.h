@@ -0,0 +1,13 @@
+#pragma once
+
+/**
+ * @file myfs_mem.h
+ *
+ * The in-memory backend. Files and their data blocks are kept in this process only and are gone when MyFS
+ * exits. It's meant for benchmarking and profiling MyFS itself without a database in the way.
+ */
+
+#include "myfs_backend.h"
+
+/** The in-memory backend. */
+extern const myfs_backend_t myfs_mem_backend;
@@ -0,0 +1,1405 @@
+/**
+ * @file myfs_sqlite.c
+ *
+ * The tables are the same as the ones `create` makes in MariaDB, and data is kept in the same contiguous
+ * MYFS_FILE_BLOCK_SIZE blocks, so the same operations happen in the same order.
+ *
+ * Changes are made on one connection under a mutex, since a transaction belongs to a connection. Lookups
+ * and reads each use a read only connection of their own thread; in WAL mode they read the last commit
+ * without waiting on the writer, and with `mmap_size` they read pages straight from the file's mapping.
+ * Every statement is prepared once per connection and reset between uses.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include "../common/log.h"
+#include "../common/config.h"
+#include "../common/string.h"
+#include "../common/metrics.h"
+#include "../common/trace.h"
+#include "myfs_db.h"
+#include "myfs_sqlite.h"
+
+#define MODULE "MyFS SQLite"
+
+/** The number of milliseconds to wait for another process holding the database before giving up. */
+#define MYFS_SQLITE_BUSY_TIMEOUT 5000
+
+/** The number of bytes of the database to memory map for reads. */
+#define MYFS_SQLITE_MMAP_SIZE (256LL * 1024 * 1024)
+
+/**
+ * The statements that are prepared on each connection.
+ */
+typedef enum {
+    MYFS_SQLITE_STMT_FILE_INSERT = 0,
+    MYFS_SQLITE_STMT_FILE_SIZE,
+    MYFS_SQLITE_STMT_FILE_DELETE,
+    MYFS_SQLITE_STMT_FILE_SET_SIZE,
+    MYFS_SQLITE_STMT_FILE_SET_TIMES,
+    MYFS_SQLITE_STMT_FILE_CHOWN,
+    MYFS_SQLITE_STMT_FILE_CHMOD,
+    MYFS_SQLITE_STMT_FILE_SET_PARENT,
+    MYFS_SQLITE_STMT_FILE_RENAME,
+    MYFS_SQLITE_STMT_FILE_GET,
+    MYFS_SQLITE_STMT_FILE_GET_NAME,
+    MYFS_SQLITE_STMT_FILE_CHILDREN,
+    MYFS_SQLITE_STMT_BLOCK_GET,
+    MYFS_SQLITE_STMT_BLOCK_PUT,
+    MYFS_SQLITE_STMT_BLOCK_SHRINK,
+    MYFS_SQLITE_STMT_BLOCKS_GET,
+    MYFS_SQLITE_STMT_BLOCKS_DELETE,
+    MYFS_SQLITE_STMT_STATS_ADD,
+    MYFS_SQLITE_STMT_STATS_GET,
+    MYFS_SQLITE_STMT_MAX
+} myfs_sqlite_stmt_t;
+
+/** The SQL of each statement, indexed by `myfs_sqlite_stmt_t`. SQLite accepts MariaDB's backtick quotes. */
+static const char *myfs_sqlite_sql[MYFS_SQLITE_STMT_MAX] = {
+    [MYFS_SQLITE_STMT_FILE_INSERT] = "INSERT INTO `files` (`parent_id`,`name`,`type`,`user`,`group`,`uid`,`gid`,`mode`,`size`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\n"
+                                     "VALUES (?1,?2,?3,?4,?5,?6,?7,?8,0,?9,?9,?9,?9)",
+    [MYFS_SQLITE_STMT_FILE_SIZE] = "SELECT `size`,`version` FROM `files` WHERE `file_id`=?",
+    [MYFS_SQLITE_STMT_FILE_DELETE] = "DELETE FROM `files` WHERE `file_id`=?",
+    [MYFS_SQLITE_STMT_FILE_SET_SIZE] = "UPDATE `files` SET `size`=?1,`version`=`version`+1,`last_modified_on`=COALESCE(?2,`last_modified_on`) WHERE `file_id`=?3",
+    [MYFS_SQLITE_STMT_FILE_SET_TIMES] = "UPDATE `files` SET `last_accessed_on`=COALESCE(?1,`last_accessed_on`),`last_modified_on`=COALESCE(?2,`last_modified_on`) WHERE `file_id`=?3",
+    [MYFS_SQLITE_STMT_FILE_CHOWN] = "UPDATE `files` SET `user`=COALESCE(?1,`user`),`uid`=COALESCE(?2,`uid`),`group`=COALESCE(?3,`group`),`gid`=COALESCE(?4,`gid`) WHERE `file_id`=?5",
+    [MYFS_SQLITE_STMT_FILE_CHMOD] = "UPDATE `files` SET `mode`=? WHERE `file_id`=?",
+    [MYFS_SQLITE_STMT_FILE_SET_PARENT] = "UPDATE `files` SET `parent_id`=? WHERE `file_id`=?",
+    [MYFS_SQLITE_STMT_FILE_RENAME] = "UPDATE `files` SET `parent_id`=?,`name`=? WHERE `file_id`=?",
+    [MYFS_SQLITE_STMT_FILE_GET] = "SELECT " MYFS_DB_FILE_COLUMNS " FROM `files` WHERE `file_id`=?",
+    [MYFS_SQLITE_STMT_FILE_GET_NAME] = "SELECT `file_id` FROM `files` WHERE `parent_id`=? AND `name`=?",
+    [MYFS_SQLITE_STMT_FILE_CHILDREN] = "SELECT " MYFS_DB_FILE_COLUMNS " FROM `files` WHERE `parent_id`=? AND `file_id`!=0 ORDER BY `name` ASC",
+    [MYFS_SQLITE_STMT_BLOCK_GET] = "SELECT `data` FROM `file_data` WHERE `file_id`=? AND `index`=?",
+    [MYFS_SQLITE_STMT_BLOCK_PUT] = "INSERT INTO `file_data` (`file_id`,`index`,`data`) VALUES (?,?,?)\n"
+                                   "ON CONFLICT (`file_id`,`index`) DO UPDATE SET `data`=excluded.`data`",
+    [MYFS_SQLITE_STMT_BLOCK_SHRINK] = "UPDATE `file_data` SET `data`=SUBSTR(`data`,1,?) WHERE `file_id`=? AND `index`=?",
+    [MYFS_SQLITE_STMT_BLOCKS_GET] = "SELECT `data` FROM `file_data` WHERE `file_id`=? AND `index`>=? ORDER BY `index` ASC LIMIT ?",
+    [MYFS_SQLITE_STMT_BLOCKS_DELETE] = "DELETE FROM `file_data` WHERE `file_id`=? AND `index`>=?",
+    [MYFS_SQLITE_STMT_STATS_ADD] = "UPDATE `fs_stats` SET `files`=`files`+?,`bytes`=`bytes`+? WHERE `shard`=0",
+    [MYFS_SQLITE_STMT_STATS_GET] = "SELECT COALESCE(SUM(`files`),0),COALESCE(SUM(`bytes`),0) FROM `fs_stats`"
+};
+
+/** The schema, the same as `create` makes in MariaDB. Run once when the database is opened. */
+static const char *myfs_sqlite_schema =
+    "CREATE TABLE IF NOT EXISTS `files` (\n"
+    "    `file_id` INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+    "    `parent_id` INTEGER NOT NULL REFERENCES `files` (`file_id`) ON DELETE CASCADE ON UPDATE CASCADE,\n"
+    "    `name` TEXT NOT NULL,\n"
+    "    `type` TEXT NOT NULL CHECK (`type` IN ('File','Directory','Soft Link')),\n"
+    "    `user` TEXT NOT NULL,\n"
+    "    `group` TEXT NOT NULL,\n"
+    "    `uid` INTEGER DEFAULT NULL,\n"
+    "    `gid` INTEGER DEFAULT NULL,\n"
+    "    `mode` INTEGER NOT NULL,\n"
+    "    `size` INTEGER NOT NULL,\n"
+    "    `version` INTEGER NOT NULL DEFAULT 0,\n"
+    "    `created_on` INTEGER NOT NULL,\n"
+    "    `last_accessed_on` INTEGER NOT NULL,\n"
+    "    `last_modified_on` INTEGER NOT NULL,\n"
+    "    `last_status_changed_on` INTEGER NOT NULL,\n"
+    "    UNIQUE (`parent_id`,`name`)\n"
+    ");\n"
+    "CREATE TABLE IF NOT EXISTS `file_data` (\n"
+    "    `file_data_id` INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+    "    `file_id` INTEGER NOT NULL REFERENCES `files` (`file_id`) ON DELETE CASCADE ON UPDATE CASCADE,\n"
+    "    `index` INTEGER NOT NULL,\n"
+    "    `data` BLOB NOT NULL,\n"
+    "    UNIQUE (`file_id`,`index`)\n"
+    ");\n"
+    "CREATE TABLE IF NOT EXISTS `file_protection` (\n"
+    "    `file_id` INTEGER PRIMARY KEY REFERENCES `files` (`file_id`) ON UPDATE CASCADE\n"
+    ");\n"
+    "CREATE TABLE IF NOT EXISTS `fs_stats` (\n"
+    "    `shard` INTEGER PRIMARY KEY,\n"
+    "    `files` INTEGER NOT NULL,\n"
+    "    `bytes` INTEGER NOT NULL\n"
+    ");";
+
+typedef struct myfs_sqlite_conn_t myfs_sqlite_conn_t;
+
+/**
+ * A connection to the database and the statements prepared on it.
+ */
+struct myfs_sqlite_conn_t {
+    sqlite3 *handle;                                    //!< The SQLite connection.
+    sqlite3_stmt *stmts[MYFS_SQLITE_STMT_MAX];          //!< Prepared statements, indexed by `myfs_sqlite_stmt_t`. `NULL` until first used.
+    myfs_sqlite_conn_t *next;                           //!< The next read connection.
+};
+
+typedef struct {
+    char path[PATH_MAX];                //!< The database file.
+    myfs_sqlite_conn_t *writer;         //!< The connection every change is made on.
+    pthread_mutex_t writer_lock;        //!< Held for the whole of a change, including its transaction.
+    pthread_key_t reader_key;           //!< Each thread's read connection.
+    myfs_sqlite_conn_t *readers;        //!< Every read connection, so they can be closed on disconnect.
+    pthread_mutex_t readers_lock;       //!< Protects `readers`.
+} myfs_sqlite_t;
+
+static myfs_sqlite_t sqlite;
+
+/**
+ * Opens a connection to the database.
+ *
+ * @param[in] read_only Whether the connection is only used for reads.
+ * @return The connection, or `NULL` on failure.
+ */
+static myfs_sqlite_conn_t *
+myfs_sqlite_conn_open(bool read_only) {
+    myfs_sqlite_conn_t *conn;
+    char sql[128];
+    int flags, ret;
+
+    conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        log_err(MODULE, "Error opening '%s': Out of memory", sqlite.path);
+        return NULL;
+    }
+
+    //Connections are never shared between threads at the same time, so SQLite's own mutexes aren't needed.
+    flags = SQLITE_OPEN_NOMUTEX | (read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+
+    ret = sqlite3_open_v2(sqlite.path, &conn->handle, flags, NULL);
+    if (ret != SQLITE_OK) {
+        log_err(MODULE, "Error opening '%s': %s", sqlite.path, conn->handle == NULL ? sqlite3_errstr(ret) : sqlite3_errmsg(conn->handle));
+        goto fail;
+    }
+
+    sqlite3_busy_timeout(conn->handle, MYFS_SQLITE_BUSY_TIMEOUT);
+
+    snprintf(sql, sizeof(sql), "PRAGMA foreign_keys=ON;PRAGMA mmap_size=%lld;", MYFS_SQLITE_MMAP_SIZE);
+    ret = sqlite3_exec(conn->handle, sql, NULL, NULL, NULL);
+    if (ret != SQLITE_OK) {
+        log_err(MODULE, "Error setting up '%s': %s", sqlite.path, sqlite3_errmsg(conn->handle));
+        goto fail;
+    }
+
+    return conn;
+
+fail:
+    sqlite3_close(conn->handle);
+    free(conn);
+
+    return NULL;
+}
+
+/**
+ * Closes a connection and its statements.
+ */
+static void
+myfs_sqlite_conn_close(myfs_sqlite_conn_t *conn) {
+    unsigned int i;
+
+    for (i = 0; i < MYFS_SQLITE_STMT_MAX; i++) {
+        sqlite3_finalize(conn->stmts[i]);
+    }
+
+    sqlite3_close(conn->handle);
+    free(conn);
+}
+
+/**
+ * Closes a thread's read connection when the thread exits.
+ */
+static void
+myfs_sqlite_reader_free(void *arg) {
+    myfs_sqlite_conn_t *conn = arg, **link;
+
+    pthread_mutex_lock(&sqlite.readers_lock);
+    for (link = &sqlite.readers; *link != NULL; link = &(*link)->next) {
+        if (*link == conn) {
+            *link = conn->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sqlite.readers_lock);
+
+    myfs_sqlite_conn_close(conn);
+}
+
+/**
+ * Gets the calling thread's read connection, opening it the first time.
+ *
+ * @return The connection, or `NULL` if it couldn't be opened.
+ */
+static myfs_sqlite_conn_t *
+myfs_sqlite_reader() {
+    myfs_sqlite_conn_t *conn;
+
+    conn = pthread_getspecific(sqlite.reader_key);
+    if (conn != NULL) {
+        return conn;
+    }
+
+    conn = myfs_sqlite_conn_open(true);
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sqlite.readers_lock);
+    conn->next = sqlite.readers;
+    sqlite.readers = conn;
+    pthread_mutex_unlock(&sqlite.readers_lock);
+
+    pthread_setspecific(sqlite.reader_key, conn);
+
+    return conn;
+}
+
+/**
+ * Gets a statement on a connection, preparing it the first time. The statement is reset and its
+ * parameters cleared, so it's ready to bind. Call `sqlite3_reset()` when done with it so readers don't
+ * hold on to an old snapshot.
+ *
+ * @param[in] conn The connection.
+ * @param[in] stmt The statement.
+ * @return The statement, or `NULL` if it couldn't be prepared.
+ */
+static sqlite3_stmt *
+myfs_sqlite_stmt(myfs_sqlite_conn_t *conn, myfs_sqlite_stmt_t stmt) {
+    int ret;
+
+    if (conn->stmts[stmt] == NULL) {
+        ret = sqlite3_prepare_v3(conn->handle, myfs_sqlite_sql[stmt], -1, SQLITE_PREPARE_PERSISTENT, &conn->stmts[stmt], NULL);
+        if (ret != SQLITE_OK) {
+            log_err(MODULE, "Error preparing statement: %s: %s", sqlite3_errmsg(conn->handle), myfs_sqlite_sql[stmt]);
+            return NULL;
+        }
+    }
+    else {
+        sqlite3_reset(conn->stmts[stmt]);
+        sqlite3_clear_bindings(conn->stmts[stmt]);
+    }
+
+    metrics_stat_add(METRICS_STAT_QUERIES, 1);
+
+    return conn->stmts[stmt];
+}
+
+/**
+ * Runs a statement that returns no rows and resets it.
+ *
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_sqlite_exec(sqlite3_stmt *stmt) {
+    int ret;
+
+    ret = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if (ret == SQLITE_DONE) {
+        metrics_stat_add(METRICS_STAT_ROWS, sqlite3_changes(sqlite3_db_handle(stmt)));
+    }
+
+    return ret == SQLITE_DONE;
+}
+
+static bool
+myfs_sqlite_transaction_start(myfs_sqlite_conn_t *conn) {
+    //IMMEDIATE takes the write lock up front, like the `FOR UPDATE` reads in MariaDB.
+    return sqlite3_exec(conn->handle, "BEGIN IMMEDIATE", NULL, NULL, NULL) == SQLITE_OK;
+}
+
+static bool
+myfs_sqlite_transaction_stop(myfs_sqlite_conn_t *conn, bool commit) {
+    if (commit && sqlite3_exec(conn->handle, "COMMIT", NULL, NULL, NULL) == SQLITE_OK) {
+        return true;
+    }
+
+    if (commit) {
+        log_err(MODULE, "Error committing transaction: %s", sqlite3_errmsg(conn->handle));
+    }
+
+    sqlite3_exec(conn->handle, "ROLLBACK", NULL, NULL, NULL);
+
+    return false;
+}
+
+/**
+ * Gets a file's size and version.
+ *
+ * @return The size, or -1 if the file wasn't found or on an error.
+ */
+static off_t
+myfs_sqlite_file_size(myfs_sqlite_conn_t *conn, unsigned int file_id, uint64_t *version) {
+    sqlite3_stmt *stmt;
+    off_t size = -1;
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_SIZE);
+    if (stmt == NULL) {
+        return -1;
+    }
+
+    sqlite3_bind_int64(stmt, 1, file_id);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        size = sqlite3_column_int64(stmt, 0);
+        *version = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_reset(stmt);
+
+    return size;
+}
+
+/**
+ * Sets a file's size and, unless the kernel's writeback cache owns it, its modified time. The file's version
+ * goes up by one.
+ */
+static bool
+myfs_sqlite_file_set_size(myfs_t *myfs, myfs_sqlite_conn_t *conn, unsigned int file_id, off_t size) {
+    sqlite3_stmt *stmt;
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_SET_SIZE);
+    if (stmt == NULL) {
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, size);
+    if (!myfs->writeback_cache) {
+        sqlite3_bind_int64(stmt, 2, time(NULL));
+    }
+    sqlite3_bind_int64(stmt, 3, file_id);
+
+    return myfs_sqlite_exec(stmt);
+}
+
+/**
+ * Adds to the file and byte counts in `fs_stats`. This must be called inside of the transaction making
+ * the change. There's only one writer, so there's only one row.
+ */
+static bool
+myfs_sqlite_stats_add(myfs_sqlite_conn_t *conn, long long files, long long bytes) {
+    sqlite3_stmt *stmt;
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_STATS_ADD);
+    if (stmt == NULL) {
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, files);
+    sqlite3_bind_int64(stmt, 2, bytes);
+
+    return myfs_sqlite_exec(stmt);
+}
+
+/**
+ * Writes data into a file's blocks, reading a block first only when part of it is kept. The blocks must
+ * already reach `offset`, so a hole past the end is filled by first writing zeros from the end of the file.
+ * This must be called inside of a transaction.
+ *
+ * @param[in] conn The write connection.
+ * @param[in] file_id The File ID of the file to write to.
+ * @param[in] data The data to write, or `NULL` to write zeros.
+ * @param[in] len The length to write.
+ * @param[in] offset Where to start writing. Must not be past `size`.
+ * @param[in] size The file's size before the write.
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_sqlite_file_write_blocks(myfs_sqlite_conn_t *conn, unsigned int file_id, const char *data, size_t len, off_t offset, off_t size) {
+    size_t index, block_offset, block_len, existing, write_size;
+    char block[MYFS_FILE_BLOCK_SIZE];
+    sqlite3_stmt *stmt;
+    const void *blob;
+    int blob_len;
+
+    while (len > 0) {
+        index = offset / MYFS_FILE_BLOCK_SIZE;
+        block_offset = offset % MYFS_FILE_BLOCK_SIZE;
+        write_size = MYFS_FILE_BLOCK_SIZE - block_offset;
+        if (write_size > len) {
+            write_size = len;
+        }
+
+        //Blocks are contiguous, so the file's size tells how much of this block already exists.
+        existing = 0;
+        if ((off_t)index * MYFS_FILE_BLOCK_SIZE < size) {
+            existing = size - (off_t)index * MYFS_FILE_BLOCK_SIZE;
+            if (existing > MYFS_FILE_BLOCK_SIZE) {
+                existing = MYFS_FILE_BLOCK_SIZE;
+            }
+        }
+
+        block_len = block_offset + write_size;
+        if (block_len < existing) {
+            block_len = existing;
+        }
+
+        //Only read the block if some of it is being kept.
+        memset(block, 0, block_len);
+        if (write_size < block_len && existing > 0) {
+            stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_BLOCK_GET);
+            if (stmt == NULL) {
+                return false;
+            }
+
+            sqlite3_bind_int64(stmt, 1, file_id);
+            sqlite3_bind_int64(stmt, 2, index);
+
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                blob = sqlite3_column_blob(stmt, 0);
+                blob_len = sqlite3_column_bytes(stmt, 0);
+                if (blob_len > MYFS_FILE_BLOCK_SIZE) {
+                    blob_len = MYFS_FILE_BLOCK_SIZE;
+                }
+                memcpy(block, blob, blob_len);
+            }
+            sqlite3_reset(stmt);
+        }
+
+        if (data != NULL) {
+            memcpy(block + block_offset, data, write_size);
+            data += write_size;
+        }
+
+        stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_BLOCK_PUT);
+        if (stmt == NULL) {
+            return false;
+        }
+
+        sqlite3_bind_int64(stmt, 1, file_id);
+        sqlite3_bind_int64(stmt, 2, index);
+        sqlite3_bind_blob(stmt, 3, block, block_len, SQLITE_STATIC);
+
+        if (!myfs_sqlite_exec(stmt)) {
+            log_err(MODULE, "Error writing data for File ID %u: Failed writing block %zu: %s", file_id, index, sqlite3_errmsg(conn->handle));
+            return false;
+        }
+
+        offset += write_size;
+        len -= write_size;
+        if (offset > size) {
+            size = offset;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes data at an offset, or at the end of the file if `offset` is negative, the same way as
+ * `myfs_db_file_write()` and `myfs_db_file_append()`.
+ */
+static bool
+myfs_sqlite_file_write_at(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version) {
+    myfs_sqlite_conn_t *conn = sqlite.writer;
+    off_t current_size, new_size = 0;
+    uint64_t current_version = 0;
+    bool success;
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    success = myfs_sqlite_transaction_start(conn);
+    if (!success) {
+        log_err(MODULE, "Error writing data for File ID %u: Failed to start transaction: %s", file_id, sqlite3_errmsg(conn->handle));
+        goto unlock;
+    }
+
+    current_size = myfs_sqlite_file_size(conn, file_id, &current_version);
+    if (current_size == -1) {
+        log_err(MODULE, "Error writing data for File ID %u: Not found", file_id);
+        success = false;
+        goto done;
+    }
+
+    if (offset < 0) {
+        offset = current_size;
+    }
+
+    //Fill a hole past the end of the file with zeros so the blocks stay contiguous.
+    if (offset > current_size) {
+        success = myfs_sqlite_file_write_blocks(conn, file_id, NULL, offset - current_size, current_size, current_size);
+        if (!success) {
+            goto done;
+        }
+    }
+
+    success = myfs_sqlite_file_write_blocks(conn, file_id, data, len, offset, offset > current_size ? offset : current_size);
+    if (!success) {
+        goto done;
+    }
+
+    new_size = current_size;
+    if (offset + (off_t)len > new_size) {
+        new_size = offset + len;
+    }
+
+    success = myfs_sqlite_file_set_size(myfs, conn, file_id, new_size);
+    if (!success) {
+        log_err(MODULE, "Error writing data for File ID %u: Failed updating file size: %s", file_id, sqlite3_errmsg(conn->handle));
+        goto done;
+    }
+
+    if (new_size != current_size) {
+        success = myfs_sqlite_stats_add(conn, 0, new_size - current_size);
+        if (!success) {
+            log_err(MODULE, "Error updating file system stats for File ID %u: %s", file_id, sqlite3_errmsg(conn->handle));
+        }
+    }
+
+done:
+    success = myfs_sqlite_transaction_stop(conn, success);
+
+unlock:
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    if (success) {
+        metrics_stat_add(METRICS_STAT_BYTES, len);
+        if (size != NULL) {
+            *size = new_size;
+        }
+        //Changes are made one at a time under the writer lock, so nothing else moved the version.
+        if (version != NULL) {
+            *version = current_version + 1;
+        }
+    }
+
+    return success;
+}
+
+unsigned int
+myfs_sqlite_file_create(myfs_t *myfs, const char *name, myfs_file_type_t type, unsigned int parent_id, mode_t mode) {
+    myfs_sqlite_conn_t *conn = sqlite.writer;
+    unsigned int file_id = 0;
+    sqlite3_stmt *stmt;
+    bool success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    switch (type) {
+        case MYFS_FILE_TYPE_FILE:
+            mode |= S_IFREG;
+            break;
+        case MYFS_FILE_TYPE_DIRECTORY:
+            mode |= S_IFDIR;
+            break;
+        case MYFS_FILE_TYPE_SOFT_LINK:
+            mode |= S_IFLNK;
+            break;
+        case MYFS_FILE_TYPE_INVALID:
+            break;
+    }
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    success = myfs_sqlite_transaction_start(conn);
+    if (!success) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: Failed to start transaction: %s", name, parent_id, sqlite3_errmsg(conn->handle));
+        goto unlock;
+    }
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_INSERT);
+    success = stmt != NULL;
+    if (!success) {
+        goto done;
+    }
+
+    //Both the names and the IDs are stored, the same as in MariaDB.
+    sqlite3_bind_int64(stmt, 1, parent_id);
+    sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, myfs_file_type_str(type), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, myfs->config.user, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, myfs->config.group, -1, SQLITE_STATIC);
+    if (myfs->config.uid_found) {
+        sqlite3_bind_int64(stmt, 6, myfs->config.uid);
+    }
+    if (myfs->config.gid_found) {
+        sqlite3_bind_int64(stmt, 7, myfs->config.gid);
+    }
+    sqlite3_bind_int64(stmt, 8, mode);
+    sqlite3_bind_int64(stmt, 9, time(NULL));
+
+    success = myfs_sqlite_exec(stmt);
+    if (!success) {
+        log_err(MODULE, "Error creating file '%s' with Parent ID %u: %s", name, parent_id, sqlite3_errmsg(conn->handle));
+        goto done;
+    }
+
+    file_id = sqlite3_last_insert_rowid(conn->handle);
+
+    success = myfs_sqlite_stats_add(conn, 1, 0);
+    if (!success) {
+        log_err(MODULE, "Error updating file system stats for File ID %u: %s", file_id, sqlite3_errmsg(conn->handle));
+    }
+
+done:
+    success = myfs_sqlite_transaction_stop(conn, success);
+
+unlock:
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    return success ? file_id : 0;
+}
+
+bool
+myfs_sqlite_file_delete(myfs_t *myfs, unsigned int file_id) {
+    myfs_sqlite_conn_t *conn = sqlite.writer;
+    sqlite3_stmt *stmt;
+    uint64_t version;
+    off_t size;
+    bool success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    success = myfs_sqlite_transaction_start(conn);
+    if (!success) {
+        log_err(MODULE, "Error deleting File ID %u: Failed to start transaction: %s", file_id, sqlite3_errmsg(conn->handle));
+        goto unlock;
+    }
+
+    //Get the file's size so it can be taken out of the stats.
+    size = myfs_sqlite_file_size(conn, file_id, &version);
+    if (size == -1) {
+        log_err(MODULE, "Error deleting File ID %u: Not found", file_id);
+        success = false;
+        goto done;
+    }
+
+    //Children and blocks are removed by the cascading foreign keys. `file_protection` keeps the root.
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_DELETE);
+    success = stmt != NULL;
+    if (success) {
+        sqlite3_bind_int64(stmt, 1, file_id);
+        success = myfs_sqlite_exec(stmt);
+    }
+
+    if (!success) {
+        log_err(MODULE, "Error deleting File ID %u: %s", file_id, sqlite3_errmsg(conn->handle));
+        goto done;
+    }
+
+    success = myfs_sqlite_stats_add(conn, -1, -size);
+    if (!success) {
+        log_err(MODULE, "Error updating file system stats for File ID %u: %s", file_id, sqlite3_errmsg(conn->handle));
+    }
+
+done:
+    success = myfs_sqlite_transaction_stop(conn, success);
+
+unlock:
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    return success;
+}
+
+bool
+myfs_sqlite_file_write(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t offset, off_t *size, uint64_t *version) {
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, offset, len);
+
+    return myfs_sqlite_file_write_at(myfs, file_id, data, len, offset, size, version);
+}
+
+bool
+myfs_sqlite_file_append(myfs_t *myfs, unsigned int file_id, const char *data, size_t len, off_t *size, uint64_t *version) {
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, len);
+
+    return myfs_sqlite_file_write_at(myfs, file_id, data, len, -1, size, version);
+}
+
+bool
+myfs_sqlite_file_set_times(myfs_t *myfs, unsigned int file_id, const time_t *last_accessed_on, const time_t *last_modified_on) {
+    sqlite3_stmt *stmt;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    //A NULL parameter leaves the column unchanged.
+    stmt = myfs_sqlite_stmt(sqlite.writer, MYFS_SQLITE_STMT_FILE_SET_TIMES);
+    if (stmt != NULL) {
+        if (last_accessed_on != NULL) {
+            sqlite3_bind_int64(stmt, 1, *last_accessed_on);
+        }
+        if (last_modified_on != NULL) {
+            sqlite3_bind_int64(stmt, 2, *last_modified_on);
+        }
+        sqlite3_bind_int64(stmt, 3, file_id);
+
+        success = myfs_sqlite_exec(stmt);
+    }
+
+    if (!success) {
+        log_err(MODULE, "Error updating times for File ID %u: %s", file_id, sqlite3_errmsg(sqlite.writer->handle));
+    }
+
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    return success;
+}
+
+bool
+myfs_sqlite_file_chown(myfs_t *myfs, unsigned int file_id, const char *user, uid_t uid, const char *group, gid_t gid) {
+    bool set_user, set_group, success = false;
+    sqlite3_stmt *stmt;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    set_user = user != NULL && user[0] != '\0';
+    set_group = group != NULL && group[0] != '\0';
+
+    if (!set_user && !set_group) {
+        return false;
+    }
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    //The names and IDs are always set together so clients in either ownership mode see the change.
+    stmt = myfs_sqlite_stmt(sqlite.writer, MYFS_SQLITE_STMT_FILE_CHOWN);
+    if (stmt != NULL) {
+        if (set_user) {
+            sqlite3_bind_text(stmt, 1, user, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 2, uid);
+        }
+        if (set_group) {
+            sqlite3_bind_text(stmt, 3, group, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 4, gid);
+        }
+        sqlite3_bind_int64(stmt, 5, file_id);
+
+        success = myfs_sqlite_exec(stmt);
+    }
+
+    if (!success) {
+        log_err(MODULE, "Error setting user[%s] and group[%s] on File ID %u: %s", user, group, file_id, sqlite3_errmsg(sqlite.writer->handle));
+    }
+
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    return success;
+}
+
+bool
+myfs_sqlite_file_chmod(myfs_t *myfs, unsigned int file_id, mode_t mode) {
+    sqlite3_stmt *stmt;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    stmt = myfs_sqlite_stmt(sqlite.writer, MYFS_SQLITE_STMT_FILE_CHMOD);
+    if (stmt != NULL) {
+        sqlite3_bind_int64(stmt, 1, mode);
+        sqlite3_bind_int64(stmt, 2, file_id);
+
+        success = myfs_sqlite_exec(stmt);
+    }
+
+    if (!success) {
+        log_err(MODULE, "Error setting mode[%u] on File ID %u: %s", mode, file_id, sqlite3_errmsg(sqlite.writer->handle));
+    }
+
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    return success;
+}
+
+/**
+ * Moves a file to another directory. This must be called inside of a transaction.
+ */
+static bool
+myfs_sqlite_file_set_parent(myfs_sqlite_conn_t *conn, unsigned int file_id, unsigned int parent_id) {
+    sqlite3_stmt *stmt;
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_SET_PARENT);
+    if (stmt == NULL) {
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, parent_id);
+    sqlite3_bind_int64(stmt, 2, file_id);
+
+    return myfs_sqlite_exec(stmt);
+}
+
+bool
+myfs_sqlite_file_swap(myfs_t *myfs, myfs_file_t *file1, myfs_file_t *file2) {
+    myfs_sqlite_conn_t *conn = sqlite.writer;
+    unsigned int parent1_id = 0, parent2_id = 0;
+    bool success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file1->file_id, 0, 0);
+
+    if (file1->parent != NULL) {
+        parent1_id = file1->parent->file_id;
+    }
+    if (file2->parent != NULL) {
+        parent2_id = file2->parent->file_id;
+    }
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    success = myfs_sqlite_transaction_start(conn);
+    if (!success) {
+        goto unlock;
+    }
+
+    success = myfs_sqlite_file_set_parent(conn, file1->file_id, parent2_id) &&
+              myfs_sqlite_file_set_parent(conn, file2->file_id, parent1_id);
+
+    if (!success) {
+        log_err(MODULE, "Error swaping file File ID %u with File ID %u: %s", file1->file_id, file2->file_id, sqlite3_errmsg(conn->handle));
+    }
+
+    success = myfs_sqlite_transaction_stop(conn, success);
+
+unlock:
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    return success;
+}
+
+bool
+myfs_sqlite_file_rename(myfs_t *myfs, unsigned int file_id, unsigned int parent_id, const char *name) {
+    sqlite3_stmt *stmt;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    stmt = myfs_sqlite_stmt(sqlite.writer, MYFS_SQLITE_STMT_FILE_RENAME);
+    if (stmt != NULL) {
+        sqlite3_bind_int64(stmt, 1, parent_id);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 3, file_id);
+
+        success = myfs_sqlite_exec(stmt);
+    }
+
+    if (!success) {
+        log_err(MODULE, "Error updating Parent ID for File ID %u: %s", file_id, sqlite3_errmsg(sqlite.writer->handle));
+    }
+
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    return success;
+}
+
+ssize_t
+myfs_sqlite_file_read(myfs_t *myfs, unsigned int file_id, char *buf, size_t size, off_t offset) {
+    size_t page_offset, data_len;
+    myfs_sqlite_conn_t *conn;
+    sqlite3_stmt *stmt;
+    ssize_t count = 0;
+    const char *data;
+    int ret;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, offset, size);
+
+    conn = myfs_sqlite_reader();
+    if (conn == NULL) {
+        return -1;
+    }
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_BLOCKS_GET);
+    if (stmt == NULL) {
+        return -1;
+    }
+
+    page_offset = offset % MYFS_FILE_BLOCK_SIZE;
+
+    sqlite3_bind_int64(stmt, 1, file_id);
+    sqlite3_bind_int64(stmt, 2, offset / MYFS_FILE_BLOCK_SIZE);
+    sqlite3_bind_int64(stmt, 3, (page_offset + size + MYFS_FILE_BLOCK_SIZE - 1) / MYFS_FILE_BLOCK_SIZE);
+
+    while (size > 0 && (ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        data = sqlite3_column_blob(stmt, 0);
+        data_len = sqlite3_column_bytes(stmt, 0);
+
+        metrics_stat_add(METRICS_STAT_ROWS, 1);
+
+        //A short block can only be the last one, so there's nothing left to read past it.
+        if (page_offset >= data_len) {
+            break;
+        }
+
+        data_len -= page_offset;
+        if (data_len > size) {
+            data_len = size;
+        }
+
+        memcpy(buf + count, data + page_offset, data_len);
+
+        page_offset = 0;
+        count += data_len;
+        size -= data_len;
+    }
+
+    if (size > 0 && ret != SQLITE_ROW && ret != SQLITE_DONE) {
+        log_err(MODULE, "Error reading data for File ID %u: %s", file_id, sqlite3_errmsg(conn->handle));
+        count = -1;
+    }
+
+    sqlite3_reset(stmt);
+
+    if (count > 0) {
+        metrics_stat_add(METRICS_STAT_BYTES, count);
+    }
+
+    return count;
+}
+
+bool
+myfs_sqlite_file_truncate(myfs_t *myfs, unsigned int file_id, off_t size, uint64_t *version) {
+    myfs_sqlite_conn_t *conn = sqlite.writer;
+    off_t current_size, keep;
+    uint64_t new_version = 0;
+    sqlite3_stmt *stmt;
+    bool success;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, size);
+
+    pthread_mutex_lock(&sqlite.writer_lock);
+
+    success = myfs_sqlite_transaction_start(conn);
+    if (!success) {
+        log_err(MODULE, "Error truncating File ID %u: Failed to start transaction: %s", file_id, sqlite3_errmsg(conn->handle));
+        goto unlock;
+    }
+
+    current_size = myfs_sqlite_file_size(conn, file_id, &new_version);
+    if (current_size == -1) {
+        log_err(MODULE, "Error truncating File ID %u: Not found", file_id);
+        success = false;
+        goto done;
+    }
+
+    if (size == current_size) {
+        goto done;
+    }
+
+    if (size > current_size) {
+        success = myfs_sqlite_file_write_blocks(conn, file_id, NULL, size - current_size, current_size, current_size);
+    }
+    else {
+        //Drop every block past the new end, then shorten the one the new end is in.
+        keep = (size + MYFS_FILE_BLOCK_SIZE - 1) / MYFS_FILE_BLOCK_SIZE;
+
+        stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_BLOCKS_DELETE);
+        success = stmt != NULL;
+        if (success) {
+            sqlite3_bind_int64(stmt, 1, file_id);
+            sqlite3_bind_int64(stmt, 2, keep);
+            success = myfs_sqlite_exec(stmt);
+        }
+
+        if (success && size % MYFS_FILE_BLOCK_SIZE != 0) {
+            stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_BLOCK_SHRINK);
+            success = stmt != NULL;
+            if (success) {
+                sqlite3_bind_int64(stmt, 1, size % MYFS_FILE_BLOCK_SIZE);
+                sqlite3_bind_int64(stmt, 2, file_id);
+                sqlite3_bind_int64(stmt, 3, keep - 1);
+                success = myfs_sqlite_exec(stmt);
+            }
+        }
+
+        if (!success) {
+            log_err(MODULE, "Error truncating File ID %u: Failed to remove blocks: %s", file_id, sqlite3_errmsg(conn->handle));
+        }
+    }
+
+    if (success) {
+        new_version++;
+        success = myfs_sqlite_file_set_size(myfs, conn, file_id, size) &&
+                  myfs_sqlite_stats_add(conn, 0, size - current_size);
+
+        if (!success) {
+            log_err(MODULE, "Error truncating File ID %u: Error setting new file size to %zd: %s", file_id, size, sqlite3_errmsg(conn->handle));
+        }
+    }
+
+done:
+    success = myfs_sqlite_transaction_stop(conn, success);
+
+unlock:
+    pthread_mutex_unlock(&sqlite.writer_lock);
+
+    if (success && version != NULL) {
+        *version = new_version;
+    }
+
+    return success;
+}
+
+/**
+ * Builds a MyFS file from the current row of a statement that selected `MYFS_DB_FILE_COLUMNS`.
+ */
+static myfs_file_t *
+myfs_sqlite_file_from_row(myfs_t *myfs, sqlite3_stmt *stmt) {
+    char *row[14];
+    unsigned int i;
+
+    //The columns are read as text so the file is built exactly the way MariaDB rows are.
+    for (i = 0; i < sizeof(row) / sizeof(row[0]); i++) {
+        row[i] = (char *)sqlite3_column_text(stmt, i);
+    }
+
+    return myfs_db_file_from_row(myfs, row);
+}
+
+/**
+ * Gets a file's children, sorted by name. The file must be a MYFS_FILE_TYPE_DIRECTORY. Like
+ * `myfs_db_file_query_children()`, a list cut short by an error is freed.
+ *
+ * @return `true` on success, otherwise `false`.
+ */
+static bool
+myfs_sqlite_file_query_children(myfs_t *myfs, myfs_sqlite_conn_t *conn, myfs_file_t *file) {
+    unsigned int size = 0, i;
+    sqlite3_stmt *stmt;
+    int ret;
+
+    if (file->type != MYFS_FILE_TYPE_DIRECTORY) {
+        log_err(MODULE, "Error getting children for file '%s': Not a directory", file->name);
+        return false;
+    }
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_CHILDREN);
+    if (stmt == NULL) {
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, file->file_id);
+
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (file->children_count == size) {
+            size = size == 0 ? 16 : size * 2;
+            file->children = realloc(file->children, size * sizeof(myfs_file_t *));
+        }
+
+        file->children[file->children_count++] = myfs_sqlite_file_from_row(myfs, stmt);
+    }
+
+    metrics_stat_add(METRICS_STAT_ROWS, file->children_count);
+
+    if (ret != SQLITE_DONE) {
+        log_err(MODULE, "Error getting children for File ID %u: %s", file->file_id, sqlite3_errmsg(conn->handle));
+
+        for (i = 0; i < file->children_count; i++) {
+            myfs_file_free(file->children[i]);
+        }
+        free(file->children);
+        file->children = NULL;
+        file->children_count = 0;
+    }
+
+    sqlite3_reset(stmt);
+
+    return ret == SQLITE_DONE;
+}
+
+/**
+ * Gets a file and its parents up to the root, the same as `myfs_db_file_query()`.
+ */
+static myfs_file_t *
+myfs_sqlite_file_get(myfs_t *myfs, myfs_sqlite_conn_t *conn, unsigned int file_id, bool include_children) {
+    myfs_file_t *file = NULL;
+    unsigned int parent_id = 0;
+    sqlite3_stmt *stmt;
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_GET);
+    if (stmt == NULL) {
+        return NULL;
+    }
+
+    sqlite3_bind_int64(stmt, 1, file_id);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        file = myfs_sqlite_file_from_row(myfs, stmt);
+        parent_id = sqlite3_column_int64(stmt, 2);
+    }
+    else {
+        log_err(MODULE, "Error getting file with File ID %u: Not found", file_id);
+    }
+
+    sqlite3_reset(stmt);
+
+    if (file != NULL && file_id > 0) {
+        file->parent = myfs_sqlite_file_get(myfs, conn, parent_id, false);
+    }
+
+    if (file != NULL && include_children && !myfs_sqlite_file_query_children(myfs, conn, file)) {
+        myfs_file_free(file);
+        file = NULL;
+    }
+
+    return file;
+}
+
+myfs_file_t *
+myfs_sqlite_file_query(myfs_t *myfs, unsigned int file_id, bool include_children) {
+    myfs_sqlite_conn_t *conn;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(file_id, 0, 0);
+
+    conn = myfs_sqlite_reader();
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    return myfs_sqlite_file_get(myfs, conn, file_id, include_children);
+}
+
+myfs_file_t *
+myfs_sqlite_file_query_name(myfs_t *myfs, const char *name, unsigned int parent_id, bool include_children) {
+    myfs_sqlite_conn_t *conn;
+    unsigned int file_id = 0;
+    sqlite3_stmt *stmt;
+    bool found;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    conn = myfs_sqlite_reader();
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_FILE_GET_NAME);
+    if (stmt == NULL) {
+        return NULL;
+    }
+
+    sqlite3_bind_int64(stmt, 1, parent_id);
+    sqlite3_bind_text(stmt, 2, name == NULL ? "" : name, -1, SQLITE_STATIC);
+
+    found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        file_id = sqlite3_column_int64(stmt, 0);
+    }
+
+    sqlite3_reset(stmt);
+
+    //Don't output an error if the file doesn't exist. FUSE will try to stat() files to see if they exist before making other calls.
+    return found ? myfs_sqlite_file_get(myfs, conn, file_id, include_children) : NULL;
+}
+
+bool
+myfs_sqlite_get_stats(myfs_t *myfs, uint64_t *files, uint64_t *bytes) {
+    myfs_sqlite_conn_t *conn;
+    sqlite3_stmt *stmt;
+    bool success = false;
+
+    METRICS_SCOPE();
+    TRACE_SCOPE(0, 0, 0);
+
+    conn = myfs_sqlite_reader();
+    if (conn == NULL) {
+        return false;
+    }
+
+    stmt = myfs_sqlite_stmt(conn, MYFS_SQLITE_STMT_STATS_GET);
+    if (stmt == NULL) {
+        return false;
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        *files = sqlite3_column_int64(stmt, 0);
+        *bytes = sqlite3_column_int64(stmt, 1);
+        success = true;
+    }
+    else {
+        log_err(MODULE, "Error getting file system stats: %s", sqlite3_errmsg(conn->handle));
+    }
+
+    sqlite3_reset(stmt);
+
+    return success;
+}
+
+/**
+ * Creates the tables if they don't exist yet, with the root directory protected in `file_protection` and
+ * the root counted in `fs_stats`, the same as `create` does in MariaDB.
+ */
+static bool
+myfs_sqlite_schema_create(myfs_t *myfs) {
+    myfs_sqlite_conn_t *conn = sqlite.writer;
+    sqlite3_stmt *stmt = NULL;
+    bool success;
+    int ret;
+
+    success = myfs_sqlite_transaction_start(conn);
+    if (!success) {
+        log_err(MODULE, "Error creating the database schema: %s", sqlite3_errmsg(conn->handle));
+        return false;
+    }
+
+    ret = sqlite3_exec(conn->handle, myfs_sqlite_schema, NULL, NULL, NULL);
+    if (ret != SQLITE_OK) {
+        log_err(MODULE, "Error creating the database schema: %s", sqlite3_errmsg(conn->handle));
+        success = false;
+        goto done;
+    }
+
+    //Databases made before the `version` column was added don't have it. Reading it fails to prepare if so.
+    ret = sqlite3_prepare_v2(conn->handle, "SELECT `version` FROM `files` LIMIT 0", -1, &stmt, NULL);
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+
+    if (ret != SQLITE_OK) {
+        log_info(MODULE, "Adding the 'version' column to 'files'");
+
+        ret = sqlite3_exec(conn->handle, "ALTER TABLE `files` ADD COLUMN `version` INTEGER NOT NULL DEFAULT 0", NULL, NULL, NULL);
+        if (ret != SQLITE_OK) {
+            log_err(MODULE, "Error adding the 'version' column to 'files': %s", sqlite3_errmsg(conn->handle));
+            success = false;
+            goto done;
+        }
+    }
+
+    ret = sqlite3_prepare_v2(conn->handle, "INSERT OR IGNORE INTO `files` (`file_id`,`parent_id`,`name`,`type`,`user`,`group`,`uid`,`gid`,`mode`,`size`,`created_on`,`last_accessed_on`,`last_modified_on`,`last_status_changed_on`)\n"
+                                           "VALUES (0,0,'','Directory',?1,?2,?3,?4,16893,0,?5,?5,?5,?5)",
+                                           -1, &stmt, NULL);
+    if (ret != SQLITE_OK) {
+        log_err(MODULE, "Error creating the root directory: %s", sqlite3_errmsg(conn->handle));
+        success = false;
+        goto done;
+    }
+
+    sqlite3_bind_text(stmt, 1, myfs->config.user, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, myfs->config.group, -1, SQLITE_STATIC);
+    if (myfs->config.uid_found) {
+        sqlite3_bind_int64(stmt, 3, myfs->config.uid);
+    }
+    if (myfs->config.gid_found) {
+        sqlite3_bind_int64(stmt, 4, myfs->config.gid);
+    }
+    sqlite3_bind_int64(stmt, 5, time(NULL));
+
+    success = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+
+    if (!success) {
+        log_err(MODULE, "Error creating the root directory: %s", sqlite3_errmsg(conn->handle));
+        goto done;
+    }
+
+    ret = sqlite3_exec(conn->handle, "INSERT OR IGNORE INTO `file_protection` (`file_id`) VALUES (0);\n"
+                                     "INSERT OR IGNORE INTO `fs_stats` (`shard`,`files`,`bytes`) VALUES (0,1,0);",
+                                     NULL, NULL, NULL);
+    if (ret != SQLITE_OK) {
+        log_err(MODULE, "Error creating the database schema: %s", sqlite3_errmsg(conn->handle));
+        success = false;
+    }
+
+done:
+    return myfs_sqlite_transaction_stop(conn, success);
+}
+
+/**
+ * Opens the database, creating it if needed, and switches it to WAL mode.
+ */
+static bool
+myfs_sqlite_connect(myfs_t *myfs) {
+    char *journal_mode = NULL;
+    sqlite3_stmt *stmt;
+
+    memset(&sqlite, 0, sizeof(sqlite));
+    strlcpy(sqlite.path, config_get("sqlite_file"), sizeof(sqlite.path));
+    pthread_mutex_init(&sqlite.writer_lock, NULL);
+    pthread_mutex_init(&sqlite.readers_lock, NULL);
+    pthread_key_create(&sqlite.reader_key, myfs_sqlite_reader_free);
+
+    sqlite.writer = myfs_sqlite_conn_open(false);
+    if (sqlite.writer == NULL) {
+        return false;
+    }
+
+    //WAL lets the read connections keep reading while a change is being written. With it, NORMAL only
+    //syncs at checkpoints, so a power loss can lose the last changes but never corrupts the database.
+    if (sqlite3_prepare_v2(sqlite.writer->handle, "PRAGMA journal_mode=WAL", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            journal_mode = strdup((const char *)sqlite3_column_text(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    if (journal_mode == NULL || strcmp(journal_mode, "wal") != 0) {
+        log_err(MODULE, "Error switching '%s' to WAL mode: %s", sqlite.path, journal_mode == NULL ? sqlite3_errmsg(sqlite.writer->handle) : journal_mode);
+        free(journal_mode);
+        return false;
+    }
+
+    free(journal_mode);
+
+    if (sqlite3_exec(sqlite.writer->handle, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL) != SQLITE_OK) {
+        log_err(MODULE, "Error setting up '%s': %s", sqlite.path, sqlite3_errmsg(sqlite.writer->handle));
+        return false;
+    }
+
+    if (!myfs_sqlite_schema_create(myfs)) {
+        return false;
+    }
+
+    //Requests are only limited by FUSE since there are no packets to fit in.
+    myfs->request_size = MYFS_REQUEST_SIZE_MAX;
+    myfs->blocks_per_insert = MYFS_INSERT_BLOCKS_MAX;
+
+    log_info(MODULE, "Opened '%s' with SQLite %s", sqlite.path, sqlite3_libversion());
+
+    return true;
+}
+
+static void
+myfs_sqlite_disconnect(myfs_t *myfs) {
+    myfs_sqlite_conn_t *conn, *next;
+
+    pthread_mutex_lock(&sqlite.readers_lock);
+    for (conn = sqlite.readers; conn != NULL; conn = next) {
+        next = conn->next;
+        myfs_sqlite_conn_close(conn);
+    }
+    sqlite.readers = NULL;
+    pthread_mutex_unlock(&sqlite.readers_lock);
+
+    //Threads that are still around must not close their connections again.
+    pthread_key_delete(sqlite.reader_key);
+
+    if (sqlite.writer != NULL) {
+        myfs_sqlite_conn_close(sqlite.writer);
+        sqlite.writer = NULL;
+    }
+
+    pthread_mutex_destroy(&sqlite.writer_lock);
+    pthread_mutex_destroy(&sqlite.readers_lock);
+}
+
+const myfs_backend_t myfs_sqlite_backend = {
+    .name = "sqlite",
+    .connect = myfs_sqlite_connect,
+    .disconnect = myfs_sqlite_disconnect,
+    .file_create = myfs_sqlite_file_create,
+    .file_delete = myfs_sqlite_file_delete,
+    .file_write = myfs_sqlite_file_write,
+    .file_append = myfs_sqlite_file_append,
+    .file_set_times = myfs_sqlite_file_set_times,
+    .file_chown = myfs_sqlite_file_chown,
+    .file_chmod = myfs_sqlite_file_chmod,
+    .file_swap = myfs_sqlite_file_swap,
+    .file_rename = myfs_sqlite_file_rename,
+    .file_read = myfs_sqlite_file_read,
+    .file_truncate = myfs_sqlite_file_truncate,
+    .file_query = myfs_sqlite_file_query,
+    .file_query_name = myfs_sqlite_file_query_name,
+    .get_stats = myfs_sqlite_get_stats
+};
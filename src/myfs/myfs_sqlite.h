@@ -0,0 +1,14 @@
+#pragma once
+
+/**
+ * @file myfs_sqlite.h
+ *
+ * The SQLite backend, for mounts that are only used on one host. Files are stored in a local SQLite
+ * database in WAL mode with the same `files`, `file_data`, `file_protection` and `fs_stats` tables as
+ * MariaDB, so there's no server or network between MyFS and its data.
+ */
+
+#include "myfs_backend.h"
+
+/** The SQLite backend. */
+extern const myfs_backend_t myfs_sqlite_backend;
@@ -20,8 +20,7 @@
 #define RECLAIMER_OPTIMISTIC_WAIT_TIME (60 * 30)
 
 typedef struct {
-    time_t last_action;          //<! When reclaimer was notified of the last action
-    pthread_mutex_t lock;
+    _Atomic time_t last_action;          //<! When reclaimer was notified of the last action
 } reclaimer_optimistic_t;
 
 typedef struct {
@@ -41,17 +40,17 @@ static reclaimer_t reclaimer;
 
 static bool
 reclaimer_should_run() {
+    time_t last_action;
     bool run = false;
 
     switch (reclaimer.level) {
         case RECLAIMER_LEVEL_OFF:
             break;
         case RECLAIMER_LEVEL_OPTIMISTIC:
-            pthread_mutex_lock(&reclaimer.optimistic.lock);
-            if (reclaimer.optimistic.last_action > 0) {
-                run = time(NULL) - reclaimer.optimistic.last_action >= RECLAIMER_OPTIMISTIC_WAIT_TIME;
+            last_action = reclaimer.optimistic.last_action;
+            if (last_action > 0) {
+                run = time(NULL) - last_action >= RECLAIMER_OPTIMISTIC_WAIT_TIME;
             }
-            pthread_mutex_unlock(&reclaimer.optimistic.lock);
             break;
         case RECLAIMER_LEVEL_AGGRESSIVE:
             run = reclaimer.aggressive.run;
@@ -67,9 +66,7 @@ reclaimer_reset() {
         case RECLAIMER_LEVEL_OFF:
             break;
         case RECLAIMER_LEVEL_OPTIMISTIC:
-            pthread_mutex_lock(&reclaimer.optimistic.lock);
             reclaimer.optimistic.last_action = 0;
-            pthread_mutex_unlock(&reclaimer.optimistic.lock);
             break;
         case RECLAIMER_LEVEL_AGGRESSIVE:
             reclaimer.aggressive.run = false;
@@ -124,13 +121,11 @@ reclaimer_init() {
     memset(&reclaimer, 0, sizeof(reclaimer));
 
     db_init(&reclaimer.db);
-    pthread_mutex_init(&reclaimer.optimistic.lock, NULL);
 }
 
 void
 reclaimer_free() {
     db_free(&reclaimer.db);
-    pthread_mutex_destroy(&reclaimer.optimistic.lock);
 }
 
 bool
@@ -154,6 +149,9 @@ reclaimer_start() {
         return false;
     }
 
+    //Only log the reclaimer's slow queries. Its statements aren't summarized along with MyFS's own.
+    db_set_profile_options(&reclaimer.db, config_get_uint("slow_query_ms"), 0, 0);
+
     //Start the thread.
     reclaimer.running = true;
     ret = pthread_create(&reclaimer.thread, NULL, reclaimer_process, NULL);
@@ -180,13 +178,18 @@ reclaimer_stop() {
 
 void
 reclaimer_notify(reclaimer_action_t action) {
+    time_t now;
+
     switch (reclaimer.level) {
         case RECLAIMER_LEVEL_OFF:
             break;
         case RECLAIMER_LEVEL_OPTIMISTIC:
-            pthread_mutex_lock(&reclaimer.optimistic.lock);
-            reclaimer.optimistic.last_action = time(NULL);
-            pthread_mutex_unlock(&reclaimer.optimistic.lock);
+            //This is called by every create and delete, so it mustn't take a lock. Only storing the time
+            //once a second keeps the threads from fighting over the cache line too.
+            now = time(NULL);
+            if (reclaimer.optimistic.last_action != now) {
+                reclaimer.optimistic.last_action = now;
+            }
             break;
         case RECLAIMER_LEVEL_AGGRESSIVE:
             if (action == RECLAIMER_ACTION_DELETE) {
@@ -8,9 +8,46 @@
 #include <grp.h>
 #include <libgen.h>
 #include <termios.h>
+#include <time.h>
+#include <pthread.h>
 #include "../common/string.h"
+#include "../common/metrics.h"
 #include "util.h"
 
+/** The number of entries in each direction of a name/ID cache. Must be a power of two. */
+#define UTIL_ID_CACHE_SIZE 1024
+
+/** The longest name that will be cached. Longer names are always looked up. */
+#define UTIL_ID_NAME_MAX_LEN 32
+
+/**
+ * A cached user or group lookup. Lookups that found nothing are cached too, with `error` set to ENOENT.
+ */
+typedef struct {
+    char name[UTIL_ID_NAME_MAX_LEN + 1];                //!< The user or group name.
+    unsigned int id;                                    //!< The UID or GID.
+    int error;                                          //!< 0 if the lookup succeeded, otherwise ENOENT.
+    bool reported;                                      //!< Whether a failed lookup has been reported. See `util_id_cache_report()`.
+    time_t expires;                                     //!< When this entry expires, or 0 if it's unused.
+} util_id_entry_t;
+
+/**
+ * A cache for looking up a user or group by name and by ID. Both directions are direct mapped tables so a
+ * lookup is a hash, a compare and no allocations. Many threads can read at once.
+ */
+typedef struct {
+    pthread_rwlock_t lock;                              //!< Protects both tables.
+    util_id_entry_t by_name[UTIL_ID_CACHE_SIZE];        //!< Entries indexed by a hash of the name.
+    util_id_entry_t by_id[UTIL_ID_CACHE_SIZE];          //!< Entries indexed by the ID.
+} util_id_cache_t;
+
+typedef int (*util_id_lookup_name_t)(const char *name, unsigned int *id);
+typedef int (*util_id_lookup_id_t)(unsigned int id, char *dst, size_t size);
+
+static util_id_cache_t util_users = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+static util_id_cache_t util_groups = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+static int util_id_cache_ttl = UTIL_ID_CACHE_TTL_DEFAULT;
+
 void
 util_sleep_ms(unsigned int ms) {
     usleep(ms * 1000);
@@ -54,8 +91,241 @@ util_dirname(const char *path, char *dst, size_t size) {
     return dst;
 }
 
-int
-util_username(uid_t uid, char *dst, size_t size) {
+/**
+ * Gets the current time for cache expiration. Uses the monotonic clock so changing the system time doesn't
+ * expire or extend entries.
+ */
+static time_t
+util_id_cache_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * FNV-1a hash of a name, masked to an index into a cache table.
+ */
+static unsigned int
+util_id_cache_hash(const char *name) {
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash & (UTIL_ID_CACHE_SIZE - 1);
+}
+
+/**
+ * Stores a lookup in both directions of a cache. Only successful lookups are stored by ID since a failed
+ * name lookup has no ID. This must be called with the cache's write lock held.
+ */
+static void
+util_id_cache_store(util_id_cache_t *cache, const char *name, unsigned int id, int error, time_t expires) {
+    util_id_entry_t *entry;
+
+    entry = &cache->by_name[util_id_cache_hash(name)];
+    strlcpy(entry->name, name, sizeof(entry->name));
+    entry->id = id;
+    entry->error = error;
+    entry->expires = expires;
+    entry->reported = false;
+
+    if (error == 0) {
+        entry = &cache->by_id[id & (UTIL_ID_CACHE_SIZE - 1)];
+        strlcpy(entry->name, name, sizeof(entry->name));
+        entry->id = id;
+        entry->error = 0;
+        entry->expires = expires;
+    }
+}
+
+/**
+ * Looks up an ID by name, using the cache if possible. Only successful and not found lookups are cached,
+ * any other error (eg. LDAP being unreachable) is tried again on the next call.
+ */
+static int
+util_id_cache_get_id(util_id_cache_t *cache, const char *name, util_id_lookup_name_t lookup, unsigned int *id) {
+    util_id_entry_t *entry;
+    bool found = false;
+    time_t now;
+    int ret;
+
+    if (util_id_cache_ttl <= 0 || strlen(name) > UTIL_ID_NAME_MAX_LEN) {
+        return lookup(name, id);
+    }
+
+    now = util_id_cache_now();
+    entry = &cache->by_name[util_id_cache_hash(name)];
+
+    pthread_rwlock_rdlock(&cache->lock);
+    if (entry->expires > now && strcmp(entry->name, name) == 0) {
+        found = true;
+        ret = entry->error;
+        if (ret == 0) {
+            *id = entry->id;
+        }
+    }
+    pthread_rwlock_unlock(&cache->lock);
+
+    if (found) {
+        METRICS_COUNT("id_cache_hits", 1);
+        return ret;
+    }
+
+    METRICS_COUNT("id_cache_misses", 1);
+    ret = lookup(name, id);
+
+    if (ret == 0 || ret == ENOENT) {
+        pthread_rwlock_wrlock(&cache->lock);
+        util_id_cache_store(cache, name, ret == 0 ? *id : 0, ret, now + util_id_cache_ttl);
+        pthread_rwlock_unlock(&cache->lock);
+    }
+
+    return ret;
+}
+
+/**
+ * Marks a cached name that wasn't found as reported.
+ *
+ * @return `true` the first time for each cache entry, or if the name isn't cached, otherwise `false`.
+ */
+static bool
+util_id_cache_report(util_id_cache_t *cache, const char *name) {
+    util_id_entry_t *entry;
+    bool report = true;
+
+    if (util_id_cache_ttl <= 0 || strlen(name) > UTIL_ID_NAME_MAX_LEN) {
+        return true;
+    }
+
+    entry = &cache->by_name[util_id_cache_hash(name)];
+
+    pthread_rwlock_wrlock(&cache->lock);
+    if (entry->expires > util_id_cache_now() && entry->error != 0 && strcmp(entry->name, name) == 0) {
+        report = !entry->reported;
+        entry->reported = true;
+    }
+    pthread_rwlock_unlock(&cache->lock);
+
+    return report;
+}
+
+/**
+ * Looks up a name by ID, using the cache if possible. Only successful lookups are cached.
+ */
+static int
+util_id_cache_get_name(util_id_cache_t *cache, unsigned int id, util_id_lookup_id_t lookup, char *dst, size_t size) {
+    char name[UTIL_ID_NAME_MAX_LEN + 1];
+    util_id_entry_t *entry;
+    bool found = false;
+    time_t now;
+    int ret;
+
+    if (util_id_cache_ttl <= 0) {
+        return lookup(id, dst, size);
+    }
+
+    now = util_id_cache_now();
+    entry = &cache->by_id[id & (UTIL_ID_CACHE_SIZE - 1)];
+
+    pthread_rwlock_rdlock(&cache->lock);
+    if (entry->expires > now && entry->id == id) {
+        found = true;
+        ret = strlcpy(dst, entry->name, size) < size ? 0 : ERANGE;
+    }
+    pthread_rwlock_unlock(&cache->lock);
+
+    if (found) {
+        METRICS_COUNT("id_cache_hits", 1);
+        return ret;
+    }
+
+    METRICS_COUNT("id_cache_misses", 1);
+    ret = lookup(id, name, sizeof(name));
+
+    //Names too long for the cache are looked up again into the caller's buffer.
+    if (ret == ERANGE) {
+        return lookup(id, dst, size);
+    }
+
+    if (ret == 0) {
+        pthread_rwlock_wrlock(&cache->lock);
+        util_id_cache_store(cache, name, id, 0, now + util_id_cache_ttl);
+        pthread_rwlock_unlock(&cache->lock);
+
+        if (strlcpy(dst, name, size) >= size) {
+            ret = ERANGE;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Empties both tables of a cache.
+ */
+static void
+util_id_cache_clear(util_id_cache_t *cache) {
+    pthread_rwlock_wrlock(&cache->lock);
+    memset(cache->by_name, 0, sizeof(cache->by_name));
+    memset(cache->by_id, 0, sizeof(cache->by_id));
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+void
+util_id_cache_set_ttl(int ttl) {
+    util_id_cache_ttl = ttl;
+    util_id_cache_flush();
+}
+
+void
+util_id_cache_flush() {
+    util_id_cache_clear(&util_users);
+    util_id_cache_clear(&util_groups);
+}
+
+/**
+ * Counts the unexpired entries in both tables of a cache.
+ */
+static void
+util_id_cache_count(util_id_cache_t *cache, time_t now, unsigned int *by_name, unsigned int *by_id) {
+    unsigned int i;
+
+    *by_name = 0;
+    *by_id = 0;
+
+    pthread_rwlock_rdlock(&cache->lock);
+    for (i = 0; i < UTIL_ID_CACHE_SIZE; i++) {
+        *by_name += cache->by_name[i].expires > now;
+        *by_id += cache->by_id[i].expires > now;
+    }
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+void
+util_id_cache_write(FILE *f) {
+    unsigned int by_name, by_id;
+    time_t now;
+
+    now = util_id_cache_now();
+
+    fprintf(f, "id_cache_ttl                     %d\n", util_id_cache_ttl);
+    fprintf(f, "id_cache_size                    %d\n", UTIL_ID_CACHE_SIZE);
+
+    util_id_cache_count(&util_users, now, &by_name, &by_id);
+    fprintf(f, "id_cache_users_by_name           %u\n", by_name);
+    fprintf(f, "id_cache_users_by_id             %u\n", by_id);
+
+    util_id_cache_count(&util_groups, now, &by_name, &by_id);
+    fprintf(f, "id_cache_groups_by_name          %u\n", by_name);
+    fprintf(f, "id_cache_groups_by_id            %u\n", by_id);
+}
+
+static int
+util_username_lookup(unsigned int uid, char *dst, size_t size) {
     struct passwd pwd, *result;
     char unused[1024];
     int ret;
@@ -71,12 +341,15 @@ util_username(uid_t uid, char *dst, size_t size) {
         return ret;
     }
 
-    strlcpy(dst, pwd.pw_name, size);
+    if (strlcpy(dst, pwd.pw_name, size) >= size) {
+        return ERANGE;
+    }
+
     return 0;
 }
 
-int
-util_user_id(const char *name, uid_t *uid) {
+static int
+util_user_id_lookup(const char *name, unsigned int *uid) {
     struct passwd pwd, *result;
     char unused[1024];
     int ret;
@@ -96,15 +369,8 @@ util_user_id(const char *name, uid_t *uid) {
     return 0;
 }
 
-bool
-util_user_exists(const char *name) {
-    uid_t uid;
-
-    return util_user_id(name, &uid) == 0;
-}
-
-int
-util_groupname(gid_t gid, char *dst, size_t size) {
+static int
+util_groupname_lookup(unsigned int gid, char *dst, size_t size) {
     struct group grp, *result;
     char unused[1024];
     int ret;
@@ -120,12 +386,15 @@ util_groupname(gid_t gid, char *dst, size_t size) {
         return ret;
     }
 
-    strlcpy(dst, grp.gr_name, size);
+    if (strlcpy(dst, grp.gr_name, size) >= size) {
+        return ERANGE;
+    }
+
     return 0;
 }
 
-int
-util_group_id(const char *name, gid_t *gid) {
+static int
+util_group_id_lookup(const char *name, unsigned int *gid) {
     struct group grp, *result;
     char unused[1024];
     int ret;
@@ -145,6 +414,59 @@ util_group_id(const char *name, gid_t *gid) {
     return 0;
 }
 
+int
+util_username(uid_t uid, char *dst, size_t size) {
+    return util_id_cache_get_name(&util_users, uid, util_username_lookup, dst, size);
+}
+
+int
+util_user_id(const char *name, uid_t *uid) {
+    unsigned int id;
+    int ret;
+
+    ret = util_id_cache_get_id(&util_users, name, util_user_id_lookup, &id);
+    if (ret == 0) {
+        *uid = id;
+    }
+
+    return ret;
+}
+
+bool
+util_user_report(const char *name) {
+    return util_id_cache_report(&util_users, name);
+}
+
+bool
+util_user_exists(const char *name) {
+    uid_t uid;
+
+    return util_user_id(name, &uid) == 0;
+}
+
+int
+util_groupname(gid_t gid, char *dst, size_t size) {
+    return util_id_cache_get_name(&util_groups, gid, util_groupname_lookup, dst, size);
+}
+
+int
+util_group_id(const char *name, gid_t *gid) {
+    unsigned int id;
+    int ret;
+
+    ret = util_id_cache_get_id(&util_groups, name, util_group_id_lookup, &id);
+    if (ret == 0) {
+        *gid = id;
+    }
+
+    return ret;
+}
+
+bool
+util_group_report(const char *name) {
+    return util_id_cache_report(&util_groups, name);
+}
+
 bool
 util_group_exists(const char *name) {
     gid_t gid;
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 
+/** The default number of seconds user and group lookups are cached for. */
+#define UTIL_ID_CACHE_TTL_DEFAULT 60
+
 /**
  * Sleeps for a number of miliseconds.
  *
@@ -31,17 +36,38 @@ const char * util_basename(const char *path, char *dst, size_t size);
 const char * util_dirname(const char *path, char *dst, size_t size);
 
 /**
- * Looks up a Linux user by its ID and copies its name into a buffer.
+ * Sets how long user and group lookups are cached and empties the cache. Lookups that found nothing are
+ * cached for the same amount of time. Lookups that failed for any other reason are never cached.
+ *
+ * @param[in] ttl The number of seconds to cache lookups for. 0 disables the cache.
+ */
+void util_id_cache_set_ttl(int ttl);
+
+/**
+ * Empties the user and group lookup cache so the next lookups go to NSS.
+ */
+void util_id_cache_flush();
+
+/**
+ * Writes the user and group lookup cache's settings and how many entries it's holding as text.
+ *
+ * @param[in] f The file to write to.
+ */
+void util_id_cache_write(FILE *f);
+
+/**
+ * Looks up a Linux user by its ID and copies its name into a buffer. The result is cached, see
+ * `util_id_cache_set_ttl()`.
  *
  * @param[in] uid The User ID of the user.
  * @param[out] dst The buffer to copy the user's name into.
  * @param[in] size The size of `dst`.
- * @return 0 on success, or an errno otherwise.
+ * @return 0 on success, ERANGE if the name doesn't fit in `dst`, or an errno otherwise.
  */
 int util_username(uid_t uid, char *dst, size_t size);
 
 /**
- * Looks up a Linux user by its name and gets its UID.
+ * Looks up a Linux user by its name and gets its UID. The result is cached, see `util_id_cache_set_ttl()`.
  *
  * @param[in] name The name of the user.
  * @param[out] uid The buffer to store the UID into.
@@ -49,6 +75,15 @@ int util_username(uid_t uid, char *dst, size_t size);
  */
 int util_user_id(const char *name, uid_t *uid);
 
+/**
+ * Tells whether a user that `util_user_id()` didn't find should be reported, so it's logged once per
+ * cache entry instead of once per file that names it.
+ *
+ * @param[in] name The name of the user.
+ * @return `true` the first time it's asked for each cache entry, or every time if the name isn't cached.
+ */
+bool util_user_report(const char *name);
+
 /**
  * Determines if a Linux user exists by name.
  *
@@ -58,17 +93,18 @@ int util_user_id(const char *name, uid_t *uid);
 bool util_user_exists(const char *name);
 
 /**
- * Looks up a Linux group by its ID and copies its name into a buffer.
+ * Looks up a Linux group by its ID and copies its name into a buffer. The result is cached, see
+ * `util_id_cache_set_ttl()`.
  *
  * @param[in] gid The Group ID of the group.
  * @param[out] dst The buffer to copy the group's name into.
  * @param[in] size The size of `dst`.
- * @return 0 on success, or an errno otherwise.
+ * @return 0 on success, ERANGE if the name doesn't fit in `dst`, or an errno otherwise.
  */
 int util_groupname(gid_t gid, char *dst, size_t size);
 
 /**
- * Looks up a Linux group by its name and gets its GID.
+ * Looks up a Linux group by its name and gets its GID. The result is cached, see `util_id_cache_set_ttl()`.
  *
  * @param[in] name The name of the group.
  * @param[out] gid The buffer to store the GID into.
@@ -76,6 +112,15 @@ int util_groupname(gid_t gid, char *dst, size_t size);
  */
 int util_group_id(const char *name, gid_t *gid);
 
+/**
+ * Tells whether a group that `util_group_id()` didn't find should be reported, so it's logged once per
+ * cache entry instead of once per file that names it.
+ *
+ * @param[in] name The name of the group.
+ * @return `true` the first time it's asked for each cache entry, or every time if the name isn't cached.
+ */
+bool util_group_report(const char *name);
+
 /**
  * Determines if a Linux group exists by name.
  *